@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ * Derived from simple_sub_pub_demo.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+#include "logging_levels.h"
+/* define LOG_LEVEL here if you want to modify the logging level from the default */
+
+#define LOG_LEVEL    LOG_ERROR
+
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sys_evt.h"
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
+#include "mqtt_agent_metrics.h"
+#include "freertos_command_pool.h"
+
+#include "iotcl_telemetry.h"
+#include "iotcl.h"
+
+/*-----------------------------------------------------------*/
+
+#define METRIC_NAME_MAX_LEN    ( 32U )
+
+/*-----------------------------------------------------------*/
+
+static void prvSetMetric( IotclMessageHandle xMsg,
+                          const char * pcPrefix,
+                          const char * pcName,
+                          uint32_t ulValue )
+{
+    char pcMetricName[ METRIC_NAME_MAX_LEN ];
+
+    ( void ) snprintf( pcMetricName, sizeof( pcMetricName ), "mqtt_%s_%s", pcPrefix, pcName );
+
+    iotcl_telemetry_set_number( xMsg, pcMetricName, ( double ) ulValue );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSendMetrics( MQTTAgentHandle_t xAgentHandle )
+{
+    static const char * const pcLaneNames[ MQTT_AGENT_NUM_LANES ] = { "high", "normal", "bulk" };
+    IotclMessageHandle xMsg = iotcl_telemetry_create();
+    CommandPoolStats_t xPoolStats;
+    MQTTAgentWakeStats_t xWakeStats;
+    MqttRateStats_t xRateStats;
+
+    for( uint32_t ulStage = 0; ulStage < MQTT_AGENT_NUM_STAGES; ulStage++ )
+    {
+        const char * pcStage = MqttAgentMetrics_StageName( ( MQTTAgentStage_t ) ulStage );
+        MQTTAgentHistogram_t xHistogram;
+
+        MqttAgentMetrics_GetHistogram( ( MQTTAgentStage_t ) ulStage, &xHistogram );
+
+        prvSetMetric( xMsg, pcStage, "count", xHistogram.ulCount );
+        prvSetMetric( xMsg, pcStage, "p50_us", MqttAgentMetrics_PercentileUs( &xHistogram, 50 ) );
+        prvSetMetric( xMsg, pcStage, "p99_us", MqttAgentMetrics_PercentileUs( &xHistogram, 99 ) );
+        prvSetMetric( xMsg, pcStage, "max_us", MqttAgentMetrics_TicksToUs( xHistogram.ulMaxTicks ) );
+    }
+
+    for( uint32_t ulLane = 0; ulLane < MQTT_AGENT_NUM_LANES; ulLane++ )
+    {
+        MQTTAgentLaneStats_t xLaneStats;
+
+        if( xMQTTAgentGetLaneStats( xAgentHandle, ( MQTTAgentLane_t ) ulLane, &xLaneStats ) )
+        {
+            prvSetMetric( xMsg, pcLaneNames[ ulLane ], "max_depth", xLaneStats.ulMaxDepth );
+            prvSetMetric( xMsg, pcLaneNames[ ulLane ], "rejected", xLaneStats.ulRejected );
+            prvSetMetric( xMsg, pcLaneNames[ ulLane ], "high_watermarks", xLaneStats.ulHighWatermarks );
+        }
+    }
+
+    for( size_t uxClass = 0; xMQTTAgentGetRateStats( xAgentHandle, uxClass, &xRateStats ); uxClass++ )
+    {
+        char pcClassName[ 8 ];
+
+        ( void ) snprintf( pcClassName, sizeof( pcClassName ), "rate%lu", ( unsigned long ) uxClass );
+
+        prvSetMetric( xMsg, pcClassName, "delayed", xRateStats.ulDelayed );
+        prvSetMetric( xMsg, pcClassName, "merged", xRateStats.ulMerged );
+        prvSetMetric( xMsg, pcClassName, "dropped", xRateStats.ulDropped );
+        prvSetMetric( xMsg, pcClassName, "max_delay_ms", xRateStats.ulMaxDelayMs );
+    }
+
+    Agent_GetPoolStats( &xPoolStats );
+    prvSetMetric( xMsg, "pool", "high_water", xPoolStats.ulHighWater );
+    prvSetMetric( xMsg, "pool", "exhausted", xPoolStats.ulExhausted );
+
+    MqttAgentMetrics_GetWakeStats( &xWakeStats );
+    prvSetMetric( xMsg, "agent", "wakeups", xWakeStats.ulWakeups );
+    prvSetMetric( xMsg, "agent", "wake_timeouts", xWakeStats.ulTimeouts );
+
+    iotcl_mqtt_send_telemetry( xMsg, true );
+    iotcl_telemetry_destroy( xMsg );
+}
+
+/*-----------------------------------------------------------*/
+
+void vAgentMetricsPublishTask( void * pvParameters )
+{
+    MQTTAgentHandle_t xAgentHandle = NULL;
+
+    ( void ) pvParameters;
+
+    vSleepUntilMQTTAgentReady();
+
+    xAgentHandle = xGetMqttAgentHandle();
+
+    /* Metrics should neither delay other traffic nor fill the offline journal. */
+    vMQTTAgentSetTaskLane( MQTT_AGENT_LANE_BULK );
+    vMQTTAgentSetTaskJournalMode( MQTT_AGENT_JOURNAL_NONE );
+
+    for( ; ; )
+    {
+        vTaskDelay( pdMS_TO_TICKS( MQTT_AGENT_METRICS_PUBLISH_INTERVAL_S * 1000U ) );
+
+        if( xIsMqttAgentConnected() )
+        {
+            prvSendMetrics( xAgentHandle );
+        }
+    }
+}
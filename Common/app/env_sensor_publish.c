@@ -50,6 +50,7 @@
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
+#include "mqtt_journal.h"
 
 /* Sensor includes */
 #include "b_u585i_iot02a_env_sensors.h"
@@ -144,6 +145,12 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
 
     xAgentHandle = xGetMqttAgentHandle();
 
+    /* Periodic telemetry should not delay shadow and command traffic. */
+    vMQTTAgentSetTaskLane( MQTT_AGENT_LANE_BULK );
+
+    /* Keep telemetry gathered while offline in the journal. */
+    vMQTTAgentSetTaskJournalMode( MQTT_AGENT_JOURNAL_ALL );
+
     while( xExitFlag == pdFALSE )
     {
         TickType_t xTicksToWait = pdMS_TO_TICKS( MQTT_PUBLISH_TIME_BETWEEN_MS );
@@ -159,7 +166,7 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
             payload.bMotionSensorValid = false;
             payload.bEnvSensorDataValid = true;
 
-        	if( xIsMqttConnected() == pdTRUE )
+        	if( ( xIsMqttConnected() == pdTRUE ) || MqttJournal_IsAccepting() )
         	{
             	iotcApp_create_and_send_telemetry_json(&payload, sizeof(payload));
         	}
@@ -57,6 +57,7 @@
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
+#include "mqtt_journal.h"
 
 /* Sensor includes */
 #include "b_u585i_iot02a_motion_sensors.h"
@@ -74,129 +75,28 @@
 #define MQTT_PUBLISH_MAX_LEN                 ( 200 )
 #define MQTT_PUBLISH_PERIOD_MS               ( 500 )
 #define MQTT_PUBLICH_TOPIC_STR_LEN           ( 256 )
-#define MQTT_PUBLISH_BLOCK_TIME_MS           ( 200 )
-#define MQTT_PUBLISH_NOTIFICATION_WAIT_MS    ( 1000 )
-#define MQTT_NOTIFY_IDX                      ( 1 )
-#define MQTT_PUBLISH_QOS                     ( MQTTQoS0 )
-
-
-/*-----------------------------------------------------------*/
 
 /**
- * @brief Defines the structure to use as the command callback context in this
- * demo.
+ * @brief Commands waiting in the bulk lane at which samples stop being
+ * published, and at or below which publishing resumes.
  */
-struct MQTTAgentCommandContext
-{
-    MQTTStatus_t xReturnStatus;
-    TaskHandle_t xTaskToNotify;
-    uint32_t ulNotificationValue;
-};
-
-/*-----------------------------------------------------------*/
-static void prvPublishCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
-                                       MQTTAgentReturnInfo_t * pxReturnInfo )
-{
-    TaskHandle_t xTaskHandle = ( TaskHandle_t ) pxCommandContext;
+#define MQTT_PUBLISH_HIGH_WATERMARK          ( ( MQTT_AGENT_COMMAND_QUEUE_LENGTH * 3 ) / 4 )
+#define MQTT_PUBLISH_LOW_WATERMARK           ( MQTT_AGENT_COMMAND_QUEUE_LENGTH / 4 )
 
-    configASSERT( pxReturnInfo != NULL );
 
-    uint32_t ulNotifyValue = pxReturnInfo->returnCode;
+/*-----------------------------------------------------------*/
 
-    if( xTaskHandle != NULL )
-    {
-        /* Send the context's ulNotificationValue as the notification value so
-         * the receiving task can check the value it set in the context matches
-         * the value it receives in the notification. */
-        ( void ) xTaskNotifyIndexed( xTaskHandle,
-                                     MQTT_NOTIFY_IDX,
-                                     ulNotifyValue,
-                                     eSetValueWithOverwrite );
-    }
-}
+/* Set by the agent while the bulk lane is above its high watermark. */
+static volatile bool xBulkLaneBusy = false;
 
 /*-----------------------------------------------------------*/
 
-static BaseType_t prvPublishAndWaitForAck( MQTTAgentHandle_t xAgentHandle,
-                                           const char * pcTopic,
-                                           const void * pvPublishData,
-                                           size_t xPublishDataLen )
+static void prvBulkLaneWatermarkCallback( void * pvCallbackCtx,
+                                          bool xAboveHigh )
 {
-    MQTTStatus_t xStatus;
-    size_t uxTopicLen = 0;
-
-    configASSERT( pcTopic != NULL );
-    configASSERT( pvPublishData != NULL );
-    configASSERT( xPublishDataLen > 0 );
+    ( void ) pvCallbackCtx;
 
-    uxTopicLen = strnlen( pcTopic, UINT16_MAX );
-
-    MQTTPublishInfo_t xPublishInfo =
-    {
-        .qos             = MQTT_PUBLISH_QOS,
-        .retain          = 0,
-        .dup             = 0,
-        .pTopicName      = pcTopic,
-        .topicNameLength = ( uint16_t ) uxTopicLen,
-        .pPayload        = pvPublishData,
-        .payloadLength   = xPublishDataLen
-    };
-
-    MQTTAgentCommandInfo_t xCommandParams =
-    {
-        .blockTimeMs                 = MQTT_PUBLISH_BLOCK_TIME_MS,
-        .cmdCompleteCallback         = prvPublishCommandCallback,
-        .pCmdCompleteCallbackContext = ( void * ) xTaskGetCurrentTaskHandle(),
-    };
-
-    if( xPublishInfo.qos > MQTTQoS0 )
-    {
-        xCommandParams.pCmdCompleteCallbackContext = ( void * ) xTaskGetCurrentTaskHandle();
-    }
-
-    /* Clear the notification index */
-    xTaskNotifyStateClearIndexed( NULL, MQTT_NOTIFY_IDX );
-
-
-    xStatus = MQTTAgent_Publish( xAgentHandle,
-                                 &xPublishInfo,
-                                 &xCommandParams );
-
-    if( xStatus == MQTTSuccess )
-    {
-        uint32_t ulNotifyValue = 0;
-        BaseType_t xResult = pdFALSE;
-
-        xResult = xTaskNotifyWaitIndexed( MQTT_NOTIFY_IDX,
-                                          0xFFFFFFFF,
-                                          0xFFFFFFFF,
-                                          &ulNotifyValue,
-                                          pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-
-        if( xResult )
-        {
-            xStatus = ( MQTTStatus_t ) ulNotifyValue;
-
-            if( xStatus != MQTTSuccess )
-            {
-                LogError( "MQTT Agent returned error code: %d during publish operation.",
-                          xStatus );
-                xResult = pdFALSE;
-            }
-        }
-        else
-        {
-            LogError( "Timed out while waiting for publish ACK or Sent event. xTimeout = %d",
-                      pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-            xResult = pdFALSE;
-        }
-    }
-    else
-    {
-        LogError( "MQTTAgent_Publish returned error code: %d.", xStatus );
-    }
-
-    return( xStatus == MQTTSuccess );
+    xBulkLaneBusy = xAboveHigh;
 }
 
 /*-----------------------------------------------------------*/
@@ -232,6 +132,7 @@ void vMotionSensorsPublish( void * pvParameters )
     char pcTopicString[ MQTT_PUBLICH_TOPIC_STR_LEN ] = { 0 };
     char * pcDeviceId = NULL;
     int lTopicLen = 0;
+    uint32_t ulSkippedSamples = 0;
 
     xResult = xInitSensors();
 
@@ -262,6 +163,23 @@ void vMotionSensorsPublish( void * pvParameters )
 
     xAgentHandle = xGetMqttAgentHandle();
 
+    /* Periodic telemetry should not delay shadow and command traffic. */
+    vMQTTAgentSetTaskLane( MQTT_AGENT_LANE_BULK );
+
+    /* Keep telemetry gathered while offline in the journal. */
+    vMQTTAgentSetTaskJournalMode( MQTT_AGENT_JOURNAL_ALL );
+
+    /* Skip samples rather than stall the sampling period on a full lane. */
+    if( xMQTTAgentAddLaneWatermark( xAgentHandle,
+                                    MQTT_AGENT_LANE_BULK,
+                                    MQTT_PUBLISH_HIGH_WATERMARK,
+                                    MQTT_PUBLISH_LOW_WATERMARK,
+                                    prvBulkLaneWatermarkCallback,
+                                    NULL ) == false )
+    {
+        LogWarn( "Failed to register the bulk lane watermark." );
+    }
+
     while( xExitFlag == pdFALSE )
     {
         /* Interpret sensor data */
@@ -277,8 +195,18 @@ void vMotionSensorsPublish( void * pvParameters )
             payload.bMotionSensorValid = true;
             payload.bEnvSensorDataValid = false;
 
-        	if(xIsMqttAgentConnected() == pdTRUE)
+            if( xBulkLaneBusy )
             {
+                ulSkippedSamples++;
+            }
+            else if( ( xIsMqttAgentConnected() == pdTRUE ) || MqttJournal_IsAccepting() )
+            {
+                if( ulSkippedSamples > 0 )
+                {
+                    LogWarn( "Skipped %lu samples while the agent was busy.", ( unsigned long ) ulSkippedSamples );
+                    ulSkippedSamples = 0;
+                }
+
             	iotcApp_create_and_send_telemetry_json(&payload, sizeof(payload));
             }
         }
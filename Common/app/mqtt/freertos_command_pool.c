@@ -43,9 +43,14 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "atomic.h"
 
 /* Header include. */
 #include "freertos_command_pool.h"
+#include "mqtt_agent_metrics.h"
+
+#define POOL_BITS_PER_WORD    ( 32U )
+#define POOL_FREE_MAP_WORDS   ( ( MQTT_COMMAND_CONTEXTS_POOL_SIZE + POOL_BITS_PER_WORD - 1U ) / POOL_BITS_PER_WORD )
 
 /**
  * @brief The pool of command structures used to hold information on commands (such
@@ -54,23 +59,86 @@
  */
 static MQTTAgentCommand_t commandStructurePool[ MQTT_COMMAND_CONTEXTS_POOL_SIZE ];
 
-static QueueHandle_t xCommandPoolQueue = NULL;
+/**
+ * @brief One bit per entry in commandStructurePool, set while the entry is free.
+ * Entries are claimed and returned with a compare and swap on the word holding
+ * their bit, so no lock is taken on the fast path.
+ */
+static volatile uint32_t pulFreeMap[ POOL_FREE_MAP_WORDS ];
+
+/**
+ * @brief Counting semaphore used only to block callers while the pool is empty.
+ */
+static SemaphoreHandle_t xPoolAvailableSemaphore = NULL;
+
+/**
+ * @brief Number of tasks blocked (or about to block) waiting for a free entry.
+ */
+static volatile uint32_t ulWaitingTasks = 0;
+
+static volatile uint32_t ulInUse = 0;
+static volatile uint32_t ulHighWater = 0;
+static volatile uint32_t ulExhausted = 0;
+
+/*-----------------------------------------------------------*/
+
+static MQTTAgentCommand_t * prvTryAllocate( void )
+{
+    MQTTAgentCommand_t * pxCommand = NULL;
+
+    for( uint32_t ulWord = 0; ( ulWord < POOL_FREE_MAP_WORDS ) && ( pxCommand == NULL ); ulWord++ )
+    {
+        uint32_t ulFree = pulFreeMap[ ulWord ];
+
+        while( ( ulFree != 0U ) && ( pxCommand == NULL ) )
+        {
+            uint32_t ulBit = ( uint32_t ) __builtin_ctz( ulFree );
+
+            if( Atomic_CompareAndSwap_u32( &( pulFreeMap[ ulWord ] ),
+                                           ulFree & ~( 1UL << ulBit ),
+                                           ulFree ) == ATOMIC_COMPARE_AND_SWAP_SUCCESS )
+            {
+                pxCommand = &( commandStructurePool[ ( ulWord * POOL_BITS_PER_WORD ) + ulBit ] );
+            }
+            else
+            {
+                /* Another task changed this word, reload it and try again. */
+                ulFree = pulFreeMap[ ulWord ];
+            }
+        }
+    }
+
+    if( pxCommand != NULL )
+    {
+        uint32_t ulNowInUse = Atomic_Increment_u32( &ulInUse ) + 1U;
+        uint32_t ulPeak = ulHighWater;
+
+        while( ( ulNowInUse > ulPeak ) &&
+               ( Atomic_CompareAndSwap_u32( &ulHighWater, ulNowInUse, ulPeak ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+        {
+            ulPeak = ulHighWater;
+        }
+    }
+
+    return pxCommand;
+}
 
 /*-----------------------------------------------------------*/
 
 void Agent_InitializePool( void )
 {
-    if( xCommandPoolQueue == NULL )
+    if( xPoolAvailableSemaphore == NULL )
     {
-        xCommandPoolQueue = xQueueCreate( MQTT_COMMAND_CONTEXTS_POOL_SIZE, sizeof( MQTTAgentCommand_t * ) );
+        ( void ) memset( ( void * ) pulFreeMap, 0, sizeof( pulFreeMap ) );
 
-        /* Populate the queue with pointers to each command structure. */
+        /* Mark each command structure as free. */
         for( uint32_t ulIdx = 0; ulIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE; ulIdx++ )
         {
-            MQTTAgentCommand_t * pCommand = &commandStructurePool[ ulIdx ];
-
-            ( void ) xQueueSend( xCommandPoolQueue, &pCommand, 0U );
+            pulFreeMap[ ulIdx / POOL_BITS_PER_WORD ] |= ( 1UL << ( ulIdx % POOL_BITS_PER_WORD ) );
         }
+
+        xPoolAvailableSemaphore = xSemaphoreCreateCounting( MQTT_COMMAND_CONTEXTS_POOL_SIZE, 0 );
+        configASSERT( xPoolAvailableSemaphore != NULL );
     }
 }
 
@@ -79,13 +147,44 @@ void Agent_InitializePool( void )
 MQTTAgentCommand_t * Agent_GetCommand( uint32_t ulBlockTimeMs )
 {
     MQTTAgentCommand_t * pxCommandStruct = NULL;
+    uint32_t ulStartTime = MqttAgentMetrics_Now();
+
+    ( void ) ulStartTime;
 
-    if( xCommandPoolQueue )
+    if( xPoolAvailableSemaphore )
     {
-        if( !xQueueReceive( xCommandPoolQueue, &pxCommandStruct, pdMS_TO_TICKS( ulBlockTimeMs ) ) )
+        pxCommandStruct = prvTryAllocate();
+
+        if( pxCommandStruct == NULL )
+        {
+            TickType_t xTicksToWait = pdMS_TO_TICKS( ulBlockTimeMs );
+            TimeOut_t xTimeOut;
+
+            ( void ) Atomic_Increment_u32( &ulExhausted );
+
+            vTaskSetTimeOutState( &xTimeOut );
+
+            /* Register as a waiter before checking the pool again so that a
+             * release between the two checks always signals the semaphore. */
+            ( void ) Atomic_Increment_u32( &ulWaitingTasks );
+
+            while( ( ( pxCommandStruct = prvTryAllocate() ) == NULL ) &&
+                   ( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdFALSE ) )
+            {
+                ( void ) xSemaphoreTake( xPoolAvailableSemaphore, xTicksToWait );
+            }
+
+            ( void ) Atomic_Decrement_u32( &ulWaitingTasks );
+        }
+
+        if( pxCommandStruct == NULL )
         {
             LogError( ( "No command structure available." ) );
         }
+        else
+        {
+            MqttAgentMetrics_CommandAllocated( pxCommandStruct, ulStartTime );
+        }
     }
     else
     {
@@ -99,25 +198,99 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t ulBlockTimeMs )
 
 bool Agent_ReleaseCommand( MQTTAgentCommand_t * pCommandToRelease )
 {
-    BaseType_t xStructReturned = pdFALSE;
+    bool xStructReturned = false;
 
-    if( !xCommandPoolQueue )
+    if( !xPoolAvailableSemaphore )
     {
         LogError( ( "Command pool not initialized." ) );
     }
     /* See if the structure being returned is actually from the pool. */
     else if( ( pCommandToRelease < commandStructurePool ) ||
-             ( pCommandToRelease > ( commandStructurePool + MQTT_COMMAND_CONTEXTS_POOL_SIZE ) ) )
+             ( pCommandToRelease >= ( commandStructurePool + MQTT_COMMAND_CONTEXTS_POOL_SIZE ) ) )
     {
         LogError( ( "Provided pointer: %p does not belong to the command pool.", pCommandToRelease ) );
     }
     else
     {
-        xStructReturned = xQueueSend( xCommandPoolQueue, &pCommandToRelease, 0U );
+        uint32_t ulIdx = ( uint32_t ) ( pCommandToRelease - commandStructurePool );
+        uint32_t ulWord = ulIdx / POOL_BITS_PER_WORD;
+        uint32_t ulMask = 1UL << ( ulIdx % POOL_BITS_PER_WORD );
+        uint32_t ulPrevious = 0;
+
+        /* Before the structure can be allocated again. */
+        MqttAgentMetrics_CommandReleased( pCommandToRelease );
+
+        /* Also before, so that an allocation taking the entry as soon as its
+         * bit is set does not count it twice towards ulHighWater. */
+        ( void ) Atomic_Decrement_u32( &ulInUse );
+
+        ulPrevious = Atomic_OR_u32( &( pulFreeMap[ ulWord ] ), ulMask );
+
+        if( ( ulPrevious & ulMask ) != 0U )
+        {
+            ( void ) Atomic_Increment_u32( &ulInUse );
+
+            LogError( ( "Command Context %d was already in the pool.", ( int ) ulIdx ) );
+        }
+        else
+        {
+            xStructReturned = true;
+
+            if( ulWaitingTasks > 0U )
+            {
+                ( void ) xSemaphoreGive( xPoolAvailableSemaphore );
+            }
+
+            LogDebug( ( "Returned Command Context %d to pool", ( int ) ulIdx ) );
+        }
+    }
 
-        LogDebug( ( "Returned Command Context %d to pool",
-                    ( int ) ( pCommandToRelease - commandStructurePool ) ) );
+    return xStructReturned;
+}
+
+/*-----------------------------------------------------------*/
+
+void Agent_GetPoolStats( CommandPoolStats_t * pxStats )
+{
+    if( pxStats != NULL )
+    {
+        pxStats->ulPoolSize = MQTT_COMMAND_CONTEXTS_POOL_SIZE;
+        pxStats->ulInUse = ulInUse;
+        pxStats->ulHighWater = ulHighWater;
+        pxStats->ulExhausted = ulExhausted;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+size_t Agent_GetCommandIndex( const MQTTAgentCommand_t * pxCommand )
+{
+    size_t uxIdx = MQTT_COMMAND_CONTEXTS_POOL_SIZE;
+
+    if( ( pxCommand >= commandStructurePool ) &&
+        ( pxCommand < ( commandStructurePool + MQTT_COMMAND_CONTEXTS_POOL_SIZE ) ) )
+    {
+        uxIdx = ( size_t ) ( pxCommand - commandStructurePool );
+    }
+
+    return uxIdx;
+}
+
+/*-----------------------------------------------------------*/
+
+void Agent_ConcludeCommand( MQTTAgentCommand_t * pxCommand,
+                            MQTTStatus_t xStatus )
+{
+    MQTTAgentReturnInfo_t xReturnInfo =
+    {
+        .returnCode   = xStatus,
+        .pSubackCodes = NULL
+    };
+
+    if( pxCommand->pCommandCompleteCallback != NULL )
+    {
+        pxCommand->pCommandCompleteCallback( pxCommand->pCmdContext, &xReturnInfo );
     }
 
-    return ( bool ) xStructReturned;
+    ( void ) Agent_ReleaseCommand( pxCommand );
 }
@@ -34,6 +34,17 @@
 /* MQTT agent includes. */
 #include "core_mqtt_agent.h"
 
+/**
+ * @brief Usage counters for the command structure pool.
+ */
+typedef struct CommandPoolStats
+{
+    uint32_t ulPoolSize;  /**< Number of structures in the pool. */
+    uint32_t ulInUse;     /**< Number of structures currently allocated. */
+    uint32_t ulHighWater; /**< Largest number of structures allocated at once. */
+    uint32_t ulExhausted; /**< Number of Agent_GetCommand calls that found the pool empty. */
+} CommandPoolStats_t;
+
 /**
  * @brief Initialize the common task pool. Not thread safe.
  */
@@ -80,4 +91,31 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t blockTimeMs );
  */
 bool Agent_ReleaseCommand( MQTTAgentCommand_t * pCommandToRelease );
 
+/**
+ * @brief Read the usage counters of the command structure pool.
+ *
+ * @param[out] pxStats Structure to fill in.
+ */
+void Agent_GetPoolStats( CommandPoolStats_t * pxStats );
+
+/**
+ * @brief Get the position of a command structure in the pool.
+ *
+ * @param[in] pxCommand Command structure.
+ *
+ * @return Index of the structure, or MQTT_COMMAND_CONTEXTS_POOL_SIZE if it
+ * does not belong to the pool.
+ */
+size_t Agent_GetCommandIndex( const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Complete a command that was never handed to coreMQTT-Agent, such as
+ * one dropped by a rate limit, and give it back to the pool.
+ *
+ * @param[in] pxCommand Command taken from the pool.
+ * @param[in] xStatus Status passed to the command's completion callback.
+ */
+void Agent_ConcludeCommand( MQTTAgentCommand_t * pxCommand,
+                            MQTTStatus_t xStatus );
+
 #endif /* FREERTOS_COMMAND_POOL_H */
@@ -0,0 +1,434 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+#include "atomic.h"
+
+#include "mqtt_agent_delivery.h"
+
+/*-----------------------------------------------------------*/
+
+static MQTTAgentDelivery_t * prvCreateDelivery( MQTTAgentHandle_t xHandle,
+                                                 const MQTTPublishInfo_t * pxPublishInfo )
+{
+    MQTTAgentDelivery_t * pxDelivery = NULL;
+    MQTTAgentPayloadHandle_t xPayload = MqttAgent_RetainPayload( xHandle, pxPublishInfo );
+
+    if( xPayload != NULL )
+    {
+        pxDelivery = pvPortMalloc( sizeof( MQTTAgentDelivery_t ) );
+
+        if( pxDelivery != NULL )
+        {
+            pxDelivery->xPublishInfo = *pxPublishInfo;
+            pxDelivery->xPayload = xPayload;
+            pxDelivery->ulRefCount = 1;
+        }
+        else
+        {
+            MqttAgent_ReleasePayload( xPayload );
+        }
+    }
+    else
+    {
+        /* No spare receive buffer, fall back to copying the publish. */
+        pxDelivery = pvPortMalloc( sizeof( MQTTAgentDelivery_t ) +
+                                   pxPublishInfo->topicNameLength +
+                                   pxPublishInfo->payloadLength );
+    }
+
+    if( ( pxDelivery != NULL ) && ( xPayload == NULL ) )
+    {
+        char * pcTopicName = ( char * ) &( pxDelivery[ 1 ] );
+        uint8_t * pucPayload = ( uint8_t * ) &( pcTopicName[ pxPublishInfo->topicNameLength ] );
+
+        ( void ) memcpy( pcTopicName, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+        ( void ) memcpy( pucPayload, pxPublishInfo->pPayload, pxPublishInfo->payloadLength );
+
+        pxDelivery->xPublishInfo = *pxPublishInfo;
+        pxDelivery->xPublishInfo.pTopicName = pcTopicName;
+        pxDelivery->xPublishInfo.pPayload = pucPayload;
+        pxDelivery->xPayload = NULL;
+
+        /* Reference held by the caller until all subscribers have been queued. */
+        pxDelivery->ulRefCount = 1;
+    }
+
+    return pxDelivery;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentDelivery_Release( MQTTAgentDelivery_t * pxDelivery )
+{
+    configASSERT( pxDelivery );
+
+    /* Atomic_Decrement_u32 returns the value before the decrement. */
+    if( Atomic_Decrement_u32( &( pxDelivery->ulRefCount ) ) == 1U )
+    {
+        MqttAgent_ReleasePayload( pxDelivery->xPayload );
+        vPortFree( pxDelivery );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+DeliveryQueue_t * MqttAgentDelivery_GetQueue( DeliveryQueue_t * pxQueues,
+                                              TaskHandle_t xTaskHandle )
+{
+    DeliveryQueue_t * pxDeliveryQueue = NULL;
+
+    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_DELIVERY_QUEUES; uxIdx++ )
+    {
+        if( pxQueues[ uxIdx ].xTaskHandle == xTaskHandle )
+        {
+            pxDeliveryQueue = &( pxQueues[ uxIdx ] );
+            break;
+        }
+    }
+
+    return pxDeliveryQueue;
+}
+
+/*-----------------------------------------------------------*/
+
+DeliveryQueue_t * MqttAgentDelivery_AcquireQueue( DeliveryQueue_t * pxQueues,
+                                                  SemaphoreHandle_t xMutex,
+                                                  UBaseType_t uxQueueLength )
+{
+    DeliveryQueue_t * pxDeliveryQueue = NULL;
+
+    configASSERT( xSemaphoreGetMutexHolder( xMutex ) == xTaskGetCurrentTaskHandle() );
+
+    pxDeliveryQueue = MqttAgentDelivery_GetQueue( pxQueues, xTaskGetCurrentTaskHandle() );
+
+    if( pxDeliveryQueue != NULL )
+    {
+        /* The task has not deleted its retired queue yet, use it again. */
+        pxDeliveryQueue->xRetired = false;
+    }
+    else
+    {
+        pxDeliveryQueue = MqttAgentDelivery_GetQueue( pxQueues, NULL );
+
+        if( pxDeliveryQueue != NULL )
+        {
+            memset( pxDeliveryQueue, 0, sizeof( DeliveryQueue_t ) );
+
+            pxDeliveryQueue->xQueue = xQueueCreate( uxQueueLength, sizeof( DeliveryItem_t ) );
+
+            if( pxDeliveryQueue->xQueue != NULL )
+            {
+                pxDeliveryQueue->uxQueueLength = uxQueueLength;
+
+                /* Set last, MqttAgent_ProcessDeliveries looks up queues without the mutex. */
+                pxDeliveryQueue->xTaskHandle = xTaskGetCurrentTaskHandle();
+            }
+            else
+            {
+                LogError( "Failed to allocate a delivery queue of length %lu.", uxQueueLength );
+                pxDeliveryQueue = NULL;
+            }
+        }
+        else
+        {
+            LogError( "No free delivery queue slots." );
+        }
+    }
+
+    if( pxDeliveryQueue != NULL )
+    {
+        pxDeliveryQueue->ulCallbackRefs++;
+    }
+
+    return pxDeliveryQueue;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Drop the queued publishes of a queue no callback refers to any more, and
+ * wake its task to delete it. */
+static void prvRetireQueue( DeliveryQueue_t * pxDeliveryQueue )
+{
+    DeliveryItem_t xItem = { 0 };
+
+    while( xQueueReceive( pxDeliveryQueue->xQueue, &xItem, 0 ) == pdTRUE )
+    {
+        if( xItem.pxDelivery != NULL )
+        {
+            MqttAgentDelivery_Release( xItem.pxDelivery );
+        }
+    }
+
+    pxDeliveryQueue->xRetired = true;
+
+    /* The queue was just emptied, so there is room for the wake up item. */
+    xItem.pxDelivery = NULL;
+    ( void ) xQueueSendToBack( pxDeliveryQueue->xQueue, &xItem, 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Delete the calling task's queue if it has been retired. Returns true if
+ * it was deleted. */
+static bool prvFreeRetiredQueue( DeliveryQueue_t * pxDeliveryQueue,
+                                 SemaphoreHandle_t xMutex )
+{
+    bool xFreed = false;
+
+    if( pxDeliveryQueue->xRetired &&
+        ( xSemaphoreTake( xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        /* Checked again, the task may not have held the mutex. */
+        if( pxDeliveryQueue->xRetired )
+        {
+            vQueueDelete( pxDeliveryQueue->xQueue );
+            pxDeliveryQueue->xQueue = NULL;
+            memset( &( pxDeliveryQueue->xStats ), 0, sizeof( MQTTAgentDeliveryStats_t ) );
+            pxDeliveryQueue->xRetired = false;
+
+            /* Cleared last, the slot is free once the handle is NULL. */
+            pxDeliveryQueue->xTaskHandle = NULL;
+            xFreed = true;
+        }
+
+        ( void ) xSemaphoreGive( xMutex );
+    }
+
+    return xFreed;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentDelivery_ReleaseQueue( DeliveryQueue_t * pxDeliveryQueue )
+{
+    configASSERT( pxDeliveryQueue->ulCallbackRefs > 0 );
+
+    pxDeliveryQueue->ulCallbackRefs--;
+
+    if( pxDeliveryQueue->ulCallbackRefs == 0 )
+    {
+        prvRetireQueue( pxDeliveryQueue );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentDelivery_PurgeQueue( DeliveryQueue_t * pxDeliveryQueue,
+                                   IncomingPubCallback_t pxCallback,
+                                   void * pvCallbackCtx )
+{
+    UBaseType_t uxWaiting = uxQueueMessagesWaiting( pxDeliveryQueue->xQueue );
+    DeliveryItem_t xItem;
+
+    /* Rotate through the queue once so the order of the remaining items is kept. */
+    for( UBaseType_t uxIdx = 0; uxIdx < uxWaiting; uxIdx++ )
+    {
+        if( xQueueReceive( pxDeliveryQueue->xQueue, &xItem, 0 ) != pdTRUE )
+        {
+            break;
+        }
+
+        if( ( xItem.pxDelivery != NULL ) &&
+            ( xItem.pxCallback == pxCallback ) &&
+            ( xItem.pvCallbackCtx == pvCallbackCtx ) )
+        {
+            MqttAgentDelivery_Release( xItem.pxDelivery );
+        }
+        else
+        {
+            ( void ) xQueueSendToBack( pxDeliveryQueue->xQueue, &xItem, 0 );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentDelivery_RetireQueues( DeliveryQueue_t * pxQueues )
+{
+    /* A subscriber task may be blocked on its queue, so only the task deletes it. */
+    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_DELIVERY_QUEUES; uxIdx++ )
+    {
+        DeliveryQueue_t * pxDeliveryQueue = &( pxQueues[ uxIdx ] );
+
+        pxDeliveryQueue->ulCallbackRefs = 0;
+
+        if( ( pxDeliveryQueue->xTaskHandle != NULL ) && !pxDeliveryQueue->xRetired )
+        {
+            prvRetireQueue( pxDeliveryQueue );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentDelivery_FreeQueues( DeliveryQueue_t * pxQueues )
+{
+    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_DELIVERY_QUEUES; uxIdx++ )
+    {
+        DeliveryQueue_t * pxDeliveryQueue = &( pxQueues[ uxIdx ] );
+
+        if( pxDeliveryQueue->xQueue != NULL )
+        {
+            vQueueDelete( pxDeliveryQueue->xQueue );
+        }
+
+        memset( pxDeliveryQueue, 0, sizeof( DeliveryQueue_t ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentDelivery_Queue( MQTTAgentHandle_t xHandle,
+                              DeliveryQueue_t * pxDeliveryQueue,
+                              MQTTAgentDelivery_t ** ppxDelivery,
+                              const MQTTPublishInfo_t * pxPublishInfo,
+                              IncomingPubCallback_t pxCallback,
+                              void * pvCallbackCtx )
+{
+    bool xQueued = false;
+
+    /* Copy the publish once, the copy is shared by every subscriber task. */
+    if( *ppxDelivery == NULL )
+    {
+        *ppxDelivery = prvCreateDelivery( xHandle, pxPublishInfo );
+    }
+
+    if( *ppxDelivery != NULL )
+    {
+        DeliveryItem_t xItem =
+        {
+            .pxDelivery    = *ppxDelivery,
+            .pxCallback    = pxCallback,
+            .pvCallbackCtx = pvCallbackCtx,
+        };
+
+        ( void ) Atomic_Increment_u32( &( xItem.pxDelivery->ulRefCount ) );
+
+        xQueued = ( xQueueSendToBack( pxDeliveryQueue->xQueue, &xItem, 0 ) == pdTRUE );
+
+        if( !xQueued )
+        {
+            MqttAgentDelivery_Release( xItem.pxDelivery );
+        }
+    }
+
+    if( xQueued )
+    {
+        UBaseType_t uxDepth = uxQueueMessagesWaiting( pxDeliveryQueue->xQueue );
+
+        pxDeliveryQueue->xStats.ulQueued++;
+        pxDeliveryQueue->xOverflowing = false;
+
+        if( uxDepth > pxDeliveryQueue->xStats.uxMaxDepth )
+        {
+            pxDeliveryQueue->xStats.uxMaxDepth = uxDepth;
+        }
+    }
+    else
+    {
+        pxDeliveryQueue->xStats.ulDropped++;
+
+        /* Only log the first drop until the subscriber catches up. */
+        if( !pxDeliveryQueue->xOverflowing )
+        {
+            pxDeliveryQueue->xOverflowing = true;
+            pxDeliveryQueue->xStats.ulOverflows++;
+
+            LogWarn( "Delivery queue for task=%s is full, dropping publishes. topic=\"%.*s\".",
+                     pcTaskGetName( pxDeliveryQueue->xTaskHandle ),
+                     pxPublishInfo->topicNameLength,
+                     pxPublishInfo->pTopicName );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+size_t MqttAgentDelivery_Process( DeliveryQueue_t * pxQueues,
+                                  SemaphoreHandle_t xMutex,
+                                  TickType_t xTicksToWait )
+{
+    /* A task's queue is only created and deleted by the task itself, other
+     * tasks just retire it, so the lookup needs no lock. */
+    DeliveryQueue_t * pxDeliveryQueue = MqttAgentDelivery_GetQueue( pxQueues, xTaskGetCurrentTaskHandle() );
+    size_t uxDelivered = 0;
+
+    if( ( pxDeliveryQueue != NULL ) &&
+        prvFreeRetiredQueue( pxDeliveryQueue, xMutex ) )
+    {
+        pxDeliveryQueue = NULL;
+    }
+
+    if( pxDeliveryQueue != NULL )
+    {
+        DeliveryItem_t xItem;
+
+        /* Bound the time spent here to one queue length of publishes. */
+        while( ( pxDeliveryQueue != NULL ) &&
+               ( uxDelivered < pxDeliveryQueue->uxQueueLength ) &&
+               ( xQueueReceive( pxDeliveryQueue->xQueue, &xItem, xTicksToWait ) == pdTRUE ) )
+        {
+            if( xItem.pxDelivery == NULL )
+            {
+                /* Woken to delete the queue, unless the task subscribed again. */
+                if( prvFreeRetiredQueue( pxDeliveryQueue, xMutex ) )
+                {
+                    pxDeliveryQueue = NULL;
+                }
+            }
+            else
+            {
+                xItem.pxCallback( xItem.pvCallbackCtx, &( xItem.pxDelivery->xPublishInfo ) );
+
+                MqttAgentDelivery_Release( xItem.pxDelivery );
+
+                pxDeliveryQueue->xStats.ulDelivered++;
+                uxDelivered++;
+            }
+
+            /* Only wait for the first publish. */
+            xTicksToWait = 0;
+        }
+    }
+    else
+    {
+        vTaskDelay( xTicksToWait );
+    }
+
+    return uxDelivered;
+}
@@ -0,0 +1,192 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_agent_delivery.h
+ * @brief Delivery of incoming publishes to the tasks of their subscribers.
+ *
+ * A subscription made with a delivery queue length has its publishes queued
+ * for the subscribing task, which runs the callbacks in
+ * MqttAgent_ProcessDeliveries instead of the agent task. Each publish is
+ * copied once, or kept in a receive buffer retained with
+ * MqttAgent_RetainPayload, and the copy is shared by every queue it is put on.
+ *
+ * The queue slots of an agent instance are guarded by its subscription
+ * manager mutex. A queue is only created and deleted by its own task. Once
+ * its last callback is removed it is retired, and an item with a NULL
+ * pxDelivery wakes the task to delete it.
+ */
+#ifndef MQTT_AGENT_DELIVERY_H
+#define MQTT_AGENT_DELIVERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "subscription_manager.h"
+
+/**
+ * @brief Copy of an incoming publish shared by the subscriber tasks it is
+ * queued for.
+ */
+typedef struct MQTTAgentDelivery
+{
+    MQTTPublishInfo_t xPublishInfo;
+    uint32_t ulRefCount;
+    /* Receive buffer holding the publish, or NULL if the topic name and
+     * payload were copied to follow this struct in the same allocation. */
+    MQTTAgentPayloadHandle_t xPayload;
+} MQTTAgentDelivery_t;
+
+typedef struct DeliveryItem
+{
+    MQTTAgentDelivery_t * pxDelivery;
+    IncomingPubCallback_t pxCallback;
+    void * pvCallbackCtx;
+} DeliveryItem_t;
+
+/**
+ * @brief Delivery queue of a subscriber task. The slot is free while
+ * xTaskHandle is NULL.
+ */
+typedef struct MQTTAgentDeliveryQueue
+{
+    TaskHandle_t xTaskHandle;
+    QueueHandle_t xQueue;
+    UBaseType_t uxQueueLength;
+    uint32_t ulCallbackRefs;
+    bool xRetired;
+    bool xOverflowing;
+    MQTTAgentDeliveryStats_t xStats;
+} DeliveryQueue_t;
+
+/**
+ * @brief Find the delivery queue of a task. Needs no lock when called by the
+ * task itself.
+ *
+ * @param[in] pxQueues The MQTT_AGENT_MAX_DELIVERY_QUEUES slots of the instance.
+ * @param[in] xTaskHandle Task, NULL to find a free slot.
+ *
+ * @return The queue, or NULL if the task has none.
+ */
+DeliveryQueue_t * MqttAgentDelivery_GetQueue( DeliveryQueue_t * pxQueues,
+                                              TaskHandle_t xTaskHandle );
+
+/**
+ * @brief Get a reference to the calling task's delivery queue, creating it
+ * if needed. Call with xMutex held.
+ *
+ * @param[in] pxQueues The MQTT_AGENT_MAX_DELIVERY_QUEUES slots of the instance.
+ * @param[in] xMutex Subscription manager mutex guarding the slots.
+ * @param[in] uxQueueLength Length of a new queue.
+ *
+ * @return The queue, or NULL if none could be created.
+ */
+DeliveryQueue_t * MqttAgentDelivery_AcquireQueue( DeliveryQueue_t * pxQueues,
+                                                  SemaphoreHandle_t xMutex,
+                                                  UBaseType_t uxQueueLength );
+
+/**
+ * @brief Drop a reference taken by MqttAgentDelivery_AcquireQueue, retiring
+ * the queue with the last one. Call with the subscription manager mutex held.
+ *
+ * @param[in] pxDeliveryQueue Queue.
+ */
+void MqttAgentDelivery_ReleaseQueue( DeliveryQueue_t * pxDeliveryQueue );
+
+/**
+ * @brief Discard the publishes already queued for a callback which is being
+ * removed. Call with the subscription manager mutex held.
+ *
+ * @param[in] pxDeliveryQueue Queue.
+ * @param[in] pxCallback Callback being removed.
+ * @param[in] pvCallbackCtx Context of the callback.
+ */
+void MqttAgentDelivery_PurgeQueue( DeliveryQueue_t * pxDeliveryQueue,
+                                   IncomingPubCallback_t pxCallback,
+                                   void * pvCallbackCtx );
+
+/**
+ * @brief Retire every queue, once all the callbacks have been freed. Call with
+ * the subscription manager mutex held.
+ *
+ * @param[in] pxQueues The MQTT_AGENT_MAX_DELIVERY_QUEUES slots of the instance.
+ */
+void MqttAgentDelivery_RetireQueues( DeliveryQueue_t * pxQueues );
+
+/**
+ * @brief Delete every queue as the instance is freed. Its subscriber tasks
+ * must already have stopped calling MqttAgent_ProcessDeliveries.
+ *
+ * @param[in] pxQueues The MQTT_AGENT_MAX_DELIVERY_QUEUES slots of the instance.
+ */
+void MqttAgentDelivery_FreeQueues( DeliveryQueue_t * pxQueues );
+
+/**
+ * @brief Queue an incoming publish for a callback. Called by the agent task
+ * with the subscription manager mutex held.
+ *
+ * @param[in] xHandle Agent the publish was received by.
+ * @param[in] pxDeliveryQueue Queue of the subscriber task.
+ * @param[in,out] ppxDelivery Copy of the publish, made by the first call for
+ * a publish and released by the caller with MqttAgentDelivery_Release.
+ * @param[in] pxPublishInfo Incoming publish.
+ * @param[in] pxCallback Callback run by the subscriber task.
+ * @param[in] pvCallbackCtx Context of the callback.
+ */
+void MqttAgentDelivery_Queue( MQTTAgentHandle_t xHandle,
+                              DeliveryQueue_t * pxDeliveryQueue,
+                              MQTTAgentDelivery_t ** ppxDelivery,
+                              const MQTTPublishInfo_t * pxPublishInfo,
+                              IncomingPubCallback_t pxCallback,
+                              void * pvCallbackCtx );
+
+/**
+ * @brief Drop a reference to a copy of a publish.
+ *
+ * @param[in] pxDelivery Copy of the publish.
+ */
+void MqttAgentDelivery_Release( MQTTAgentDelivery_t * pxDelivery );
+
+/**
+ * @brief Run the callbacks of the publishes queued for the calling task, see
+ * MqttAgent_ProcessDeliveries.
+ *
+ * @param[in] pxQueues The MQTT_AGENT_MAX_DELIVERY_QUEUES slots of the instance.
+ * @param[in] xMutex Subscription manager mutex guarding the slots.
+ * @param[in] xTicksToWait Time to wait for the first publish.
+ *
+ * @return The number of publishes delivered.
+ */
+size_t MqttAgentDelivery_Process( DeliveryQueue_t * pxQueues,
+                                  SemaphoreHandle_t xMutex,
+                                  TickType_t xTicksToWait );
+
+#endif /* MQTT_AGENT_DELIVERY_H */
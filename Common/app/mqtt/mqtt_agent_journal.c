@@ -0,0 +1,96 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "mqtt_agent_journal.h"
+#include "mqtt_agent_task.h"
+#include "mqtt_agent_transport.h"
+#include "freertos_command_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/* Thread local storage index holding the mode set by vMQTTAgentSetTaskJournalMode. */
+#define MQTT_AGENT_JOURNAL_TLS_IDX    ( 2 )
+
+/*-----------------------------------------------------------*/
+
+#if MQTT_AGENT_JOURNAL_ENABLED
+
+/*
+ * Store a publish in the offline journal instead of queueing it while the agent
+ * is disconnected, or while older journaled publishes are still waiting to be
+ * replayed so that they keep their order. The command completes immediately.
+ */
+    bool MqttAgentJournal_Command( MQTTAgentCommand_t * pxCommand,
+                                   uint32_t ulInstance,
+                                   bool xConnected )
+    {
+        bool xJournaled = false;
+        MQTTAgentJournalMode_t xMode = ( MQTTAgentJournalMode_t ) ( uintptr_t ) pvTaskGetThreadLocalStoragePointer( NULL, MQTT_AGENT_JOURNAL_TLS_IDX );
+
+        /* The journal is replayed through the default instance only. */
+        if( ( pxCommand->commandType == PUBLISH ) &&
+            ( pxCommand->pArgs != NULL ) &&
+            ( xMode != MQTT_AGENT_JOURNAL_NONE ) &&
+            ( ulInstance == MQTT_AGENT_DEFAULT_INSTANCE ) )
+        {
+            const MQTTPublishInfo_t * pxPublishInfo = ( const MQTTPublishInfo_t * ) pxCommand->pArgs;
+
+            if( ( ( pxPublishInfo->qos != MQTTQoS0 ) || ( xMode == MQTT_AGENT_JOURNAL_ALL ) ) &&
+                ( MqttAgentTransport_GetCommandStream( pxCommand ) == NULL ) &&
+                ( !xConnected || !MqttJournal_IsEmpty() ) )
+            {
+                /* On failure the publish is queued as usual. */
+                xJournaled = ( MqttJournal_Append( pxPublishInfo ) == MQTTSuccess );
+            }
+        }
+
+        if( xJournaled )
+        {
+            Agent_ConcludeCommand( pxCommand, MQTTSuccess );
+        }
+
+        return xJournaled;
+    }
+
+#endif /* MQTT_AGENT_JOURNAL_ENABLED */
+
+/*-----------------------------------------------------------*/
+
+void vMQTTAgentSetTaskJournalMode( MQTTAgentJournalMode_t xMode )
+{
+    configASSERT( xMode <= MQTT_AGENT_JOURNAL_ALL );
+
+    vTaskSetThreadLocalStoragePointer( NULL, MQTT_AGENT_JOURNAL_TLS_IDX,
+                                       ( void * ) ( uintptr_t ) xMode );
+}
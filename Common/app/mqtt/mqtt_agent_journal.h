@@ -0,0 +1,64 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_agent_journal.h
+ * @brief Offline journal hooks of the MQTT agent.
+ *
+ * Publishes of tasks that opted in with vMQTTAgentSetTaskJournalMode are
+ * written to the journal of mqtt_journal.h instead of a command lane while the
+ * default instance is disconnected, or while older journaled publishes are
+ * still waiting to be replayed.
+ */
+#ifndef MQTT_AGENT_JOURNAL_H
+#define MQTT_AGENT_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core_mqtt_agent.h"
+#include "mqtt_journal.h"
+
+#if MQTT_AGENT_JOURNAL_ENABLED
+
+/**
+ * @brief Store a publish in the journal instead of queueing it. Called in the
+ * context of the task sending the command.
+ *
+ * @param[in] pxCommand Command being sent to the agent.
+ * @param[in] ulInstance Agent instance the command is sent to.
+ * @param[in] xConnected Whether that instance is connected to the broker.
+ *
+ * @return true if the publish was journaled and its command completed, false
+ * if it must be queued as usual.
+ */
+    bool MqttAgentJournal_Command( MQTTAgentCommand_t * pxCommand,
+                                   uint32_t ulInstance,
+                                   bool xConnected );
+
+#endif /* MQTT_AGENT_JOURNAL_ENABLED */
+
+#endif /* MQTT_AGENT_JOURNAL_H */
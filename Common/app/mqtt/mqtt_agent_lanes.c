@@ -0,0 +1,562 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#include "atomic.h"
+
+#include "mqtt_agent_lanes.h"
+#include "mqtt_agent_metrics.h"
+#include "freertos_command_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/* Thread local storage index holding the lane selected by vMQTTAgentSetTaskLane.
+ * Index 0 is used by the lwIP port. */
+#define MQTT_AGENT_LANE_TLS_IDX    ( 1 )
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvIsQoS0Publish( const MQTTAgentCommand_t * pxCommand )
+{
+    return( ( pxCommand != NULL ) &&
+            ( pxCommand->commandType == PUBLISH ) &&
+            ( pxCommand->pArgs != NULL ) &&
+            ( ( ( const MQTTPublishInfo_t * ) pxCommand->pArgs )->qos == MQTTQoS0 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTAgentLane_t prvSelectLane( const MQTTAgentCommand_t * pxCommand )
+{
+    MQTTAgentLane_t xLane = MQTT_AGENT_LANE_HIGH;
+
+    if( pxCommand->commandType == PUBLISH )
+    {
+        /* Stored as lane + 1 so that an unset pointer selects the normal lane. */
+        uintptr_t uxTaskLane = ( uintptr_t ) pvTaskGetThreadLocalStoragePointer( NULL, MQTT_AGENT_LANE_TLS_IDX );
+
+        if( ( uxTaskLane == 0 ) || ( uxTaskLane > MQTT_AGENT_NUM_LANES ) )
+        {
+            xLane = MQTT_AGENT_LANE_NORMAL;
+        }
+        else
+        {
+            xLane = ( MQTTAgentLane_t ) ( uxTaskLane - 1 );
+        }
+    }
+
+    return xLane;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Report the lane's depth crossing its watermarks. The scheduler is suspended
+ * so that a producer and the agent cannot report the crossings of a
+ * watermark out of order.
+ */
+static void prvLaneCheckWatermarks( CommandLane_t * pxLane )
+{
+    if( pxLane->uxWatermarkCount > 0 )
+    {
+        vTaskSuspendAll();
+        {
+            uint32_t ulDepth = ( uint32_t ) uxQueueMessagesWaiting( pxLane->xQueue );
+
+            for( size_t uxIdx = 0; uxIdx < pxLane->uxWatermarkCount; uxIdx++ )
+            {
+                LaneWatermark_t * pxWatermark = &( pxLane->pxWatermarks[ uxIdx ] );
+
+                if( !pxWatermark->xAboveHigh && ( ulDepth >= pxWatermark->ulHigh ) )
+                {
+                    pxWatermark->xAboveHigh = true;
+                    pxLane->xStats.ulHighWatermarks++;
+                    pxWatermark->pxCallback( pxWatermark->pvCallbackCtx, true );
+                }
+                else if( pxWatermark->xAboveHigh && ( ulDepth <= pxWatermark->ulLow ) )
+                {
+                    pxWatermark->xAboveHigh = false;
+                    pxWatermark->pxCallback( pxWatermark->pvCallbackCtx, false );
+                }
+            }
+        }
+        ( void ) xTaskResumeAll();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgentLanes_IsEmpty( const MqttAgentLanes_t * pxLanes )
+{
+    bool xEmpty = true;
+
+    for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+    {
+        xEmpty &= ( uxQueueMessagesWaiting( pxLanes->pxLanes[ uxLane ].xQueue ) == 0 );
+    }
+
+    return xEmpty;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvLaneDequeue( CommandLane_t * pxLane,
+                            LaneItem_t * pxItem )
+{
+    uint32_t ulWaitMs = 0;
+
+    ( void ) xQueueReceive( pxLane->xQueue, pxItem, 0 );
+
+    ulWaitMs = ( uint32_t ) pdTICKS_TO_MS( xTaskGetTickCount() - pxItem->xEnqueueTime );
+
+    pxLane->xStats.ulDequeued++;
+    pxLane->xStats.ulTotalWaitMs += ulWaitMs;
+
+    if( ulWaitMs > pxLane->xStats.ulMaxWaitMs )
+    {
+        pxLane->xStats.ulMaxWaitMs = ulWaitMs;
+    }
+
+    MqttAgentMetrics_CommandDequeued( pxItem->pxCommand );
+
+    prvLaneCheckWatermarks( pxLane );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Take the oldest held publish of a rate class which has a token again. */
+static bool prvRateBacklogReceive( MqttAgentLanes_t * pxLanes,
+                                   LaneItem_t * pxItem,
+                                   uint32_t ulNowMs )
+{
+    bool xReceived = false;
+
+    for( size_t uxIdx = 0; ( uxIdx < pxLanes->xRateLimit.uxBucketCount ) && !xReceived; uxIdx++ )
+    {
+        RateBacklog_t * pxBacklog = &( pxLanes->pxBacklogs[ uxIdx ] );
+        MqttRateBucket_t * pxBucket = &( pxLanes->xRateLimit.pxBuckets[ uxIdx ] );
+
+        if( ( pxBacklog->uxCount > 0 ) && MqttRateLimit_Take( pxBucket, ulNowMs ) )
+        {
+            uint32_t ulHeldMs = 0;
+
+            *pxItem = pxBacklog->pxItems[ pxBacklog->uxHead ];
+            pxBacklog->uxHead = ( pxBacklog->uxHead + 1U ) % MQTT_RATE_LIMIT_BACKLOG_LENGTH;
+            pxBacklog->uxCount--;
+
+            ulHeldMs = ( uint32_t ) pdTICKS_TO_MS( xTaskGetTickCount() - pxItem->xEnqueueTime );
+
+            if( ulHeldMs > pxBucket->xStats.ulMaxDelayMs )
+            {
+                pxBucket->xStats.ulMaxDelayMs = ulHeldMs;
+            }
+
+            xReceived = true;
+        }
+    }
+
+    return xReceived;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Handle xItem, the publish at the head of a lane whose rate class has no
+ * token, as set by the class policy. Returns false if the publish has to stay in the lane
+ * because the class backlog is full.
+ */
+static bool prvRateLimitHold( MqttAgentLanes_t * pxLanes,
+                              size_t uxClass,
+                              CommandLane_t * pxLane,
+                              LaneItem_t xItem )
+{
+    MqttRateBucket_t * pxBucket = &( pxLanes->xRateLimit.pxBuckets[ uxClass ] );
+    RateBacklog_t * pxBacklog = &( pxLanes->pxBacklogs[ uxClass ] );
+    LaneItem_t * pxMerge = NULL;
+    bool xHandled = true;
+
+    if( ( pxBucket->pxClass->xPolicy == MQTT_RATE_MERGE ) && prvIsQoS0Publish( xItem.pxCommand ) )
+    {
+        const MQTTPublishInfo_t * pxPublishInfo = ( const MQTTPublishInfo_t * ) xItem.pxCommand->pArgs;
+
+        for( size_t uxIdx = 0; ( uxIdx < pxBacklog->uxCount ) && ( pxMerge == NULL ); uxIdx++ )
+        {
+            LaneItem_t * pxHeld = &( pxBacklog->pxItems[ ( pxBacklog->uxHead + uxIdx ) % MQTT_RATE_LIMIT_BACKLOG_LENGTH ] );
+            const MQTTPublishInfo_t * pxHeldInfo = ( const MQTTPublishInfo_t * ) pxHeld->pxCommand->pArgs;
+
+            if( prvIsQoS0Publish( pxHeld->pxCommand ) &&
+                ( pxHeldInfo->topicNameLength == pxPublishInfo->topicNameLength ) &&
+                ( strncmp( pxHeldInfo->pTopicName, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength ) == 0 ) )
+            {
+                pxMerge = pxHeld;
+            }
+        }
+    }
+
+    if( pxBucket->pxClass->xPolicy == MQTT_RATE_DROP )
+    {
+        prvLaneDequeue( pxLane, &xItem );
+        pxBucket->xStats.ulDropped++;
+        Agent_ConcludeCommand( xItem.pxCommand, MQTTNoMemory );
+    }
+    else if( pxMerge != NULL )
+    {
+        /* The newer publish takes the place of the held one, which is
+         * completed as sent since its value has been superseded. */
+        MQTTAgentCommand_t * pxSuperseded = pxMerge->pxCommand;
+
+        prvLaneDequeue( pxLane, &xItem );
+        pxMerge->pxCommand = xItem.pxCommand;
+        pxBucket->xStats.ulMerged++;
+        Agent_ConcludeCommand( pxSuperseded, MQTTSuccess );
+    }
+    else if( pxBacklog->uxCount < MQTT_RATE_LIMIT_BACKLOG_LENGTH )
+    {
+        prvLaneDequeue( pxLane, &xItem );
+        xItem.xEnqueueTime = xTaskGetTickCount();
+        pxBacklog->pxItems[ ( pxBacklog->uxHead + pxBacklog->uxCount ) % MQTT_RATE_LIMIT_BACKLOG_LENGTH ] = xItem;
+        pxBacklog->uxCount++;
+        pxBucket->xStats.ulDelayed++;
+    }
+    else
+    {
+        xHandled = false;
+    }
+
+    return xHandled;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentLanes_CancelHeld( MqttAgentLanes_t * pxLanes )
+{
+    for( size_t uxIdx = 0; uxIdx < pxLanes->xRateLimit.uxBucketCount; uxIdx++ )
+    {
+        RateBacklog_t * pxBacklog = &( pxLanes->pxBacklogs[ uxIdx ] );
+
+        while( pxBacklog->uxCount > 0 )
+        {
+            MQTTAgentCommand_t * pxCommand = pxBacklog->pxItems[ pxBacklog->uxHead ].pxCommand;
+
+            pxBacklog->uxHead = ( pxBacklog->uxHead + 1U ) % MQTT_RATE_LIMIT_BACKLOG_LENGTH;
+            pxBacklog->uxCount--;
+
+            Agent_ConcludeCommand( pxCommand, MQTTRecvFailed );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttAgentLanes_GetWaitMs( const MqttAgentLanes_t * pxLanes,
+                                   uint32_t ulNowMs )
+{
+    uint32_t ulWaitMs = UINT32_MAX;
+
+    for( size_t uxIdx = 0; uxIdx < pxLanes->xRateLimit.uxBucketCount; uxIdx++ )
+    {
+        if( pxLanes->pxBacklogs[ uxIdx ].uxCount > 0 )
+        {
+            uint32_t ulClassWaitMs = MqttRateLimit_GetWaitMs( &( pxLanes->xRateLimit.pxBuckets[ uxIdx ] ), ulNowMs );
+
+            ulWaitMs = ( ulClassWaitMs < ulWaitMs ) ? ulClassWaitMs : ulWaitMs;
+        }
+    }
+
+    return ulWaitMs;
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgentLanes_Receive( MqttAgentLanes_t * pxLanes,
+                             MQTTAgentCommand_t ** ppxCommand,
+                             uint32_t ulNowMs )
+{
+    MQTTAgentLane_t pxOrder[ MQTT_AGENT_NUM_LANES ] =
+    {
+        MQTT_AGENT_LANE_HIGH, MQTT_AGENT_LANE_NORMAL, MQTT_AGENT_LANE_BULK
+    };
+    bool xReceived = false;
+    LaneItem_t xItem = { 0 };
+
+    /* Give the bulk lane a turn once the normal lane has had its share. */
+    if( pxLanes->ulNormalBurst >= MQTT_AGENT_LANE_NORMAL_WEIGHT )
+    {
+        pxOrder[ 1 ] = MQTT_AGENT_LANE_BULK;
+        pxOrder[ 2 ] = MQTT_AGENT_LANE_NORMAL;
+    }
+
+    if( pxLanes->xRateLimit.uxBucketCount > 0 )
+    {
+        xReceived = prvRateBacklogReceive( pxLanes, &xItem, ulNowMs );
+    }
+
+    for( size_t uxIdx = 0; ( uxIdx < MQTT_AGENT_NUM_LANES ) && !xReceived; uxIdx++ )
+    {
+        CommandLane_t * pxLane = &( pxLanes->pxLanes[ pxOrder[ uxIdx ] ] );
+        bool xLaneBlocked = false;
+
+        while( !xReceived && !xLaneBlocked &&
+               ( xQueuePeek( pxLane->xQueue, &xItem, 0 ) == pdTRUE ) )
+        {
+            size_t uxClass = MQTT_RATE_LIMIT_MAX_CLASSES;
+
+            if( ( pxLanes->xRateLimit.uxBucketCount > 0 ) &&
+                ( xItem.pxCommand->commandType == PUBLISH ) &&
+                ( xItem.pxCommand->pArgs != NULL ) )
+            {
+                uxClass = MqttRateLimit_Classify( &( pxLanes->xRateLimit ),
+                                                  ( const MQTTPublishInfo_t * ) xItem.pxCommand->pArgs,
+                                                  ( uint32_t ) pxOrder[ uxIdx ] );
+            }
+
+            if( uxClass == MQTT_RATE_LIMIT_MAX_CLASSES )
+            {
+                xReceived = true;
+            }
+            else if( MqttRateLimit_Take( &( pxLanes->xRateLimit.pxBuckets[ uxClass ] ), ulNowMs ) )
+            {
+                pxLanes->xRateLimit.pxBuckets[ uxClass ].xStats.ulPassed++;
+                xReceived = true;
+            }
+            else
+            {
+                xLaneBlocked = !prvRateLimitHold( pxLanes, uxClass, pxLane, xItem );
+            }
+        }
+
+        if( xReceived )
+        {
+            prvLaneDequeue( pxLane, &xItem );
+
+            if( pxOrder[ uxIdx ] == MQTT_AGENT_LANE_NORMAL )
+            {
+                pxLanes->ulNormalBurst++;
+            }
+            else if( pxOrder[ uxIdx ] == MQTT_AGENT_LANE_BULK )
+            {
+                pxLanes->ulNormalBurst = 0;
+            }
+        }
+    }
+
+    if( xReceived )
+    {
+        *ppxCommand = xItem.pxCommand;
+    }
+
+    return xReceived;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgentLanes_Init( MqttAgentLanes_t * pxLanes,
+                                  const MqttRateClass_t * pxRateClasses,
+                                  size_t uxRateClassCount,
+                                  uint32_t ulNowMs )
+{
+    MQTTStatus_t xStatus = MQTTSuccess;
+
+    for( size_t uxLane = 0; ( uxLane < MQTT_AGENT_NUM_LANES ) && ( xStatus == MQTTSuccess ); uxLane++ )
+    {
+        pxLanes->pxLanes[ uxLane ].xQueue = xQueueCreate( MQTT_AGENT_COMMAND_QUEUE_LENGTH,
+                                                          sizeof( LaneItem_t ) );
+
+        if( pxLanes->pxLanes[ uxLane ].xQueue == NULL )
+        {
+            xStatus = MQTTNoMemory;
+            LogError( "Failed to allocate MQTT Agent message queue." );
+        }
+    }
+
+    MqttRateLimit_Init( &( pxLanes->xRateLimit ),
+                        pxRateClasses,
+                        uxRateClassCount,
+                        ulNowMs );
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentLanes_Free( MqttAgentLanes_t * pxLanes )
+{
+    for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+    {
+        if( pxLanes->pxLanes[ uxLane ].xQueue != NULL )
+        {
+            vQueueDelete( pxLanes->pxLanes[ uxLane ].xQueue );
+            pxLanes->pxLanes[ uxLane ].xQueue = NULL;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgentLanes_Send( MqttAgentLanes_t * pxLanes,
+                          MQTTAgentCommand_t * pxCommand,
+                          uint32_t ulBlockTimeMs )
+{
+    CommandLane_t * pxLane = &( pxLanes->pxLanes[ prvSelectLane( pxCommand ) ] );
+    BaseType_t xQueueStatus = pdFAIL;
+    LaneItem_t xItem =
+    {
+        .pxCommand    = pxCommand,
+        .xEnqueueTime = xTaskGetTickCount()
+    };
+
+    MqttAgentMetrics_CommandQueued( pxCommand );
+
+    xQueueStatus = xQueueSendToBack( pxLane->xQueue, &xItem, pdMS_TO_TICKS( ulBlockTimeMs ) );
+
+    if( xQueueStatus == pdTRUE )
+    {
+        uint32_t ulDepth = ( uint32_t ) uxQueueMessagesWaiting( pxLane->xQueue );
+        uint32_t ulMaxDepth = pxLane->xStats.ulMaxDepth;
+
+        ( void ) Atomic_Increment_u32( &( pxLane->xStats.ulEnqueued ) );
+
+        while( ( ulDepth > ulMaxDepth ) &&
+               ( Atomic_CompareAndSwap_u32( &( pxLane->xStats.ulMaxDepth ), ulDepth, ulMaxDepth ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+        {
+            ulMaxDepth = pxLane->xStats.ulMaxDepth;
+        }
+    }
+    else
+    {
+        ( void ) Atomic_Increment_u32( &( pxLane->xStats.ulRejected ) );
+    }
+
+    prvLaneCheckWatermarks( pxLane );
+
+    return( xQueueStatus == pdTRUE );
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgentLanes_GetStats( const MqttAgentLanes_t * pxLanes,
+                              MQTTAgentLane_t xLane,
+                              MQTTAgentLaneStats_t * pxStats )
+{
+    bool xResult = false;
+
+    if( ( xLane < MQTT_AGENT_NUM_LANES ) &&
+        ( pxStats != NULL ) )
+    {
+        *pxStats = pxLanes->pxLanes[ xLane ].xStats;
+        xResult = true;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgentLanes_AddWatermark( MqttAgentLanes_t * pxLanes,
+                                  MQTTAgentLane_t xLane,
+                                  uint32_t ulHighWatermark,
+                                  uint32_t ulLowWatermark,
+                                  MQTTAgentWatermarkCallback_t pxCallback,
+                                  void * pvCallbackCtx )
+{
+    bool xResult = false;
+
+    if( ( xLane < MQTT_AGENT_NUM_LANES ) &&
+        ( ulLowWatermark < ulHighWatermark ) &&
+        ( ulHighWatermark <= MQTT_AGENT_COMMAND_QUEUE_LENGTH ) &&
+        ( pxCallback != NULL ) )
+    {
+        CommandLane_t * pxLane = &( pxLanes->pxLanes[ xLane ] );
+
+        vTaskSuspendAll();
+        {
+            if( pxLane->uxWatermarkCount < MQTT_AGENT_LANE_MAX_WATERMARKS )
+            {
+                LaneWatermark_t * pxWatermark = &( pxLane->pxWatermarks[ pxLane->uxWatermarkCount ] );
+
+                pxWatermark->pxCallback = pxCallback;
+                pxWatermark->pvCallbackCtx = pvCallbackCtx;
+                pxWatermark->ulHigh = ulHighWatermark;
+                pxWatermark->ulLow = ulLowWatermark;
+                pxWatermark->xAboveHigh = false;
+                pxLane->uxWatermarkCount++;
+                xResult = true;
+            }
+        }
+        ( void ) xTaskResumeAll();
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentLanes_RemoveWatermark( MqttAgentLanes_t * pxLanes,
+                                     MQTTAgentWatermarkCallback_t pxCallback,
+                                     void * pvCallbackCtx )
+{
+    vTaskSuspendAll();
+    {
+        for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+        {
+            CommandLane_t * pxLane = &( pxLanes->pxLanes[ uxLane ] );
+            size_t uxKept = 0;
+
+            for( size_t uxIdx = 0; uxIdx < pxLane->uxWatermarkCount; uxIdx++ )
+            {
+                if( ( pxLane->pxWatermarks[ uxIdx ].pxCallback != pxCallback ) ||
+                    ( pxLane->pxWatermarks[ uxIdx ].pvCallbackCtx != pvCallbackCtx ) )
+                {
+                    pxLane->pxWatermarks[ uxKept ] = pxLane->pxWatermarks[ uxIdx ];
+                    uxKept++;
+                }
+            }
+
+            pxLane->uxWatermarkCount = uxKept;
+        }
+    }
+    ( void ) xTaskResumeAll();
+}
+
+/*-----------------------------------------------------------*/
+
+void vMQTTAgentSetTaskLane( MQTTAgentLane_t xLane )
+{
+    configASSERT( xLane < MQTT_AGENT_NUM_LANES );
+
+    vTaskSetThreadLocalStoragePointer( NULL, MQTT_AGENT_LANE_TLS_IDX,
+                                       ( void * ) ( ( uintptr_t ) xLane + 1 ) );
+}
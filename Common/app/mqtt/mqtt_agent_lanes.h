@@ -0,0 +1,198 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_agent_lanes.h
+ * @brief Command lanes of the MQTT agent.
+ *
+ * Commands wait for the agent in one of MQTT_AGENT_NUM_LANES queues. The high
+ * lane is always drained first, and the normal lane is favored over the bulk
+ * lane by MQTT_AGENT_LANE_NORMAL_WEIGHT. Producers may register watermarks on
+ * a lane to be told when it fills up.
+ *
+ * Publishes beyond the limits of their rate class, see mqtt_rate_limit.h, are
+ * taken from their lane into the backlog of the class and handed to the agent
+ * once the class has a token again.
+ */
+#ifndef MQTT_AGENT_LANES_H
+#define MQTT_AGENT_LANES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
+#include "mqtt_rate_limit.h"
+
+typedef struct LaneItem
+{
+    MQTTAgentCommand_t * pxCommand;
+    TickType_t xEnqueueTime;
+} LaneItem_t;
+
+/* Publishes of a rate class waiting for a token, oldest first. */
+typedef struct RateBacklog
+{
+    LaneItem_t pxItems[ MQTT_RATE_LIMIT_BACKLOG_LENGTH ]; /* xEnqueueTime is when the publish was held. */
+    size_t uxHead;
+    size_t uxCount;
+} RateBacklog_t;
+
+typedef struct LaneWatermark
+{
+    MQTTAgentWatermarkCallback_t pxCallback;
+    void * pvCallbackCtx;
+    uint32_t ulHigh;
+    uint32_t ulLow;
+    bool xAboveHigh;
+} LaneWatermark_t;
+
+typedef struct CommandLane
+{
+    QueueHandle_t xQueue;
+    MQTTAgentLaneStats_t xStats;
+    LaneWatermark_t pxWatermarks[ MQTT_AGENT_LANE_MAX_WATERMARKS ];
+    size_t uxWatermarkCount;
+} CommandLane_t;
+
+/**
+ * @brief Lanes of an agent instance. Commands are sent by any task, and
+ * received and held back by the agent task only.
+ */
+typedef struct MqttAgentLanes
+{
+    CommandLane_t pxLanes[ MQTT_AGENT_NUM_LANES ];
+    uint32_t ulNormalBurst;
+    MqttRateLimit_t xRateLimit;
+    RateBacklog_t pxBacklogs[ MQTT_RATE_LIMIT_MAX_CLASSES ];
+} MqttAgentLanes_t;
+
+/**
+ * @brief Create the lane queues and set up the rate limits.
+ *
+ * @param[in] pxLanes Zeroed lanes.
+ * @param[in] pxRateClasses Rate classes of the instance, may be NULL.
+ * @param[in] uxRateClassCount Number of entries in pxRateClasses.
+ * @param[in] ulNowMs Current time in milliseconds.
+ *
+ * @return MQTTSuccess, or MQTTNoMemory if a queue could not be created.
+ */
+MQTTStatus_t MqttAgentLanes_Init( MqttAgentLanes_t * pxLanes,
+                                  const MqttRateClass_t * pxRateClasses,
+                                  size_t uxRateClassCount,
+                                  uint32_t ulNowMs );
+
+/**
+ * @brief Delete the lane queues.
+ *
+ * @param[in] pxLanes Lanes.
+ */
+void MqttAgentLanes_Free( MqttAgentLanes_t * pxLanes );
+
+/**
+ * @brief Queue a command on the lane selected by vMQTTAgentSetTaskLane, or
+ * on the high lane if it is not a publish.
+ *
+ * @param[in] pxLanes Lanes.
+ * @param[in] pxCommand Command.
+ * @param[in] ulBlockTimeMs Time to wait for room in the lane.
+ *
+ * @return true if the command was queued.
+ */
+bool MqttAgentLanes_Send( MqttAgentLanes_t * pxLanes,
+                          MQTTAgentCommand_t * pxCommand,
+                          uint32_t ulBlockTimeMs );
+
+/**
+ * @brief Take the next command from the lanes without blocking. Publishes
+ * held back by the rate limits go first once their class has a token.
+ *
+ * @param[in] pxLanes Lanes.
+ * @param[out] ppxCommand Command taken.
+ * @param[in] ulNowMs Current time in milliseconds.
+ *
+ * @return true if a command was taken.
+ */
+bool MqttAgentLanes_Receive( MqttAgentLanes_t * pxLanes,
+                             MQTTAgentCommand_t ** ppxCommand,
+                             uint32_t ulNowMs );
+
+/**
+ * @brief Check whether no command is waiting in the lanes.
+ *
+ * @param[in] pxLanes Lanes.
+ *
+ * @return true if every lane is empty.
+ */
+bool MqttAgentLanes_IsEmpty( const MqttAgentLanes_t * pxLanes );
+
+/**
+ * @brief Time until the next publish held by the rate limits may be sent.
+ *
+ * @param[in] pxLanes Lanes.
+ * @param[in] ulNowMs Current time in milliseconds.
+ *
+ * @return Time in milliseconds, UINT32_MAX if no publish is held.
+ */
+uint32_t MqttAgentLanes_GetWaitMs( const MqttAgentLanes_t * pxLanes,
+                                   uint32_t ulNowMs );
+
+/**
+ * @brief Fail the publishes held by the rate limits, as MQTTAgent_CancelAll
+ * does with the commands still queued.
+ *
+ * @param[in] pxLanes Lanes.
+ */
+void MqttAgentLanes_CancelHeld( MqttAgentLanes_t * pxLanes );
+
+/**
+ * @brief See xMQTTAgentGetLaneStats.
+ */
+bool MqttAgentLanes_GetStats( const MqttAgentLanes_t * pxLanes,
+                              MQTTAgentLane_t xLane,
+                              MQTTAgentLaneStats_t * pxStats );
+
+/**
+ * @brief See xMQTTAgentAddLaneWatermark.
+ */
+bool MqttAgentLanes_AddWatermark( MqttAgentLanes_t * pxLanes,
+                                  MQTTAgentLane_t xLane,
+                                  uint32_t ulHighWatermark,
+                                  uint32_t ulLowWatermark,
+                                  MQTTAgentWatermarkCallback_t pxCallback,
+                                  void * pvCallbackCtx );
+
+/**
+ * @brief See vMQTTAgentRemoveLaneWatermark.
+ */
+void MqttAgentLanes_RemoveWatermark( MqttAgentLanes_t * pxLanes,
+                                     MQTTAgentWatermarkCallback_t pxCallback,
+                                     void * pvCallbackCtx );
+
+#endif /* MQTT_AGENT_LANES_H */
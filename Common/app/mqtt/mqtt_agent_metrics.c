@@ -0,0 +1,341 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "mqtt_agent_metrics.h"
+#include "freertos_command_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/* Stage a command is in, and when it entered that stage. */
+typedef struct CommandStamp
+{
+    uint32_t ulTime;
+    uint8_t ucStage; /* MQTTAgentStage_t, or MQTT_AGENT_NUM_STAGES when not timed. */
+} CommandStamp_t;
+
+static MQTTAgentHistogram_t pxHistograms[ MQTT_AGENT_NUM_STAGES ] = { 0 };
+
+static MQTTAgentWakeStats_t xWakeStats = { 0 };
+
+/* Tick count at which xWakeStats was cleared. */
+static TickType_t xWakeStatsStart = 0;
+
+#if MQTT_AGENT_METRICS_ENABLED
+    static CommandStamp_t pxStamps[ MQTT_COMMAND_CONTEXTS_POOL_SIZE ] = { 0 };
+#endif
+
+static const char * const pcStageNames[ MQTT_AGENT_NUM_STAGES ] =
+{
+    "alloc", "queue", "process", "ack", "recv", "send"
+};
+
+/*-----------------------------------------------------------*/
+
+#if MQTT_AGENT_METRICS_ENABLED
+
+/* Must be called from a critical section. */
+    static void prvRecord( MQTTAgentStage_t xStage,
+                           uint32_t ulTicks )
+    {
+        MQTTAgentHistogram_t * pxHistogram = &( pxHistograms[ xStage ] );
+        uint32_t ulBucket = ( ulTicks == 0 ) ? 0 : ( 32U - ( uint32_t ) __builtin_clz( ulTicks ) );
+
+        if( ulBucket >= MQTT_AGENT_METRICS_BUCKETS )
+        {
+            ulBucket = MQTT_AGENT_METRICS_BUCKETS - 1U;
+        }
+
+        pxHistogram->pulBuckets[ ulBucket ]++;
+        pxHistogram->ulCount++;
+        pxHistogram->ullTotalTicks += ulTicks;
+
+        if( ulTicks > pxHistogram->ulMaxTicks )
+        {
+            pxHistogram->ulMaxTicks = ulTicks;
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Record the end of the stage pxCommand is in if it is xFromStage, and start xToStage. */
+    static void prvAdvance( const MQTTAgentCommand_t * pxCommand,
+                            MQTTAgentStage_t xFromStage,
+                            MQTTAgentStage_t xToStage )
+    {
+        size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+        if( uxIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE )
+        {
+            uint32_t ulNow = MqttAgentMetrics_Now();
+            CommandStamp_t * pxStamp = &( pxStamps[ uxIdx ] );
+
+            taskENTER_CRITICAL();
+            {
+                if( pxStamp->ucStage == ( uint8_t ) xFromStage )
+                {
+                    prvRecord( xFromStage, ulNow - pxStamp->ulTime );
+                    pxStamp->ucStage = ( uint8_t ) xToStage;
+                    pxStamp->ulTime = ulNow;
+                }
+            }
+            taskEXIT_CRITICAL();
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_CommandAllocated( const MQTTAgentCommand_t * pxCommand,
+                                            uint32_t ulStartTime )
+    {
+        size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+        if( uxIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE )
+        {
+            uint32_t ulNow = MqttAgentMetrics_Now();
+
+            taskENTER_CRITICAL();
+            {
+                prvRecord( MQTT_AGENT_STAGE_ALLOC, ulNow - ulStartTime );
+
+                /* The queue stage starts when the command is sent to the agent. */
+                pxStamps[ uxIdx ].ucStage = ( uint8_t ) MQTT_AGENT_NUM_STAGES;
+                pxStamps[ uxIdx ].ulTime = ulNow;
+            }
+            taskEXIT_CRITICAL();
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_CommandQueued( const MQTTAgentCommand_t * pxCommand )
+    {
+        size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+        if( uxIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE )
+        {
+            taskENTER_CRITICAL();
+            {
+                pxStamps[ uxIdx ].ucStage = ( uint8_t ) MQTT_AGENT_STAGE_QUEUE;
+                pxStamps[ uxIdx ].ulTime = MqttAgentMetrics_Now();
+            }
+            taskEXIT_CRITICAL();
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_CommandDequeued( const MQTTAgentCommand_t * pxCommand )
+    {
+        prvAdvance( pxCommand, MQTT_AGENT_STAGE_QUEUE, MQTT_AGENT_STAGE_PROCESS );
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_CommandProcessed( const MQTTAgentCommand_t * pxCommand )
+    {
+        prvAdvance( pxCommand, MQTT_AGENT_STAGE_PROCESS, MQTT_AGENT_STAGE_ACK );
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_CommandReleased( const MQTTAgentCommand_t * pxCommand )
+    {
+        size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+        if( uxIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE )
+        {
+            uint32_t ulNow = MqttAgentMetrics_Now();
+            CommandStamp_t * pxStamp = &( pxStamps[ uxIdx ] );
+
+            taskENTER_CRITICAL();
+            {
+                /* A command released while queued was cancelled, and one
+                 * released while being processed did not need an acknowledgment. */
+                if( ( pxStamp->ucStage == ( uint8_t ) MQTT_AGENT_STAGE_PROCESS ) ||
+                    ( pxStamp->ucStage == ( uint8_t ) MQTT_AGENT_STAGE_ACK ) )
+                {
+                    prvRecord( ( MQTTAgentStage_t ) pxStamp->ucStage, ulNow - pxStamp->ulTime );
+                }
+
+                pxStamp->ucStage = ( uint8_t ) MQTT_AGENT_NUM_STAGES;
+            }
+            taskEXIT_CRITICAL();
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_PublishReceived( uint32_t ulReadyTime )
+    {
+        uint32_t ulNow = MqttAgentMetrics_Now();
+
+        taskENTER_CRITICAL();
+        {
+            prvRecord( MQTT_AGENT_STAGE_RECV, ulNow - ulReadyTime );
+        }
+        taskEXIT_CRITICAL();
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_Sent( uint32_t ulStartTime )
+    {
+        uint32_t ulNow = MqttAgentMetrics_Now();
+
+        taskENTER_CRITICAL();
+        {
+            prvRecord( MQTT_AGENT_STAGE_SEND, ulNow - ulStartTime );
+        }
+        taskEXIT_CRITICAL();
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentMetrics_AgentWoke( bool xTimedOut )
+    {
+        taskENTER_CRITICAL();
+        {
+            xWakeStats.ulWakeups++;
+
+            if( xTimedOut )
+            {
+                xWakeStats.ulTimeouts++;
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentMetrics_GetHistogram( MQTTAgentStage_t xStage,
+                                    MQTTAgentHistogram_t * pxHistogram )
+{
+    configASSERT( xStage < MQTT_AGENT_NUM_STAGES );
+    configASSERT( pxHistogram != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxHistogram = pxHistograms[ xStage ];
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentMetrics_GetWakeStats( MQTTAgentWakeStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxStats = xWakeStats;
+        pxStats->ulElapsedMs = ( uint32_t ) pdTICKS_TO_MS( xTaskGetTickCount() - xWakeStatsStart );
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentMetrics_Reset( void )
+{
+    taskENTER_CRITICAL();
+    {
+        ( void ) memset( pxHistograms, 0, sizeof( pxHistograms ) );
+        ( void ) memset( &xWakeStats, 0, sizeof( xWakeStats ) );
+        xWakeStatsStart = xTaskGetTickCount();
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttAgentMetrics_TicksToUs( uint64_t ullTicks )
+{
+    uint64_t ullUs = ( ullTicks * 1000000ULL ) / MQTT_AGENT_METRICS_COUNTER_HZ;
+
+    return( ( ullUs > UINT32_MAX ) ? UINT32_MAX : ( uint32_t ) ullUs );
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttAgentMetrics_BucketLimitUs( size_t uxBucket )
+{
+    uint32_t ulLimitUs = UINT32_MAX;
+
+    if( uxBucket < ( MQTT_AGENT_METRICS_BUCKETS - 1U ) )
+    {
+        ulLimitUs = MqttAgentMetrics_TicksToUs( 1ULL << uxBucket );
+    }
+
+    return ulLimitUs;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttAgentMetrics_PercentileUs( const MQTTAgentHistogram_t * pxHistogram,
+                                        uint32_t ulPercent )
+{
+    uint32_t ulLimitUs = 0;
+
+    configASSERT( pxHistogram != NULL );
+
+    if( pxHistogram->ulCount > 0 )
+    {
+        uint64_t ullRank = ( ( ( uint64_t ) pxHistogram->ulCount * ulPercent ) + 99U ) / 100U;
+        uint64_t ullSeen = 0;
+        size_t uxBucket = 0;
+
+        while( ( uxBucket < ( MQTT_AGENT_METRICS_BUCKETS - 1U ) ) &&
+               ( ( ullSeen + pxHistogram->pulBuckets[ uxBucket ] ) < ullRank ) )
+        {
+            ullSeen += pxHistogram->pulBuckets[ uxBucket ];
+            uxBucket++;
+        }
+
+        /* The last bucket has no upper bound, report the longest duration instead. */
+        ulLimitUs = ( uxBucket < ( MQTT_AGENT_METRICS_BUCKETS - 1U ) ) ?
+                    MqttAgentMetrics_BucketLimitUs( uxBucket ) :
+                    MqttAgentMetrics_TicksToUs( pxHistogram->ulMaxTicks );
+    }
+
+    return ulLimitUs;
+}
+
+/*-----------------------------------------------------------*/
+
+const char * MqttAgentMetrics_StageName( MQTTAgentStage_t xStage )
+{
+    return( ( xStage < MQTT_AGENT_NUM_STAGES ) ? pcStageNames[ xStage ] : "unknown" );
+}
@@ -0,0 +1,219 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_agent_metrics.h
+ * @brief Latency histograms for the stages of an MQTT agent command.
+ *
+ * Each command is timestamped with the run time stats counter as it is
+ * allocated, queued, picked up by the agent and released, and the time spent
+ * in each stage is added to a histogram with power of two buckets. Recording a
+ * stage takes a short critical section and no division.
+ */
+#ifndef MQTT_AGENT_METRICS_H
+#define MQTT_AGENT_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Set to 0 to remove the instrumentation.
+ */
+#ifndef MQTT_AGENT_METRICS_ENABLED
+    #define MQTT_AGENT_METRICS_ENABLED    1
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
+/**
+ * @brief Number of histogram buckets. Bucket 0 counts durations of less than
+ * one counter tick and bucket n durations of 2^(n-1) to 2^n - 1 ticks. The last
+ * bucket also counts anything longer.
+ */
+#ifndef MQTT_AGENT_METRICS_BUCKETS
+    #define MQTT_AGENT_METRICS_BUCKETS    20U
+#endif /* MQTT_AGENT_METRICS_BUCKETS */
+
+/**
+ * @brief Frequency of portGET_RUN_TIME_COUNTER_VALUE (TIM5, 160 MHz / 4097).
+ */
+#ifndef MQTT_AGENT_METRICS_COUNTER_HZ
+    #define MQTT_AGENT_METRICS_COUNTER_HZ    ( 160000000U / 4097U )
+#endif /* MQTT_AGENT_METRICS_COUNTER_HZ */
+
+/**
+ * @brief Interval between metrics messages sent by vAgentMetricsPublishTask.
+ */
+#ifndef MQTT_AGENT_METRICS_PUBLISH_INTERVAL_S
+    #define MQTT_AGENT_METRICS_PUBLISH_INTERVAL_S    300U
+#endif /* MQTT_AGENT_METRICS_PUBLISH_INTERVAL_S */
+
+typedef enum MQTTAgentStage
+{
+    MQTT_AGENT_STAGE_ALLOC = 0, /* Waiting for a free command structure. */
+    MQTT_AGENT_STAGE_QUEUE,     /* Waiting in a command lane. */
+    MQTT_AGENT_STAGE_PROCESS,   /* Serialized and sent by the agent. */
+    MQTT_AGENT_STAGE_ACK,       /* Waiting for the PUBACK, SUBACK or UNSUBACK. */
+    MQTT_AGENT_STAGE_RECV,      /* From socket data ready to an incoming publish being dispatched. */
+    MQTT_AGENT_STAGE_SEND,      /* One write to the TLS connection, including waits for socket space. */
+    MQTT_AGENT_NUM_STAGES
+} MQTTAgentStage_t;
+
+typedef struct MQTTAgentHistogram
+{
+    uint32_t pulBuckets[ MQTT_AGENT_METRICS_BUCKETS ];
+    uint32_t ulCount;      /* Number of durations recorded. */
+    uint32_t ulMaxTicks;   /* Longest duration recorded. */
+    uint64_t ullTotalTicks;
+} MQTTAgentHistogram_t;
+
+typedef struct MQTTAgentWakeStats
+{
+    uint32_t ulWakeups;   /* Times an agent stopped waiting for a command or socket data. */
+    uint32_t ulTimeouts;  /* Wake-ups at the end of the wait time rather than on a notification. */
+    uint32_t ulElapsedMs; /* Time since the counters were cleared. */
+} MQTTAgentWakeStats_t;
+
+#if MQTT_AGENT_METRICS_ENABLED
+
+/**
+ * @brief Current value of the counter used for all timestamps.
+ */
+    static inline uint32_t MqttAgentMetrics_Now( void )
+    {
+        return ( uint32_t ) portGET_RUN_TIME_COUNTER_VALUE();
+    }
+
+/**
+ * @brief Record the time taken to obtain a command structure.
+ *
+ * @param[in] pxCommand Command structure returned by Agent_GetCommand.
+ * @param[in] ulStartTime Time at which Agent_GetCommand was called.
+ */
+    void MqttAgentMetrics_CommandAllocated( const MQTTAgentCommand_t * pxCommand,
+                                            uint32_t ulStartTime );
+
+/**
+ * @brief Note that a command is about to be added to a lane.
+ */
+    void MqttAgentMetrics_CommandQueued( const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Record the time a command waited in its lane. Called by the agent task.
+ */
+    void MqttAgentMetrics_CommandDequeued( const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Record the time the agent spent processing a command. Called by the
+ * agent task when it next waits for a command. If the command has not been
+ * released yet, it is waiting to be acknowledged.
+ */
+    void MqttAgentMetrics_CommandProcessed( const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Record the end of the last stage of a command. Called by Agent_ReleaseCommand.
+ */
+    void MqttAgentMetrics_CommandReleased( const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Record the time from the socket notification at ulReadyTime to the
+ * dispatch of the first incoming publish read after it. Called by the agent task.
+ */
+    void MqttAgentMetrics_PublishReceived( uint32_t ulReadyTime );
+
+/**
+ * @brief Record the time of a call of mbedtls_transport_send started at
+ * ulStartTime. Called by the agent task.
+ */
+    void MqttAgentMetrics_Sent( uint32_t ulStartTime );
+
+/**
+ * @brief Count the end of a wait of the agent task.
+ *
+ * @param[in] xTimedOut True if the wait ended without a notification.
+ */
+    void MqttAgentMetrics_AgentWoke( bool xTimedOut );
+
+#else /* MQTT_AGENT_METRICS_ENABLED */
+
+    #define MqttAgentMetrics_Now()                                   ( 0U )
+    #define MqttAgentMetrics_CommandAllocated( pxCommand, ulStart )
+    #define MqttAgentMetrics_CommandQueued( pxCommand )
+    #define MqttAgentMetrics_CommandDequeued( pxCommand )
+    #define MqttAgentMetrics_CommandProcessed( pxCommand )
+    #define MqttAgentMetrics_CommandReleased( pxCommand )
+    #define MqttAgentMetrics_PublishReceived( ulReadyTime )
+    #define MqttAgentMetrics_Sent( ulStartTime )
+    #define MqttAgentMetrics_AgentWoke( xTimedOut )
+
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
+/**
+ * @brief Get a copy of the histogram of a stage.
+ */
+void MqttAgentMetrics_GetHistogram( MQTTAgentStage_t xStage,
+                                    MQTTAgentHistogram_t * pxHistogram );
+
+/**
+ * @brief Get a copy of the agent wake-up counters.
+ */
+void MqttAgentMetrics_GetWakeStats( MQTTAgentWakeStats_t * pxStats );
+
+/**
+ * @brief Clear all histograms and the wake-up counters.
+ */
+void MqttAgentMetrics_Reset( void );
+
+/**
+ * @brief Convert a duration in counter ticks to microseconds.
+ */
+uint32_t MqttAgentMetrics_TicksToUs( uint64_t ullTicks );
+
+/**
+ * @brief Upper bound of a histogram bucket in microseconds.
+ */
+uint32_t MqttAgentMetrics_BucketLimitUs( size_t uxBucket );
+
+/**
+ * @brief Estimate a percentile of a histogram.
+ *
+ * @param[in] pxHistogram Histogram.
+ * @param[in] ulPercent Percentile, 1 to 100.
+ *
+ * @return Upper bound in microseconds of the bucket holding the percentile,
+ * or zero if the histogram is empty.
+ */
+uint32_t MqttAgentMetrics_PercentileUs( const MQTTAgentHistogram_t * pxHistogram,
+                                        uint32_t ulPercent );
+
+/**
+ * @brief Name of a stage, for display.
+ */
+const char * MqttAgentMetrics_StageName( MQTTAgentStage_t xStage );
+
+#endif /* MQTT_AGENT_METRICS_H */
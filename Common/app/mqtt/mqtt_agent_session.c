@@ -0,0 +1,360 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+#include "mqtt_agent_session.h"
+
+#if MQTT_AGENT_SESSION_STORE_ENABLED
+
+    #include "core_mqtt_state.h"
+
+    #include "freertos_command_pool.h"
+    #include "mqtt_agent_task.h"
+    #include "mqtt_agent_transport.h"
+
+/*-----------------------------------------------------------*/
+
+    static bool prvIsAwaitingAck( const MQTTAgentContext_t * pxAgentCtx,
+                                  uint16_t usPacketId )
+    {
+        bool xFound = false;
+
+        for( size_t uxIdx = 0; ( uxIdx < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && !xFound; uxIdx++ )
+        {
+            xFound = ( pxAgentCtx->pPendingAcks[ uxIdx ].packetId == usPacketId );
+        }
+
+        return xFound;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool prvIsStored( const MqttAgentSession_t * pxSession,
+                             uint16_t usPacketId )
+    {
+        bool xFound = false;
+
+        for( size_t uxIdx = 0; ( uxIdx < pxSession->uxRefCount ) && !xFound; uxIdx++ )
+        {
+            xFound = ( pxSession->pxRefs[ uxIdx ].usPacketId == usPacketId );
+        }
+
+        return xFound;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvRestoredPublishCallback( MQTTAgentCommandContext_t * pxCmdCallbackContext,
+                                            MQTTAgentReturnInfo_t * pxReturnInfo );
+
+/* Write the record of a QoS1 publish that is still awaiting its PUBACK. */
+    static void prvSessionStoreSave( MqttAgentSession_t * pxSession,
+                                     const MQTTAgentAckInfo_t * pxAck )
+    {
+        const MQTTAgentCommand_t * pxCommand = pxAck->pOriginalCommand;
+        const MQTTPublishInfo_t * pxPublishInfo = ( const MQTTPublishInfo_t * ) pxCommand->pArgs;
+
+        if( pxCommand->pCommandCompleteCallback == prvRestoredPublishCallback )
+        {
+            MqttSessionRecord_t * pxRecord = ( MqttSessionRecord_t * ) pxCommand->pCmdContext;
+            uint32_t ulSeq = 0;
+
+            /* A restored publish already has a record. One queued again as a new
+             * publish is rewritten under its new packet id, so that a reset does
+             * not leave two records of it. */
+            if( ( pxRecord->usPacketId != pxAck->packetId ) &&
+                ( MqttSessionStore_Save( pxAck->packetId, pxPublishInfo, &ulSeq ) == MQTTSuccess ) )
+            {
+                MqttSessionStore_Remove( pxRecord->ulSeq );
+                pxRecord->ulSeq = ulSeq;
+                pxRecord->usPacketId = pxAck->packetId;
+            }
+        }
+        /* Streamed payloads are not held in RAM, so they cannot be stored. */
+        else if( ( pxCommand->commandType == PUBLISH ) &&
+                 ( pxPublishInfo != NULL ) &&
+                 ( pxPublishInfo->qos == MQTTQoS1 ) &&
+                 ( MqttAgentTransport_GetCommandStream( pxCommand ) == NULL ) &&
+                 ( pxSession->uxRefCount < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) &&
+                 !prvIsStored( pxSession, pxAck->packetId ) )
+        {
+            SessionStoreRef_t * pxRef = &( pxSession->pxRefs[ pxSession->uxRefCount ] );
+
+            if( MqttSessionStore_Save( pxAck->packetId, pxPublishInfo, &( pxRef->ulSeq ) ) == MQTTSuccess )
+            {
+                pxRef->usPacketId = pxAck->packetId;
+                pxSession->uxRefCount++;
+            }
+        }
+        else
+        {
+            /* Empty else marker. */
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentSession_Sync( MqttAgentSession_t * pxSession,
+                                uint32_t ulNowMs,
+                                bool xForce )
+    {
+        const MQTTAgentContext_t * pxAgentCtx = pxSession->pxAgentContext;
+        size_t uxIdx = 0;
+
+        if( xForce ||
+            ( ( ulNowMs - pxSession->ulLastSyncMs ) >= MQTT_SESSION_STORE_SYNC_INTERVAL_MS ) )
+        {
+            pxSession->ulLastSyncMs = ulNowMs;
+
+            while( uxIdx < pxSession->uxRefCount )
+            {
+                if( prvIsAwaitingAck( pxAgentCtx, pxSession->pxRefs[ uxIdx ].usPacketId ) )
+                {
+                    uxIdx++;
+                }
+                else
+                {
+                    MqttSessionStore_Remove( pxSession->pxRefs[ uxIdx ].ulSeq );
+
+                    pxSession->uxRefCount--;
+                    pxSession->pxRefs[ uxIdx ] = pxSession->pxRefs[ pxSession->uxRefCount ];
+                }
+            }
+
+            for( uxIdx = 0; uxIdx < MQTT_AGENT_MAX_OUTSTANDING_ACKS; uxIdx++ )
+            {
+                const MQTTAgentAckInfo_t * pxAck = &( pxAgentCtx->pPendingAcks[ uxIdx ] );
+                SessionStoreSeen_t * pxSeen = &( pxSession->pxSeen[ uxIdx ] );
+
+                if( ( pxAck->packetId != MQTT_PACKET_ID_INVALID ) &&
+                    ( pxAck->pOriginalCommand != NULL ) &&
+                    ( pxAck->packetId == pxSeen->usPacketId ) &&
+                    ( pxAck->pOriginalCommand == pxSeen->pxCommand ) )
+                {
+                    prvSessionStoreSave( pxSession, pxAck );
+                }
+
+                pxSeen->usPacketId = pxAck->packetId;
+                pxSeen->pxCommand = pxAck->pOriginalCommand;
+            }
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    uint32_t MqttAgentSession_GetWaitMs( const MqttAgentSession_t * pxSession,
+                                         uint32_t ulNowMs )
+    {
+        uint32_t ulWaitMs = UINT32_MAX;
+        bool xPending = ( pxSession->uxRefCount > 0 );
+
+        for( size_t uxIdx = 0; ( uxIdx < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && !xPending; uxIdx++ )
+        {
+            xPending = ( pxSession->pxAgentContext->pPendingAcks[ uxIdx ].packetId != MQTT_PACKET_ID_INVALID );
+        }
+
+        if( xPending )
+        {
+            uint32_t ulElapsedMs = ulNowMs - pxSession->ulLastSyncMs;
+
+            ulWaitMs = ( ulElapsedMs < MQTT_SESSION_STORE_SYNC_INTERVAL_MS ) ?
+                       ( MQTT_SESSION_STORE_SYNC_INTERVAL_MS - ulElapsedMs ) : 0U;
+        }
+
+        return ulWaitMs;
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Completion of a publish read back from the session store. A failed publish
+ * keeps its record, so it is tried again after the next reset. The record is
+ * the one written under the publish's latest packet id, see
+ * prvSessionStoreSave. */
+    static void prvRestoredPublishCallback( MQTTAgentCommandContext_t * pxCmdCallbackContext,
+                                            MQTTAgentReturnInfo_t * pxReturnInfo )
+    {
+        MqttSessionRecord_t * pxRecord = ( MqttSessionRecord_t * ) pxCmdCallbackContext;
+
+        if( pxReturnInfo->returnCode == MQTTSuccess )
+        {
+            MqttSessionStore_Remove( pxRecord->ulSeq );
+        }
+        else
+        {
+            LogWarn( "Restored publish to %.*s failed: %s.",
+                     pxRecord->xPublishInfo.topicNameLength,
+                     pxRecord->xPublishInfo.pTopicName,
+                     MQTT_Status_strerror( pxReturnInfo->returnCode ) );
+        }
+
+        vPortFree( pxRecord );
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Put a stored publish back in the coreMQTT state and the agent's pending
+ * acks, as if it had been sent on this connection with the same packet id. */
+    static bool prvRestoreInFlight( MQTTAgentContext_t * pxAgentCtx,
+                                    MqttSessionRecord_t * pxRecord )
+    {
+        MQTTAgentAckInfo_t * pxAck = NULL;
+        MQTTAgentCommand_t * pxCommand = NULL;
+        MQTTPublishState_t xState = MQTTStateNull;
+        bool xRestored = false;
+
+        for( size_t uxIdx = 0; ( uxIdx < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && ( pxAck == NULL ); uxIdx++ )
+        {
+            if( pxAgentCtx->pPendingAcks[ uxIdx ].packetId == MQTT_PACKET_ID_INVALID )
+            {
+                pxAck = &( pxAgentCtx->pPendingAcks[ uxIdx ] );
+            }
+        }
+
+        if( pxAck != NULL )
+        {
+            pxCommand = Agent_GetCommand( 0 );
+        }
+
+        if( pxCommand != NULL )
+        {
+            if( ( MQTT_ReserveState( &( pxAgentCtx->mqttContext ), pxRecord->usPacketId, MQTTQoS1 ) == MQTTSuccess ) &&
+                ( MQTT_UpdateStatePublish( &( pxAgentCtx->mqttContext ), pxRecord->usPacketId,
+                                           MQTT_SEND, MQTTQoS1, &xState ) == MQTTSuccess ) )
+            {
+                pxCommand->commandType = PUBLISH;
+                pxCommand->pArgs = &( pxRecord->xPublishInfo );
+                pxCommand->pCommandCompleteCallback = prvRestoredPublishCallback;
+                pxCommand->pCmdContext = ( MQTTAgentCommandContext_t * ) pxRecord;
+
+                pxAck->packetId = pxRecord->usPacketId;
+                pxAck->pOriginalCommand = pxCommand;
+                xRestored = true;
+            }
+            else
+            {
+                ( void ) Agent_ReleaseCommand( pxCommand );
+            }
+        }
+
+        return xRestored;
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentSession_Restore( MqttAgentSession_t * pxSession,
+                                   bool xSessionPresent )
+    {
+        MQTTAgentContext_t * pxAgentCtx = pxSession->pxAgentContext;
+        MqttSessionRecord_t * pxRecord = pxSession->pxRestored;
+        uint32_t ulResent = 0;
+        uint32_t ulQueued = 0;
+
+        pxSession->pxRestored = NULL;
+
+        /* Publishes queued by the agent task itself must not go to the journal. */
+        vMQTTAgentSetTaskJournalMode( MQTT_AGENT_JOURNAL_NONE );
+
+        while( pxRecord != NULL )
+        {
+            MqttSessionRecord_t * pxNext = pxRecord->pxNext;
+
+            pxRecord->pxNext = NULL;
+
+            /* New publishes must not reuse the packet ids of the restored ones. */
+            if( pxRecord->usPacketId >= pxAgentCtx->mqttContext.nextPacketId )
+            {
+                pxAgentCtx->mqttContext.nextPacketId = ( pxRecord->usPacketId == UINT16_MAX ) ? 1U : ( uint16_t ) ( pxRecord->usPacketId + 1U );
+            }
+
+            if( xSessionPresent && prvRestoreInFlight( pxAgentCtx, pxRecord ) )
+            {
+                ulResent++;
+            }
+            else
+            {
+                MQTTAgentCommandInfo_t xCommandInfo =
+                {
+                    .blockTimeMs                 = 0U,
+                    .cmdCompleteCallback         = prvRestoredPublishCallback,
+                    .pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pxRecord,
+                };
+
+                if( MQTTAgent_Publish( pxAgentCtx, &( pxRecord->xPublishInfo ), &xCommandInfo ) == MQTTSuccess )
+                {
+                    ulQueued++;
+                }
+                else
+                {
+                    LogWarn( "Failed to queue restored publish to %.*s, keeping it for the next boot.",
+                             pxRecord->xPublishInfo.topicNameLength,
+                             pxRecord->xPublishInfo.pTopicName );
+                    vPortFree( pxRecord );
+                }
+            }
+
+            pxRecord = pxNext;
+        }
+
+        LogInfo( "Restored %lu in-flight publishes, queued %lu as new publishes.",
+                 ( unsigned long ) ulResent, ( unsigned long ) ulQueued );
+    }
+
+/*-----------------------------------------------------------*/
+
+    MQTTStatus_t MqttAgentSession_Open( MqttAgentSession_t * pxSession,
+                                        MQTTAgentContext_t * pxAgentContext )
+    {
+        MQTTStatus_t xStatus = MqttSessionStore_Init();
+
+        if( xStatus == MQTTSuccess )
+        {
+            pxSession->pxAgentContext = pxAgentContext;
+            pxSession->pxRestored = MqttSessionStore_Load();
+        }
+
+        return xStatus;
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttAgentSession_Free( MqttAgentSession_t * pxSession )
+    {
+        while( pxSession->pxRestored != NULL )
+        {
+            MqttSessionRecord_t * pxRecord = pxSession->pxRestored;
+
+            pxSession->pxRestored = pxRecord->pxNext;
+            vPortFree( pxRecord );
+        }
+    }
+
+#endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
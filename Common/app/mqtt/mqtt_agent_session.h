@@ -0,0 +1,132 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_agent_session.h
+ * @brief Session store hooks of the MQTT agent.
+ *
+ * Keeps the records of mqtt_session_store.h in step with the QoS1 publishes
+ * of the default instance awaiting their PUBACK, and hands the publishes read
+ * back at boot to the agent once it is connected. Only accessed by the agent
+ * task.
+ */
+#ifndef MQTT_AGENT_SESSION_H
+#define MQTT_AGENT_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core_mqtt_agent.h"
+#include "mqtt_session_store.h"
+
+#if MQTT_AGENT_SESSION_STORE_ENABLED
+
+/* Record in the session store of a publish awaiting its PUBACK. */
+    typedef struct SessionStoreRef
+    {
+        uint16_t usPacketId;
+        uint32_t ulSeq;
+    } SessionStoreRef_t;
+
+/* Entry of the agent's pending acks at the previous sync. */
+    typedef struct SessionStoreSeen
+    {
+        uint16_t usPacketId;
+        const MQTTAgentCommand_t * pxCommand;
+    } SessionStoreSeen_t;
+
+    typedef struct MqttAgentSession
+    {
+        MQTTAgentContext_t * pxAgentContext;
+        SessionStoreRef_t pxRefs[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ];
+        size_t uxRefCount;
+        SessionStoreSeen_t pxSeen[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ];
+        uint32_t ulLastSyncMs;
+        MqttSessionRecord_t * pxRestored; /* Read back at boot, handed to the agent after the first CONNACK. */
+    } MqttAgentSession_t;
+
+/**
+ * @brief Open the session store and read back the publishes of the previous
+ * boot into pxRestored. The file system must be mounted.
+ *
+ * @param[in] pxSession Zeroed session store state.
+ * @param[in] pxAgentContext Agent whose publishes are stored.
+ *
+ * @return MQTTSuccess, or the error of MqttSessionStore_Init.
+ */
+    MQTTStatus_t MqttAgentSession_Open( MqttAgentSession_t * pxSession,
+                                        MQTTAgentContext_t * pxAgentContext );
+
+/**
+ * @brief Keep the session store in step with the publishes awaiting a PUBACK,
+ * at most once every MQTT_SESSION_STORE_SYNC_INTERVAL_MS unless xForce is
+ * set. Remove the records of those that completed or were cancelled, and
+ * write one for each QoS1 publish that was already awaiting its PUBACK at the
+ * previous sync, so that a publish acknowledged within the interval costs no
+ * flash write.
+ *
+ * @param[in] pxSession Session store state.
+ * @param[in] ulNowMs Current time in milliseconds.
+ * @param[in] xForce Sync whatever the time since the previous sync.
+ */
+    void MqttAgentSession_Sync( MqttAgentSession_t * pxSession,
+                                uint32_t ulNowMs,
+                                bool xForce );
+
+/**
+ * @brief Time until MqttAgentSession_Sync next has work to do.
+ *
+ * @param[in] pxSession Session store state.
+ * @param[in] ulNowMs Current time in milliseconds.
+ *
+ * @return Time in milliseconds, UINT32_MAX if there are no records or acks
+ * to check.
+ */
+    uint32_t MqttAgentSession_GetWaitMs( const MqttAgentSession_t * pxSession,
+                                         uint32_t ulNowMs );
+
+/**
+ * @brief Hand the publishes read back at boot to the agent, once connected.
+ * If the broker kept the session they are resent by MQTTAgent_ResumeSession
+ * with their packet ids and the DUP flag, otherwise they are queued as new
+ * publishes. Call before MQTTAgent_ResumeSession.
+ *
+ * @param[in] pxSession Session store state.
+ * @param[in] xSessionPresent Session present flag of the CONNACK.
+ */
+    void MqttAgentSession_Restore( MqttAgentSession_t * pxSession,
+                                   bool xSessionPresent );
+
+/**
+ * @brief Free the publishes read back at boot which were never restored.
+ *
+ * @param[in] pxSession Session store state.
+ */
+    void MqttAgentSession_Free( MqttAgentSession_t * pxSession );
+
+#endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+#endif /* MQTT_AGENT_SESSION_H */
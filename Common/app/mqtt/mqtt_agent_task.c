@@ -40,6 +40,7 @@
 #include "queue.h"
 #include "task.h"
 #include "event_groups.h"
+#include "atomic.h"
 
 #include "mqtt_metrics.h"
 
@@ -47,6 +48,7 @@
 #include "core_mqtt.h"
 
 #include "core_mqtt_serializer.h"
+#include "core_mqtt_state.h"
 
 /* MQTT agent include. */
 #include "core_mqtt_agent.h"
@@ -60,6 +62,15 @@
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
+#include "topic_trie.h"
+#include "slab_pool.h"
+#include "mqtt_keepalive.h"
+#include "mqtt_agent_metrics.h"
+#include "mqtt_agent_transport.h"
+#include "mqtt_agent_delivery.h"
+#include "mqtt_agent_lanes.h"
+#include "mqtt_agent_session.h"
+#include "mqtt_agent_journal.h"
 
 #include "mbedtls_transport.h"
 #include "sys_evt.h"
@@ -104,18 +115,26 @@ static_assert( ( ( uint64_t ) RETRY_BACKOFF_MULTIPLIER * ( uint64_t ) RETRY_MAX_
  *  Control Packets being sent does not exceed the this Keep Alive value. In the
  *  absence of sending any other Control Packets, the Client MUST send a
  *  PINGREQ Packet.
+ *
+ *  PINGREQs are sent at the shorter interval chosen by mqtt_keepalive.c.
  */
-#define KEEP_ALIVE_INTERVAL_S                 ( 60U )
+#define KEEP_ALIVE_INTERVAL_S                 ( MQTT_KEEPALIVE_MAX_S )
 
 #define MQTT_AGENT_NOTIFY_IDX                 ( 3U )
 
 #define MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV    ( 1U << 31 )
 #define MQTT_AGENT_NOTIFY_FLAG_M_QUEUE        ( 1U << 30 )
 
-/**
- * @brief Socket send and receive timeouts to use.
- */
-#define SEND_TIMEOUT_MS                       ( 2000U )
+/* Thread local storage index holding the instance selected by vMQTTAgentSetTaskInstance.
+ * Index 0 is used by the lwIP port, 1 and 2 by mqtt_agent_lanes.c and
+ * mqtt_agent_journal.c. */
+#define MQTT_AGENT_INSTANCE_TLS_IDX           ( 3 )
+
+#define MQTTS_PORT                            ( 8883U )
+
+/* Every instance needs two event bits in xSystemEvents, see sys_evt.h. */
+static_assert( ( MQTT_AGENT_MAX_INSTANCES > 0U ) &&
+               ( EVT_MASK_MQTT_CONNECTED_INSTANCE( MQTT_AGENT_MAX_INSTANCES - 1U ) < ( 1UL << 24 ) ) );
 
 #define AGENT_READY_EVT_MASK                  ( 1U )
 
@@ -123,31 +142,92 @@ static_assert( ( ( uint64_t ) RETRY_BACKOFF_MULTIPLIER * ( uint64_t ) RETRY_MAX_
 
 struct MQTTAgentMessageContext
 {
-    QueueHandle_t xQueue;
+    MqttAgentLanes_t xLanes;
     TaskHandle_t xAgentTaskHandle;
+    MqttAgentTransport_t * pxTransport;
+    MqttKeepAlive_t * pxKeepAlive;
+    MQTTContext_t * pxMqttContext;
+    bool xConnected;
+    MQTTAgentCommand_t * pxLastCommand; /* Returned by the previous receive. */
+    uint32_t ulInstance;
+    uint32_t ulRecvReadyTime;           /* Metrics timestamp of the last socket notification. */
+    bool xRecvReadyTimed;               /* ulRecvReadyTime has not been recorded yet. */
+    #if MQTT_AGENT_SESSION_STORE_ENABLED
+        MqttAgentSession_t * pxSessionStore; /* NULL unless this instance keeps its publishes on flash. */
+    #endif
 };
 
+typedef struct SubscriptionEntry
+{
+    /* First member, so SubCallbackElement_t.pxSubInfo also points to the entry. */
+    MQTTSubscribeInfo_t xSubInfo;
+    MQTTSubAckStatus_t xSubAckStatus;
+    uint32_t ulCallbackCount;
+    SubCallbackElement_t * pxCallbacks;
+    struct SubscriptionEntry * pxNext;
+    struct SubscriptionEntry * pxPrev;
+} SubscriptionEntry_t;
+
+/* One of the SUBSCRIBE packets sent to restore the subscriptions after a reconnect. */
+typedef struct ResubscribeBatch
+{
+    MQTTAgentSubscribeArgs_t xArgs;
+    SubscriptionEntry_t ** ppxEntries;
+    struct MQTTAgentSubscriptionManagerCtx * pxCtx;
+} ResubscribeBatch_t;
+
+/* Subscription entries and callback elements share a single slab pool. */
+typedef union SubMgrSlot
+{
+    SubscriptionEntry_t xSubscription;
+    SubCallbackElement_t xCallback;
+} SubMgrSlot_t;
+
 typedef struct MQTTAgentSubscriptionManagerCtx
 {
-    MQTTSubscribeInfo_t pxSubscriptions[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];
-    MQTTSubAckStatus_t pxSubAckStatus[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];
-    uint32_t pulSubCbCount[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];
-    SubCallbackElement_t pxCallbacks[ MQTT_AGENT_MAX_CALLBACKS ];
+    SlabPool_t xSlabPool;
+    SubscriptionEntry_t * pxSubscriptions;
+    DeliveryQueue_t pxDeliveryQueues[ MQTT_AGENT_MAX_DELIVERY_QUEUES ];
+
+    /* Index of pxSubscriptions by topic filter, used to look up a filter and
+     * to dispatch incoming publishes. */
+    TopicTrie_t xTopicTrie;
 
     size_t uxSubscriptionCount;
     size_t uxCallbackCount;
-    MQTTAgentSubscribeArgs_t xInitialSubscribeArgs;
+
+    /* SUBSCRIBE packets issued after a reconnect. The subscribe info, entry
+     * arrays and topic filters they refer to follow the batches in the same
+     * allocation, so the mutex is not held while the SUBACKs are awaited. */
+    ResubscribeBatch_t * pxResubscribeBatches;
+    size_t uxResubscribeBatchCount;
+    size_t uxResubscribePending;
+    TickType_t xConnAckTime;
+    uint32_t ulResubscribeTimeMs;
 
     SemaphoreHandle_t xMutex;
 } SubMgrCtx_t;
 
 
+/* Receive buffer which can be handed to subscribers by MqttAgent_RetainPayload. */
+typedef struct MQTTAgentRxBuffer
+{
+    uint8_t * pucBuffer;
+    uint32_t ulRefCount;
+} RxBuffer_t;
+
 typedef struct MQTTAgentTaskCtx
 {
     MQTTAgentContext_t xAgentContext;
 
     MQTTFixedBuffer_t xNetworkFixedBuffer;
+    RxBuffer_t pxRxBuffers[ MQTT_AGENT_RX_BUFFER_COUNT ];
     TransportInterface_t xTransport;
+    MqttAgentTransport_t xTransportCtx;
+    MqttKeepAlive_t xKeepAlive;
+    #if MQTT_AGENT_SESSION_STORE_ENABLED
+        MqttAgentSession_t xSessionStore;
+    #endif
 
     MQTTAgentMessageInterface_t xMessageInterface;
     MQTTAgentMessageContext_t xAgentMessageCtx;
@@ -155,26 +235,39 @@ typedef struct MQTTAgentTaskCtx
     SubMgrCtx_t xSubMgrCtx;
 
     MQTTConnectInfo_t xConnectInfo;
-    char * pcMqttEndpoint;
-    size_t uxMqttEndpointLen;
-    uint32_t ulMqttPort;
+    const MQTTAgentInstanceConfig_t * pxConfig;
 } MQTTAgentTaskCtx_t;
 
 /* ALPN protocols must be a NULL-terminated list of strings. */
 static const char * pcAlpnProtocols[] = { AWS_IOT_MQTT_ALPN, NULL };
 
-static MQTTAgentHandle_t xDefaultInstanceHandle = NULL;
+/* Running instances, indexed by MQTTAgentInstanceConfig_t.ulInstance. */
+static MQTTAgentTaskCtx_t * pxInstances[ MQTT_AGENT_MAX_INSTANCES ] = { NULL };
+
+#if MQTT_AGENT_PUBLISH_RATE_LIMIT_ENABLED
+
+/* Connection wide publish limit of the default instance. */
+    static const MqttRateClass_t xDefaultRateClasses[] =
+    {
+        {
+            .pcTopicPrefix = NULL,
+            .ulLaneMask    = 0U,
+            .ulRatePerSec  = MQTT_AGENT_PUBLISH_RATE_PER_SEC,
+            .ulBurst       = MQTT_AGENT_PUBLISH_BURST,
+            .xPolicy       = MQTT_RATE_DELAY
+        }
+    };
+
+#endif /* MQTT_AGENT_PUBLISH_RATE_LIMIT_ENABLED */
 
 /*
- * @brief Configuration settings passed from iotconnect_init().
+ * @brief Configuration settings of the default instance, passed from iotconnect_init().
  */
 static struct IOTCMQTTConfig {
-	const char *host;
-	int port;
-	char *duid;
 	PkiObject_t root_ca_cert;
 	PkiObject_t client_certificate;
 	PkiObject_t private_key;
+	MQTTAgentInstanceConfig_t instance;
 } mqtt_config;
 
 
@@ -208,6 +301,18 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 static MQTTStatus_t prvHandleResubscribe( MQTTAgentContext_t * pxMqttAgentCtx,
                                           SubMgrCtx_t * pxCtx );
 
+/**
+ * @brief Pass a piece of the payload of a publish larger than the network
+ * buffer to the stream subscriptions matching its topic.
+ *
+ * @return The number of callbacks the piece was passed to.
+ */
+static size_t prvDispatchChunk( void * pvCtx,
+                                const MQTTPublishInfo_t * pxPublishInfo,
+                                size_t uxOffset,
+                                const uint8_t * pucChunk,
+                                size_t uxChunkLength );
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -227,6 +332,8 @@ static uint32_t prvGetTimeMs( void );
  */
 static uint32_t ulGlobalEntryTimeMs;
 
+static bool xGlobalEntryTimeSet = false;
+
 /*-----------------------------------------------------------*/
 
 static inline BaseType_t xLockSubCtx( SubMgrCtx_t * pxSubCtx )
@@ -278,19 +385,41 @@ static inline BaseType_t xUnlockSubCtx( SubMgrCtx_t * pxSubCtx )
 }
 
 /*-----------------------------------------------------------*/
+
+static inline uint32_t prvGetTaskInstance( void )
+{
+    uintptr_t uxTaskInstance = ( uintptr_t ) pvTaskGetThreadLocalStoragePointer( NULL, MQTT_AGENT_INSTANCE_TLS_IDX );
+
+    /* Zero means vMQTTAgentSetTaskInstance was never called by this task. */
+    return( ( uxTaskInstance == 0 ) ? MQTT_AGENT_DEFAULT_INSTANCE : ( uint32_t ) ( uxTaskInstance - 1 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvIsInstanceConnected( uint32_t ulInstance )
+{
+    EventBits_t uxEvents = xEventGroupGetBits( xSystemEvents );
+
+    return( ( uxEvents & EVT_MASK_MQTT_CONNECTED_INSTANCE( ulInstance ) ) != 0 );
+}
+
+/*-----------------------------------------------------------*/
+
 void vSleepUntilMQTTAgentReady( void )
 {
+    EventBits_t uxInitMask = EVT_MASK_MQTT_INIT_INSTANCE( prvGetTaskInstance() );
+
     configASSERT( xSystemEvents != NULL );
 
     while( 1 )
     {
         EventBits_t uxEvents = xEventGroupWaitBits( xSystemEvents,
-                                                    EVT_MASK_MQTT_INIT,
+                                                    uxInitMask,
                                                     pdFALSE,
                                                     pdTRUE,
                                                     portMAX_DELAY );
 
-        if( uxEvents & EVT_MASK_MQTT_INIT )
+        if( uxEvents & uxInitMask )
         {
             break;
         }
@@ -306,17 +435,19 @@ void vSleepUntilMQTTAgentReady( void )
 
 void vSleepUntilMQTTAgentConnected( void )
 {
+    EventBits_t uxConnectedMask = EVT_MASK_MQTT_CONNECTED_INSTANCE( prvGetTaskInstance() );
+
     configASSERT( xSystemEvents != NULL );
 
     while( 1 )
     {
         EventBits_t uxEvents = xEventGroupWaitBits( xSystemEvents,
-                                                    EVT_MASK_MQTT_CONNECTED,
+                                                    uxConnectedMask,
                                                     pdFALSE,
                                                     pdTRUE,
                                                     portMAX_DELAY );
 
-        if( uxEvents & EVT_MASK_MQTT_CONNECTED )
+        if( uxEvents & uxConnectedMask )
         {
             break;
         }
@@ -327,158 +458,190 @@ void vSleepUntilMQTTAgentConnected( void )
 
 bool xIsMqttAgentConnected( void )
 {
-    EventBits_t uxEvents = xEventGroupWaitBits( xSystemEvents,
-                                                EVT_MASK_MQTT_CONNECTED,
-                                                pdFALSE,
-                                                pdTRUE,
-                                                0 );
-
-    return( ( bool ) ( uxEvents & EVT_MASK_MQTT_CONNECTED ) );
+    return prvIsInstanceConnected( prvGetTaskInstance() );
 }
 
 /*-----------------------------------------------------------*/
 
-static inline void prvUpdateCallbackRefs( SubCallbackElement_t * pxCallbacksList,
-                                          MQTTSubscribeInfo_t * pxSubList,
-                                          size_t uxOldIdx,
-                                          size_t uxNewIdx )
+static SubscriptionEntry_t * prvFindSubscription( SubMgrCtx_t * pxCtx,
+                                                  const char * pcTopicFilter,
+                                                  size_t xTopicFilterLen )
 {
-    configASSERT( pxCallbacksList );
-    configASSERT( pxSubList );
-    configASSERT( uxOldIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS );
-    configASSERT( uxNewIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS );
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
 
-    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
-    {
-        if( pxCallbacksList[ uxIdx ].pxSubInfo == &( pxSubList[ uxOldIdx ] ) )
-        {
-            pxCallbacksList[ uxIdx ].pxSubInfo = &( pxSubList[ uxNewIdx ] );
-        }
-    }
+    return ( SubscriptionEntry_t * ) TopicTrie_Find( &( pxCtx->xTopicTrie ),
+                                                     pcTopicFilter,
+                                                     ( uint16_t ) xTopicFilterLen );
 }
 
 /*-----------------------------------------------------------*/
 
-static inline void prvCompressSubscriptionList( MQTTSubscribeInfo_t * pxSubList,
-                                                SubCallbackElement_t * pxCallbacksList,
-                                                size_t * puxSubCount )
+/* Add an entry for a new topic filter, copying the filter to the heap. */
+static SubscriptionEntry_t * prvAddSubscription( SubMgrCtx_t * pxCtx,
+                                                 const char * pcTopicFilter,
+                                                 size_t xTopicFilterLen )
 {
-    size_t uxLastOccupiedIndex = 0;
-    size_t uxSubCount = 0;
+    SubscriptionEntry_t * pxEntry = NULL;
+    char * pcDupTopicFilter = NULL;
+
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
 
-    configASSERT( pxSubList );
-    configASSERT( pxCallbacksList );
+    pxEntry = SlabPool_Alloc( &( pxCtx->xSlabPool ) );
 
-    for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
+    if( pxEntry != NULL )
     {
-        if( ( pxSubList[ uxIdx ].pTopicFilter == NULL ) &&
-            ( pxSubList[ uxIdx ].topicFilterLength == 0 ) &&
-            ( uxLastOccupiedIndex < MQTT_AGENT_MAX_SUBSCRIPTIONS ) )
-        {
-            if( uxLastOccupiedIndex <= uxIdx )
-            {
-                uxLastOccupiedIndex = uxIdx + 1;
-            }
+        pcDupTopicFilter = pvPortMalloc( xTopicFilterLen + 1 );
+    }
 
-            /* Iterate over remainder of list for occupied spots */
-            for( ; uxLastOccupiedIndex < MQTT_AGENT_MAX_CALLBACKS; uxLastOccupiedIndex++ )
-            {
-                if( pxSubList[ uxLastOccupiedIndex ].topicFilterLength != 0 )
-                {
-                    /* Move new item into place */
-                    pxSubList[ uxIdx ] = pxSubList[ uxLastOccupiedIndex ];
+    if( pcDupTopicFilter != NULL )
+    {
+        ( void ) memcpy( pcDupTopicFilter, pcTopicFilter, xTopicFilterLen );
 
-                    /* Clear old location */
-                    memset( &( pxSubList[ uxLastOccupiedIndex ] ), 0, sizeof( MQTTSubscribeInfo_t ) );
+        /* Ensure null terminated */
+        pcDupTopicFilter[ xTopicFilterLen ] = '\00';
 
-                    prvUpdateCallbackRefs( pxCallbacksList, pxSubList, uxLastOccupiedIndex, uxIdx );
+        if( TopicTrie_Insert( &( pxCtx->xTopicTrie ),
+                              pcDupTopicFilter,
+                              ( uint16_t ) xTopicFilterLen,
+                              pxEntry ) != MQTTSuccess )
+        {
+            vPortFree( pcDupTopicFilter );
+            pcDupTopicFilter = NULL;
+        }
+    }
 
-                    /* Increment count of active subscriptions */
-                    uxSubCount++;
+    if( pcDupTopicFilter != NULL )
+    {
+        pxEntry->xSubInfo.pTopicFilter = pcDupTopicFilter;
+        pxEntry->xSubInfo.topicFilterLength = ( uint16_t ) xTopicFilterLen;
+        pxEntry->xSubAckStatus = MQTTSubAckFailure;
 
-                    /* Increment counter so we don't visit this location again */
-                    uxLastOccupiedIndex++;
+        pxEntry->pxNext = pxCtx->pxSubscriptions;
 
-                    break;
-                }
-            }
-        }
-        else if( ( pxSubList[ uxIdx ].pTopicFilter != NULL ) &&
-                 ( pxSubList[ uxIdx ].topicFilterLength != 0 ) )
-        {
-            /* Increment count of active subscriptions */
-            uxSubCount++;
-        }
-        else /*  pxSubList[ uxIdx ].topicFilterLength == 0 */
+        if( pxCtx->pxSubscriptions != NULL )
         {
-            /* Continue iterating */
+            pxCtx->pxSubscriptions->pxPrev = pxEntry;
         }
+
+        pxCtx->pxSubscriptions = pxEntry;
+        pxCtx->uxSubscriptionCount++;
+    }
+    else if( pxEntry != NULL )
+    {
+        SlabPool_Free( &( pxCtx->xSlabPool ), pxEntry );
+        pxEntry = NULL;
+    }
+    else
+    {
+        /* Empty */
     }
 
-    *puxSubCount = uxSubCount;
+    return pxEntry;
 }
 
 /*-----------------------------------------------------------*/
 
-static inline void prvCompressCallbackList( SubCallbackElement_t * pxCallbackList,
-                                            size_t * puxCallbackCount )
+static void prvRemoveSubscription( SubMgrCtx_t * pxCtx,
+                                   SubscriptionEntry_t * pxEntry )
 {
-    size_t uxLastOccupiedIndex = 0;
-    size_t uxCallbackCount = 0;
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+    configASSERT( pxEntry->pxCallbacks == NULL );
+    configASSERT( pxCtx->uxSubscriptionCount > 0 );
 
-    configASSERT( pxCallbackList );
-    configASSERT( puxCallbackCount );
+    ( void ) TopicTrie_Remove( &( pxCtx->xTopicTrie ),
+                               pxEntry->xSubInfo.pTopicFilter,
+                               pxEntry->xSubInfo.topicFilterLength );
 
-    for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
+    if( pxEntry->pxPrev != NULL )
+    {
+        pxEntry->pxPrev->pxNext = pxEntry->pxNext;
+    }
+    else
     {
-        if( ( pxCallbackList[ uxIdx ].pxSubInfo == NULL ) &&     /* Current slot at uxIdx is Empty */
-            ( uxLastOccupiedIndex < MQTT_AGENT_MAX_CALLBACKS ) ) /* There may be occupied slots after the current one */
+        pxCtx->pxSubscriptions = pxEntry->pxNext;
+    }
+
+    if( pxEntry->pxNext != NULL )
+    {
+        pxEntry->pxNext->pxPrev = pxEntry->pxPrev;
+    }
+
+    /* A resubscribe in flight must not update the freed entry on SUBACK. */
+    for( size_t uxIdx = 0; uxIdx < pxCtx->uxResubscribeBatchCount; uxIdx++ )
+    {
+        ResubscribeBatch_t * pxBatch = &( pxCtx->pxResubscribeBatches[ uxIdx ] );
+
+        for( uint32_t ulSubIdx = 0; ulSubIdx < pxBatch->xArgs.numSubscriptions; ulSubIdx++ )
         {
-            /* uxLastOccupiedIndex is always > uxIdx */
-            if( uxLastOccupiedIndex <= uxIdx )
+            if( pxBatch->ppxEntries[ ulSubIdx ] == pxEntry )
             {
-                uxLastOccupiedIndex = uxIdx + 1;
+                pxBatch->ppxEntries[ ulSubIdx ] = NULL;
             }
+        }
+    }
 
-            /* Iterate over remainder of list for occupied spots */
-            for( ; uxLastOccupiedIndex < MQTT_AGENT_MAX_CALLBACKS; uxLastOccupiedIndex++ )
-            {
-                if( pxCallbackList[ uxLastOccupiedIndex ].pxSubInfo != NULL )
-                {
-                    configASSERT( uxLastOccupiedIndex > uxIdx );
+    /* Free heap allocated topic filter */
+    vPortFree( ( void * ) pxEntry->xSubInfo.pTopicFilter );
 
-                    /* Move context from uxLastOccupiedIndex to uxIdx */
-                    pxCallbackList[ uxIdx ] = pxCallbackList[ uxLastOccupiedIndex ];
+    SlabPool_Free( &( pxCtx->xSlabPool ), pxEntry );
 
-                    /* Clear old context location */
-                    memset( &( pxCallbackList[ uxLastOccupiedIndex ] ), 0, sizeof( SubCallbackElement_t ) );
+    pxCtx->uxSubscriptionCount--;
+}
 
-                    pxCallbackList[ uxLastOccupiedIndex ].pxIncomingPublishCallback = NULL;
-                    pxCallbackList[ uxLastOccupiedIndex ].pvIncomingPublishCallbackContext = NULL;
-                    pxCallbackList[ uxLastOccupiedIndex ].xTaskHandle = NULL;
-                    pxCallbackList[ uxLastOccupiedIndex ].pxSubInfo = NULL;
+/*-----------------------------------------------------------*/
 
-                    /* Increment count of active callbacks */
-                    uxCallbackCount++;
+static SubCallbackElement_t * prvAddCallback( SubMgrCtx_t * pxCtx,
+                                              SubscriptionEntry_t * pxEntry )
+{
+    SubCallbackElement_t * pxCbCtx = NULL;
 
-                    /* Increment counter so we don't visit this empty location again */
-                    uxLastOccupiedIndex++;
-                    break;
-                }
-            }
-        }
-        else if( pxCallbackList[ uxIdx ].pxSubInfo != NULL )
-        {
-            /* Increment count of valid contexts */
-            uxCallbackCount++;
-        }
-        else /* pxCallbackList[ uxIdx ].pxSubInfo == NULL */
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+
+    pxCbCtx = SlabPool_Alloc( &( pxCtx->xSlabPool ) );
+
+    if( pxCbCtx != NULL )
+    {
+        pxCbCtx->pxSubInfo = &( pxEntry->xSubInfo );
+        pxCbCtx->pxNext = pxEntry->pxCallbacks;
+
+        if( pxEntry->pxCallbacks != NULL )
         {
-            /* Continue iterating, ignore empty slot. */
+            pxEntry->pxCallbacks->pxPrev = pxCbCtx;
         }
+
+        pxEntry->pxCallbacks = pxCbCtx;
+        pxCtx->uxCallbackCount++;
+    }
+
+    return pxCbCtx;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRemoveCallback( SubMgrCtx_t * pxCtx,
+                               SubscriptionEntry_t * pxEntry,
+                               SubCallbackElement_t * pxCbCtx )
+{
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+    configASSERT( pxCtx->uxCallbackCount > 0 );
+
+    if( pxCbCtx->pxPrev != NULL )
+    {
+        pxCbCtx->pxPrev->pxNext = pxCbCtx->pxNext;
+    }
+    else
+    {
+        pxEntry->pxCallbacks = pxCbCtx->pxNext;
     }
 
-    *puxCallbackCount = uxCallbackCount;
+    if( pxCbCtx->pxNext != NULL )
+    {
+        pxCbCtx->pxNext->pxPrev = pxCbCtx->pxPrev;
+    }
+
+    SlabPool_Free( &( pxCtx->xSlabPool ), pxCbCtx );
+
+    pxCtx->uxCallbackCount--;
 }
 
 /*-----------------------------------------------------------*/
@@ -489,6 +652,9 @@ static void prvSocketRecvReadyCallback( void * pvCtx )
 
     if( pxMsgCtx )
     {
+        pxMsgCtx->ulRecvReadyTime = MqttAgentMetrics_Now();
+        pxMsgCtx->xRecvReadyTimed = true;
+
         ( void ) xTaskNotifyIndexed( pxMsgCtx->xAgentTaskHandle,
                                      MQTT_AGENT_NOTIFY_IDX,
                                      MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV,
@@ -498,15 +664,62 @@ static void prvSocketRecvReadyCallback( void * pvCtx )
 
 /*-----------------------------------------------------------*/
 
+#if MQTT_AGENT_SESSION_STORE_ENABLED
+
+static void prvSessionStoreInit( MQTTAgentTaskCtx_t * pxCtx )
+{
+    MqttAgentSession_t * pxSession = &( pxCtx->xSessionStore );
+
+    ( void ) xEventGroupWaitBits( xSystemEvents,
+                                  EVT_MASK_FS_READY,
+                                  pdFALSE,
+                                  pdTRUE,
+                                  portMAX_DELAY );
+
+    if( MqttAgentSession_Open( pxSession, &( pxCtx->xAgentContext ) ) != MQTTSuccess )
+    {
+        LogError( "Failed to open the session store, in-flight publishes will not survive a reset." );
+    }
+    else
+    {
+        pxCtx->xAgentMessageCtx.pxSessionStore = pxSession;
+
+        /* Ask the broker for the session of the previous boot, which holds
+         * the packet ids of the restored publishes. */
+        if( pxSession->pxRestored != NULL )
+        {
+            pxCtx->xConnectInfo.cleanSession = false;
+        }
+    }
+}
+
+#endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+/*-----------------------------------------------------------*/
+
 static bool prvAgentMessageSend( MQTTAgentMessageContext_t * pxMsgCtx,
                                  MQTTAgentCommand_t * const * pxCommandToSend,
                                  uint32_t blockTimeMs )
 {
-    BaseType_t xQueueStatus = pdFAIL;
+    bool xQueueStatus = false;
+    bool xJournaled = false;
+
+    #if MQTT_AGENT_JOURNAL_ENABLED
+        if( pxMsgCtx && pxCommandToSend && *pxCommandToSend )
+        {
+            xJournaled = MqttAgentJournal_Command( *pxCommandToSend,
+                                                   pxMsgCtx->ulInstance,
+                                                   prvIsInstanceConnected( pxMsgCtx->ulInstance ) );
+        }
+    #endif /* MQTT_AGENT_JOURNAL_ENABLED */
 
-    if( pxMsgCtx && pxCommandToSend )
+    if( xJournaled )
     {
-        xQueueStatus = xQueueSendToBack( pxMsgCtx->xQueue, pxCommandToSend, pdMS_TO_TICKS( blockTimeMs ) );
+        xQueueStatus = true;
+    }
+    else if( pxMsgCtx && pxCommandToSend && *pxCommandToSend )
+    {
+        xQueueStatus = MqttAgentLanes_Send( &( pxMsgCtx->xLanes ), *pxCommandToSend, blockTimeMs );
 
         /* Notify the agent that a message is waiting */
         if( pxMsgCtx->xAgentTaskHandle )
@@ -517,8 +730,64 @@ static bool prvAgentMessageSend( MQTTAgentMessageContext_t * pxMsgCtx,
                                          eSetBits );
         }
     }
+    else
+    {
+        /* Empty else marker. */
+    }
+
+    return xQueueStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Time the agent may wait for a command or a socket notification. While
+ * connected, coreMQTT only needs to run when data arrives or a keep alive
+ * deadline passes, so once the connection has been read dry the agent sleeps
+ * until the next deadline instead of polling every blockTimeMs.
+ */
+static TickType_t prvGetWaitTicks( const MQTTAgentMessageContext_t * pxMsgCtx,
+                                   uint32_t blockTimeMs )
+{
+    TickType_t xWaitTicks = pdMS_TO_TICKS( blockTimeMs );
+
+    if( !pxMsgCtx->xConnected )
+    {
+        /* Keep polling while the connection is being set up. */
+    }
+    else if( !MqttAgentTransport_IsDrained( pxMsgCtx->pxTransport ) )
+    {
+        xWaitTicks = 0;
+    }
+    else
+    {
+        uint32_t ulNowMs = prvGetTimeMs();
+        uint32_t ulWaitMs = MqttKeepAlive_GetWaitMs( pxMsgCtx->pxKeepAlive, pxMsgCtx->pxMqttContext );
+        uint32_t ulCapMs = MqttAgentTransport_GetWaitMs( pxMsgCtx->pxTransport );
+
+        if( ulWaitMs > MQTT_AGENT_MAX_IDLE_WAIT_MS )
+        {
+            ulWaitMs = MQTT_AGENT_MAX_IDLE_WAIT_MS;
+        }
+
+        ulWaitMs = ( ulCapMs < ulWaitMs ) ? ulCapMs : ulWaitMs;
+
+        ulCapMs = MqttAgentLanes_GetWaitMs( &( pxMsgCtx->xLanes ), ulNowMs );
+        ulWaitMs = ( ulCapMs < ulWaitMs ) ? ulCapMs : ulWaitMs;
+
+        #if MQTT_AGENT_SESSION_STORE_ENABLED
+            if( pxMsgCtx->pxSessionStore != NULL )
+            {
+                ulCapMs = MqttAgentSession_GetWaitMs( pxMsgCtx->pxSessionStore, ulNowMs );
+                ulWaitMs = ( ulCapMs < ulWaitMs ) ? ulCapMs : ulWaitMs;
+            }
+        #endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+        /* Round up, so that the deadline has passed when the agent wakes. */
+        xWaitTicks = pdMS_TO_TICKS( ulWaitMs ) + 1U;
+    }
 
-    return ( bool ) xQueueStatus;
+    return xWaitTicks;
 }
 
 /*-----------------------------------------------------------*/
@@ -527,65 +796,161 @@ static bool prvAgentMessageReceive( MQTTAgentMessageContext_t * pxMsgCtx,
                                     MQTTAgentCommand_t ** ppxReceivedCommand,
                                     uint32_t blockTimeMs )
 {
-    BaseType_t xQueueStatus = pdFAIL;
+    bool xQueueStatus = false;
     uint32_t ulNotifyValue = 0;
 
     if( pxMsgCtx && ppxReceivedCommand )
     {
-        if( xTaskNotifyWaitIndexed( MQTT_AGENT_NOTIFY_IDX,
-                                    0x0,
-                                    0xFFFFFFFF,
-                                    &ulNotifyValue,
-                                    pdMS_TO_TICKS( blockTimeMs ) ) )
-        {
-            /* Prioritize processing incoming network packets over local requests */
-            if( ulNotifyValue & MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV )
+        MqttAgentTransport_t * const pxTransport = pxMsgCtx->pxTransport;
+
+        /* The previous command has been processed. Write out any coalesced
+         * publishes before the agent waits, or if they have waited too long. */
+        MqttAgentTransport_EndCommand( pxTransport );
+
+        #if MQTT_AGENT_SESSION_STORE_ENABLED
+            if( pxMsgCtx->pxSessionStore != NULL )
             {
-                *ppxReceivedCommand = NULL;
+                MqttAgentSession_Sync( pxMsgCtx->pxSessionStore, prvGetTimeMs(), false );
             }
-            else
+        #endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+        if( pxMsgCtx->pxLastCommand != NULL )
+        {
+            MqttAgentMetrics_CommandProcessed( pxMsgCtx->pxLastCommand );
+            pxMsgCtx->pxLastCommand = NULL;
+        }
+
+        MqttAgentTransport_Flush( pxTransport, MqttAgentLanes_IsEmpty( &( pxMsgCtx->xLanes ) ) );
+
+        if( pxMsgCtx->xConnected )
+        {
+            MqttKeepAlive_Process( pxMsgCtx->pxKeepAlive, pxMsgCtx->pxMqttContext );
+        }
+
+        *ppxReceivedCommand = NULL;
+
+        /* Collect any pending notification. The lanes are checked on every call
+         * rather than only when notified, since a single notification may
+         * stand for several queued commands. */
+        ( void ) xTaskNotifyWaitIndexed( MQTT_AGENT_NOTIFY_IDX,
+                                         0x0,
+                                         0xFFFFFFFF,
+                                         &ulNotifyValue,
+                                         0 );
+
+        /* Prioritize processing incoming network packets over local requests */
+        if( ( ulNotifyValue & MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV ) == 0 )
+        {
+            xQueueStatus = MqttAgentLanes_Receive( &( pxMsgCtx->xLanes ), ppxReceivedCommand, prvGetTimeMs() );
+
+            if( !xQueueStatus )
             {
-                xQueueStatus = xQueueReceive( pxMsgCtx->xQueue, ppxReceivedCommand, 0 );
+                TickType_t xWaitTicks = prvGetWaitTicks( pxMsgCtx, blockTimeMs );
+                BaseType_t xNotified = pdFALSE;
+
+                if( xWaitTicks > 0 )
+                {
+                    xNotified = xTaskNotifyWaitIndexed( MQTT_AGENT_NOTIFY_IDX,
+                                                        0x0,
+                                                        0xFFFFFFFF,
+                                                        &ulNotifyValue,
+                                                        xWaitTicks );
+
+                    MqttAgentMetrics_AgentWoke( xNotified == pdFALSE );
+                }
+
+                if( xNotified &&
+                    ( ( ulNotifyValue & MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV ) == 0 ) )
+                {
+                    xQueueStatus = MqttAgentLanes_Receive( &( pxMsgCtx->xLanes ), ppxReceivedCommand, prvGetTimeMs() );
+                }
             }
         }
+
+        if( xQueueStatus )
+        {
+            pxMsgCtx->pxLastCommand = *ppxReceivedCommand;
+            MqttAgentTransport_BeginCommand( pxTransport, *ppxReceivedCommand );
+        }
     }
 
-    return ( bool ) xQueueStatus;
+    return xQueueStatus;
 }
 
+/*-----------------------------------------------------------*/
+
+/* Called once the last SUBACK of a resubscribe has arrived, or the commands were cancelled. */
+static void prvResubscribeComplete( SubMgrCtx_t * pxCtx )
+{
+    size_t uxSubCount = 0;
+
+    for( size_t uxIdx = 0; uxIdx < pxCtx->uxResubscribeBatchCount; uxIdx++ )
+    {
+        uxSubCount += pxCtx->pxResubscribeBatches[ uxIdx ].xArgs.numSubscriptions;
+    }
+
+    pxCtx->ulResubscribeTimeMs = ( uint32_t ) pdTICKS_TO_MS( xTaskGetTickCount() - pxCtx->xConnAckTime );
+
+    LogInfo( "Re-subscribed %lu topic filters with %lu SUBSCRIBE packets, %lu ms after CONNACK.",
+             ( unsigned long ) uxSubCount,
+             ( unsigned long ) pxCtx->uxResubscribeBatchCount,
+             pxCtx->ulResubscribeTimeMs );
+
+    vPortFree( pxCtx->pxResubscribeBatches );
+    pxCtx->pxResubscribeBatches = NULL;
+    pxCtx->uxResubscribeBatchCount = 0;
+}
 
 /*-----------------------------------------------------------*/
 
 static void prvResubscribeCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
                                            MQTTAgentReturnInfo_t * pxReturnInfo )
 {
-    SubMgrCtx_t * pxCtx = ( SubMgrCtx_t * ) pxCommandContext;
+    ResubscribeBatch_t * pxBatch = ( ResubscribeBatch_t * ) pxCommandContext;
+    SubMgrCtx_t * pxCtx = NULL;
+    bool xLocked = false;
 
     configASSERT( pxCommandContext != NULL );
     configASSERT( pxReturnInfo != NULL );
-    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
 
-    /* Ignore pxReturnInfo->returnCode */
+    pxCtx = pxBatch->pxCtx;
 
-    for( uint32_t ulSubIdx = 0; ulSubIdx < pxCtx->uxSubscriptionCount; ulSubIdx++ )
+    /* The agent task already holds the mutex when commands are cancelled on reconnect. */
+    if( !MUTEX_IS_OWNED( pxCtx->xMutex ) )
     {
-        /* Update cached SubAck status */
-        pxCtx->pxSubAckStatus[ ulSubIdx ] = pxReturnInfo->pSubackCodes[ ulSubIdx ];
+        xLocked = ( xLockSubCtx( pxCtx ) == pdTRUE );
+    }
 
-        if( pxReturnInfo->pSubackCodes[ ulSubIdx ] == MQTTSubAckFailure )
+    configASSERT( pxCtx->uxResubscribePending > 0 );
+
+    /* Ignore pxReturnInfo->returnCode. pSubackCodes is NULL if the command was cancelled. */
+
+    for( uint32_t ulSubIdx = 0;
+         ( pxReturnInfo->pSubackCodes != NULL ) &&
+         ( ulSubIdx < pxBatch->xArgs.numSubscriptions );
+         ulSubIdx++ )
+    {
+        SubscriptionEntry_t * const pxEntry = pxBatch->ppxEntries[ ulSubIdx ];
+
+        /* NULL if the entry was removed while the SUBSCRIBE was in flight. */
+        if( pxEntry != NULL )
         {
-            MQTTSubscribeInfo_t * const pxSubInfo = &( pxCtx->pxSubscriptions[ ulSubIdx ] );
+            /* Update cached SubAck status */
+            pxEntry->xSubAckStatus = pxReturnInfo->pSubackCodes[ ulSubIdx ];
+        }
 
+        if( ( pxEntry != NULL ) &&
+            ( pxReturnInfo->pSubackCodes[ ulSubIdx ] == MQTTSubAckFailure ) )
+        {
             LogError( "Failed to re-subscribe to topic filter \"%.*s\".",
-                      pxSubInfo->topicFilterLength,
-                      pxSubInfo->pTopicFilter );
+                      pxEntry->xSubInfo.topicFilterLength,
+                      pxEntry->xSubInfo.pTopicFilter );
 
-            for( uint32_t ulCbIdx = 0; ulCbIdx < MQTT_AGENT_MAX_CALLBACKS; ulCbIdx++ )
+            for( SubCallbackElement_t * pxCbInfo = pxEntry->pxCallbacks;
+                 pxCbInfo != NULL;
+                 pxCbInfo = pxCbInfo->pxNext )
             {
-                SubCallbackElement_t * const pxCbInfo = &( pxCtx->pxCallbacks[ ulCbIdx ] );
-
-                if( ( pxCbInfo->pxSubInfo == pxSubInfo ) &&
-                    ( pxCbInfo->xTaskHandle != NULL ) )
+                if( pxCbInfo->xTaskHandle != NULL )
                 {
                     LogWarn( "Detected orphaned callback for task: %s due to failed re-subscribe operation.",
                              pcTaskGetName( pxCbInfo->xTaskHandle ) );
@@ -594,7 +959,102 @@ static void prvResubscribeCommandCallback( MQTTAgentCommandContext_t * pxCommand
         }
     }
 
-    ( void ) xUnlockSubCtx( pxCtx );
+    pxCtx->uxResubscribePending--;
+
+    if( pxCtx->uxResubscribePending == 0 )
+    {
+        prvResubscribeComplete( pxCtx );
+    }
+
+    if( xLocked )
+    {
+        ( void ) xUnlockSubCtx( pxCtx );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Size of a SUBSCRIBE packet with uxPayloadSize bytes of topic filters. */
+static size_t prvSubscribePacketSize( size_t uxPayloadSize )
+{
+    /* Packet identifier and payload */
+    size_t uxRemainingLength = 2U + uxPayloadSize;
+    size_t uxPacketSize = 1U + uxRemainingLength;
+
+    /* Remaining length is encoded with 7 bits per byte. */
+    do
+    {
+        uxPacketSize++;
+        uxRemainingLength >>= 7;
+    } while( uxRemainingLength > 0U );
+
+    return uxPacketSize;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Split the subscriptions into as few SUBSCRIBE packets as fit in the network
+ * buffer and return the number of packets. The batches and arrays are only
+ * filled in when they are not NULL, so the same walk sizes the allocation.
+ */
+static size_t prvPlanResubscribeBatches( SubMgrCtx_t * pxCtx,
+                                         ResubscribeBatch_t * pxBatches,
+                                         MQTTSubscribeInfo_t * pxSubInfoList,
+                                         SubscriptionEntry_t ** ppxEntries )
+{
+    size_t uxBatchCount = 0;
+    size_t uxBatchStart = 0;
+    size_t uxPayloadSize = 0;
+    size_t uxIdx = 0;
+
+    for( SubscriptionEntry_t * pxEntry = pxCtx->pxSubscriptions;
+         pxEntry != NULL;
+         pxEntry = pxEntry->pxNext )
+    {
+        /* Length prefix, filter and requested QoS byte */
+        size_t uxFilterSize = 2U + pxEntry->xSubInfo.topicFilterLength + 1U;
+
+        if( ( uxPayloadSize > 0U ) &&
+            ( prvSubscribePacketSize( uxPayloadSize + uxFilterSize ) > MQTT_AGENT_NETWORK_BUFFER_SIZE ) )
+        {
+            if( pxBatches != NULL )
+            {
+                pxBatches[ uxBatchCount ].xArgs.pSubscribeInfo = &( pxSubInfoList[ uxBatchStart ] );
+                pxBatches[ uxBatchCount ].xArgs.numSubscriptions = uxIdx - uxBatchStart;
+                pxBatches[ uxBatchCount ].ppxEntries = &( ppxEntries[ uxBatchStart ] );
+                pxBatches[ uxBatchCount ].pxCtx = pxCtx;
+            }
+
+            uxBatchCount++;
+            uxBatchStart = uxIdx;
+            uxPayloadSize = 0;
+        }
+
+        if( pxSubInfoList != NULL )
+        {
+            pxSubInfoList[ uxIdx ] = pxEntry->xSubInfo;
+            ppxEntries[ uxIdx ] = pxEntry;
+        }
+
+        uxPayloadSize += uxFilterSize;
+        uxIdx++;
+    }
+
+    if( uxIdx > uxBatchStart )
+    {
+        if( pxBatches != NULL )
+        {
+            pxBatches[ uxBatchCount ].xArgs.pSubscribeInfo = &( pxSubInfoList[ uxBatchStart ] );
+            pxBatches[ uxBatchCount ].xArgs.numSubscriptions = uxIdx - uxBatchStart;
+            pxBatches[ uxBatchCount ].ppxEntries = &( ppxEntries[ uxBatchStart ] );
+            pxBatches[ uxBatchCount ].pxCtx = pxCtx;
+        }
+
+        uxBatchCount++;
+    }
+
+    return uxBatchCount;
 }
 
 /*-----------------------------------------------------------*/
@@ -602,80 +1062,279 @@ static void prvResubscribeCommandCallback( MQTTAgentCommandContext_t * pxCommand
 static MQTTStatus_t prvHandleResubscribe( MQTTAgentContext_t * pxMqttAgentCtx,
                                           SubMgrCtx_t * pxCtx )
 {
-    MQTTStatus_t xStatus;
+    MQTTStatus_t xStatus = MQTTSuccess;
+    ResubscribeBatch_t * pxBatches = NULL;
+    size_t uxSubCount = 0;
+    size_t uxBatchCount = 0;
+    size_t uxFilterBytes = 0;
 
     configASSERT( pxCtx );
     configASSERT( pxCtx->xMutex );
     configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+    configASSERT( pxCtx->uxResubscribePending == 0 );
 
-    prvCompressSubscriptionList( pxCtx->pxSubscriptions,
-                                 pxCtx->pxCallbacks,
-                                 &( pxCtx->uxSubscriptionCount ) );
+    uxSubCount = pxCtx->uxSubscriptionCount;
 
-    if( pxCtx->uxSubscriptionCount > 0U )
+    if( uxSubCount > 0U )
     {
-        MQTTAgentCommandInfo_t xCommandParams =
+        uxBatchCount = prvPlanResubscribeBatches( pxCtx, NULL, NULL, NULL );
+
+        for( SubscriptionEntry_t * pxEntry = pxCtx->pxSubscriptions;
+             pxEntry != NULL;
+             pxEntry = pxEntry->pxNext )
         {
-            .blockTimeMs                 = 0U,
-            .cmdCompleteCallback         = prvResubscribeCommandCallback,
-            .pCmdCompleteCallbackContext = ( void * ) pxCtx,
-        };
+            uxFilterBytes += pxEntry->xSubInfo.topicFilterLength;
+        }
 
-        pxCtx->xInitialSubscribeArgs.pSubscribeInfo = pxCtx->pxSubscriptions;
-        pxCtx->xInitialSubscribeArgs.numSubscriptions = pxCtx->uxSubscriptionCount;
+        /* MQTTAgent_Subscribe needs the subscriptions of a packet in a contiguous array.
+         * The topic filters are copied as well, entries may be removed before the
+         * agent serializes the packets. */
+        pxBatches = pvPortMalloc( ( uxBatchCount * sizeof( ResubscribeBatch_t ) ) +
+                                  ( uxSubCount * ( sizeof( MQTTSubscribeInfo_t ) +
+                                                   sizeof( SubscriptionEntry_t * ) ) ) +
+                                  uxFilterBytes );
 
-        /* Enqueue the subscribe command */
-        xStatus = MQTTAgent_Subscribe( pxMqttAgentCtx,
-                                       &( pxCtx->xInitialSubscribeArgs ),
-                                       &xCommandParams );
+        if( pxBatches == NULL )
+        {
+            LogError( "Failed to allocate a resubscribe list for %lu subscriptions.",
+                      ( unsigned long ) uxSubCount );
+            xStatus = MQTTNoMemory;
+        }
+    }
 
-        /* prvResubscribeCommandCallback handles giving the mutex */
+    if( pxBatches != NULL )
+    {
+        MQTTSubscribeInfo_t * pxSubInfoList = ( MQTTSubscribeInfo_t * ) &( pxBatches[ uxBatchCount ] );
+        SubscriptionEntry_t ** ppxEntries = ( SubscriptionEntry_t ** ) &( pxSubInfoList[ uxSubCount ] );
+        char * pcFilters = ( char * ) &( ppxEntries[ uxSubCount ] );
 
-        if( xStatus != MQTTSuccess )
+        ( void ) prvPlanResubscribeBatches( pxCtx, pxBatches, pxSubInfoList, ppxEntries );
+
+        for( size_t uxIdx = 0; uxIdx < uxSubCount; uxIdx++ )
+        {
+            ( void ) memcpy( pcFilters, pxSubInfoList[ uxIdx ].pTopicFilter,
+                             pxSubInfoList[ uxIdx ].topicFilterLength );
+            pxSubInfoList[ uxIdx ].pTopicFilter = pcFilters;
+            pcFilters += pxSubInfoList[ uxIdx ].topicFilterLength;
+        }
+
+        pxCtx->pxResubscribeBatches = pxBatches;
+        pxCtx->uxResubscribeBatchCount = uxBatchCount;
+
+        /* Enqueue every SUBSCRIBE at once, the SUBACKs are matched by packet id
+         * so the agent does not wait for one before sending the next. */
+        for( size_t uxIdx = 0; uxIdx < uxBatchCount; uxIdx++ )
+        {
+            MQTTAgentCommandInfo_t xCommandParams =
+            {
+                .blockTimeMs                 = 0U,
+                .cmdCompleteCallback         = prvResubscribeCommandCallback,
+                .pCmdCompleteCallbackContext = ( void * ) &( pxBatches[ uxIdx ] ),
+            };
+
+            xStatus = MQTTAgent_Subscribe( pxMqttAgentCtx,
+                                           &( pxBatches[ uxIdx ].xArgs ),
+                                           &xCommandParams );
+
+            if( xStatus != MQTTSuccess )
+            {
+                LogError( "Failed to enqueue the MQTT subscribe command. xStatus=%s.",
+                          MQTT_Status_strerror( xStatus ) );
+
+                /* Only the batches already enqueued are waited for. */
+                pxCtx->uxResubscribeBatchCount = uxIdx;
+                break;
+            }
+
+            pxCtx->uxResubscribePending++;
+        }
+
+        if( pxCtx->uxResubscribePending == 0 )
         {
-            LogError( "Failed to enqueue the MQTT subscribe command. xStatus=%s.",
-                      MQTT_Status_strerror( xStatus ) );
+            vPortFree( pxBatches );
+            pxCtx->pxResubscribeBatches = NULL;
+            pxCtx->uxResubscribeBatchCount = 0;
         }
     }
-    else
+    else if( xStatus == MQTTSuccess )
     {
-        ( void ) xUnlockSubCtx( pxCtx );
-
         /* Mark the resubscribe as success if there is nothing to be subscribed to. */
-        xStatus = MQTTSuccess;
+    }
+    else
+    {
+        /* Empty */
     }
 
+    /* Incoming publishes are dispatched under the mutex while the SUBACKs are
+     * awaited. prvResubscribeCommandCallback takes it again to update the entries. */
+    ( void ) xUnlockSubCtx( pxCtx );
+
     return xStatus;
 }
 
 /*-----------------------------------------------------------*/
 
-static inline bool prvMatchTopic( MQTTSubscribeInfo_t * pxSubscribeInfo,
-                                  const char * pcTopicName,
-                                  const uint16_t usTopicLen )
+static inline bool prvMatchCbCtx( SubCallbackElement_t * pxCbCtx,
+                                  IncomingPubCallback_t pxCallback,
+                                  IncomingPubChunkCallback_t pxChunkCallback,
+                                  void * pvCallbackCtx )
 {
-    MQTTStatus_t xStatus = MQTTSuccess;
-    bool isMatched = false;
+    return( pxCbCtx->pvIncomingPublishCallbackContext == pvCallbackCtx &&
+            pxCbCtx->pxIncomingPublishCallback == pxCallback &&
+            pxCbCtx->pxChunkCallback == pxChunkCallback &&
+            pxCbCtx->xTaskHandle == xTaskGetCurrentTaskHandle() );
+}
+
+/*-----------------------------------------------------------*/
 
-    xStatus = MQTT_MatchTopic( pcTopicName,
-                               usTopicLen,
-                               pxSubscribeInfo->pTopicFilter,
-                               pxSubscribeInfo->topicFilterLength,
-                               &isMatched );
-    return ( xStatus == MQTTSuccess ) && isMatched;
+static SubCallbackElement_t * prvFindCallback( SubscriptionEntry_t * pxEntry,
+                                               IncomingPubCallback_t pxCallback,
+                                               IncomingPubChunkCallback_t pxChunkCallback,
+                                               void * pvCallbackCtx )
+{
+    SubCallbackElement_t * pxCbCtx = pxEntry->pxCallbacks;
+
+    while( ( pxCbCtx != NULL ) &&
+           !prvMatchCbCtx( pxCbCtx, pxCallback, pxChunkCallback, pvCallbackCtx ) )
+    {
+        pxCbCtx = pxCbCtx->pxNext;
+    }
+
+    return pxCbCtx;
 }
 
 /*-----------------------------------------------------------*/
 
-static inline bool prvMatchCbCtx( SubCallbackElement_t * pxCbCtx,
-                                  MQTTSubscribeInfo_t * pxSubInfo,
-                                  IncomingPubCallback_t pxCallback,
-                                  void * pvCallbackCtx )
+typedef struct DispatchCtx
 {
-    return( pxCbCtx->pxSubInfo == pxSubInfo &&
-            pxCbCtx->pvIncomingPublishCallbackContext == pvCallbackCtx &&
-            pxCbCtx->pxIncomingPublishCallback == pxCallback &&
-            pxCbCtx->xTaskHandle == xTaskGetCurrentTaskHandle() );
+    MQTTAgentHandle_t xHandle;
+    SubMgrCtx_t * pxCtx;
+    MQTTPublishInfo_t * pxPublishInfo;
+    MQTTAgentDelivery_t * pxDelivery;
+    bool xPublishHandled;
+} DispatchCtx_t;
+
+/*-----------------------------------------------------------*/
+
+/* Called by TopicTrie_Match for each subscription matching an incoming publish. */
+static void prvDispatchToSubscription( void * pvEntry,
+                                       void * pvDispatchCtx )
+{
+    SubscriptionEntry_t * const pxEntry = ( SubscriptionEntry_t * ) pvEntry;
+    DispatchCtx_t * const pxDispatchCtx = ( DispatchCtx_t * ) pvDispatchCtx;
+    MQTTPublishInfo_t * const pxPublishInfo = pxDispatchCtx->pxPublishInfo;
+
+    for( SubCallbackElement_t * pxCallback = pxEntry->pxCallbacks;
+         pxCallback != NULL;
+         pxCallback = pxCallback->pxNext )
+    {
+        if( pxCallback->pxDeliveryQueue != NULL )
+        {
+            MqttAgentDelivery_Queue( pxDispatchCtx->xHandle,
+                                     pxCallback->pxDeliveryQueue,
+                                     &( pxDispatchCtx->pxDelivery ),
+                                     pxPublishInfo,
+                                     pxCallback->pxIncomingPublishCallback,
+                                     pxCallback->pvIncomingPublishCallbackContext );
+        }
+        else if( pxCallback->pxChunkCallback != NULL )
+        {
+            /* The whole payload fits the network buffer, pass it in one piece. */
+            pxCallback->pxChunkCallback( pxCallback->pvIncomingPublishCallbackContext,
+                                         pxPublishInfo, 0U,
+                                         ( const uint8_t * ) pxPublishInfo->pPayload,
+                                         pxPublishInfo->payloadLength );
+        }
+        else
+        {
+            char * pcTaskName = pcTaskGetName( pxCallback->xTaskHandle );
+
+            if( !pcTaskName )
+            {
+                pcTaskName = "Unknown";
+            }
+
+            LogInfo( "Handling callback for task=%s, topic=\"%.*s\", filter=\"%.*s\".",
+                     pcTaskName,
+                     pxPublishInfo->topicNameLength, pxPublishInfo->pTopicName,
+                     pxEntry->xSubInfo.topicFilterLength, pxEntry->xSubInfo.pTopicFilter );
+
+            pxCallback->pxIncomingPublishCallback( pxCallback->pvIncomingPublishCallbackContext,
+                                                   pxPublishInfo );
+        }
+
+        pxDispatchCtx->xPublishHandled = true;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+typedef struct ChunkDispatchCtx
+{
+    const MQTTPublishInfo_t * pxPublishInfo;
+    size_t uxOffset;
+    const uint8_t * pucChunk;
+    size_t uxChunkLength;
+    size_t uxCallbacks;
+} ChunkDispatchCtx_t;
+
+/*-----------------------------------------------------------*/
+
+/* Called by TopicTrie_Match for each subscription matching a streamed publish. */
+static void prvDispatchChunkToSubscription( void * pvEntry,
+                                            void * pvDispatchCtx )
+{
+    SubscriptionEntry_t * const pxEntry = ( SubscriptionEntry_t * ) pvEntry;
+    ChunkDispatchCtx_t * const pxDispatchCtx = ( ChunkDispatchCtx_t * ) pvDispatchCtx;
+
+    for( SubCallbackElement_t * pxCallback = pxEntry->pxCallbacks;
+         pxCallback != NULL;
+         pxCallback = pxCallback->pxNext )
+    {
+        /* Other callbacks need the whole payload at once. */
+        if( pxCallback->pxChunkCallback != NULL )
+        {
+            pxCallback->pxChunkCallback( pxCallback->pvIncomingPublishCallbackContext,
+                                         pxDispatchCtx->pxPublishInfo,
+                                         pxDispatchCtx->uxOffset,
+                                         pxDispatchCtx->pucChunk,
+                                         pxDispatchCtx->uxChunkLength );
+            pxDispatchCtx->uxCallbacks++;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvDispatchChunk( void * pvCtx,
+                                const MQTTPublishInfo_t * pxPublishInfo,
+                                size_t uxOffset,
+                                const uint8_t * pucChunk,
+                                size_t uxChunkLength )
+{
+    SubMgrCtx_t * const pxCtx = ( SubMgrCtx_t * ) pvCtx;
+    ChunkDispatchCtx_t xDispatchCtx =
+    {
+        .pxPublishInfo = pxPublishInfo,
+        .uxOffset      = uxOffset,
+        .pucChunk      = pucChunk,
+        .uxChunkLength = uxChunkLength,
+        .uxCallbacks   = 0,
+    };
+
+    /* Locked per piece, so that subscribing does not wait for the whole payload. */
+    if( xLockSubCtx( pxCtx ) )
+    {
+        ( void ) TopicTrie_Match( &( pxCtx->xTopicTrie ),
+                                  pxPublishInfo->pTopicName,
+                                  pxPublishInfo->topicNameLength,
+                                  prvDispatchChunkToSubscription,
+                                  &xDispatchCtx );
+
+        ( void ) xUnlockSubCtx( pxCtx );
+    }
+
+    return xDispatchCtx.uxCallbacks;
 }
 
 /*-----------------------------------------------------------*/
@@ -685,6 +1344,7 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
                                         MQTTPublishInfo_t * pxPublishInfo )
 {
     SubMgrCtx_t * pxCtx = NULL;
+    MQTTAgentMessageContext_t * pxMsgCtx = NULL;
     bool xPublishHandled = false;
 
     ( void ) packetId;
@@ -695,35 +1355,39 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 
     pxCtx = ( SubMgrCtx_t * ) pMqttAgentContext->pIncomingCallbackContext;
 
+    /* xAgentContext is the first member of the task context. */
+    pxMsgCtx = &( ( ( MQTTAgentTaskCtx_t * ) pMqttAgentContext )->xAgentMessageCtx );
+
+    if( pxMsgCtx->xRecvReadyTimed )
+    {
+        pxMsgCtx->xRecvReadyTimed = false;
+        MqttAgentMetrics_PublishReceived( pxMsgCtx->ulRecvReadyTime );
+    }
+
     if( xLockSubCtx( pxCtx ) )
     {
-        /* Iterate over pxCtx->pxCallbacks list */
-        for( uint32_t ulCbIdx = 0; ulCbIdx < MQTT_AGENT_MAX_CALLBACKS; ulCbIdx++ )
+        DispatchCtx_t xDispatchCtx =
         {
-            SubCallbackElement_t * const pxCallback = &( pxCtx->pxCallbacks[ ulCbIdx ] );
-            MQTTSubscribeInfo_t * const pxSubInfo = pxCallback->pxSubInfo;
-
-            if( ( pxSubInfo != NULL ) &&
-                prvMatchTopic( pxSubInfo,
-                               pxPublishInfo->pTopicName,
-                               pxPublishInfo->topicNameLength ) )
-            {
-                char * pcTaskName = pcTaskGetName( pxCallback->xTaskHandle );
+            .xHandle         = pMqttAgentContext,
+            .pxCtx           = pxCtx,
+            .pxPublishInfo   = pxPublishInfo,
+            .pxDelivery      = NULL,
+            .xPublishHandled = false,
+        };
 
-                if( !pcTaskName )
-                {
-                    pcTaskName = "Unknown";
-                }
+        /* Only the subscriptions matching the topic name are visited. */
+        ( void ) TopicTrie_Match( &( pxCtx->xTopicTrie ),
+                                  pxPublishInfo->pTopicName,
+                                  pxPublishInfo->topicNameLength,
+                                  prvDispatchToSubscription,
+                                  &xDispatchCtx );
 
-                LogInfo( "Handling callback for task=%s, topic=\"%.*s\", filter=\"%.*s\".",
-                         pcTaskName,
-                         pxPublishInfo->topicNameLength, pxPublishInfo->pTopicName,
-                         pxSubInfo->topicFilterLength, pxSubInfo->pTopicFilter );
+        xPublishHandled = xDispatchCtx.xPublishHandled;
 
-                pxCallback->pxIncomingPublishCallback( pxCallback->pvIncomingPublishCallbackContext,
-                                                       pxPublishInfo );
-                xPublishHandled = true;
-            }
+        /* Drop the reference held while queuing to subscriber tasks. */
+        if( xDispatchCtx.pxDelivery != NULL )
+        {
+            MqttAgentDelivery_Release( xDispatchCtx.pxDelivery );
         }
 
         ( void ) xUnlockSubCtx( pxCtx );
@@ -738,6 +1402,36 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 
 /*-----------------------------------------------------------*/
 
+/* Free every subscription and callback, and retire the delivery queues. */
+static void prvSubscriptionManagerCtxClear( SubMgrCtx_t * pxSubMgrCtx )
+{
+    SubscriptionEntry_t * pxEntry = pxSubMgrCtx->pxSubscriptions;
+
+    while( pxEntry != NULL )
+    {
+        if( pxEntry->xSubInfo.pTopicFilter != NULL )
+        {
+            vPortFree( ( void * ) pxEntry->xSubInfo.pTopicFilter );
+        }
+
+        pxEntry = pxEntry->pxNext;
+    }
+
+    /* Releases the subscription entries and callback elements at once. */
+    SlabPool_Destroy( &( pxSubMgrCtx->xSlabPool ) );
+
+    TopicTrie_Free( &( pxSubMgrCtx->xTopicTrie ) );
+
+    pxSubMgrCtx->pxSubscriptions = NULL;
+    pxSubMgrCtx->uxSubscriptionCount = 0;
+    pxSubMgrCtx->uxCallbackCount = 0;
+
+    /* No callback is left, so no delivery queue is referenced. */
+    MqttAgentDelivery_RetireQueues( pxSubMgrCtx->pxDeliveryQueues );
+}
+
+/*-----------------------------------------------------------*/
+
 static void prvSubscriptionManagerCtxFree( SubMgrCtx_t * pxSubMgrCtx )
 {
     configASSERT( pxSubMgrCtx );
@@ -747,6 +1441,12 @@ static void prvSubscriptionManagerCtxFree( SubMgrCtx_t * pxSubMgrCtx )
         configASSERT_CONTINUE( MUTEX_IS_OWNED( pxSubMgrCtx->xMutex ) );
         vSemaphoreDelete( pxSubMgrCtx->xMutex );
     }
+
+    prvSubscriptionManagerCtxClear( pxSubMgrCtx );
+
+    /* The instance is going away with its queue slots, so its subscriber
+     * tasks must already have stopped calling MqttAgent_ProcessDeliveries. */
+    MqttAgentDelivery_FreeQueues( pxSubMgrCtx->pxDeliveryQueues );
 }
 
 /*-----------------------------------------------------------*/
@@ -756,29 +1456,12 @@ static void prvSubscriptionManagerCtxReset( SubMgrCtx_t * pxSubMgrCtx )
     configASSERT( pxSubMgrCtx );
     configASSERT_CONTINUE( MUTEX_IS_OWNED( pxSubMgrCtx->xMutex ) );
 
-    pxSubMgrCtx->uxSubscriptionCount = 0;
-    pxSubMgrCtx->uxCallbackCount = 0;
+    prvSubscriptionManagerCtxClear( pxSubMgrCtx );
 
-    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
-    {
-        pxSubMgrCtx->pxSubAckStatus[ uxIdx ] = MQTTSubAckFailure;
-        pxSubMgrCtx->pulSubCbCount[ uxIdx ] = 0;
-
-        pxSubMgrCtx->pxSubscriptions[ uxIdx ].pTopicFilter = NULL;
-        pxSubMgrCtx->pxSubscriptions[ uxIdx ].qos = 0;
-        pxSubMgrCtx->pxSubscriptions[ uxIdx ].topicFilterLength = 0;
-    }
+    configASSERT( pxSubMgrCtx->uxResubscribePending == 0 );
 
-    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
-    {
-        pxSubMgrCtx->pxCallbacks[ uxIdx ].pvIncomingPublishCallbackContext = NULL;
-        pxSubMgrCtx->pxCallbacks[ uxIdx ].pxIncomingPublishCallback = NULL;
-        pxSubMgrCtx->pxCallbacks[ uxIdx ].pxSubInfo = NULL;
-        pxSubMgrCtx->pxCallbacks[ uxIdx ].xTaskHandle = NULL;
-    }
-
-    pxSubMgrCtx->xInitialSubscribeArgs.numSubscriptions = 0;
-    pxSubMgrCtx->xInitialSubscribeArgs.pSubscribeInfo = NULL;
+    pxSubMgrCtx->pxResubscribeBatches = NULL;
+    pxSubMgrCtx->uxResubscribeBatchCount = 0;
 }
 
 /*-----------------------------------------------------------*/
@@ -789,6 +1472,13 @@ static MQTTStatus_t prvSubscriptionManagerCtxInit( SubMgrCtx_t * pxSubMgrCtx )
 
     configASSERT( pxSubMgrCtx );
 
+    TopicTrie_Init( &( pxSubMgrCtx->xTopicTrie ) );
+
+    SlabPool_Init( &( pxSubMgrCtx->xSlabPool ),
+                   sizeof( SubMgrSlot_t ),
+                   MQTT_AGENT_SUBSCRIPTION_SLAB_ENTRIES,
+                   MQTT_AGENT_SUBSCRIPTION_MEMORY_BUDGET );
+
     pxSubMgrCtx->xMutex = xSemaphoreCreateMutex();
 
     if( pxSubMgrCtx->xMutex )
@@ -811,23 +1501,31 @@ static void prvFreeAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx )
 {
     if( pxCtx )
     {
-        if( pxCtx->xAgentMessageCtx.xQueue != NULL )
-        {
-            vQueueDelete( pxCtx->xAgentMessageCtx.xQueue );
-        }
+        MqttAgentLanes_Free( &( pxCtx->xAgentMessageCtx.xLanes ) );
 
-        if( pxCtx->xConnectInfo.pClientIdentifier != NULL )
+        /* The first receive buffer belongs to the caller of prvConfigureAgentTaskCtx. */
+        for( size_t uxIdx = 1; uxIdx < MQTT_AGENT_RX_BUFFER_COUNT; uxIdx++ )
         {
-            vPortFree( ( void * ) pxCtx->xConnectInfo.pClientIdentifier );
-        }
-
-        if( pxCtx->pcMqttEndpoint != NULL )
-        {
-            vPortFree( pxCtx->pcMqttEndpoint );
+            if( pxCtx->pxRxBuffers[ uxIdx ].ulRefCount > 0 )
+            {
+                LogWarn( "Receive buffer %lu is still retained by a subscriber.", ( unsigned long ) uxIdx );
+            }
+            else if( pxCtx->pxRxBuffers[ uxIdx ].pucBuffer != NULL )
+            {
+                vPortFree( pxCtx->pxRxBuffers[ uxIdx ].pucBuffer );
+            }
+            else
+            {
+                /* Empty */
+            }
         }
 
         prvSubscriptionManagerCtxFree( &( pxCtx->xSubMgrCtx ) );
 
+        #if MQTT_AGENT_SESSION_STORE_ENABLED
+            MqttAgentSession_Free( &( pxCtx->xSessionStore ) );
+        #endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
         vPortFree( ( void * ) pxCtx );
     }
 }
@@ -835,6 +1533,7 @@ static void prvFreeAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx )
 /*-----------------------------------------------------------*/
 
 static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
+                                              const MQTTAgentInstanceConfig_t * pxConfig,
                                               NetworkContext_t * pxNetworkContext,
                                               uint8_t * pucNetworkBuffer,
                                               size_t uxNetworkBufferLen )
@@ -862,6 +1561,8 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
     {
         /* Zero Initialize */
         memset( pxCtx, 0, sizeof( MQTTAgentTaskCtx_t ) );
+
+        pxCtx->pxConfig = pxConfig;
     }
 
     if( xStatus == MQTTSuccess )
@@ -870,10 +1571,28 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
         pxCtx->xNetworkFixedBuffer.pBuffer = pucNetworkBuffer;
         pxCtx->xNetworkFixedBuffer.size = uxNetworkBufferLen;
 
-        /* Setup transport interface */
-        pxCtx->xTransport.pNetworkContext = pxNetworkContext;
-        pxCtx->xTransport.send = mbedtls_transport_send;
-        pxCtx->xTransport.recv = mbedtls_transport_recv;
+        /* Spare receive buffers are optional, MqttAgent_RetainPayload fails without them. */
+        pxCtx->pxRxBuffers[ 0 ].pucBuffer = pucNetworkBuffer;
+
+        for( size_t uxIdx = 1; uxIdx < MQTT_AGENT_RX_BUFFER_COUNT; uxIdx++ )
+        {
+            pxCtx->pxRxBuffers[ uxIdx ].pucBuffer = ( uint8_t * ) pvPortMalloc( uxNetworkBufferLen );
+
+            if( pxCtx->pxRxBuffers[ uxIdx ].pucBuffer == NULL )
+            {
+                LogWarn( "Failed to allocate %lu bytes for spare receive buffer %lu.",
+                         ( unsigned long ) uxNetworkBufferLen, ( unsigned long ) uxIdx );
+            }
+        }
+
+        /* Setup transport interface, writes pass through the coalescing buffer */
+        MqttAgentTransport_Init( &( pxCtx->xTransportCtx ),
+                                 &( pxCtx->xTransport ),
+                                 pxNetworkContext,
+                                 &( pxCtx->xAgentContext.mqttContext ),
+                                 uxNetworkBufferLen,
+                                 prvDispatchChunk,
+                                 &( pxCtx->xSubMgrCtx ) );
 
         /* MQTTConnectInfo_t */
         /* Always start the initial connection with a clean session */
@@ -884,7 +1603,7 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
         pxCtx->xConnectInfo.pPassword = NULL;
         pxCtx->xConnectInfo.passwordLength = 0U;
 
-        pxCtx->xConnectInfo.pClientIdentifier = mqtt_config.duid;
+        pxCtx->xConnectInfo.pClientIdentifier = pxConfig->pcClientId;
 
         if( pxCtx->xConnectInfo.pClientIdentifier != NULL ) {
 
@@ -906,16 +1625,16 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
 
     if( xStatus == MQTTSuccess )
     {
-        pxCtx->xAgentMessageCtx.xQueue = xQueueCreate( MQTT_AGENT_COMMAND_QUEUE_LENGTH,
-                                                       sizeof( MQTTAgentCommand_t * ) );
-
-        if( pxCtx->xAgentMessageCtx.xQueue == NULL )
-        {
-            xStatus = MQTTNoMemory;
-            LogError( "Failed to allocate MQTT Agent message queue." );
-        }
+        xStatus = MqttAgentLanes_Init( &( pxCtx->xAgentMessageCtx.xLanes ),
+                                       pxConfig->pxRateClasses,
+                                       pxConfig->uxRateClassCount,
+                                       prvGetTimeMs() );
 
         pxCtx->xAgentMessageCtx.xAgentTaskHandle = xTaskGetCurrentTaskHandle();
+        pxCtx->xAgentMessageCtx.pxTransport = &( pxCtx->xTransportCtx );
+        pxCtx->xAgentMessageCtx.pxKeepAlive = &( pxCtx->xKeepAlive );
+        pxCtx->xAgentMessageCtx.pxMqttContext = &( pxCtx->xAgentContext.mqttContext );
+        pxCtx->xAgentMessageCtx.ulInstance = pxConfig->ulInstance;
     }
 
     if( xStatus == MQTTSuccess )
@@ -930,9 +1649,7 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
 
     if( xStatus == MQTTSuccess )
     {
-        pxCtx->pcMqttEndpoint = mqtt_config.host;
-
-        if( pxCtx->pcMqttEndpoint == NULL || strlen(pxCtx->pcMqttEndpoint) == 0)
+        if( pxConfig->pcEndpoint == NULL || strlen(pxConfig->pcEndpoint) == 0)
         {
             LogError( "Invalid mqtt endpoint." );
             xStatus = MQTTNoMemory;
@@ -941,9 +1658,7 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
 
     if( xStatus == MQTTSuccess )
     {
-        pxCtx->ulMqttPort = mqtt_config.port;
-
-        if( ( pxCtx->ulMqttPort == 0 ) ||
+        if( ( pxConfig->usPort == 0 ) ||
             ( xSuccess == pdFALSE ) )
         {
             LogError( "Invalid mqtt port number." );
@@ -966,29 +1681,74 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
 
 /*-----------------------------------------------------------*/
 
+MQTTAgentHandle_t xGetMqttAgentHandleForInstance( uint32_t ulInstance )
+{
+    MQTTAgentHandle_t xHandle = NULL;
+
+    if( ( ulInstance < MQTT_AGENT_MAX_INSTANCES ) &&
+        ( ( xEventGroupGetBits( xSystemEvents ) & EVT_MASK_MQTT_INIT_INSTANCE( ulInstance ) ) != 0 ) )
+    {
+        xHandle = &( pxInstances[ ulInstance ]->xAgentContext );
+    }
+
+    return xHandle;
+}
+
+/*-----------------------------------------------------------*/
+
 MQTTAgentHandle_t xGetMqttAgentHandle( void )
 {
-    return xDefaultInstanceHandle;
+    return xGetMqttAgentHandleForInstance( prvGetTaskInstance() );
 }
 
 /*-----------------------------------------------------------*/
 
-extern void vLogCertInfo( mbedtls_x509_crt * pxCert, const char * pcMessage );
+void vMQTTAgentSetTaskInstance( uint32_t ulInstance )
+{
+    configASSERT( ulInstance < MQTT_AGENT_MAX_INSTANCES );
 
-#define MQTTS_PORT		8883
+    vTaskSetThreadLocalStoragePointer( NULL, MQTT_AGENT_INSTANCE_TLS_IDX,
+                                       ( void * ) ( ( uintptr_t ) ulInstance + 1 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+extern void vLogCertInfo( mbedtls_x509_crt * pxCert, const char * pcMessage );
 
 void vMQTTAgentTask(void *arg)
 {
     IotConnectDeviceClientConfig *client_config = arg;
 
-    mqtt_config.host = client_config->host;
-    mqtt_config.port = MQTTS_PORT;
-    mqtt_config.duid = client_config->duid;
     mqtt_config.root_ca_cert = client_config->auth->mqtt_root_ca;
     mqtt_config.client_certificate =
 			client_config->auth->data.cert_info.device_cert;
     mqtt_config.private_key = client_config->auth->data.cert_info.device_key;
 
+    mqtt_config.instance.ulInstance = MQTT_AGENT_DEFAULT_INSTANCE;
+    mqtt_config.instance.pcEndpoint = client_config->host;
+    mqtt_config.instance.usPort = MQTTS_PORT;
+    mqtt_config.instance.pcClientId = client_config->duid;
+    mqtt_config.instance.pxRootCaCert = &mqtt_config.root_ca_cert;
+    mqtt_config.instance.pxClientCert = &mqtt_config.client_certificate;
+    mqtt_config.instance.pxPrivateKey = &mqtt_config.private_key;
+    mqtt_config.instance.uxNetworkBufferSize = MQTT_AGENT_NETWORK_BUFFER_SIZE;
+
+    #if MQTT_AGENT_PUBLISH_RATE_LIMIT_ENABLED
+        mqtt_config.instance.pxRateClasses = xDefaultRateClasses;
+        mqtt_config.instance.uxRateClassCount = sizeof( xDefaultRateClasses ) / sizeof( xDefaultRateClasses[ 0 ] );
+    #else
+        mqtt_config.instance.pxRateClasses = NULL;
+        mqtt_config.instance.uxRateClassCount = 0U;
+    #endif
+
+    vMQTTAgentInstanceTask( &mqtt_config.instance );
+}
+
+/*-----------------------------------------------------------*/
+
+void vMQTTAgentInstanceTask( void * pvParameters )
+{
+    const MQTTAgentInstanceConfig_t * pxConfig = ( const MQTTAgentInstanceConfig_t * ) pvParameters;
     MQTTStatus_t xMQTTStatus = MQTTSuccess;
     TlsTransportStatus_t xTlsStatus = TLS_TRANSPORT_CONNECT_FAILURE;
     BaseType_t xExitFlag = pdFALSE;
@@ -997,17 +1757,46 @@ void vMQTTAgentTask(void *arg)
     uint8_t * pucNetworkBuffer = NULL;
     NetworkContext_t * pxNetworkContext = NULL;
     uint16_t usNextRetryBackOff = 0U;
+    size_t uxNetworkBufferSize = 0U;
+    EventBits_t uxInitMask = 0U;
+    EventBits_t uxConnectedMask = 0U;
 
-    /* Miscellaneous initialization. */
-    ulGlobalEntryTimeMs = prvGetTimeMs();
+    configASSERT( pxConfig != NULL );
+    configASSERT( pxConfig->ulInstance < MQTT_AGENT_MAX_INSTANCES );
 
-    /* Memory Allocation */
-    pucNetworkBuffer = ( uint8_t * ) pvPortMalloc( MQTT_AGENT_NETWORK_BUFFER_SIZE );
+    uxNetworkBufferSize = ( pxConfig->uxNetworkBufferSize > 0U ) ? pxConfig->uxNetworkBufferSize : MQTT_AGENT_NETWORK_BUFFER_SIZE;
+    uxInitMask = EVT_MASK_MQTT_INIT_INSTANCE( pxConfig->ulInstance );
+    uxConnectedMask = EVT_MASK_MQTT_CONNECTED_INSTANCE( pxConfig->ulInstance );
 
-    if( pucNetworkBuffer == NULL )
+    /* Miscellaneous initialization, shared by all instances. */
+    vTaskSuspendAll();
     {
-        LogError( "Failed to allocate %d bytes for pucNetworkBuffer.", MQTT_AGENT_NETWORK_BUFFER_SIZE );
-        xMQTTStatus = MQTTNoMemory;
+        if( !xGlobalEntryTimeSet )
+        {
+            ulGlobalEntryTimeMs = prvGetTimeMs();
+            xGlobalEntryTimeSet = true;
+        }
+
+        Agent_InitializePool();
+    }
+    ( void ) xTaskResumeAll();
+
+    if( pxInstances[ pxConfig->ulInstance ] != NULL )
+    {
+        LogError( "MQTT agent instance %lu is already running.", ( unsigned long ) pxConfig->ulInstance );
+        xMQTTStatus = MQTTBadParameter;
+    }
+
+    /* Memory Allocation */
+    if( xMQTTStatus == MQTTSuccess )
+    {
+        pucNetworkBuffer = ( uint8_t * ) pvPortMalloc( uxNetworkBufferSize );
+
+        if( pucNetworkBuffer == NULL )
+        {
+            LogError( "Failed to allocate %lu bytes for pucNetworkBuffer.", ( unsigned long ) uxNetworkBufferSize );
+            xMQTTStatus = MQTTNoMemory;
+        }
     }
 
     if( xMQTTStatus == MQTTSuccess )
@@ -1025,9 +1814,9 @@ void vMQTTAgentTask(void *arg)
     {
         xTlsStatus = mbedtls_transport_configure( pxNetworkContext,
                                                   pcAlpnProtocols,
-                                                  &mqtt_config.private_key,
-                                                  &mqtt_config.client_certificate,
-                                                  &mqtt_config.root_ca_cert,
+                                                  pxConfig->pxPrivateKey,
+                                                  pxConfig->pxClientCert,
+                                                  pxConfig->pxRootCaCert,
                                                   1 );
 
         if( xTlsStatus != TLS_TRANSPORT_SUCCESS )
@@ -1043,9 +1832,10 @@ void vMQTTAgentTask(void *arg)
 
         if( pxCtx != NULL )
         {
-            xMQTTStatus = prvConfigureAgentTaskCtx( pxCtx, pxNetworkContext,
+            xMQTTStatus = prvConfigureAgentTaskCtx( pxCtx, pxConfig,
+                                                    pxNetworkContext,
                                                     pucNetworkBuffer,
-                                                    MQTT_AGENT_NETWORK_BUFFER_SIZE );
+                                                    uxNetworkBufferSize );
         }
         else
         {
@@ -1054,11 +1844,6 @@ void vMQTTAgentTask(void *arg)
         }
     }
 
-    if( xMQTTStatus == MQTTSuccess )
-    {
-        Agent_InitializePool();
-    }
-
     if( xMQTTStatus == MQTTSuccess )
     {
         /* Initialize the MQTT context with the buffer and transport interface. */
@@ -1076,8 +1861,16 @@ void vMQTTAgentTask(void *arg)
         }
         else
         {
-            ( void ) xEventGroupSetBits( xSystemEvents, EVT_MASK_MQTT_INIT );
-            xDefaultInstanceHandle = &( pxCtx->xAgentContext );
+            #if MQTT_AGENT_SESSION_STORE_ENABLED
+                /* The store only holds the publishes of the default instance. */
+                if( pxConfig->ulInstance == MQTT_AGENT_DEFAULT_INSTANCE )
+                {
+                    prvSessionStoreInit( pxCtx );
+                }
+            #endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+            pxInstances[ pxConfig->ulInstance ] = pxCtx;
+            ( void ) xEventGroupSetBits( xSystemEvents, uxInitMask );
         }
     }
 
@@ -1124,12 +1917,12 @@ void vMQTTAgentTask(void *arg)
                                           pdTRUE,
                                           portMAX_DELAY );
 
-            LogInfo( "Attempting a TLS connection to %s:%d.",
-                     pxCtx->pcMqttEndpoint, pxCtx->ulMqttPort );
+            LogInfo( "Attempting a TLS connection to %s:%u.",
+                     pxConfig->pcEndpoint, pxConfig->usPort );
 
             xTlsStatus = mbedtls_transport_connect( pxNetworkContext,
-                                                    pxCtx->pcMqttEndpoint,
-                                                    ( uint16_t ) pxCtx->ulMqttPort,
+                                                    pxConfig->pcEndpoint,
+                                                    pxConfig->usPort,
                                                     0, 0 );
 
             if( xTlsStatus != TLS_TRANSPORT_SUCCESS )
@@ -1170,6 +1963,16 @@ void vMQTTAgentTask(void *arg)
 
             configASSERT_CONTINUE( MUTEX_IS_OWNED( pxCtx->xSubMgrCtx.xMutex ) );
 
+            pxCtx->xSubMgrCtx.xConnAckTime = xTaskGetTickCount();
+
+            #if MQTT_AGENT_SESSION_STORE_ENABLED
+                /* Restored before MQTTAgent_ResumeSession, which resends them. */
+                if( ( xMQTTStatus == MQTTSuccess ) && ( pxCtx->xSessionStore.pxRestored != NULL ) )
+                {
+                    MqttAgentSession_Restore( &( pxCtx->xSessionStore ), xSessionPresent );
+                }
+            #endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
             /* Resume a session if desired. */
             if( ( xMQTTStatus == MQTTSuccess ) &&
                 ( pxCtx->xConnectInfo.cleanSession == false ) )
@@ -1229,7 +2032,10 @@ void vMQTTAgentTask(void *arg)
 
         if( xMQTTStatus == MQTTSuccess )
         {
-            ( void ) xEventGroupSetBits( xSystemEvents, EVT_MASK_MQTT_CONNECTED );
+            ( void ) xEventGroupSetBits( xSystemEvents, uxConnectedMask );
+
+            MqttKeepAlive_Start( &( pxCtx->xKeepAlive ), &( pxCtx->xAgentContext.mqttContext ) );
+            pxCtx->xAgentMessageCtx.xConnected = true;
 
             /* Reset backoff timer */
             BackoffAlgorithm_InitializeParams( &xReconnectParams,
@@ -1246,13 +2052,30 @@ void vMQTTAgentTask(void *arg)
 
             LogDebug( "MQTTAgent_CommandLoop returned with status: %s.",
                       MQTT_Status_strerror( xMQTTStatus ) );
+
+            pxCtx->xAgentMessageCtx.xConnected = false;
+            pxCtx->xAgentMessageCtx.pxLastCommand = NULL;
+            MqttKeepAlive_Stop( &( pxCtx->xKeepAlive ), xMQTTStatus );
         }
 
-        ( void ) MQTTAgent_CancelAll( &( pxCtx->xAgentContext ) );
+        ( void ) MQTTAgent_CancelAll( &( pxCtx->xAgentContext ) );
+
+        #if MQTT_AGENT_SESSION_STORE_ENABLED
+            /* The cancelled publishes were reported as failed, drop their records. */
+            if( pxCtx->xAgentMessageCtx.pxSessionStore != NULL )
+            {
+                MqttAgentSession_Sync( pxCtx->xAgentMessageCtx.pxSessionStore, prvGetTimeMs(), true );
+            }
+        #endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+        MqttAgentLanes_CancelHeld( &( pxCtx->xAgentMessageCtx.xLanes ) );
+
+        /* Unsent QoS0 publishes are lost with the connection. */
+        MqttAgentTransport_Reset( &( pxCtx->xTransportCtx ) );
 
         mbedtls_transport_disconnect( pxNetworkContext );
 
-        ( void ) xEventGroupClearBits( xSystemEvents, EVT_MASK_MQTT_CONNECTED );
+        ( void ) xEventGroupClearBits( xSystemEvents, uxConnectedMask );
 
         /* Wait for any subscription related calls to complete */
         if( !MUTEX_IS_OWNED( pxCtx->xSubMgrCtx.xMutex ) )
@@ -1261,9 +2084,12 @@ void vMQTTAgentTask(void *arg)
         }
 
         /* Reset subscription status */
-        memset( pxCtx->xSubMgrCtx.pxSubAckStatus,
-                MQTTSubAckFailure,
-                sizeof( pxCtx->xSubMgrCtx.pxSubAckStatus ) );
+        for( SubscriptionEntry_t * pxEntry = pxCtx->xSubMgrCtx.pxSubscriptions;
+             pxEntry != NULL;
+             pxEntry = pxEntry->pxNext )
+        {
+            pxEntry->xSubAckStatus = MQTTSubAckFailure;
+        }
 
         if( !xExitFlag )
         {
@@ -1289,6 +2115,12 @@ void vMQTTAgentTask(void *arg)
 
     if( pxCtx != NULL )
     {
+        if( pxInstances[ pxConfig->ulInstance ] == pxCtx )
+        {
+            ( void ) xEventGroupClearBits( xSystemEvents, uxInitMask | uxConnectedMask );
+            pxInstances[ pxConfig->ulInstance ] = NULL;
+        }
+
         prvFreeAgentTaskCtx( pxCtx );
         pxCtx = NULL;
     }
@@ -1300,9 +2132,7 @@ void vMQTTAgentTask(void *arg)
         pxNetworkContext = NULL;
     }
 
-    ( void ) xEventGroupClearBits( xSystemEvents, EVT_MASK_MQTT_INIT | EVT_MASK_MQTT_CONNECTED );
-
-    LogError( "Terminating MqttAgentTask." );
+    LogError( "Terminating MqttAgentTask for instance %lu.", ( unsigned long ) pxConfig->ulInstance );
 
     vTaskDelete( NULL );
 }
@@ -1428,11 +2258,15 @@ static inline MQTTStatus_t prvSendSubRequest( MQTTAgentContext_t * pxAgentCtx,
 
 /*-----------------------------------------------------------*/
 
-MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
+/* Exactly one of pxCallback and pxChunkCallback is set. Deferred delivery
+ * (uxDeliveryQueueLength > 0) is only available to pxCallback. */
+static MQTTStatus_t prvSubscribeSync( MQTTAgentHandle_t xHandle,
                                       const char * pcTopicFilter,
                                       MQTTQoS_t xRequestedQoS,
                                       IncomingPubCallback_t pxCallback,
-                                      void * pvCallbackCtx )
+                                      IncomingPubChunkCallback_t pxChunkCallback,
+                                      void * pvCallbackCtx,
+                                      UBaseType_t uxDeliveryQueueLength )
 {
     MQTTStatus_t xStatus = MQTTSuccess;
     size_t xTopicFilterLen = 0;
@@ -1441,7 +2275,7 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
 
     if( ( xHandle == NULL ) ||
         ( pcTopicFilter == NULL ) ||
-        ( pxCallback == NULL ) ||
+        ( ( pxCallback == NULL ) == ( pxChunkCallback == NULL ) ) ||
         !prvValidateQoS( xRequestedQoS ) )
     {
         xStatus = MQTTBadParameter;
@@ -1460,133 +2294,106 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
     if( ( xStatus == MQTTSuccess ) &&
         xLockSubCtx( pxCtx ) )
     {
-        size_t uxTargetSubIdx = MQTT_AGENT_MAX_SUBSCRIPTIONS;
-        size_t uxTargetCbIdx = MQTT_AGENT_MAX_CALLBACKS;
+        SubscriptionEntry_t * pxEntry = NULL;
+        SubCallbackElement_t * pxCbCtx = NULL;
+        DeliveryQueue_t * pxDeliveryQueue = NULL;
+        bool xNewEntry = false;
+        bool xSendSubscribe = false;
 
-        /* If no slot is found, return MQTTNoMemory */
-        xStatus = MQTTNoMemory;
+        pxEntry = prvFindSubscription( pxCtx, pcTopicFilter, xTopicFilterLen );
 
-        for( size_t uxSubIdx = 0U; uxSubIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxSubIdx++ )
+        if( pxEntry != NULL )
         {
-            MQTTSubscribeInfo_t * const pxSubInfo = &( pxCtx->pxSubscriptions[ uxSubIdx ] );
-
-            if( ( pxCtx->pxSubscriptions[ uxSubIdx ].pTopicFilter == NULL ) &&
-                ( uxTargetSubIdx == MQTT_AGENT_MAX_SUBSCRIPTIONS ) )
-            {
-                /* Check that the current context is indeed empty */
-                configASSERT( pxCtx->pxSubscriptions[ uxSubIdx ].topicFilterLength == 0 );
-
-                uxTargetSubIdx = uxSubIdx;
-                xStatus = MQTTSuccess;
-
-                /* Reset SubAckStatus to trigger a subscribe op */
-                pxCtx->pxSubAckStatus[ uxTargetSubIdx ] = MQTTSubAckFailure;
-            }
-            else if( strncmp( pxSubInfo->pTopicFilter, pcTopicFilter, pxSubInfo->topicFilterLength ) == 0 )
-            {
-                xRequestedQoS = prvGetNewQoS( pxSubInfo->qos, xRequestedQoS );
-                xStatus = MQTTSuccess;
-                uxTargetSubIdx = uxSubIdx;
+            xRequestedQoS = prvGetNewQoS( pxEntry->xSubInfo.qos, xRequestedQoS );
 
-                /* If QoS differs, trigger a subscribe op */
-                if( pxSubInfo->qos != xRequestedQoS )
-                {
-                    pxCtx->pxSubAckStatus[ uxTargetSubIdx ] = MQTTSubAckFailure;
-                }
-
-                break;
-            }
-            else
+            /* If QoS differs, trigger a subscribe op */
+            if( pxEntry->xSubInfo.qos != xRequestedQoS )
             {
-                /* Empty */
+                pxEntry->xSubAckStatus = MQTTSubAckFailure;
             }
         }
+        else
+        {
+            pxEntry = prvAddSubscription( pxCtx, pcTopicFilter, xTopicFilterLen );
+            xNewEntry = true;
+        }
 
-        /* Add Callback to list */
-        if( xStatus == MQTTSuccess )
+        if( pxEntry == NULL )
         {
-            /* If no slot is found, return MQTTNoMemory */
             xStatus = MQTTNoMemory;
+        }
+        else
+        {
+            pxCbCtx = prvFindCallback( pxEntry, pxCallback, pxChunkCallback, pvCallbackCtx );
+        }
 
-            /* Find matching or empty callback context */
-            for( size_t uxCbIdx = 0U; uxCbIdx < MQTT_AGENT_MAX_CALLBACKS; uxCbIdx++ )
+        /* Add Callback to list */
+        if( ( xStatus == MQTTSuccess ) && ( pxCbCtx == NULL ) )
+        {
+            /* Deferred callbacks need a delivery queue for the calling task */
+            if( uxDeliveryQueueLength > 0U )
             {
-                if( ( uxTargetCbIdx == MQTT_AGENT_MAX_CALLBACKS ) &&
-                    ( pxCtx->pxCallbacks[ uxCbIdx ].pxSubInfo == NULL ) )
-                {
-                    uxTargetCbIdx = uxCbIdx;
-                    xStatus = MQTTSuccess;
-                }
-                else if( prvMatchCbCtx( &( pxCtx->pxCallbacks[ uxCbIdx ] ),
-                                        &( pxCtx->pxSubscriptions[ uxTargetSubIdx ] ),
-                                        pxCallback,
-                                        pvCallbackCtx ) )
+                pxDeliveryQueue = MqttAgentDelivery_AcquireQueue( pxCtx->pxDeliveryQueues, pxCtx->xMutex, uxDeliveryQueueLength );
+
+                if( pxDeliveryQueue == NULL )
                 {
-                    uxTargetCbIdx = uxCbIdx;
-                    xStatus = MQTTSuccess;
-                    break;
+                    xStatus = MQTTNoMemory;
                 }
             }
-        }
 
-        /*
-         * Populate the subscription entry (by copying topic filter to heap)
-         */
-        if( ( xStatus == MQTTSuccess ) &&
-            ( pxCtx->pxSubAckStatus[ uxTargetSubIdx ] == MQTTSubAckFailure ) )
-        {
-            if( pxCtx->pxSubscriptions[ uxTargetSubIdx ].pTopicFilter == NULL )
+            if( xStatus == MQTTSuccess )
             {
-                char * pcDupTopicFilter = pvPortMalloc( xTopicFilterLen + 1 );
+                pxCbCtx = prvAddCallback( pxCtx, pxEntry );
 
-                if( pcDupTopicFilter == NULL )
+                if( pxCbCtx == NULL )
                 {
                     xStatus = MQTTNoMemory;
                 }
-                else
-                {
-                    ( void ) strncpy( pcDupTopicFilter, pcTopicFilter, xTopicFilterLen + 1 );
+            }
 
-                    /* Ensure null terminated */
-                    pcDupTopicFilter[ xTopicFilterLen ] = '\00';
+            if( xStatus == MQTTSuccess )
+            {
+                pxCbCtx->xTaskHandle = xTaskGetCurrentTaskHandle();
+                pxCbCtx->pxIncomingPublishCallback = pxCallback;
+                pxCbCtx->pxChunkCallback = pxChunkCallback;
+                pxCbCtx->pvIncomingPublishCallbackContext = pvCallbackCtx;
+                pxCbCtx->pxDeliveryQueue = pxDeliveryQueue;
 
-                    pxCtx->pxSubscriptions[ uxTargetSubIdx ].pTopicFilter = pcDupTopicFilter;
-                    pxCtx->pxSubscriptions[ uxTargetSubIdx ].topicFilterLength = ( uint16_t ) xTopicFilterLen;
+                /* The callback entry now owns the delivery queue reference. */
+                pxDeliveryQueue = NULL;
 
-                    pxCtx->uxSubscriptionCount++;
-                }
-            }
+                /* Increment subscription reference count. */
+                pxEntry->ulCallbackCount++;
 
-            pxCtx->pxSubscriptions[ uxTargetSubIdx ].qos = xRequestedQoS;
+                LogInfo( "Callback registered with filter=\"%.*s\".", xTopicFilterLen, pcTopicFilter );
+            }
         }
 
-        /*
-         * Populate the callback entry
-         */
-        if( ( xStatus == MQTTSuccess ) &&
-            ( pxCtx->pxCallbacks[ uxTargetCbIdx ].pxSubInfo == NULL ) )
+        if( pxDeliveryQueue != NULL )
         {
-            pxCtx->pxCallbacks[ uxTargetCbIdx ].pxSubInfo = &( pxCtx->pxSubscriptions[ uxTargetSubIdx ] );
-            pxCtx->pxCallbacks[ uxTargetCbIdx ].xTaskHandle = xTaskGetCurrentTaskHandle();
-            pxCtx->pxCallbacks[ uxTargetCbIdx ].pxIncomingPublishCallback = pxCallback;
-            pxCtx->pxCallbacks[ uxTargetCbIdx ].pvIncomingPublishCallbackContext = pvCallbackCtx;
-
-            /* Increment subscription reference count. */
-            pxCtx->pulSubCbCount[ uxTargetSubIdx ]++;
+            MqttAgentDelivery_ReleaseQueue( pxDeliveryQueue );
+        }
 
-            pxCtx->uxCallbackCount++;
+        if( ( xStatus != MQTTSuccess ) && xNewEntry && ( pxEntry != NULL ) )
+        {
+            prvRemoveSubscription( pxCtx, pxEntry );
+            pxEntry = NULL;
+        }
 
-            LogInfo( "Callback registered with filter=\"%.*s\".", xTopicFilterLen, pcTopicFilter );
+        if( ( xStatus == MQTTSuccess ) &&
+            ( pxEntry->xSubAckStatus == MQTTSubAckFailure ) )
+        {
+            pxEntry->xSubInfo.qos = xRequestedQoS;
+            xSendSubscribe = true;
         }
 
         ( void ) xUnlockSubCtx( pxCtx );
 
-        if( ( xStatus == MQTTSuccess ) &&
-            ( pxCtx->pxSubAckStatus[ uxTargetSubIdx ] == MQTTSubAckFailure ) )
+        if( xSendSubscribe )
         {
             xStatus = prvSendSubRequest( &( pxTaskCtx->xAgentContext ),
-                                         &( pxCtx->pxSubscriptions[ uxTargetSubIdx ] ),
-                                         &( pxCtx->pxSubAckStatus[ uxTargetSubIdx ] ),
+                                         &( pxEntry->xSubInfo ),
+                                         &( pxEntry->xSubAckStatus ),
                                          portMAX_DELAY );
         }
     }
@@ -1601,6 +2408,48 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
+                                      const char * pcTopicFilter,
+                                      MQTTQoS_t xRequestedQoS,
+                                      IncomingPubCallback_t pxCallback,
+                                      void * pvCallbackCtx )
+{
+    return prvSubscribeSync( xHandle, pcTopicFilter, xRequestedQoS,
+                             pxCallback, NULL, pvCallbackCtx, 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_SubscribeSyncDeferred( MQTTAgentHandle_t xHandle,
+                                              const char * pcTopicFilter,
+                                              MQTTQoS_t xRequestedQoS,
+                                              IncomingPubCallback_t pxCallback,
+                                              void * pvCallbackCtx,
+                                              UBaseType_t uxQueueLength )
+{
+    if( uxQueueLength == 0U )
+    {
+        uxQueueLength = MQTT_AGENT_DELIVERY_QUEUE_LENGTH;
+    }
+
+    return prvSubscribeSync( xHandle, pcTopicFilter, xRequestedQoS,
+                             pxCallback, NULL, pvCallbackCtx, uxQueueLength );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_SubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                            const char * pcTopicFilter,
+                                            MQTTQoS_t xRequestedQoS,
+                                            IncomingPubChunkCallback_t pxChunkCallback,
+                                            void * pvCallbackCtx )
+{
+    return prvSubscribeSync( xHandle, pcTopicFilter, xRequestedQoS,
+                             NULL, pxChunkCallback, pvCallbackCtx, 0U );
+}
+
+/*-----------------------------------------------------------*/
+
 static void prvAgentRequestCallback( MQTTAgentCommandContext_t * pxCommandContext,
                                      MQTTAgentReturnInfo_t * pxReturnInfo )
 {
@@ -1677,20 +2526,20 @@ static inline MQTTStatus_t prvSendUnsubRequest( MQTTAgentContext_t * pxAgentCtx,
 
 /*-----------------------------------------------------------*/
 
-MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
+static MQTTStatus_t prvUnSubscribeSync( MQTTAgentHandle_t xHandle,
                                         const char * pcTopicFilter,
                                         IncomingPubCallback_t pxCallback,
+                                        IncomingPubChunkCallback_t pxChunkCallback,
                                         void * pvCallbackCtx )
 {
     MQTTStatus_t xStatus = MQTTSuccess;
     size_t xTopicFilterLen = 0;
     MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
     SubMgrCtx_t * pxCtx = &( pxTaskCtx->xSubMgrCtx );
-    uint32_t ulCallbackCount = 0;
 
     if( ( xHandle == NULL ) ||
         ( pcTopicFilter == NULL ) ||
-        ( pxCallback == NULL ) )
+        ( ( pxCallback == NULL ) == ( pxChunkCallback == NULL ) ) )
     {
         xStatus = MQTTBadParameter;
     }
@@ -1706,28 +2555,43 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
 
     if( xStatus == MQTTSuccess )
     {
-        xStatus = MQTTNoDataAvailable;
+        bool xSendUnsubscribe = false;
 
         /* Acquire mutex */
         if( xLockSubCtx( pxCtx ) )
         {
-            /* Find matching subscription context */
-            for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
+            SubscriptionEntry_t * pxEntry = prvFindSubscription( pxCtx, pcTopicFilter, xTopicFilterLen );
+            SubCallbackElement_t * pxCbCtx = NULL;
+
+            if( pxEntry != NULL )
+            {
+                pxCbCtx = prvFindCallback( pxEntry, pxCallback, pxChunkCallback, pvCallbackCtx );
+            }
+
+            if( pxCbCtx == NULL )
+            {
+                xStatus = MQTTNoDataAvailable;
+            }
+            else
             {
-                if( ( xTopicFilterLen == pxCtx->pxSubscriptions[ uxIdx ].topicFilterLength ) &&
-                    ( strncmp( pxCtx->pxSubscriptions[ uxIdx ].pTopicFilter,
-                               pcTopicFilter,
-                               pxCtx->pxSubscriptions[ uxIdx ].topicFilterLength ) == 0 ) )
+                if( pxCbCtx->pxDeliveryQueue != NULL )
                 {
-                    ulCallbackCount = pxCtx->pulSubCbCount[ uxIdx ];
+                    MqttAgentDelivery_PurgeQueue( pxCbCtx->pxDeliveryQueue, pxCallback, pvCallbackCtx );
+                    MqttAgentDelivery_ReleaseQueue( pxCbCtx->pxDeliveryQueue );
+                }
 
-                    if( ulCallbackCount > 0 )
-                    {
-                        pxCtx->pulSubCbCount[ uxIdx ] = ulCallbackCount - 1;
-                    }
+                prvRemoveCallback( pxCtx, pxEntry, pxCbCtx );
 
-                    xStatus = MQTTSuccess;
-                    break;
+                LogInfo( "Callback de-registered, filter=\"%.*s\".", xTopicFilterLen, pcTopicFilter );
+
+                configASSERT( pxEntry->ulCallbackCount > 0 );
+                pxEntry->ulCallbackCount--;
+
+                /* Remove the subscription with its last callback */
+                if( pxEntry->ulCallbackCount == 0 )
+                {
+                    xSendUnsubscribe = true;
+                    prvRemoveSubscription( pxCtx, pxEntry );
                 }
             }
 
@@ -1739,9 +2603,8 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
             LogError( "Failed to acquire MQTTAgent mutex." );
         }
 
-        /* Send unsubscribe request if only one callback is left for this subscription */
-        if( ( xStatus == MQTTSuccess ) &&
-            ( ulCallbackCount == 1 ) )
+        /* Send unsubscribe request once the last callback for this subscription is gone */
+        if( xSendUnsubscribe )
         {
             /* TODO: Use a reasonable timeout value here */
             xStatus = prvSendUnsubRequest( &( pxTaskCtx->xAgentContext ),
@@ -1750,86 +2613,288 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
                                            MQTTQoS1,
                                            portMAX_DELAY );
         }
+    }
 
-        /* Acquire mutex */
-        if( xLockSubCtx( pxCtx ) )
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
+                                        const char * pcTopicFilter,
+                                        IncomingPubCallback_t pxCallback,
+                                        void * pvCallbackCtx )
+{
+    return prvUnSubscribeSync( xHandle, pcTopicFilter, pxCallback, NULL, pvCallbackCtx );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_UnSubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                              const char * pcTopicFilter,
+                                              IncomingPubChunkCallback_t pxChunkCallback,
+                                              void * pvCallbackCtx )
+{
+    return prvUnSubscribeSync( xHandle, pcTopicFilter, NULL, pxChunkCallback, pvCallbackCtx );
+}
+
+/*-----------------------------------------------------------*/
+
+size_t MqttAgent_ProcessDeliveries( MQTTAgentHandle_t xHandle,
+                                    TickType_t xTicksToWait )
+{
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+    size_t uxDelivered = 0;
+
+    if( xHandle != NULL )
+    {
+        uxDelivered = MqttAgentDelivery_Process( pxTaskCtx->xSubMgrCtx.pxDeliveryQueues,
+                                                 pxTaskCtx->xSubMgrCtx.xMutex,
+                                                 xTicksToWait );
+    }
+    else
+    {
+        vTaskDelay( xTicksToWait );
+    }
+
+    return uxDelivered;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_GetDeliveryStats( MQTTAgentHandle_t xHandle,
+                                         TaskHandle_t xTaskHandle,
+                                         MQTTAgentDeliveryStats_t * pxStats )
+{
+    MQTTStatus_t xStatus = MQTTNoDataAvailable;
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+
+    if( ( xHandle == NULL ) || ( pxStats == NULL ) )
+    {
+        xStatus = MQTTBadParameter;
+    }
+    else
+    {
+        DeliveryQueue_t * pxDeliveryQueue = NULL;
+
+        if( xTaskHandle == NULL )
         {
-            MQTTSubscribeInfo_t * pxSubInfo = NULL;
-            size_t uxSubInfoIdx = MQTT_AGENT_MAX_SUBSCRIPTIONS;
+            xTaskHandle = xTaskGetCurrentTaskHandle();
+        }
 
-            /* Find matching subscription context again */
-            for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
-            {
-                if( ( pxCtx->pulSubCbCount[ uxIdx ] == 0 ) &&
-                    ( xTopicFilterLen == pxCtx->pxSubscriptions[ uxIdx ].topicFilterLength ) &&
-                    ( strncmp( pxCtx->pxSubscriptions[ uxIdx ].pTopicFilter,
-                               pcTopicFilter,
-                               pxCtx->pxSubscriptions[ uxIdx ].topicFilterLength ) == 0 ) )
-                {
-                    uxSubInfoIdx = uxIdx;
-                    pxSubInfo = &( pxCtx->pxSubscriptions[ uxIdx ] );
-                    xStatus = MQTTSuccess;
-                    break;
-                }
-            }
+        pxDeliveryQueue = MqttAgentDelivery_GetQueue( pxTaskCtx->xSubMgrCtx.pxDeliveryQueues, xTaskHandle );
 
-            if( xStatus == MQTTSuccess )
-            {
-                xStatus = MQTTNoDataAvailable;
+        if( pxDeliveryQueue != NULL )
+        {
+            *pxStats = pxDeliveryQueue->xStats;
+            xStatus = MQTTSuccess;
+        }
+    }
 
-                /* Find matching callback context, and remove it. */
-                for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
-                {
-                    SubCallbackElement_t * pxCbCtx = &( pxCtx->pxCallbacks[ uxIdx ] );
+    return xStatus;
+}
 
-                    if( prvMatchCbCtx( pxCbCtx, pxSubInfo, pxCallback, pvCallbackCtx ) )
-                    {
-                        xStatus = MQTTSuccess;
-                        pxCbCtx->pvIncomingPublishCallbackContext = NULL;
-                        pxCbCtx->pxIncomingPublishCallback = NULL;
-                        pxCbCtx->pxSubInfo = NULL;
-                        pxCbCtx->xTaskHandle = NULL;
+/*-----------------------------------------------------------*/
 
-                        configASSERT( pxCtx->uxCallbackCount > 0 );
+static RxBuffer_t * prvFindRxBuffer( MQTTAgentTaskCtx_t * pxCtx,
+                                     const uint8_t * pucData )
+{
+    RxBuffer_t * pxRxBuffer = NULL;
 
-                        pxCtx->uxCallbackCount--;
+    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_RX_BUFFER_COUNT; uxIdx++ )
+    {
+        const uint8_t * pucBuffer = pxCtx->pxRxBuffers[ uxIdx ].pucBuffer;
 
-                        LogInfo( "Callback de-registered, filter=\"%.*s\".", xTopicFilterLen, pcTopicFilter );
+        if( ( pucBuffer != NULL ) &&
+            ( pucData >= pucBuffer ) &&
+            ( pucData < &( pucBuffer[ pxCtx->xNetworkFixedBuffer.size ] ) ) )
+        {
+            pxRxBuffer = &( pxCtx->pxRxBuffers[ uxIdx ] );
+            break;
+        }
+    }
 
-                        prvCompressCallbackList( pxCtx->pxCallbacks, &( pxCtx->uxCallbackCount ) );
-                        break;
-                    }
-                }
+    return pxRxBuffer;
+}
 
-                if( ( xStatus == MQTTSuccess ) &&
-                    ( ulCallbackCount == 1 ) &&
-                    ( pxCtx->pulSubCbCount[ uxSubInfoIdx ] == 0 ) )
-                {
-                    /* Free heap allocated topic filter */
-                    vPortFree( ( void * ) pxSubInfo->pTopicFilter );
+/*-----------------------------------------------------------*/
 
-                    pxSubInfo->pTopicFilter = NULL;
-                    pxSubInfo->topicFilterLength = 0;
-                    pxSubInfo->qos = 0;
-                    pxCtx->pxSubAckStatus[ uxSubInfoIdx ] = MQTTSubAckFailure;
+/*
+ * Give coreMQTT a free receive buffer in place of the one holding pxPublishInfo.
+ *
+ * After the publish callback returns, coreMQTT moves any bytes received after
+ * the publish packet to the start of networkBuffer.pBuffer. Those bytes are
+ * copied to the same offset in the new buffer so that the move still works.
+ */
+static bool prvSwapRxBuffer( MQTTAgentTaskCtx_t * pxCtx,
+                             const MQTTPublishInfo_t * pxPublishInfo )
+{
+    MQTTContext_t * pxMqttContext = &( pxCtx->xAgentContext.mqttContext );
+    uint8_t * pucActive = pxMqttContext->networkBuffer.pBuffer;
+    RxBuffer_t * pxFreeBuffer = NULL;
+    size_t uxPacketEnd = 0;
 
-                    configASSERT( pxCtx->uxSubscriptionCount > 0 );
+    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_RX_BUFFER_COUNT; uxIdx++ )
+    {
+        RxBuffer_t * pxRxBuffer = &( pxCtx->pxRxBuffers[ uxIdx ] );
 
-                    if( pxCtx->uxSubscriptionCount > 0 )
-                    {
-                        pxCtx->uxSubscriptionCount--;
-                    }
-                }
-            }
+        if( ( pxRxBuffer->pucBuffer != NULL ) &&
+            ( pxRxBuffer->pucBuffer != pucActive ) &&
+            ( pxRxBuffer->ulRefCount == 0 ) )
+        {
+            pxFreeBuffer = pxRxBuffer;
+            break;
+        }
+    }
 
-            ( void ) xUnlockSubCtx( pxCtx );
+    if( pxFreeBuffer != NULL )
+    {
+        /* The payload is the last field of a publish packet. */
+        if( pxPublishInfo->payloadLength > 0 )
+        {
+            uxPacketEnd = ( size_t ) ( ( const uint8_t * ) pxPublishInfo->pPayload - pucActive ) +
+                          pxPublishInfo->payloadLength;
         }
         else
         {
-            xStatus = MQTTIllegalState;
-            LogError( "Failed to acquire MQTTAgent mutex." );
+            uxPacketEnd = ( size_t ) ( ( const uint8_t * ) pxPublishInfo->pTopicName - pucActive ) +
+                          pxPublishInfo->topicNameLength +
+                          ( ( pxPublishInfo->qos > MQTTQoS0 ) ? sizeof( uint16_t ) : 0U );
+        }
+
+        configASSERT( uxPacketEnd <= pxMqttContext->index );
+
+        ( void ) memcpy( &( pxFreeBuffer->pucBuffer[ uxPacketEnd ] ),
+                         &( pucActive[ uxPacketEnd ] ),
+                         pxMqttContext->index - uxPacketEnd );
+
+        pxMqttContext->networkBuffer.pBuffer = pxFreeBuffer->pucBuffer;
+    }
+    else
+    {
+        LogDebug( "No spare receive buffer to retain publish on topic=\"%.*s\".",
+                  pxPublishInfo->topicNameLength, pxPublishInfo->pTopicName );
+    }
+
+    return( pxFreeBuffer != NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTAgentPayloadHandle_t MqttAgent_RetainPayload( MQTTAgentHandle_t xHandle,
+                                                  const MQTTPublishInfo_t * pxPublishInfo )
+{
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+    RxBuffer_t * pxRxBuffer = NULL;
+
+    if( ( xHandle != NULL ) &&
+        ( pxPublishInfo != NULL ) &&
+        ( pxTaskCtx->xAgentMessageCtx.xAgentTaskHandle == xTaskGetCurrentTaskHandle() ) )
+    {
+        pxRxBuffer = prvFindRxBuffer( pxTaskCtx, ( const uint8_t * ) pxPublishInfo->pTopicName );
+
+        /* The first retain of a publish takes the buffer away from coreMQTT. */
+        if( ( pxRxBuffer != NULL ) &&
+            ( pxRxBuffer->pucBuffer == pxTaskCtx->xAgentContext.mqttContext.networkBuffer.pBuffer ) &&
+            !prvSwapRxBuffer( pxTaskCtx, pxPublishInfo ) )
+        {
+            pxRxBuffer = NULL;
         }
+
+        if( pxRxBuffer != NULL )
+        {
+            ( void ) Atomic_Increment_u32( &( pxRxBuffer->ulRefCount ) );
+        }
+    }
+
+    return pxRxBuffer;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgent_ReleasePayload( MQTTAgentPayloadHandle_t xPayload )
+{
+    if( xPayload != NULL )
+    {
+        configASSERT( xPayload->ulRefCount > 0 );
+
+        /* The buffer becomes available to prvSwapRxBuffer once the count reaches zero. */
+        ( void ) Atomic_Decrement_u32( &( xPayload->ulRefCount ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_PublishTry( MQTTAgentHandle_t xHandle,
+                                   MQTTPublishInfo_t * pxPublishInfo,
+                                   const MQTTAgentCommandInfo_t * pxCommandInfo )
+{
+    MQTTStatus_t xStatus = MQTTBadParameter;
+
+    if( pxCommandInfo != NULL )
+    {
+        MQTTAgentCommandInfo_t xCommandInfo = *pxCommandInfo;
+
+        /* Neither wait for a command structure nor for room in the lane. */
+        xCommandInfo.blockTimeMs = 0U;
+
+        xStatus = MQTTAgent_Publish( xHandle, pxPublishInfo, &xCommandInfo );
     }
 
     return xStatus;
 }
+
+/*-----------------------------------------------------------*/
+
+bool xMQTTAgentGetLaneStats( MQTTAgentHandle_t xHandle,
+                             MQTTAgentLane_t xLane,
+                             MQTTAgentLaneStats_t * pxStats )
+{
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+
+    return( ( pxTaskCtx != NULL ) &&
+            MqttAgentLanes_GetStats( &( pxTaskCtx->xAgentMessageCtx.xLanes ), xLane, pxStats ) );
+}
+
+/*-----------------------------------------------------------*/
+
+bool xMQTTAgentAddLaneWatermark( MQTTAgentHandle_t xHandle,
+                                 MQTTAgentLane_t xLane,
+                                 uint32_t ulHighWatermark,
+                                 uint32_t ulLowWatermark,
+                                 MQTTAgentWatermarkCallback_t pxCallback,
+                                 void * pvCallbackCtx )
+{
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+
+    return( ( pxTaskCtx != NULL ) &&
+            MqttAgentLanes_AddWatermark( &( pxTaskCtx->xAgentMessageCtx.xLanes ), xLane,
+                                         ulHighWatermark, ulLowWatermark,
+                                         pxCallback, pvCallbackCtx ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void vMQTTAgentRemoveLaneWatermark( MQTTAgentHandle_t xHandle,
+                                    MQTTAgentWatermarkCallback_t pxCallback,
+                                    void * pvCallbackCtx )
+{
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+
+    if( pxTaskCtx != NULL )
+    {
+        MqttAgentLanes_RemoveWatermark( &( pxTaskCtx->xAgentMessageCtx.xLanes ), pxCallback, pvCallbackCtx );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool xMQTTAgentGetRateStats( MQTTAgentHandle_t xHandle,
+                             size_t uxClass,
+                             MqttRateStats_t * pxStats )
+{
+    MQTTAgentTaskCtx_t * pxTaskCtx = ( MQTTAgentTaskCtx_t * ) xHandle;
+
+    return( ( pxTaskCtx != NULL ) &&
+            MqttRateLimit_GetStats( &( pxTaskCtx->xAgentMessageCtx.xLanes.xRateLimit ), uxClass, pxStats ) );
+}
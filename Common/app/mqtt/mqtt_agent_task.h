@@ -4,11 +4,125 @@
 #include "FreeRTOS.h"
 #include <stdbool.h>
 
+#include "core_mqtt_agent.h"
+#include "mqtt_rate_limit.h"
+
 struct MQTTAgentTaskCtx;
+struct PkiObject;
 typedef struct MQTTAgentContext * MQTTAgentHandle_t;
 
+/* Number of agent instances, each with its own broker connection, that can
+ * run at the same time. */
+#ifndef MQTT_AGENT_MAX_INSTANCES
+    #define MQTT_AGENT_MAX_INSTANCES    2U
+#endif /* MQTT_AGENT_MAX_INSTANCES */
+
+/* Instance started by vMQTTAgentTask, used by every task that does not call
+ * vMQTTAgentSetTaskInstance. */
+#define MQTT_AGENT_DEFAULT_INSTANCE     0U
+
+/* Connection settings of an agent instance. Referenced, not copied, so it must
+ * stay valid for as long as the instance runs. */
+typedef struct MQTTAgentInstanceConfig
+{
+    uint32_t ulInstance;                  /* Below MQTT_AGENT_MAX_INSTANCES. */
+    const char * pcEndpoint;
+    uint16_t usPort;
+    const char * pcClientId;              /* Must be unique among the instances. */
+    const struct PkiObject * pxRootCaCert;
+    const struct PkiObject * pxClientCert;
+    const struct PkiObject * pxPrivateKey;
+    size_t uxNetworkBufferSize;           /* 0 for MQTT_AGENT_NETWORK_BUFFER_SIZE. */
+    const MqttRateClass_t * pxRateClasses; /* Publish rate limits, see mqtt_rate_limit.h. NULL for none. */
+    size_t uxRateClassCount;
+} MQTTAgentInstanceConfig_t;
+
+/* Handle of the instance selected by the calling task. NULL until that
+ * instance is initialized. */
 MQTTAgentHandle_t xGetMqttAgentHandle( void );
 
+MQTTAgentHandle_t xGetMqttAgentHandleForInstance( uint32_t ulInstance );
+
+/* Select the instance used by xGetMqttAgentHandle, vSleepUntilMQTTAgentReady,
+ * vSleepUntilMQTTAgentConnected and xIsMqttAgentConnected when called from the
+ * calling task. Call it before looking up the handle. */
+void vMQTTAgentSetTaskInstance( uint32_t ulInstance );
+
+/* Command queues serviced by the agent. The high lane is always drained first,
+ * the normal lane is favored over the bulk lane by MQTT_AGENT_LANE_NORMAL_WEIGHT. */
+typedef enum MQTTAgentLane
+{
+    MQTT_AGENT_LANE_HIGH = 0,
+    MQTT_AGENT_LANE_NORMAL,
+    MQTT_AGENT_LANE_BULK,
+    MQTT_AGENT_NUM_LANES
+} MQTTAgentLane_t;
+
+typedef struct MQTTAgentLaneStats
+{
+    uint32_t ulEnqueued;       /* Commands accepted by the lane. */
+    uint32_t ulRejected;       /* Commands not accepted because the lane was full. */
+    uint32_t ulDequeued;       /* Commands picked up by the agent. */
+    uint32_t ulMaxDepth;       /* Most commands waiting in the lane at once. */
+    uint32_t ulMaxWaitMs;      /* Longest time a command waited in the lane. */
+    uint32_t ulTotalWaitMs;    /* Sum of the wait time of every dequeued command. */
+    uint32_t ulHighWatermarks; /* Times the lane reached a registered high watermark. */
+} MQTTAgentLaneStats_t;
+
+/* Select the lane used for PUBLISH commands sent by the calling task. Other
+ * commands (SUBSCRIBE, UNSUBSCRIBE, ...) always use the high lane.
+ * Tasks use MQTT_AGENT_LANE_NORMAL until this is called. */
+void vMQTTAgentSetTaskLane( MQTTAgentLane_t xLane );
+
+bool xMQTTAgentGetLaneStats( MQTTAgentHandle_t xHandle,
+                             MQTTAgentLane_t xLane,
+                             MQTTAgentLaneStats_t * pxStats );
+
+/* Called with xAboveHigh true when the number of commands waiting in a lane
+ * reaches the high watermark, and with xAboveHigh false once it has fallen back
+ * to the low watermark. Runs in the task that queued or dequeued the command,
+ * with the scheduler suspended, so it must not block or call FreeRTOS APIs
+ * other than those that may be called with the scheduler suspended, such as
+ * xEventGroupSetBits. Setting a flag polled by the producer is enough. */
+typedef void ( * MQTTAgentWatermarkCallback_t )( void * pvCallbackCtx,
+                                                 bool xAboveHigh );
+
+/* Let a producer throttle or batch its publishes before the lane is full.
+ * ulLowWatermark must be below ulHighWatermark, which must not exceed
+ * MQTT_AGENT_COMMAND_QUEUE_LENGTH. Up to MQTT_AGENT_LANE_MAX_WATERMARKS
+ * watermarks may be registered on each lane. */
+bool xMQTTAgentAddLaneWatermark( MQTTAgentHandle_t xHandle,
+                                 MQTTAgentLane_t xLane,
+                                 uint32_t ulHighWatermark,
+                                 uint32_t ulLowWatermark,
+                                 MQTTAgentWatermarkCallback_t pxCallback,
+                                 void * pvCallbackCtx );
+
+/* Remove the watermarks registered with pxCallback and pvCallbackCtx. */
+void vMQTTAgentRemoveLaneWatermark( MQTTAgentHandle_t xHandle,
+                                    MQTTAgentWatermarkCallback_t pxCallback,
+                                    void * pvCallbackCtx );
+
+/* Statistics of the instance's rate class uxClass, in the order of
+ * MQTTAgentInstanceConfig_t.pxRateClasses, skipping classes with a zero rate. */
+bool xMQTTAgentGetRateStats( MQTTAgentHandle_t xHandle,
+                             size_t uxClass,
+                             MqttRateStats_t * pxStats );
+
+/* Publishes from the calling task written to the offline journal (see
+ * mqtt_journal.h) instead of being queued while the agent is disconnected.
+ * A journaled publish completes successfully at once and is sent after the
+ * reconnect, so only tasks whose publishes stay meaningful when late, such as
+ * telemetry, should opt in. Request and response traffic must not. */
+typedef enum MQTTAgentJournalMode
+{
+    MQTT_AGENT_JOURNAL_NONE = 0, /* Never journal publishes from this task. The default. */
+    MQTT_AGENT_JOURNAL_QOS1,     /* QoS1 and QoS2 publishes only. */
+    MQTT_AGENT_JOURNAL_ALL       /* QoS0 publishes as well. */
+} MQTTAgentJournalMode_t;
+
+void vMQTTAgentSetTaskJournalMode( MQTTAgentJournalMode_t xMode );
+
 /* Event group based mechanism that can be used to block tasks until agent is ready */
 void vSleepUntilMQTTAgentReady( void );
 
@@ -16,7 +130,52 @@ void vSleepUntilMQTTAgentConnected( void );
 
 bool xIsMqttAgentConnected( void );
 
+/* Returns the number of payload bytes available at *ppucChunk, starting
+ * uxOffset bytes into the payload, or 0 on failure. Called from the agent task
+ * while the PUBLISH packet is written, so it must not block for long. The
+ * chunk only needs to stay valid until the next call. */
+typedef size_t ( * MQTTAgentStreamProducer_t )( void * pvProducerCtx,
+                                                size_t uxOffset,
+                                                const uint8_t ** ppucChunk );
+
+/* Payload of a publish sent with MqttAgent_PublishStream. Must stay valid
+ * until the command completes. */
+typedef struct MQTTAgentPublishStream
+{
+    MQTTAgentStreamProducer_t pxProducer;
+    void * pvProducerCtx;
+
+    /* Set by MqttAgent_PublishStream. */
+    MQTTAgentCommandCallback_t pxCmdCompleteCallback;
+    MQTTAgentCommandContext_t * pxCmdCompleteCallbackContext;
+} MQTTAgentPublishStream_t;
+
+/* Publish pxPublishInfo->payloadLength bytes supplied by pxStream's producer.
+ * The payload is written to the connection chunk by chunk after the PUBLISH
+ * header, so it does not need to be held in RAM or fit the network buffer.
+ * pxPublishInfo->pPayload is set to a placeholder by this function; the agent
+ * recognizes the command while it is being sent. If the producer fails
+ * part way the packet cannot be completed and the connection is dropped.
+ * Streamed publishes are never written to the offline journal. */
+MQTTStatus_t MqttAgent_PublishStream( MQTTAgentHandle_t xHandle,
+                                      MQTTPublishInfo_t * pxPublishInfo,
+                                      MQTTAgentPublishStream_t * pxStream,
+                                      const MQTTAgentCommandInfo_t * pxCommandInfo );
+
+/* Same as MQTTAgent_Publish, but never blocks. Returns MQTTNoMemory if every
+ * command structure is in use and MQTTSendFailed if the publish's lane is full,
+ * in which case the publish is not sent and its callback is not called. The
+ * topic and payload must stay valid until the command completes. */
+MQTTStatus_t MqttAgent_PublishTry( MQTTAgentHandle_t xHandle,
+                                   MQTTPublishInfo_t * pxPublishInfo,
+                                   const MQTTAgentCommandInfo_t * pxCommandInfo );
+
+/* Runs the default instance, pvParameters is the IotConnectDeviceClientConfig
+ * passed by iotconnect_init(). */
 void vMQTTAgentTask( void * pvParameters );
 
+/* Runs the instance described by pvParameters, a MQTTAgentInstanceConfig_t. */
+void vMQTTAgentInstanceTask( void * pvParameters );
+
 
 #endif /* ifndef _MQTT_AGENT_TASK_H_ */
@@ -0,0 +1,877 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "core_mqtt_serializer.h"
+#include "core_mqtt_state.h"
+
+#include "mqtt_agent_transport.h"
+#include "mqtt_agent_metrics.h"
+#include "mbedtls_transport.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Time without progress after which a send or a streamed receive fails.
+ */
+#define SEND_TIMEOUT_MS    ( 2000U )
+
+/* Payload pointer of streamed publishes, never read. */
+static const uint8_t ucStreamedPayload[ 1 ] = { 0 };
+
+/*-----------------------------------------------------------*/
+
+/* Completion callback of the publishes of MqttAgent_PublishStream, which also
+ * marks their commands as streamed. */
+static void prvStreamCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                      MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    MQTTAgentPublishStream_t * pxStream = ( MQTTAgentPublishStream_t * ) pxCommandContext;
+
+    configASSERT( pxStream != NULL );
+
+    if( pxStream->pxCmdCompleteCallback != NULL )
+    {
+        pxStream->pxCmdCompleteCallback( pxStream->pxCmdCompleteCallbackContext, pxReturnInfo );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvIsQoS0Publish( const MQTTAgentCommand_t * pxCommand )
+{
+    return( ( pxCommand != NULL ) &&
+            ( pxCommand->commandType == PUBLISH ) &&
+            ( pxCommand->pArgs != NULL ) &&
+            ( ( ( const MQTTPublishInfo_t * ) pxCommand->pArgs )->qos == MQTTQoS0 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Write to the TLS connection, recording the time taken. */
+static inline int32_t prvTransportWrite( NetworkContext_t * pxNetworkContext,
+                                         const void * pvBuffer,
+                                         size_t uxLength )
+{
+    uint32_t ulStartTime = MqttAgentMetrics_Now();
+    int32_t lResult = mbedtls_transport_send( pxNetworkContext, pvBuffer, uxLength );
+
+    MqttAgentMetrics_Sent( ulStartTime );
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Write all of pucData, giving up after SEND_TIMEOUT_MS without progress. */
+static bool prvSendAll( NetworkContext_t * pxNetworkContext,
+                        const uint8_t * pucData,
+                        size_t uxLength )
+{
+    size_t uxSent = 0;
+    bool xFailed = false;
+    TickType_t xLastProgressTime = xTaskGetTickCount();
+
+    while( !xFailed && ( uxSent < uxLength ) )
+    {
+        int32_t lResult = prvTransportWrite( pxNetworkContext,
+                                             &( pucData[ uxSent ] ),
+                                             uxLength - uxSent );
+
+        if( lResult > 0 )
+        {
+            uxSent += ( size_t ) lResult;
+            xLastProgressTime = xTaskGetTickCount();
+        }
+        else if( ( lResult < 0 ) ||
+                 ( ( xTaskGetTickCount() - xLastProgressTime ) > pdMS_TO_TICKS( SEND_TIMEOUT_MS ) ) )
+        {
+            LogError( "Failed to send %lu bytes, lResult=%ld.",
+                      ( unsigned long ) ( uxLength - uxSent ), ( long ) lResult );
+            xFailed = true;
+        }
+        else
+        {
+            /* Nothing was sent, try again. */
+        }
+    }
+
+    return !xFailed;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvTxFlush( MqttAgentTransport_t * pxTransport )
+{
+    MqttAgentTxCoalesce_t * const pxTx = &( pxTransport->xTx );
+
+    if( !pxTx->xFlushFailed && ( pxTx->uxPending > 0 ) )
+    {
+        pxTx->xFlushFailed = !prvSendAll( pxTransport->pxNetworkContext, pxTx->pucBuffer, pxTx->uxPending );
+    }
+
+    if( pxTx->uxPending > 0 )
+    {
+        pxTx->ulFlushes++;
+    }
+
+    pxTx->uxPending = 0;
+
+    return !pxTx->xFlushFailed;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvTxDeadlineExpired( const MqttAgentTxCoalesce_t * pxTx )
+{
+    return( ( pxTx->uxPending > 0 ) &&
+            ( ( xTaskGetTickCount() - pxTx->xFirstPendingTime ) >= pdMS_TO_TICKS( MQTT_AGENT_TX_COALESCE_MAX_DELAY_MS ) ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t prvStreamSend( MqttAgentTransport_t * pxTransport,
+                              MQTTAgentPublishStream_t * pxStream,
+                              size_t uxLength )
+{
+    size_t uxOffset = 0;
+    bool xSuccess = true;
+
+    while( xSuccess && ( uxOffset < uxLength ) )
+    {
+        const uint8_t * pucChunk = NULL;
+        size_t uxChunkLength = pxStream->pxProducer( pxStream->pvProducerCtx, uxOffset, &pucChunk );
+
+        if( ( uxChunkLength == 0 ) || ( pucChunk == NULL ) )
+        {
+            LogError( "Stream producer failed at offset %lu of %lu.",
+                      ( unsigned long ) uxOffset, ( unsigned long ) uxLength );
+            xSuccess = false;
+        }
+        else
+        {
+            if( uxChunkLength > ( uxLength - uxOffset ) )
+            {
+                uxChunkLength = uxLength - uxOffset;
+            }
+
+            xSuccess = prvSendAll( pxTransport->pxNetworkContext, pucChunk, uxChunkLength );
+            uxOffset += uxChunkLength;
+        }
+    }
+
+    return( xSuccess ? ( int32_t ) uxLength : -1 );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Transport send used by coreMQTT. While the agent is processing a QoS0 publish,
+ * the packet is appended to the coalescing buffer instead of being written to
+ * the TLS connection. Any other packet is sent immediately after the buffer.
+ */
+static int32_t prvTransportSend( NetworkContext_t * pxNetworkContext,
+                                 const void * pvBuffer,
+                                 size_t uxBytesToSend )
+{
+    /* pNetworkContext of the agent's transport interface is its MqttAgentTransport_t. */
+    MqttAgentTransport_t * pxTransport = ( MqttAgentTransport_t * ) pxNetworkContext;
+    MqttAgentTxCoalesce_t * const pxTx = &( pxTransport->xTx );
+    int32_t lResult = -1;
+
+    if( pxTx->xEnabled &&
+        ( ( pxTx->uxPending + uxBytesToSend ) > MQTT_AGENT_TX_COALESCE_BUFFER_SIZE ) )
+    {
+        ( void ) prvTxFlush( pxTransport );
+    }
+
+    if( pxTx->xFlushFailed )
+    {
+        lResult = -1;
+    }
+    else if( pxTx->xEnabled &&
+             ( uxBytesToSend <= MQTT_AGENT_TX_COALESCE_BUFFER_SIZE ) )
+    {
+        if( pxTx->uxPending == 0 )
+        {
+            pxTx->xFirstPendingTime = xTaskGetTickCount();
+        }
+
+        ( void ) memcpy( &( pxTx->pucBuffer[ pxTx->uxPending ] ), pvBuffer, uxBytesToSend );
+        pxTx->uxPending += uxBytesToSend;
+        lResult = ( int32_t ) uxBytesToSend;
+
+        if( prvTxDeadlineExpired( pxTx ) )
+        {
+            lResult = prvTxFlush( pxTransport ) ? lResult : -1;
+        }
+    }
+    else if( prvTxFlush( pxTransport ) )
+    {
+        lResult = prvTransportWrite( pxTransport->pxNetworkContext, pvBuffer, uxBytesToSend );
+    }
+    else
+    {
+        lResult = -1;
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Vectored transport send used by coreMQTT for packets built from several
+ * buffers, such as publishes. Unless the packet is coalesced by
+ * prvTransportSend, its pieces are written together, so that a small publish
+ * takes a single TLS record. The last piece of a streamed publish is its
+ * payload, which is pulled from the producer instead.
+ */
+static int32_t prvTransportWritev( NetworkContext_t * pxNetworkContext,
+                                   TransportOutVector_t * pxVectors,
+                                   size_t uxVectorCount )
+{
+    /* pNetworkContext of the agent's transport interface is its MqttAgentTransport_t. */
+    MqttAgentTransport_t * pxTransport = ( MqttAgentTransport_t * ) pxNetworkContext;
+    MQTTAgentPublishStream_t * pxStream = pxTransport->pxStream;
+    int32_t lResult = 0;
+
+    /* coreMQTT writes the publish once, nothing else is vectored. */
+    pxTransport->pxStream = NULL;
+
+    if( pxTransport->xTx.xFlushFailed )
+    {
+        lResult = -1;
+    }
+    else if( ( pxStream == NULL ) && !pxTransport->xTx.xEnabled )
+    {
+        if( prvTxFlush( pxTransport ) )
+        {
+            uint32_t ulStartTime = MqttAgentMetrics_Now();
+
+            lResult = mbedtls_transport_sendv( pxTransport->pxNetworkContext, pxVectors, uxVectorCount );
+
+            MqttAgentMetrics_Sent( ulStartTime );
+        }
+        else
+        {
+            lResult = -1;
+        }
+    }
+    else
+    {
+        bool xComplete = true;
+
+        for( size_t uxIdx = 0; xComplete && ( uxIdx < uxVectorCount ); uxIdx++ )
+        {
+            int32_t lSent = -1;
+
+            if( ( pxStream != NULL ) && ( uxIdx == ( uxVectorCount - 1U ) ) )
+            {
+                /* Anything coalesced before the payload is written first. */
+                lSent = prvTxFlush( pxTransport ) ? prvStreamSend( pxTransport, pxStream, pxVectors[ uxIdx ].iov_len ) : -1;
+            }
+            else
+            {
+                lSent = prvTransportSend( pxNetworkContext,
+                                          pxVectors[ uxIdx ].iov_base,
+                                          pxVectors[ uxIdx ].iov_len );
+            }
+
+            if( lSent < 0 )
+            {
+                lResult = lSent;
+            }
+            else
+            {
+                lResult += lSent;
+            }
+
+            xComplete = ( lSent == ( int32_t ) pxVectors[ uxIdx ].iov_len );
+        }
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read all of uxLength bytes, giving up after SEND_TIMEOUT_MS without progress. */
+static bool prvRecvAll( NetworkContext_t * pxNetworkContext,
+                        uint8_t * pucData,
+                        size_t uxLength )
+{
+    size_t uxReceived = 0;
+    bool xFailed = false;
+    TickType_t xLastProgressTime = xTaskGetTickCount();
+
+    while( !xFailed && ( uxReceived < uxLength ) )
+    {
+        int32_t lResult = mbedtls_transport_recv( pxNetworkContext,
+                                                  &( pucData[ uxReceived ] ),
+                                                  uxLength - uxReceived );
+
+        if( lResult > 0 )
+        {
+            uxReceived += ( size_t ) lResult;
+            xLastProgressTime = xTaskGetTickCount();
+        }
+        else if( ( lResult < 0 ) ||
+                 ( ( xTaskGetTickCount() - xLastProgressTime ) > pdMS_TO_TICKS( SEND_TIMEOUT_MS ) ) )
+        {
+            LogError( "Failed to receive %lu bytes, lResult=%ld.",
+                      ( unsigned long ) ( uxLength - uxReceived ), ( long ) lResult );
+            xFailed = true;
+        }
+        else
+        {
+            uint32_t ulWaitedMs = ( uint32_t ) pdTICKS_TO_MS( xTaskGetTickCount() - xLastProgressTime );
+
+            /* Nothing was received, block on the socket for the rest of the timeout. */
+            if( mbedtls_transport_recv_wait( pxNetworkContext,
+                                             ( ulWaitedMs < SEND_TIMEOUT_MS ) ? ( SEND_TIMEOUT_MS - ulWaitedMs ) : 0U ) < 0 )
+            {
+                LogError( "Failed to wait for %lu bytes.", ( unsigned long ) ( uxLength - uxReceived ) );
+                xFailed = true;
+            }
+        }
+    }
+
+    return !xFailed;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read from the connection, noting whether anything was left to read. The
+ * socket multiplexer only reports new data after a read which found none. */
+static inline int32_t prvRxRead( MqttAgentTransport_t * pxTransport,
+                                 void * pvBuffer,
+                                 size_t uxLength )
+{
+    int32_t lResult = mbedtls_transport_recv( pxTransport->pxNetworkContext, pvBuffer, uxLength );
+
+    pxTransport->xRx.xDrained = ( lResult == 0 );
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Returns 1 once the fixed header of the next packet has been received, 0 if
+ * more bytes are needed or -1 on failure. */
+static int32_t prvRecvHeader( MqttAgentTransport_t * pxTransport,
+                              MqttAgentRxStream_t * pxRx )
+{
+    int32_t lResult = 1;
+
+    /* Read a byte at a time so that no byte of the next field is consumed. */
+    while( !pxRx->xHeaderComplete && ( lResult > 0 ) )
+    {
+        lResult = prvRxRead( pxTransport, &( pxRx->pucHeader[ pxRx->uxHeaderLength ] ), 1U );
+
+        if( lResult > 0 )
+        {
+            pxRx->uxHeaderLength++;
+
+            if( ( pxRx->uxHeaderLength >= 2U ) &&
+                ( ( pxRx->pucHeader[ pxRx->uxHeaderLength - 1U ] & 0x80U ) == 0U ) )
+            {
+                pxRx->xHeaderComplete = true;
+            }
+            else if( pxRx->uxHeaderLength == MQTT_AGENT_RX_HEADER_MAX )
+            {
+                LogError( "Received a packet with an invalid remaining length." );
+                lResult = -1;
+            }
+            else
+            {
+                /* More bytes of remaining length follow. */
+            }
+        }
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvRxRemainingLength( const MqttAgentRxStream_t * pxRx )
+{
+    size_t uxRemainingLength = 0;
+    size_t uxMultiplier = 1;
+
+    for( size_t uxIdx = 1; uxIdx < pxRx->uxHeaderLength; uxIdx++ )
+    {
+        uxRemainingLength += ( size_t ) ( pxRx->pucHeader[ uxIdx ] & 0x7FU ) * uxMultiplier;
+        uxMultiplier *= 128U;
+    }
+
+    return uxRemainingLength;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline void prvRxHeaderReset( MqttAgentRxStream_t * pxRx )
+{
+    pxRx->uxHeaderLength = 0;
+    pxRx->uxHeaderPassed = 0;
+    pxRx->xHeaderComplete = false;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read and drop uxLength bytes, uxBufferSize at a time. */
+static bool prvRecvDiscard( NetworkContext_t * pxNetworkContext,
+                            uint8_t * pucBuffer,
+                            size_t uxBufferSize,
+                            size_t uxLength )
+{
+    bool xSuccess = true;
+
+    while( xSuccess && ( uxLength > 0U ) )
+    {
+        size_t uxChunkLength = ( uxLength > uxBufferSize ) ? uxBufferSize : uxLength;
+
+        xSuccess = prvRecvAll( pxNetworkContext, pucBuffer, uxChunkLength );
+        uxLength -= uxChunkLength;
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Read a publish too large for the network buffer and pass its payload to the
+ * stream subscriptions matching its topic. pucBuffer is the free part of the
+ * network buffer offered by coreMQTT. It holds the topic name at its start and
+ * each piece of the payload after it.
+ *
+ * A QoS1 publish is acknowledged whether or not it was delivered. A QoS2
+ * publish is recorded in the coreMQTT state engine before its PUBREC, so
+ * coreMQTT answers the PUBREL and drops redelivered duplicates.
+ */
+static bool prvRecvLargePublish( MqttAgentTransport_t * pxTransport,
+                                 MqttAgentRxStream_t * pxRx,
+                                 size_t uxRemainingLength,
+                                 uint8_t * pucBuffer,
+                                 size_t uxBufferSize )
+{
+    MQTTPublishInfo_t xPublishInfo = { 0 };
+    uint8_t pucField[ sizeof( uint16_t ) ];
+    uint16_t usPacketId = 0;
+    size_t uxTopicLength = 0;
+    size_t uxOffset = 0;
+    size_t uxConsumers = 0;
+    bool xDeliver = true;
+    bool xSuccess = false;
+
+    xPublishInfo.qos = ( MQTTQoS_t ) ( ( pxRx->pucHeader[ 0 ] >> 1 ) & 0x03U );
+    xPublishInfo.retain = ( ( pxRx->pucHeader[ 0 ] & 0x01U ) != 0U );
+    xPublishInfo.dup = ( ( pxRx->pucHeader[ 0 ] & 0x08U ) != 0U );
+
+    if( ( uxRemainingLength >= sizeof( pucField ) ) &&
+        prvRecvAll( pxTransport->pxNetworkContext, pucField, sizeof( pucField ) ) )
+    {
+        uxTopicLength = ( ( size_t ) pucField[ 0 ] << 8 ) | pucField[ 1 ];
+        uxRemainingLength -= sizeof( pucField );
+        xSuccess = true;
+    }
+
+    if( xSuccess &&
+        ( ( xPublishInfo.qos > MQTTQoS2 ) ||
+          ( ( uxTopicLength + ( ( xPublishInfo.qos > MQTTQoS0 ) ? sizeof( pucField ) : 0U ) ) > uxRemainingLength ) ) )
+    {
+        LogError( "Received a malformed publish of %lu bytes.", ( unsigned long ) uxRemainingLength );
+        xSuccess = false;
+    }
+
+    /* The topic name is kept for the callbacks, the payload is read after it. */
+    if( xSuccess && ( uxTopicLength < uxBufferSize ) )
+    {
+        xSuccess = prvRecvAll( pxTransport->pxNetworkContext, pucBuffer, uxTopicLength );
+        uxRemainingLength -= uxTopicLength;
+
+        xPublishInfo.pTopicName = ( const char * ) pucBuffer;
+        xPublishInfo.topicNameLength = ( uint16_t ) uxTopicLength;
+    }
+    else if( xSuccess )
+    {
+        /* Skipped, so that the packet identifier can still be read and acknowledged. */
+        xSuccess = prvRecvDiscard( pxTransport->pxNetworkContext, pucBuffer, uxBufferSize, uxTopicLength );
+        uxRemainingLength -= uxTopicLength;
+        xDeliver = false;
+    }
+    else
+    {
+        /* The connection is dropped by the caller. */
+    }
+
+    if( xSuccess && ( xPublishInfo.qos > MQTTQoS0 ) )
+    {
+        xSuccess = prvRecvAll( pxTransport->pxNetworkContext, pucField, sizeof( pucField ) );
+        usPacketId = ( uint16_t ) ( ( ( uint16_t ) pucField[ 0 ] << 8 ) | pucField[ 1 ] );
+        uxRemainingLength -= sizeof( pucField );
+    }
+
+    if( xSuccess && ( xPublishInfo.qos == MQTTQoS2 ) )
+    {
+        MQTTPublishState_t xState = MQTTStateNull;
+        MQTTStatus_t xStatus = MQTT_UpdateStatePublish( pxTransport->pxMqttContext, usPacketId,
+                                                        MQTT_RECEIVE, MQTTQoS2, &xState );
+
+        if( xStatus == MQTTStateCollision )
+        {
+            /* Delivered before, only the PUBREC was lost. */
+            xDeliver = false;
+        }
+        else if( xStatus != MQTTSuccess )
+        {
+            LogError( "Failed to record incoming QoS2 publish %u, xStatus=%s.",
+                      usPacketId, MQTT_Status_strerror( xStatus ) );
+            xSuccess = false;
+        }
+        else
+        {
+            /* Empty else marker. */
+        }
+    }
+
+    xPublishInfo.payloadLength = uxRemainingLength;
+
+    if( xPublishInfo.pTopicName != NULL )
+    {
+        pucBuffer = &( pucBuffer[ uxTopicLength ] );
+        uxBufferSize -= uxTopicLength;
+    }
+
+    while( xSuccess && ( uxOffset < xPublishInfo.payloadLength ) )
+    {
+        size_t uxChunkLength = xPublishInfo.payloadLength - uxOffset;
+
+        if( uxChunkLength > uxBufferSize )
+        {
+            uxChunkLength = uxBufferSize;
+        }
+
+        xSuccess = prvRecvAll( pxTransport->pxNetworkContext, pucBuffer, uxChunkLength );
+
+        if( xSuccess && xDeliver )
+        {
+            uxConsumers += pxTransport->pxChunkCallback( pxTransport->pvChunkCallbackCtx, &xPublishInfo,
+                                                         uxOffset, pucBuffer, uxChunkLength );
+        }
+
+        uxOffset += uxChunkLength;
+    }
+
+    if( xSuccess && ( xPublishInfo.qos > MQTTQoS0 ) )
+    {
+        uint8_t pucAck[ MQTT_PUBLISH_ACK_PACKET_SIZE ];
+        MQTTFixedBuffer_t xAckBuffer = { .pBuffer = pucAck, .size = sizeof( pucAck ) };
+        uint8_t ucAckType = ( xPublishInfo.qos == MQTTQoS1 ) ? MQTT_PACKET_TYPE_PUBACK : MQTT_PACKET_TYPE_PUBREC;
+
+        xSuccess = ( MQTT_SerializeAck( &xAckBuffer, ucAckType, usPacketId ) == MQTTSuccess ) &&
+                   prvTxFlush( pxTransport ) &&
+                   prvSendAll( pxTransport->pxNetworkContext, pucAck, sizeof( pucAck ) );
+    }
+
+    if( xSuccess && ( xPublishInfo.qos == MQTTQoS2 ) )
+    {
+        MQTTPublishState_t xState = MQTTStateNull;
+
+        /* coreMQTT now expects the PUBREL and answers it with a PUBCOMP. */
+        xSuccess = ( MQTT_UpdateStateAck( pxTransport->pxMqttContext, usPacketId, MQTTPubrec,
+                                          MQTT_SEND, &xState ) == MQTTSuccess );
+    }
+
+    if( xSuccess && xDeliver && ( uxConsumers > 0U ) )
+    {
+        pxRx->ulStreamedPublishes++;
+    }
+    else if( xSuccess )
+    {
+        pxRx->ulDiscardedPublishes++;
+
+        LogWarn( "Discarded a publish of %lu bytes larger than the network buffer, topic=\"%.*s\".",
+                 ( unsigned long ) xPublishInfo.payloadLength,
+                 xPublishInfo.topicNameLength, xPublishInfo.pTopicName );
+    }
+    else
+    {
+        /* The connection is dropped by the caller. */
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Transport receive used by coreMQTT. The fixed header of each packet is read
+ * first. Publishes which do not fit the network buffer are consumed by
+ * prvRecvLargePublish, any other packet is handed to coreMQTT.
+ */
+static int32_t prvTransportRecv( NetworkContext_t * pxNetworkContext,
+                                 void * pvBuffer,
+                                 size_t uxBytesToRecv )
+{
+    MqttAgentTransport_t * pxTransport = ( MqttAgentTransport_t * ) pxNetworkContext;
+    MqttAgentRxStream_t * pxRx = &( pxTransport->xRx );
+    int32_t lResult = -1;
+
+    /* Report a failed flush through the next receive so that the command loop exits. */
+    if( pxTransport->xTx.xFlushFailed )
+    {
+        lResult = -1;
+    }
+    else if( pxRx->uxPacketRemaining > 0U )
+    {
+        if( uxBytesToRecv > pxRx->uxPacketRemaining )
+        {
+            uxBytesToRecv = pxRx->uxPacketRemaining;
+        }
+
+        lResult = prvRxRead( pxTransport, pvBuffer, uxBytesToRecv );
+
+        if( lResult > 0 )
+        {
+            pxRx->uxPacketRemaining -= ( size_t ) lResult;
+        }
+    }
+    else
+    {
+        lResult = prvRecvHeader( pxTransport, pxRx );
+    }
+
+    if( ( lResult > 0 ) && pxRx->xHeaderComplete )
+    {
+        size_t uxRemainingLength = prvRxRemainingLength( pxRx );
+
+        if( ( ( pxRx->pucHeader[ 0 ] & 0xF0U ) == MQTT_PACKET_TYPE_PUBLISH ) &&
+            ( ( pxRx->uxHeaderLength + uxRemainingLength ) > pxTransport->uxNetworkBufferSize ) )
+        {
+            /* coreMQTT never sees this packet, so nothing was received as far as it is concerned. */
+            lResult = prvRecvLargePublish( pxTransport, pxRx, uxRemainingLength,
+                                           ( uint8_t * ) pvBuffer, uxBytesToRecv ) ? 0 : -1;
+            prvRxHeaderReset( pxRx );
+
+            /* More packets may follow, read again before waiting for a notification. */
+            pxRx->xDrained = false;
+        }
+        else
+        {
+            size_t uxHeaderBytes = pxRx->uxHeaderLength - pxRx->uxHeaderPassed;
+
+            if( uxHeaderBytes > uxBytesToRecv )
+            {
+                uxHeaderBytes = uxBytesToRecv;
+            }
+
+            ( void ) memcpy( pvBuffer, &( pxRx->pucHeader[ pxRx->uxHeaderPassed ] ), uxHeaderBytes );
+            pxRx->uxHeaderPassed += uxHeaderBytes;
+            lResult = ( int32_t ) uxHeaderBytes;
+
+            if( pxRx->uxHeaderPassed == pxRx->uxHeaderLength )
+            {
+                pxRx->uxPacketRemaining = uxRemainingLength;
+                prvRxHeaderReset( pxRx );
+            }
+        }
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentTransport_Init( MqttAgentTransport_t * pxTransport,
+                              TransportInterface_t * pxInterface,
+                              NetworkContext_t * pxNetworkContext,
+                              MQTTContext_t * pxMqttContext,
+                              size_t uxNetworkBufferSize,
+                              MqttAgentChunkCallback_t pxChunkCallback,
+                              void * pvChunkCallbackCtx )
+{
+    configASSERT( pxTransport != NULL );
+    configASSERT( pxInterface != NULL );
+    configASSERT( pxChunkCallback != NULL );
+
+    ( void ) memset( pxTransport, 0, sizeof( MqttAgentTransport_t ) );
+
+    pxTransport->pxNetworkContext = pxNetworkContext;
+    pxTransport->pxMqttContext = pxMqttContext;
+    pxTransport->uxNetworkBufferSize = uxNetworkBufferSize;
+    pxTransport->pxChunkCallback = pxChunkCallback;
+    pxTransport->pvChunkCallbackCtx = pvChunkCallbackCtx;
+
+    pxInterface->pNetworkContext = ( NetworkContext_t * ) pxTransport;
+    pxInterface->send = prvTransportSend;
+    pxInterface->writev = prvTransportWritev;
+    pxInterface->recv = prvTransportRecv;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentTransport_BeginCommand( MqttAgentTransport_t * pxTransport,
+                                      const MQTTAgentCommand_t * pxCommand )
+{
+    if( ( MQTT_AGENT_TX_COALESCE_ENABLED != 0 ) &&
+        prvIsQoS0Publish( pxCommand ) )
+    {
+        pxTransport->xTx.xEnabled = true;
+        pxTransport->xTx.ulCoalescedPublishes++;
+    }
+
+    pxTransport->pxStream = MqttAgentTransport_GetCommandStream( pxCommand );
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentTransport_EndCommand( MqttAgentTransport_t * pxTransport )
+{
+    pxTransport->xTx.xEnabled = false;
+    pxTransport->pxStream = NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentTransport_Flush( MqttAgentTransport_t * pxTransport,
+                               bool xForce )
+{
+    if( ( pxTransport->xTx.uxPending > 0 ) &&
+        ( xForce || prvTxDeadlineExpired( &( pxTransport->xTx ) ) ) )
+    {
+        ( void ) prvTxFlush( pxTransport );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgentTransport_IsDrained( const MqttAgentTransport_t * pxTransport )
+{
+    return pxTransport->xRx.xDrained;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttAgentTransport_GetWaitMs( const MqttAgentTransport_t * pxTransport )
+{
+    return( ( pxTransport->xTx.uxPending > 0 ) ? MQTT_AGENT_TX_COALESCE_MAX_DELAY_MS : UINT32_MAX );
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgentTransport_Reset( MqttAgentTransport_t * pxTransport )
+{
+    MqttAgentTxCoalesce_t * const pxTx = &( pxTransport->xTx );
+    MqttAgentRxStream_t * const pxRx = &( pxTransport->xRx );
+
+    if( pxTx->ulCoalescedPublishes > 0 )
+    {
+        LogDebug( "Coalesced %lu QoS0 publishes into %lu transport writes.",
+                  pxTx->ulCoalescedPublishes, pxTx->ulFlushes );
+    }
+
+    if( ( pxRx->ulStreamedPublishes > 0 ) || ( pxRx->ulDiscardedPublishes > 0 ) )
+    {
+        LogDebug( "Streamed %lu and discarded %lu publishes larger than the network buffer.",
+                  pxRx->ulStreamedPublishes, pxRx->ulDiscardedPublishes );
+    }
+
+    pxTx->uxPending = 0;
+    pxTx->xEnabled = false;
+    pxTx->xFlushFailed = false;
+    pxTransport->pxStream = NULL;
+
+    prvRxHeaderReset( pxRx );
+    pxRx->uxPacketRemaining = 0;
+    pxRx->xDrained = false;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTAgentPublishStream_t * MqttAgentTransport_GetCommandStream( const MQTTAgentCommand_t * pxCommand )
+{
+    MQTTAgentPublishStream_t * pxStream = NULL;
+
+    if( ( pxCommand != NULL ) &&
+        ( pxCommand->commandType == PUBLISH ) &&
+        ( pxCommand->pCommandCompleteCallback == prvStreamCommandCallback ) )
+    {
+        pxStream = ( MQTTAgentPublishStream_t * ) pxCommand->pCmdContext;
+    }
+
+    return pxStream;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_PublishStream( MQTTAgentHandle_t xHandle,
+                                      MQTTPublishInfo_t * pxPublishInfo,
+                                      MQTTAgentPublishStream_t * pxStream,
+                                      const MQTTAgentCommandInfo_t * pxCommandInfo )
+{
+    MQTTStatus_t xStatus = MQTTBadParameter;
+
+    if( ( xHandle != NULL ) &&
+        ( pxPublishInfo != NULL ) &&
+        ( pxPublishInfo->payloadLength > 0 ) &&
+        ( pxPublishInfo->payloadLength <= INT32_MAX ) &&
+        ( pxStream != NULL ) &&
+        ( pxStream->pxProducer != NULL ) &&
+        ( pxCommandInfo != NULL ) )
+    {
+        MQTTAgentCommandInfo_t xCommandInfo =
+        {
+            .cmdCompleteCallback         = prvStreamCommandCallback,
+            .pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pxStream,
+            .blockTimeMs                 = pxCommandInfo->blockTimeMs
+        };
+
+        pxStream->pxCmdCompleteCallback = pxCommandInfo->cmdCompleteCallback;
+        pxStream->pxCmdCompleteCallbackContext = pxCommandInfo->pCmdCompleteCallbackContext;
+
+        /* coreMQTT requires a payload pointer but never reads it: the
+         * transport knows the command from its callback and pulls the payload
+         * from the producer. */
+        pxPublishInfo->pPayload = ucStreamedPayload;
+
+        xStatus = MQTTAgent_Publish( xHandle, pxPublishInfo, &xCommandInfo );
+    }
+
+    return xStatus;
+}
@@ -0,0 +1,202 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_agent_transport.h
+ * @brief Transport interface of the MQTT agent, between coreMQTT and the TLS
+ * connection.
+ *
+ * While the agent processes a QoS0 publish, its packet is appended to a
+ * coalescing buffer, so that publishes processed back to back take a single
+ * TLS write. The payload of a publish queued by MqttAgent_PublishStream is
+ * pulled from its producer as it is written. On the receive side, publishes
+ * too large for the network buffer are read here and passed to the stream
+ * subscriptions in pieces, and coreMQTT never sees them.
+ */
+#ifndef MQTT_AGENT_TRANSPORT_H
+#define MQTT_AGENT_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "core_mqtt.h"
+#include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
+
+/**
+ * @brief Length of the fixed header of an MQTT packet: the type byte and up to
+ * four bytes of remaining length.
+ */
+#define MQTT_AGENT_RX_HEADER_MAX    ( 5U )
+
+/**
+ * @brief Called with each piece of the payload of a publish too large for the
+ * network buffer.
+ *
+ * @return The number of subscribers the piece was passed to.
+ */
+typedef size_t ( * MqttAgentChunkCallback_t )( void * pvCallbackCtx,
+                                                const MQTTPublishInfo_t * pxPublishInfo,
+                                                size_t uxOffset,
+                                                const uint8_t * pucChunk,
+                                                size_t uxChunkLength );
+
+/**
+ * @brief QoS0 publishes waiting to be written to the connection in a single send.
+ */
+typedef struct MqttAgentTxCoalesce
+{
+    uint8_t pucBuffer[ MQTT_AGENT_TX_COALESCE_BUFFER_SIZE ];
+    size_t uxPending;
+    TickType_t xFirstPendingTime;
+    bool xEnabled;
+    bool xFlushFailed;
+    uint32_t ulCoalescedPublishes;
+    uint32_t ulFlushes;
+} MqttAgentTxCoalesce_t;
+
+/**
+ * @brief Fixed header of the packet being received, and the part of the
+ * packet coreMQTT has still to read.
+ */
+typedef struct MqttAgentRxStream
+{
+    uint8_t pucHeader[ MQTT_AGENT_RX_HEADER_MAX ];
+    size_t uxHeaderLength;     /* Bytes of the fixed header received. */
+    size_t uxHeaderPassed;     /* Bytes of the fixed header handed to coreMQTT. */
+    size_t uxPacketRemaining;  /* Bytes after the fixed header still to be handed to coreMQTT. */
+    bool xHeaderComplete;
+    bool xDrained;             /* The last read found nothing, the socket multiplexer reports new data. */
+    uint32_t ulStreamedPublishes;
+    uint32_t ulDiscardedPublishes;
+} MqttAgentRxStream_t;
+
+/**
+ * @brief Transport state of an MQTT agent. The pNetworkContext of the
+ * interface filled in by MqttAgentTransport_Init points to this struct. Only
+ * accessed by the agent task.
+ */
+typedef struct MqttAgentTransport
+{
+    NetworkContext_t * pxNetworkContext;
+    MQTTContext_t * pxMqttContext; /* Tracks the QoS2 state of streamed publishes. */
+    size_t uxNetworkBufferSize;
+    MqttAgentChunkCallback_t pxChunkCallback;
+    void * pvChunkCallbackCtx;
+    MQTTAgentPublishStream_t * pxStream; /* Payload of the streamed publish the agent is processing. */
+    MqttAgentTxCoalesce_t xTx;
+    MqttAgentRxStream_t xRx;
+} MqttAgentTransport_t;
+
+/**
+ * @brief Set up the transport and the interface handed to coreMQTT.
+ *
+ * @param[in] pxTransport Transport state.
+ * @param[out] pxInterface Transport interface to pass to MQTTAgent_Init.
+ * @param[in] pxNetworkContext TLS connection.
+ * @param[in] pxMqttContext MQTT context the interface is used by.
+ * @param[in] uxNetworkBufferSize Size of the MQTT context's network buffer.
+ * @param[in] pxChunkCallback Receives the payloads of publishes too large for
+ * the network buffer.
+ * @param[in] pvChunkCallbackCtx Context passed to pxChunkCallback.
+ */
+void MqttAgentTransport_Init( MqttAgentTransport_t * pxTransport,
+                              TransportInterface_t * pxInterface,
+                              NetworkContext_t * pxNetworkContext,
+                              MQTTContext_t * pxMqttContext,
+                              size_t uxNetworkBufferSize,
+                              MqttAgentChunkCallback_t pxChunkCallback,
+                              void * pvChunkCallbackCtx );
+
+/**
+ * @brief Prepare for the command the agent is about to process: coalesce the
+ * packet of a QoS0 publish, and write the payload of a streamed publish from
+ * its producer.
+ *
+ * @param[in] pxTransport Transport state.
+ * @param[in] pxCommand Command taken from the lanes.
+ */
+void MqttAgentTransport_BeginCommand( MqttAgentTransport_t * pxTransport,
+                                      const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Send the packets of the next commands, and of coreMQTT itself,
+ * straight away again.
+ *
+ * @param[in] pxTransport Transport state.
+ */
+void MqttAgentTransport_EndCommand( MqttAgentTransport_t * pxTransport );
+
+/**
+ * @brief Write out the coalesced publishes if xForce is set or they have
+ * waited MQTT_AGENT_TX_COALESCE_MAX_DELAY_MS.
+ *
+ * @param[in] pxTransport Transport state.
+ * @param[in] xForce Write them out whatever their age.
+ */
+void MqttAgentTransport_Flush( MqttAgentTransport_t * pxTransport,
+                               bool xForce );
+
+/**
+ * @brief Check whether the last read found nothing, so that the socket
+ * multiplexer reports the next data to arrive.
+ *
+ * @param[in] pxTransport Transport state.
+ *
+ * @return true if the agent may wait for a notification.
+ */
+bool MqttAgentTransport_IsDrained( const MqttAgentTransport_t * pxTransport );
+
+/**
+ * @brief Longest time the agent may wait before MqttAgentTransport_Flush has
+ * to run again.
+ *
+ * @param[in] pxTransport Transport state.
+ *
+ * @return Time in milliseconds, UINT32_MAX if nothing is coalesced.
+ */
+uint32_t MqttAgentTransport_GetWaitMs( const MqttAgentTransport_t * pxTransport );
+
+/**
+ * @brief Drop the coalesced publishes and any partly received packet, once
+ * the connection is lost.
+ *
+ * @param[in] pxTransport Transport state.
+ */
+void MqttAgentTransport_Reset( MqttAgentTransport_t * pxTransport );
+
+/**
+ * @brief Get the stream of a publish queued by MqttAgent_PublishStream.
+ *
+ * @param[in] pxCommand Command.
+ *
+ * @return The stream, NULL for any other command.
+ */
+MQTTAgentPublishStream_t * MqttAgentTransport_GetCommandStream( const MQTTAgentCommand_t * pxCommand );
+
+#endif /* MQTT_AGENT_TRANSPORT_H */
@@ -0,0 +1,832 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+#include "mqtt_journal.h"
+
+#if MQTT_AGENT_JOURNAL_ENABLED
+
+/* Standard includes. */
+    #include <string.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <assert.h>
+
+/* Kernel includes. */
+    #include "FreeRTOS.h"
+    #include "task.h"
+    #include "semphr.h"
+    #include "event_groups.h"
+
+    #include "core_mqtt_agent.h"
+    #include "mqtt_agent_task.h"
+    #include "sys_evt.h"
+
+    #include "lfs.h"
+    #include "fs/lfs_port.h"
+
+/*-----------------------------------------------------------*/
+
+    #define JOURNAL_RECORD_MAGIC      ( 0x4A524E4CUL )
+    #define JOURNAL_NOTIFY_IDX        ( 1 )
+    #define JOURNAL_PATH_MAX          ( sizeof( MQTT_JOURNAL_DIR ) + 10 )
+    #define JOURNAL_SLOT( ulSeq )     ( ( ulSeq ) % MQTT_JOURNAL_SEGMENT_COUNT )
+
+    static_assert( MQTT_JOURNAL_SEGMENT_COUNT >= 2, "The journal needs a segment to write while another is replayed." );
+    static_assert( MQTT_JOURNAL_REPLAY_RATE_PER_SEC > 0, "MQTT_JOURNAL_REPLAY_RATE_PER_SEC must not be zero." );
+
+    typedef struct JournalRecordHeader
+    {
+        uint32_t ulMagic;
+        uint16_t usTopicLength;
+        uint8_t ucQoS;
+        uint8_t ucRetain;
+        uint32_t ulPayloadLength;
+    } JournalRecordHeader_t;
+
+/* A record read back from the journal by the replay task. */
+    typedef struct JournalRecord
+    {
+        JournalRecordHeader_t xHeader;
+        uint8_t * pucData; /* Topic followed by the payload. */
+        uint32_t ulSeq;
+        size_t uxNextOffset;
+    } JournalRecord_t;
+
+    typedef struct JournalCtx
+    {
+        lfs_t * pxLfs;
+        SemaphoreHandle_t xMutex;
+
+        /* Oldest segment, read by the replay task, and the segment being
+         * written. Both increase monotonically. */
+        uint32_t ulHeadSeq;
+        uint32_t ulTailSeq;
+        size_t uxReplayOffset;
+
+        /* Records and bytes not yet replayed, per segment. The tail segment
+         * includes the page buffer. */
+        uint32_t pulSegmentRecords[ MQTT_JOURNAL_SEGMENT_COUNT ];
+        size_t puxSegmentBytes[ MQTT_JOURNAL_SEGMENT_COUNT ];
+
+        uint8_t pucPage[ MQTT_JOURNAL_PAGE_SIZE ];
+        size_t uxPageUsed;
+        uint32_t ulPageRecords;
+
+        MqttJournalStats_t xStats;
+    } JournalCtx_t;
+
+    static JournalCtx_t xJournal = { 0 };
+
+/*-----------------------------------------------------------*/
+
+    static inline void prvSegmentPath( char * pcPath,
+                                       uint32_t ulSeq )
+    {
+        ( void ) snprintf( pcPath, JOURNAL_PATH_MAX, MQTT_JOURNAL_DIR "/%08lx", ( unsigned long ) ulSeq );
+    }
+
+/*-----------------------------------------------------------*/
+
+    static inline size_t prvRecordSize( const JournalRecordHeader_t * pxHeader )
+    {
+        return sizeof( JournalRecordHeader_t ) + pxHeader->usTopicLength + pxHeader->ulPayloadLength;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static inline bool prvIsFull( void )
+    {
+        return( ( xJournal.ulTailSeq - xJournal.ulHeadSeq + 1 ) >= MQTT_JOURNAL_SEGMENT_COUNT );
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool prvHeaderIsValid( const JournalRecordHeader_t * pxHeader )
+    {
+        return( ( pxHeader->ulMagic == JOURNAL_RECORD_MAGIC ) &&
+                ( pxHeader->ucQoS <= ( uint8_t ) MQTTQoS2 ) &&
+                ( pxHeader->usTopicLength > 0 ) &&
+                ( pxHeader->ulPayloadLength <= MQTT_JOURNAL_SEGMENT_SIZE ) &&
+                ( prvRecordSize( pxHeader ) <= MQTT_JOURNAL_SEGMENT_SIZE ) );
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Count the valid records in a segment file left by a previous boot. */
+    static void prvScanSegment( uint32_t ulSeq )
+    {
+        char pcPath[ JOURNAL_PATH_MAX ];
+        lfs_file_t xFile = { 0 };
+        uint32_t ulRecords = 0;
+        size_t uxBytes = 0;
+
+        prvSegmentPath( pcPath, ulSeq );
+
+        if( lfs_file_open( xJournal.pxLfs, &xFile, pcPath, LFS_O_RDONLY ) == LFS_ERR_OK )
+        {
+            JournalRecordHeader_t xHeader = { 0 };
+
+            while( ( lfs_file_read( xJournal.pxLfs, &xFile, &xHeader, sizeof( xHeader ) ) == sizeof( xHeader ) ) &&
+                   prvHeaderIsValid( &xHeader ) &&
+                   ( ( uxBytes + prvRecordSize( &xHeader ) ) <= ( size_t ) lfs_file_size( xJournal.pxLfs, &xFile ) ) )
+            {
+                uxBytes += prvRecordSize( &xHeader );
+                ulRecords++;
+
+                ( void ) lfs_file_seek( xJournal.pxLfs, &xFile, uxBytes, LFS_SEEK_SET );
+            }
+
+            ( void ) lfs_file_close( xJournal.pxLfs, &xFile );
+        }
+
+        xJournal.pulSegmentRecords[ JOURNAL_SLOT( ulSeq ) ] = ulRecords;
+        xJournal.puxSegmentBytes[ JOURNAL_SLOT( ulSeq ) ] = uxBytes;
+        xJournal.xStats.ulRecordsStored += ulRecords;
+        xJournal.xStats.ulBytesStored += uxBytes;
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Delete the head segment. Records it still holds are counted as dropped. */
+    static void prvDropHead( void )
+    {
+        char pcPath[ JOURNAL_PATH_MAX ];
+        uint32_t ulSlot = JOURNAL_SLOT( xJournal.ulHeadSeq );
+
+        configASSERT( xJournal.ulHeadSeq != xJournal.ulTailSeq );
+
+        prvSegmentPath( pcPath, xJournal.ulHeadSeq );
+        ( void ) lfs_remove( xJournal.pxLfs, pcPath );
+
+        xJournal.xStats.ulDroppedOldest += xJournal.pulSegmentRecords[ ulSlot ];
+        xJournal.xStats.ulRecordsStored -= xJournal.pulSegmentRecords[ ulSlot ];
+        xJournal.xStats.ulBytesStored -= xJournal.puxSegmentBytes[ ulSlot ];
+        xJournal.pulSegmentRecords[ ulSlot ] = 0;
+        xJournal.puxSegmentBytes[ ulSlot ] = 0;
+
+        xJournal.ulHeadSeq++;
+        xJournal.uxReplayOffset = 0;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static lfs_ssize_t prvWriteToTail( const void * pvData1,
+                                       size_t uxLength1,
+                                       const void * pvData2,
+                                       size_t uxLength2,
+                                       const void * pvData3,
+                                       size_t uxLength3 )
+    {
+        char pcPath[ JOURNAL_PATH_MAX ];
+        lfs_file_t xFile = { 0 };
+        lfs_ssize_t lReturn = 0;
+
+        prvSegmentPath( pcPath, xJournal.ulTailSeq );
+
+        lReturn = lfs_file_open( xJournal.pxLfs, &xFile, pcPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND );
+
+        if( lReturn == LFS_ERR_OK )
+        {
+            lReturn = lfs_file_write( xJournal.pxLfs, &xFile, pvData1, uxLength1 );
+
+            if( ( lReturn >= 0 ) && ( uxLength2 > 0 ) )
+            {
+                lReturn = lfs_file_write( xJournal.pxLfs, &xFile, pvData2, uxLength2 );
+            }
+
+            if( ( lReturn >= 0 ) && ( uxLength3 > 0 ) )
+            {
+                lReturn = lfs_file_write( xJournal.pxLfs, &xFile, pvData3, uxLength3 );
+            }
+
+            /* Closing commits the data, so a failed write leaves the file as it was. */
+            if( lReturn >= 0 )
+            {
+                lReturn = lfs_file_close( xJournal.pxLfs, &xFile );
+            }
+            else
+            {
+                ( void ) lfs_file_close( xJournal.pxLfs, &xFile );
+            }
+
+            xJournal.xStats.ulPageWrites++;
+        }
+
+        return lReturn;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvFlushPage( void )
+    {
+        if( xJournal.uxPageUsed > 0 )
+        {
+            lfs_ssize_t lReturn = prvWriteToTail( xJournal.pucPage, xJournal.uxPageUsed, NULL, 0, NULL, 0 );
+
+            if( lReturn < 0 )
+            {
+                uint32_t ulSlot = JOURNAL_SLOT( xJournal.ulTailSeq );
+
+                LogError( "Failed to write %lu journaled publishes: %ld.",
+                          ( unsigned long ) xJournal.ulPageRecords, ( long ) lReturn );
+
+                xJournal.xStats.ulDroppedNewest += xJournal.ulPageRecords;
+                xJournal.xStats.ulRecordsStored -= xJournal.ulPageRecords;
+                xJournal.xStats.ulBytesStored -= xJournal.uxPageUsed;
+                xJournal.pulSegmentRecords[ ulSlot ] -= xJournal.ulPageRecords;
+                xJournal.puxSegmentBytes[ ulSlot ] -= xJournal.uxPageUsed;
+            }
+
+            xJournal.uxPageUsed = 0;
+            xJournal.ulPageRecords = 0;
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Start a new tail segment, discarding the oldest one if the journal is full. */
+    static void prvRollTail( void )
+    {
+        prvFlushPage();
+
+        if( prvIsFull() )
+        {
+            LogWarn( "Journal full, dropping %lu publishes.",
+                     ( unsigned long ) xJournal.pulSegmentRecords[ JOURNAL_SLOT( xJournal.ulHeadSeq ) ] );
+            prvDropHead();
+        }
+
+        xJournal.ulTailSeq++;
+        xJournal.pulSegmentRecords[ JOURNAL_SLOT( xJournal.ulTailSeq ) ] = 0;
+        xJournal.puxSegmentBytes[ JOURNAL_SLOT( xJournal.ulTailSeq ) ] = 0;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool prvOpenDirectory( void )
+    {
+        struct lfs_info xInfo = { 0 };
+        lfs_dir_t xDir = { 0 };
+        bool xFound = false;
+        uint32_t ulMinSeq = UINT32_MAX;
+        uint32_t ulMaxSeq = 0;
+        int lError = lfs_stat( xJournal.pxLfs, MQTT_JOURNAL_DIR, &xInfo );
+
+        if( lError == LFS_ERR_NOENT )
+        {
+            lError = lfs_mkdir( xJournal.pxLfs, MQTT_JOURNAL_DIR );
+        }
+
+        if( lError == LFS_ERR_OK )
+        {
+            lError = lfs_dir_open( xJournal.pxLfs, &xDir, MQTT_JOURNAL_DIR );
+        }
+
+        if( lError == LFS_ERR_OK )
+        {
+            while( lfs_dir_read( xJournal.pxLfs, &xDir, &xInfo ) > 0 )
+            {
+                char * pcEnd = NULL;
+                unsigned long ulSeq = strtoul( xInfo.name, &pcEnd, 16 );
+
+                if( ( xInfo.type == LFS_TYPE_REG ) && ( pcEnd != xInfo.name ) && ( *pcEnd == '\0' ) )
+                {
+                    ulMinSeq = ( ulSeq < ulMinSeq ) ? ulSeq : ulMinSeq;
+                    ulMaxSeq = ( ulSeq > ulMaxSeq ) ? ulSeq : ulMaxSeq;
+                    xFound = true;
+                }
+            }
+
+            ( void ) lfs_dir_close( xJournal.pxLfs, &xDir );
+        }
+        else
+        {
+            LogError( "Failed to open journal directory %s: %d.", MQTT_JOURNAL_DIR, lError );
+        }
+
+        if( xFound )
+        {
+            xJournal.ulHeadSeq = ulMinSeq;
+            xJournal.ulTailSeq = ulMaxSeq;
+
+            /* Segments beyond the configured limit are from an older build. */
+            while( ( xJournal.ulTailSeq - xJournal.ulHeadSeq + 1 ) > MQTT_JOURNAL_SEGMENT_COUNT )
+            {
+                char pcPath[ JOURNAL_PATH_MAX ];
+
+                prvSegmentPath( pcPath, xJournal.ulHeadSeq );
+                ( void ) lfs_remove( xJournal.pxLfs, pcPath );
+                xJournal.ulHeadSeq++;
+            }
+
+            for( uint32_t ulSeq = xJournal.ulHeadSeq; ulSeq != ( xJournal.ulTailSeq + 1 ); ulSeq++ )
+            {
+                prvScanSegment( ulSeq );
+            }
+        }
+
+        return( lError == LFS_ERR_OK );
+    }
+
+/*-----------------------------------------------------------*/
+
+    MQTTStatus_t MqttJournal_Init( void )
+    {
+        MQTTStatus_t xStatus = MQTTSuccess;
+
+        if( xJournal.xMutex == NULL )
+        {
+            xJournal.pxLfs = pxGetDefaultFsCtx();
+            xJournal.xMutex = xSemaphoreCreateMutex();
+
+            if( ( xJournal.pxLfs == NULL ) || ( xJournal.xMutex == NULL ) )
+            {
+                xStatus = MQTTNoMemory;
+            }
+            else if( !prvOpenDirectory() )
+            {
+                xStatus = MQTTIllegalState;
+            }
+            else
+            {
+                LogInfo( "Journal holds %lu publishes in %lu segments.",
+                         ( unsigned long ) xJournal.xStats.ulRecordsStored,
+                         ( unsigned long ) ( xJournal.ulTailSeq - xJournal.ulHeadSeq + 1 ) );
+            }
+
+            if( ( xStatus != MQTTSuccess ) && ( xJournal.xMutex != NULL ) )
+            {
+                vSemaphoreDelete( xJournal.xMutex );
+                xJournal.xMutex = NULL;
+            }
+        }
+
+        return xStatus;
+    }
+
+/*-----------------------------------------------------------*/
+
+    MQTTStatus_t MqttJournal_Append( const MQTTPublishInfo_t * pxPublishInfo )
+    {
+        MQTTStatus_t xStatus = MQTTSuccess;
+        JournalRecordHeader_t xHeader = { 0 };
+        size_t uxRecordSize = 0;
+
+        if( ( pxPublishInfo == NULL ) ||
+            ( pxPublishInfo->pTopicName == NULL ) ||
+            ( pxPublishInfo->topicNameLength == 0 ) ||
+            ( ( pxPublishInfo->pPayload == NULL ) && ( pxPublishInfo->payloadLength > 0 ) ) ||
+            ( pxPublishInfo->payloadLength > MQTT_JOURNAL_SEGMENT_SIZE ) )
+        {
+            xStatus = MQTTBadParameter;
+        }
+        else if( xJournal.xMutex == NULL )
+        {
+            xStatus = MQTTIllegalState;
+        }
+        else
+        {
+            xHeader.ulMagic = JOURNAL_RECORD_MAGIC;
+            xHeader.usTopicLength = pxPublishInfo->topicNameLength;
+            xHeader.ucQoS = ( uint8_t ) pxPublishInfo->qos;
+            xHeader.ucRetain = ( uint8_t ) pxPublishInfo->retain;
+            xHeader.ulPayloadLength = ( uint32_t ) pxPublishInfo->payloadLength;
+
+            uxRecordSize = prvRecordSize( &xHeader );
+
+            if( uxRecordSize > MQTT_JOURNAL_SEGMENT_SIZE )
+            {
+                xStatus = MQTTBadParameter;
+            }
+        }
+
+        if( xStatus == MQTTSuccess )
+        {
+            uint32_t ulSlot = 0;
+
+            ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+
+            if( ( xJournal.puxSegmentBytes[ JOURNAL_SLOT( xJournal.ulTailSeq ) ] + uxRecordSize ) > MQTT_JOURNAL_SEGMENT_SIZE )
+            {
+                if( prvIsFull() && ( MQTT_JOURNAL_OVERFLOW_POLICY == MQTT_JOURNAL_DROP_NEWEST ) )
+                {
+                    xJournal.xStats.ulDroppedNewest++;
+                    xStatus = MQTTNoMemory;
+                }
+                else
+                {
+                    prvRollTail();
+                }
+            }
+
+            if( xStatus == MQTTSuccess )
+            {
+                if( ( xJournal.uxPageUsed + uxRecordSize ) > MQTT_JOURNAL_PAGE_SIZE )
+                {
+                    prvFlushPage();
+                }
+
+                if( uxRecordSize > MQTT_JOURNAL_PAGE_SIZE )
+                {
+                    if( prvWriteToTail( &xHeader, sizeof( xHeader ),
+                                        pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength,
+                                        pxPublishInfo->pPayload, pxPublishInfo->payloadLength ) < 0 )
+                    {
+                        xJournal.xStats.ulDroppedNewest++;
+                        xStatus = MQTTSendFailed;
+                    }
+                }
+                else
+                {
+                    uint8_t * pucRecord = &( xJournal.pucPage[ xJournal.uxPageUsed ] );
+
+                    ( void ) memcpy( pucRecord, &xHeader, sizeof( xHeader ) );
+                    pucRecord += sizeof( xHeader );
+                    ( void ) memcpy( pucRecord, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+                    pucRecord += pxPublishInfo->topicNameLength;
+
+                    if( pxPublishInfo->payloadLength > 0 )
+                    {
+                        ( void ) memcpy( pucRecord, pxPublishInfo->pPayload, pxPublishInfo->payloadLength );
+                    }
+
+                    xJournal.uxPageUsed += uxRecordSize;
+                    xJournal.ulPageRecords++;
+                }
+            }
+
+            if( xStatus == MQTTSuccess )
+            {
+                ulSlot = JOURNAL_SLOT( xJournal.ulTailSeq );
+
+                xJournal.pulSegmentRecords[ ulSlot ]++;
+                xJournal.puxSegmentBytes[ ulSlot ] += uxRecordSize;
+                xJournal.xStats.ulRecordsStored++;
+                xJournal.xStats.ulBytesStored += uxRecordSize;
+                xJournal.xStats.ulAppended++;
+            }
+
+            ( void ) xSemaphoreGive( xJournal.xMutex );
+        }
+
+        return xStatus;
+    }
+
+/*-----------------------------------------------------------*/
+
+    bool MqttJournal_IsEmpty( void )
+    {
+        return( xJournal.xStats.ulRecordsStored == 0 );
+    }
+
+/*-----------------------------------------------------------*/
+
+    bool MqttJournal_IsAccepting( void )
+    {
+        return( ( xJournal.xMutex != NULL ) &&
+                ( ( MQTT_JOURNAL_OVERFLOW_POLICY == MQTT_JOURNAL_DROP_OLDEST ) || !prvIsFull() ) );
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttJournal_GetStats( MqttJournalStats_t * pxStats )
+    {
+        configASSERT( pxStats != NULL );
+
+        if( xJournal.xMutex != NULL )
+        {
+            ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+            *pxStats = xJournal.xStats;
+            ( void ) xSemaphoreGive( xJournal.xMutex );
+        }
+        else
+        {
+            memset( pxStats, 0, sizeof( MqttJournalStats_t ) );
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Read the oldest record. Segments which have been fully replayed, or which
+ * hold a corrupt record, are deleted on the way. The tail segment is sealed
+ * before it is read so that appends never touch the file being replayed.
+ */
+    static bool prvReadNextRecord( JournalRecord_t * pxRecord )
+    {
+        bool xFound = false;
+        bool xNoMemory = false;
+
+        ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+
+        while( !xFound && !xNoMemory && ( xJournal.xStats.ulRecordsStored > 0 ) )
+        {
+            char pcPath[ JOURNAL_PATH_MAX ];
+            lfs_file_t xFile = { 0 };
+            bool xEndOfSegment = true;
+
+            if( xJournal.ulHeadSeq == xJournal.ulTailSeq )
+            {
+                prvRollTail();
+            }
+
+            prvSegmentPath( pcPath, xJournal.ulHeadSeq );
+
+            if( lfs_file_open( xJournal.pxLfs, &xFile, pcPath, LFS_O_RDONLY ) == LFS_ERR_OK )
+            {
+                JournalRecordHeader_t * pxHeader = &( pxRecord->xHeader );
+
+                if( ( lfs_file_seek( xJournal.pxLfs, &xFile, xJournal.uxReplayOffset, LFS_SEEK_SET ) >= 0 ) &&
+                    ( lfs_file_read( xJournal.pxLfs, &xFile, pxHeader, sizeof( *pxHeader ) ) == sizeof( *pxHeader ) ) &&
+                    prvHeaderIsValid( pxHeader ) )
+                {
+                    size_t uxDataLength = pxHeader->usTopicLength + pxHeader->ulPayloadLength;
+
+                    pxRecord->pucData = pvPortMalloc( uxDataLength );
+
+                    if( pxRecord->pucData == NULL )
+                    {
+                        /* Try again on the next replay. */
+                        xEndOfSegment = false;
+                        xNoMemory = true;
+                    }
+                    else if( lfs_file_read( xJournal.pxLfs, &xFile, pxRecord->pucData, uxDataLength ) == ( lfs_ssize_t ) uxDataLength )
+                    {
+                        pxRecord->ulSeq = xJournal.ulHeadSeq;
+                        pxRecord->uxNextOffset = xJournal.uxReplayOffset + prvRecordSize( pxHeader );
+                        xEndOfSegment = false;
+                        xFound = true;
+                    }
+                    else
+                    {
+                        vPortFree( pxRecord->pucData );
+                        pxRecord->pucData = NULL;
+                    }
+                }
+
+                ( void ) lfs_file_close( xJournal.pxLfs, &xFile );
+            }
+
+            if( xEndOfSegment )
+            {
+                if( xJournal.pulSegmentRecords[ JOURNAL_SLOT( xJournal.ulHeadSeq ) ] > 0 )
+                {
+                    LogWarn( "Discarding %lu unreadable journaled publishes.",
+                             ( unsigned long ) xJournal.pulSegmentRecords[ JOURNAL_SLOT( xJournal.ulHeadSeq ) ] );
+                }
+
+                prvDropHead();
+            }
+        }
+
+        ( void ) xSemaphoreGive( xJournal.xMutex );
+
+        return xFound;
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Remove a replayed record, unless its segment was dropped in the meantime. */
+    static void prvConsumeRecord( const JournalRecord_t * pxRecord )
+    {
+        ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+
+        if( pxRecord->ulSeq == xJournal.ulHeadSeq )
+        {
+            uint32_t ulSlot = JOURNAL_SLOT( xJournal.ulHeadSeq );
+            size_t uxRecordSize = prvRecordSize( &( pxRecord->xHeader ) );
+
+            xJournal.uxReplayOffset = pxRecord->uxNextOffset;
+
+            if( xJournal.pulSegmentRecords[ ulSlot ] > 0 )
+            {
+                xJournal.pulSegmentRecords[ ulSlot ]--;
+                xJournal.xStats.ulRecordsStored--;
+            }
+
+            if( xJournal.puxSegmentBytes[ ulSlot ] >= uxRecordSize )
+            {
+                xJournal.puxSegmentBytes[ ulSlot ] -= uxRecordSize;
+                xJournal.xStats.ulBytesStored -= uxRecordSize;
+            }
+
+            /* Delete the segment as soon as it is empty rather than on the next read. */
+            if( ( xJournal.pulSegmentRecords[ ulSlot ] == 0 ) &&
+                ( xJournal.ulHeadSeq != xJournal.ulTailSeq ) )
+            {
+                prvDropHead();
+            }
+        }
+
+        xJournal.xStats.ulReplayed++;
+
+        ( void ) xSemaphoreGive( xJournal.xMutex );
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvReplayCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                          MQTTAgentReturnInfo_t * pxReturnInfo )
+    {
+        TaskHandle_t xTaskHandle = ( TaskHandle_t ) pxCommandContext;
+
+        configASSERT( pxReturnInfo != NULL );
+
+        if( xTaskHandle != NULL )
+        {
+            ( void ) xTaskNotifyIndexed( xTaskHandle,
+                                         JOURNAL_NOTIFY_IDX,
+                                         ( uint32_t ) pxReturnInfo->returnCode,
+                                         eSetValueWithOverwrite );
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    static MQTTStatus_t prvReplayRecord( MQTTAgentHandle_t xAgentHandle,
+                                         const JournalRecord_t * pxRecord )
+    {
+        MQTTStatus_t xStatus = MQTTSuccess;
+        uint32_t ulNotifyValue = 0;
+
+        MQTTPublishInfo_t xPublishInfo =
+        {
+            .qos             = ( MQTTQoS_t ) pxRecord->xHeader.ucQoS,
+            .retain          = ( pxRecord->xHeader.ucRetain != 0 ),
+            .dup             = false,
+            .pTopicName      = ( const char * ) pxRecord->pucData,
+            .topicNameLength = pxRecord->xHeader.usTopicLength,
+            .pPayload        = &( pxRecord->pucData[ pxRecord->xHeader.usTopicLength ] ),
+            .payloadLength   = pxRecord->xHeader.ulPayloadLength
+        };
+
+        MQTTAgentCommandInfo_t xCommandParams =
+        {
+            .blockTimeMs                 = MQTT_JOURNAL_REPLAY_TIMEOUT_MS,
+            .cmdCompleteCallback         = prvReplayCommandCallback,
+            .pCmdCompleteCallbackContext = ( void * ) xTaskGetCurrentTaskHandle(),
+        };
+
+        xTaskNotifyStateClearIndexed( NULL, JOURNAL_NOTIFY_IDX );
+
+        xStatus = MQTTAgent_Publish( xAgentHandle, &xPublishInfo, &xCommandParams );
+
+        if( xStatus == MQTTSuccess )
+        {
+            if( xTaskNotifyWaitIndexed( JOURNAL_NOTIFY_IDX,
+                                        0xFFFFFFFF,
+                                        0xFFFFFFFF,
+                                        &ulNotifyValue,
+                                        pdMS_TO_TICKS( MQTT_JOURNAL_REPLAY_TIMEOUT_MS ) ) == pdTRUE )
+            {
+                xStatus = ( MQTTStatus_t ) ulNotifyValue;
+            }
+            else
+            {
+                /* No acknowledgment, the record is kept and sent again later. */
+                xStatus = MQTTRecvFailed;
+            }
+        }
+
+        return xStatus;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvReplay( MQTTAgentHandle_t xAgentHandle )
+    {
+        const TickType_t xPeriod = pdMS_TO_TICKS( 1000U / MQTT_JOURNAL_REPLAY_RATE_PER_SEC );
+        TickType_t xStartTime = xTaskGetTickCount();
+        TickType_t xLastWakeTime = xStartTime;
+        uint32_t ulReplayed = 0;
+        MQTTStatus_t xStatus = MQTTSuccess;
+        JournalRecord_t xRecord = { 0 };
+
+        LogInfo( "Replaying %lu journaled publishes.", ( unsigned long ) xJournal.xStats.ulRecordsStored );
+
+        while( ( xStatus == MQTTSuccess ) &&
+               xIsMqttAgentConnected() &&
+               prvReadNextRecord( &xRecord ) )
+        {
+            xStatus = prvReplayRecord( xAgentHandle, &xRecord );
+
+            if( xStatus == MQTTSuccess )
+            {
+                prvConsumeRecord( &xRecord );
+                ulReplayed++;
+            }
+            else
+            {
+                LogWarn( "Stopping journal replay: %s.", MQTT_Status_strerror( xStatus ) );
+            }
+
+            vPortFree( xRecord.pucData );
+            xRecord.pucData = NULL;
+
+            if( xPeriod > 0 )
+            {
+                ( void ) xTaskDelayUntil( &xLastWakeTime, xPeriod );
+            }
+        }
+
+        ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+
+        xJournal.xStats.ulLastReplayCount = ulReplayed;
+        xJournal.xStats.ulLastReplayMs = ( xTaskGetTickCount() - xStartTime ) * portTICK_PERIOD_MS;
+
+        ( void ) xSemaphoreGive( xJournal.xMutex );
+
+        LogInfo( "Replayed %lu journaled publishes in %lu ms, %lu remaining.",
+                 ( unsigned long ) ulReplayed,
+                 ( unsigned long ) xJournal.xStats.ulLastReplayMs,
+                 ( unsigned long ) xJournal.xStats.ulRecordsStored );
+    }
+
+/*-----------------------------------------------------------*/
+
+    void vMQTTJournalTask( void * pvParameters )
+    {
+        MQTTAgentHandle_t xAgentHandle = NULL;
+
+        ( void ) pvParameters;
+
+        ( void ) xEventGroupWaitBits( xSystemEvents,
+                                      EVT_MASK_FS_READY,
+                                      pdFALSE,
+                                      pdTRUE,
+                                      portMAX_DELAY );
+
+        if( MqttJournal_Init() != MQTTSuccess )
+        {
+            LogError( "Failed to open the publish journal." );
+            vTaskDelete( NULL );
+        }
+
+        vSleepUntilMQTTAgentReady();
+
+        xAgentHandle = xGetMqttAgentHandle();
+
+        /* Replayed publishes must go straight to the agent, behind live traffic. */
+        vMQTTAgentSetTaskJournalMode( MQTT_AGENT_JOURNAL_NONE );
+        vMQTTAgentSetTaskLane( MQTT_AGENT_LANE_BULK );
+
+        for( ; ; )
+        {
+            EventBits_t uxEvents = xEventGroupWaitBits( xSystemEvents,
+                                                        EVT_MASK_MQTT_CONNECTED,
+                                                        pdFALSE,
+                                                        pdTRUE,
+                                                        pdMS_TO_TICKS( MQTT_JOURNAL_FLUSH_INTERVAL_MS ) );
+
+            if( ( uxEvents & EVT_MASK_MQTT_CONNECTED ) == 0 )
+            {
+                /* Still disconnected, bound the amount of data only held in RAM. */
+                ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+                prvFlushPage();
+                ( void ) xSemaphoreGive( xJournal.xMutex );
+            }
+            else if( !MqttJournal_IsEmpty() )
+            {
+                prvReplay( xAgentHandle );
+
+                if( !MqttJournal_IsEmpty() )
+                {
+                    /* Replay was interrupted, avoid spinning while the agent reconnects. */
+                    vTaskDelay( pdMS_TO_TICKS( 1000 ) );
+                }
+            }
+            else
+            {
+                vTaskDelay( pdMS_TO_TICKS( 1000 ) );
+            }
+        }
+    }
+
+#endif /* MQTT_AGENT_JOURNAL_ENABLED */
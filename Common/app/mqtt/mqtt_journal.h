@@ -0,0 +1,184 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_journal.h
+ * @brief Bounded journal on the littlefs partition holding publishes made
+ * while the MQTT agent is disconnected, replayed in order after reconnecting.
+ *
+ * The journal is a ring of segment files. Records are buffered in RAM and
+ * written a page at a time, so publishes still in the page buffer are lost on
+ * a reset. Replayed records are only removed once the publish completes, so a
+ * reset during replay may deliver some publishes twice.
+ */
+#ifndef MQTT_JOURNAL_H
+#define MQTT_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core_mqtt.h"
+#include "kvstore_config_plat.h"
+
+/**
+ * @brief Set to 1 to journal publishes while disconnected. Requires littlefs.
+ */
+#ifndef MQTT_AGENT_JOURNAL_ENABLED
+    #if defined( KV_STORE_NVIMPL_LITTLEFS ) && ( KV_STORE_NVIMPL_LITTLEFS == 1 )
+        #define MQTT_AGENT_JOURNAL_ENABLED    1
+    #else
+        #define MQTT_AGENT_JOURNAL_ENABLED    0
+    #endif
+#endif /* MQTT_AGENT_JOURNAL_ENABLED */
+
+#define MQTT_JOURNAL_DROP_OLDEST    0
+#define MQTT_JOURNAL_DROP_NEWEST    1
+
+/**
+ * @brief Directory holding the journal segment files.
+ */
+#ifndef MQTT_JOURNAL_DIR
+    #define MQTT_JOURNAL_DIR    "/journal"
+#endif /* MQTT_JOURNAL_DIR */
+
+/**
+ * @brief Maximum size of a segment file. A single record (topic, payload and a
+ * 12 byte header) must fit in one segment.
+ */
+#ifndef MQTT_JOURNAL_SEGMENT_SIZE
+    #define MQTT_JOURNAL_SEGMENT_SIZE    4096U
+#endif /* MQTT_JOURNAL_SEGMENT_SIZE */
+
+/**
+ * @brief Maximum number of segment files. Bounds the journal to
+ * MQTT_JOURNAL_SEGMENT_COUNT * MQTT_JOURNAL_SEGMENT_SIZE bytes of flash.
+ */
+#ifndef MQTT_JOURNAL_SEGMENT_COUNT
+    #define MQTT_JOURNAL_SEGMENT_COUNT    16U
+#endif /* MQTT_JOURNAL_SEGMENT_COUNT */
+
+/**
+ * @brief Size of the RAM buffer collecting records before they are written.
+ * Records larger than this are written on their own.
+ */
+#ifndef MQTT_JOURNAL_PAGE_SIZE
+    #define MQTT_JOURNAL_PAGE_SIZE    1024U
+#endif /* MQTT_JOURNAL_PAGE_SIZE */
+
+/**
+ * @brief What to do with a new record when every segment is full:
+ * MQTT_JOURNAL_DROP_OLDEST discards the oldest segment, MQTT_JOURNAL_DROP_NEWEST
+ * refuses the new record.
+ */
+#ifndef MQTT_JOURNAL_OVERFLOW_POLICY
+    #define MQTT_JOURNAL_OVERFLOW_POLICY    MQTT_JOURNAL_DROP_OLDEST
+#endif /* MQTT_JOURNAL_OVERFLOW_POLICY */
+
+/**
+ * @brief Maximum number of journaled publishes replayed per second.
+ */
+#ifndef MQTT_JOURNAL_REPLAY_RATE_PER_SEC
+    #define MQTT_JOURNAL_REPLAY_RATE_PER_SEC    20U
+#endif /* MQTT_JOURNAL_REPLAY_RATE_PER_SEC */
+
+/**
+ * @brief Time to wait for a replayed publish to complete before giving up
+ * until the next connection.
+ */
+#ifndef MQTT_JOURNAL_REPLAY_TIMEOUT_MS
+    #define MQTT_JOURNAL_REPLAY_TIMEOUT_MS    10000U
+#endif /* MQTT_JOURNAL_REPLAY_TIMEOUT_MS */
+
+/**
+ * @brief Longest time a partially filled page is kept in RAM while disconnected.
+ */
+#ifndef MQTT_JOURNAL_FLUSH_INTERVAL_MS
+    #define MQTT_JOURNAL_FLUSH_INTERVAL_MS    30000U
+#endif /* MQTT_JOURNAL_FLUSH_INTERVAL_MS */
+
+typedef struct MqttJournalStats
+{
+    uint32_t ulAppended;        /* Publishes added to the journal. */
+    uint32_t ulReplayed;        /* Publishes replayed after reconnecting. */
+    uint32_t ulDroppedOldest;   /* Records discarded to make room for newer ones. */
+    uint32_t ulDroppedNewest;   /* Publishes refused, or lost to a write error. */
+    uint32_t ulPageWrites;      /* Writes to flash. */
+    uint32_t ulRecordsStored;   /* Records waiting to be replayed. */
+    uint32_t ulBytesStored;     /* Bytes waiting to be replayed, including headers. */
+    uint32_t ulLastReplayCount; /* Publishes sent by the last replay. */
+    uint32_t ulLastReplayMs;    /* Duration of the last replay. */
+} MqttJournalStats_t;
+
+#if MQTT_AGENT_JOURNAL_ENABLED
+
+/**
+ * @brief Open the journal, creating MQTT_JOURNAL_DIR if needed and counting
+ * the records left by a previous boot. Called by vMQTTJournalTask once the
+ * filesystem is mounted.
+ *
+ * @return `MQTTSuccess` if the journal can be used.
+ */
+    MQTTStatus_t MqttJournal_Init( void );
+
+/**
+ * @brief Add a publish to the end of the journal.
+ *
+ * @param[in] pxPublishInfo Publish to store. The topic and payload are copied.
+ *
+ * @return `MQTTSuccess` if the publish was stored, `MQTTIllegalState` if the
+ * journal is not open, `MQTTBadParameter` if the publish does not fit in a
+ * segment, `MQTTNoMemory` if the journal is full and the overflow policy is
+ * MQTT_JOURNAL_DROP_NEWEST, `MQTTSendFailed` on a write error.
+ */
+    MQTTStatus_t MqttJournal_Append( const MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Check whether any journaled publishes are waiting to be replayed.
+ */
+    bool MqttJournal_IsEmpty( void );
+
+/**
+ * @brief Check whether MqttJournal_Append can currently store a publish.
+ */
+    bool MqttJournal_IsAccepting( void );
+
+    void MqttJournal_GetStats( MqttJournalStats_t * pxStats );
+
+/**
+ * @brief Task opening the journal and replaying it whenever the agent connects.
+ */
+    void vMQTTJournalTask( void * pvParameters );
+
+#else /* MQTT_AGENT_JOURNAL_ENABLED */
+
+    static inline bool MqttJournal_IsAccepting( void )
+    {
+        return false;
+    }
+
+#endif /* MQTT_AGENT_JOURNAL_ENABLED */
+
+#endif /* MQTT_JOURNAL_H */
@@ -0,0 +1,485 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "mqtt_keepalive.h"
+#include "kvstore.h"
+
+/*-----------------------------------------------------------*/
+
+/* coreMQTT caps the interval between PINGREQs at PACKET_TX_TIMEOUT_MS. */
+static_assert( PACKET_TX_TIMEOUT_MS >= ( MQTT_KEEPALIVE_MAX_S * 1000U ) );
+static_assert( PACKET_RX_TIMEOUT_MS >= ( MQTT_KEEPALIVE_MAX_S * 1000U ) );
+static_assert( MQTT_KEEPALIVE_MAX_S <= UINT16_MAX );
+static_assert( MQTT_KEEPALIVE_MIN_S <= MQTT_KEEPALIVE_MAX_S );
+
+#define KEEPALIVE_SSID_MAX_LEN      ( 32U )
+
+/* Hash, confirmed and failed interval, e.g. "1a2b3c4d:600:660". */
+#define KEEPALIVE_RECORD_MAX_LEN    ( 8U + 1U + 5U + 1U + 5U )
+
+typedef struct KeepAliveNetwork
+{
+    uint32_t ulNetworkHash; /* Zero when the entry is unused. */
+    uint16_t usSafeS;
+    uint16_t usLimitS;
+} KeepAliveNetwork_t;
+
+/* Most recently updated network first. */
+static KeepAliveNetwork_t pxNetworks[ MQTT_KEEPALIVE_NETWORKS ] = { 0 };
+
+#if MQTT_KEEPALIVE_PERSIST
+    static bool xStorageLoaded = false;
+#endif
+
+/*-----------------------------------------------------------*/
+
+/* 32 bit FNV-1a of the configured SSID. Zero is reserved for unused entries. */
+static uint32_t prvGetNetworkHash( void )
+{
+    char pcSsid[ KEEPALIVE_SSID_MAX_LEN + 1 ] = { 0 };
+    uint32_t ulHash = 2166136261UL;
+
+    ( void ) KVStore_getString( CS_WIFI_SSID, pcSsid, sizeof( pcSsid ) );
+
+    for( size_t uxIdx = 0; ( uxIdx < KEEPALIVE_SSID_MAX_LEN ) && ( pcSsid[ uxIdx ] != '\0' ); uxIdx++ )
+    {
+        ulHash ^= ( uint8_t ) pcSsid[ uxIdx ];
+        ulHash *= 16777619UL;
+    }
+
+    return( ( ulHash == 0 ) ? 1 : ulHash );
+}
+
+/*-----------------------------------------------------------*/
+
+#if MQTT_KEEPALIVE_PERSIST
+
+    static void prvLoadFromStorage( void )
+    {
+        char pcRecords[ ( KEEPALIVE_RECORD_MAX_LEN + 1U ) * MQTT_KEEPALIVE_NETWORKS ] = { 0 };
+        char * pcNext = pcRecords;
+        bool xMalformed = false;
+
+        xStorageLoaded = true;
+
+        ( void ) KVStore_getString( CS_MQTT_KEEPALIVE, pcRecords, sizeof( pcRecords ) );
+
+        for( size_t uxIdx = 0; ( uxIdx < MQTT_KEEPALIVE_NETWORKS ) && ( *pcNext != '\0' ) && !xMalformed; uxIdx++ )
+        {
+            uint32_t ulHash = ( uint32_t ) strtoul( pcNext, &pcNext, 16 );
+            uint32_t ulSafeS = 0;
+            uint32_t ulLimitS = 0;
+
+            if( *pcNext == ':' )
+            {
+                ulSafeS = ( uint32_t ) strtoul( pcNext + 1, &pcNext, 10 );
+            }
+
+            if( *pcNext == ':' )
+            {
+                ulLimitS = ( uint32_t ) strtoul( pcNext + 1, &pcNext, 10 );
+            }
+
+            if( ( ulHash != 0 ) &&
+                ( ulSafeS >= MQTT_KEEPALIVE_MIN_S ) && ( ulSafeS <= MQTT_KEEPALIVE_MAX_S ) &&
+                ( ulLimitS <= UINT16_MAX ) )
+            {
+                pxNetworks[ uxIdx ].ulNetworkHash = ulHash;
+                pxNetworks[ uxIdx ].usSafeS = ( uint16_t ) ulSafeS;
+                pxNetworks[ uxIdx ].usLimitS = ( uint16_t ) ulLimitS;
+            }
+
+            if( *pcNext == ',' )
+            {
+                pcNext++;
+            }
+            else
+            {
+                /* Ignore the remainder of a malformed record. */
+                xMalformed = ( *pcNext != '\0' );
+            }
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvSaveToStorage( void )
+    {
+        char pcRecords[ ( KEEPALIVE_RECORD_MAX_LEN + 1U ) * MQTT_KEEPALIVE_NETWORKS ] = { 0 };
+        size_t uxLen = 0;
+
+        for( size_t uxIdx = 0; ( uxIdx < MQTT_KEEPALIVE_NETWORKS ) && ( pxNetworks[ uxIdx ].ulNetworkHash != 0 ); uxIdx++ )
+        {
+            uxLen += ( size_t ) snprintf( &( pcRecords[ uxLen ] ), sizeof( pcRecords ) - uxLen,
+                                          "%s%08lx:%u:%u", ( uxIdx > 0 ) ? "," : "",
+                                          ( unsigned long ) pxNetworks[ uxIdx ].ulNetworkHash,
+                                          ( unsigned int ) pxNetworks[ uxIdx ].usSafeS,
+                                          ( unsigned int ) pxNetworks[ uxIdx ].usLimitS );
+        }
+
+        if( ( KVStore_setString( CS_MQTT_KEEPALIVE, pcRecords ) != pdTRUE ) ||
+            ( KVStore_xCommitChanges() != pdTRUE ) )
+        {
+            LogWarn( "Failed to save the learned keep alive intervals." );
+        }
+    }
+
+#endif /* MQTT_KEEPALIVE_PERSIST */
+
+/*-----------------------------------------------------------*/
+
+/* Record the intervals learned for a network and move it to the front of the table. */
+static void prvUpdateNetwork( uint32_t ulNetworkHash,
+                              uint32_t ulSafeS,
+                              uint32_t ulLimitS )
+{
+    size_t uxIdx = 0;
+
+    taskENTER_CRITICAL();
+    {
+        while( ( uxIdx < ( MQTT_KEEPALIVE_NETWORKS - 1U ) ) &&
+               ( pxNetworks[ uxIdx ].ulNetworkHash != ulNetworkHash ) )
+        {
+            uxIdx++;
+        }
+
+        /* Otherwise the least recently updated entry is replaced. */
+        ( void ) memmove( &( pxNetworks[ 1 ] ), &( pxNetworks[ 0 ] ), uxIdx * sizeof( KeepAliveNetwork_t ) );
+
+        pxNetworks[ 0 ].ulNetworkHash = ulNetworkHash;
+        pxNetworks[ 0 ].usSafeS = ( uint16_t ) ulSafeS;
+        pxNetworks[ 0 ].usLimitS = ( uint16_t ) ulLimitS;
+    }
+    taskEXIT_CRITICAL();
+
+    #if MQTT_KEEPALIVE_PERSIST
+        prvSaveToStorage();
+    #endif
+}
+
+/*-----------------------------------------------------------*/
+
+/* Probe one step beyond the confirmed interval, unless that is already known to fail. */
+static uint32_t prvSelectInterval( uint32_t ulSafeS,
+                                   uint32_t ulLimitS )
+{
+    uint32_t ulIntervalS = ulSafeS + MQTT_KEEPALIVE_STEP_S;
+
+    if( ulIntervalS > MQTT_KEEPALIVE_MAX_S )
+    {
+        ulIntervalS = MQTT_KEEPALIVE_MAX_S;
+    }
+
+    if( ( ulLimitS != 0 ) && ( ulIntervalS >= ulLimitS ) )
+    {
+        ulIntervalS = ulSafeS;
+    }
+
+    return ulIntervalS;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSetInterval( MqttKeepAlive_t * pxKeepAlive,
+                            MQTTContext_t * pxMqttContext )
+{
+    uint32_t ulIntervalS = prvSelectInterval( pxKeepAlive->xStats.ulSafeS, pxKeepAlive->xStats.ulLimitS );
+
+    taskENTER_CRITICAL();
+    {
+        pxKeepAlive->xStats.ulIntervalS = ulIntervalS;
+    }
+    taskEXIT_CRITICAL();
+
+    pxMqttContext->keepAliveIntervalSec = ( uint16_t ) ulIntervalS;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline uint32_t prvRoundToSeconds( uint32_t ulTimeMs )
+{
+    return( ( ulTimeMs + 500U ) / 1000U );
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttKeepAlive_Start( MqttKeepAlive_t * pxKeepAlive,
+                          MQTTContext_t * pxMqttContext )
+{
+    uint32_t ulSafeS = MQTT_KEEPALIVE_MIN_S;
+    uint32_t ulLimitS = 0;
+
+    configASSERT( pxKeepAlive != NULL );
+    configASSERT( pxMqttContext != NULL );
+
+    #if MQTT_KEEPALIVE_PERSIST
+        if( !xStorageLoaded )
+        {
+            prvLoadFromStorage();
+        }
+    #endif
+
+    pxKeepAlive->ulNetworkHash = prvGetNetworkHash();
+
+    taskENTER_CRITICAL();
+    {
+        for( size_t uxIdx = 0; uxIdx < MQTT_KEEPALIVE_NETWORKS; uxIdx++ )
+        {
+            if( pxNetworks[ uxIdx ].ulNetworkHash == pxKeepAlive->ulNetworkHash )
+            {
+                ulSafeS = pxNetworks[ uxIdx ].usSafeS;
+                ulLimitS = pxNetworks[ uxIdx ].usLimitS;
+            }
+        }
+
+        pxKeepAlive->xStats.ulSafeS = ulSafeS;
+        pxKeepAlive->xStats.ulLimitS = ulLimitS;
+        pxKeepAlive->xStats.ulPingsSent = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    pxKeepAlive->ulLastActivityMs = pxMqttContext->getTime();
+    pxKeepAlive->ulPingIdleMs = 0;
+    pxKeepAlive->xWaitingForPingResp = false;
+
+    prvSetInterval( pxKeepAlive, pxMqttContext );
+
+    LogInfo( "Keep alive interval %lu s, %lu s confirmed on this network.",
+             ( unsigned long ) pxKeepAlive->xStats.ulIntervalS,
+             ( unsigned long ) ulSafeS );
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttKeepAlive_Process( MqttKeepAlive_t * pxKeepAlive,
+                            MQTTContext_t * pxMqttContext )
+{
+    configASSERT( pxKeepAlive != NULL );
+    configASSERT( pxMqttContext != NULL );
+
+    if( pxMqttContext->waitingForPingResp )
+    {
+        if( !pxKeepAlive->xWaitingForPingResp )
+        {
+            /* coreMQTT sent a PINGREQ since the last call. Note how long the
+             * connection had been idle in both directions at that point. */
+            pxKeepAlive->xWaitingForPingResp = true;
+            pxKeepAlive->ulPingIdleMs = pxMqttContext->pingReqSendTimeMs - pxKeepAlive->ulLastActivityMs;
+            pxKeepAlive->xStats.ulPingsSent++;
+        }
+    }
+    else
+    {
+        uint32_t ulNowMs = pxMqttContext->getTime();
+
+        if( pxKeepAlive->xWaitingForPingResp )
+        {
+            uint32_t ulIdleS = prvRoundToSeconds( pxKeepAlive->ulPingIdleMs );
+
+            pxKeepAlive->xWaitingForPingResp = false;
+
+            /* The access point and NAT kept the connection open for a longer
+             * idle interval than confirmed so far. */
+            if( ( ulIdleS >= pxKeepAlive->xStats.ulIntervalS ) &&
+                ( pxKeepAlive->xStats.ulIntervalS > pxKeepAlive->xStats.ulSafeS ) )
+            {
+                taskENTER_CRITICAL();
+                {
+                    pxKeepAlive->xStats.ulSafeS = pxKeepAlive->xStats.ulIntervalS;
+                    pxKeepAlive->xStats.ulProbesConfirmed++;
+                }
+                taskEXIT_CRITICAL();
+
+                prvUpdateNetwork( pxKeepAlive->ulNetworkHash,
+                                  pxKeepAlive->xStats.ulSafeS,
+                                  pxKeepAlive->xStats.ulLimitS );
+
+                prvSetInterval( pxKeepAlive, pxMqttContext );
+
+                LogInfo( "Idle interval of %lu s confirmed, keep alive interval is now %lu s.",
+                         ( unsigned long ) pxKeepAlive->xStats.ulSafeS,
+                         ( unsigned long ) pxKeepAlive->xStats.ulIntervalS );
+            }
+        }
+
+        uint32_t ulTxIdleMs = ulNowMs - pxMqttContext->lastPacketTxTime;
+        uint32_t ulRxIdleMs = ulNowMs - pxMqttContext->lastPacketRxTime;
+
+        /* Traffic in either direction keeps the NAT mapping alive. */
+        pxKeepAlive->ulLastActivityMs = ( ulTxIdleMs < ulRxIdleMs ) ?
+                                        pxMqttContext->lastPacketTxTime :
+                                        pxMqttContext->lastPacketRxTime;
+
+        /* Packets are going out but nothing is coming back. */
+        if( ( ulRxIdleMs >= ( MQTT_KEEPALIVE_RX_TIMEOUT_S * 1000U ) ) &&
+            ( ulTxIdleMs < ulRxIdleMs ) )
+        {
+            MQTTStatus_t xStatus = MQTT_Ping( pxMqttContext );
+
+            if( xStatus != MQTTSuccess )
+            {
+                LogWarn( "Failed to send PINGREQ: %s.", MQTT_Status_strerror( xStatus ) );
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Time left until ulTimeoutMs has elapsed since ulStartMs. */
+static inline uint32_t prvRemainingMs( uint32_t ulNowMs,
+                                       uint32_t ulStartMs,
+                                       uint32_t ulTimeoutMs )
+{
+    uint32_t ulElapsedMs = ulNowMs - ulStartMs;
+
+    return( ( ulElapsedMs < ulTimeoutMs ) ? ( ulTimeoutMs - ulElapsedMs ) : 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttKeepAlive_GetWaitMs( const MqttKeepAlive_t * pxKeepAlive,
+                                  const MQTTContext_t * pxMqttContext )
+{
+    uint32_t ulNowMs = 0;
+    uint32_t ulWaitMs = 0;
+
+    configASSERT( pxKeepAlive != NULL );
+    configASSERT( pxMqttContext != NULL );
+
+    ( void ) pxKeepAlive;
+
+    ulNowMs = pxMqttContext->getTime();
+
+    if( pxMqttContext->waitingForPingResp )
+    {
+        ulWaitMs = prvRemainingMs( ulNowMs, pxMqttContext->pingReqSendTimeMs, MQTT_PINGRESP_TIMEOUT_MS );
+    }
+    else
+    {
+        /* The same limits as coreMQTT's handleKeepAlive. */
+        uint32_t ulTxTimeoutMs = ( uint32_t ) pxMqttContext->keepAliveIntervalSec * 1000U;
+        uint32_t ulRxWaitMs = 0;
+
+        if( PACKET_TX_TIMEOUT_MS < ulTxTimeoutMs )
+        {
+            ulTxTimeoutMs = PACKET_TX_TIMEOUT_MS;
+        }
+
+        ulWaitMs = ( ulTxTimeoutMs > 0U ) ?
+                   prvRemainingMs( ulNowMs, pxMqttContext->lastPacketTxTime, ulTxTimeoutMs ) :
+                   UINT32_MAX;
+
+        /* MqttKeepAlive_Process only pings early if a packet was sent since
+         * the last one was received. */
+        if( ( ulNowMs - pxMqttContext->lastPacketTxTime ) < ( ulNowMs - pxMqttContext->lastPacketRxTime ) )
+        {
+            ulRxWaitMs = prvRemainingMs( ulNowMs, pxMqttContext->lastPacketRxTime,
+                                         MQTT_KEEPALIVE_RX_TIMEOUT_S * 1000U );
+        }
+        else
+        {
+            ulRxWaitMs = prvRemainingMs( ulNowMs, pxMqttContext->lastPacketRxTime, PACKET_RX_TIMEOUT_MS );
+        }
+
+        if( ulRxWaitMs < ulWaitMs )
+        {
+            ulWaitMs = ulRxWaitMs;
+        }
+    }
+
+    return ulWaitMs;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttKeepAlive_Stop( MqttKeepAlive_t * pxKeepAlive,
+                         MQTTStatus_t xStatus )
+{
+    configASSERT( pxKeepAlive != NULL );
+
+    /* A connection lost while a PINGREQ sent after a full idle interval was
+     * outstanding was most likely dropped by the access point or NAT. */
+    if( ( xStatus != MQTTSuccess ) &&
+        pxKeepAlive->xWaitingForPingResp &&
+        ( prvRoundToSeconds( pxKeepAlive->ulPingIdleMs ) >= pxKeepAlive->xStats.ulIntervalS ) )
+    {
+        uint32_t ulSafeS = pxKeepAlive->xStats.ulSafeS;
+
+        /* The confirmed interval no longer works, the network has changed. */
+        if( ( pxKeepAlive->xStats.ulIntervalS <= ulSafeS ) &&
+            ( ulSafeS > MQTT_KEEPALIVE_MIN_S ) )
+        {
+            ulSafeS = ( ulSafeS > ( MQTT_KEEPALIVE_MIN_S + MQTT_KEEPALIVE_STEP_S ) ) ?
+                      ( ulSafeS - MQTT_KEEPALIVE_STEP_S ) : MQTT_KEEPALIVE_MIN_S;
+        }
+
+        taskENTER_CRITICAL();
+        {
+            pxKeepAlive->xStats.ulLimitS = pxKeepAlive->xStats.ulIntervalS;
+            pxKeepAlive->xStats.ulSafeS = ulSafeS;
+            pxKeepAlive->xStats.ulProbesFailed++;
+        }
+        taskEXIT_CRITICAL();
+
+        prvUpdateNetwork( pxKeepAlive->ulNetworkHash, ulSafeS, pxKeepAlive->xStats.ulLimitS );
+
+        LogWarn( "Connection lost after %lu s idle, falling back to a keep alive interval of %lu s.",
+                 ( unsigned long ) prvRoundToSeconds( pxKeepAlive->ulPingIdleMs ),
+                 ( unsigned long ) prvSelectInterval( ulSafeS, pxKeepAlive->xStats.ulLimitS ) );
+    }
+
+    pxKeepAlive->xWaitingForPingResp = false;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttKeepAlive_GetStats( const MqttKeepAlive_t * pxKeepAlive,
+                             MqttKeepAliveStats_t * pxStats )
+{
+    configASSERT( pxKeepAlive != NULL );
+    configASSERT( pxStats != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxStats = pxKeepAlive->xStats;
+    }
+    taskEXIT_CRITICAL();
+}
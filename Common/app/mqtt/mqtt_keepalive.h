@@ -0,0 +1,175 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_keepalive.h
+ * @brief Adaptive keep alive for the MQTT agent.
+ *
+ * coreMQTT sends a PINGREQ once nothing has been sent for the context's keep
+ * alive interval, so any outgoing traffic already pushes the next PINGREQ back.
+ * This module chooses that interval. It starts at MQTT_KEEPALIVE_MIN_S and,
+ * each time a PINGREQ sent after a full idle interval is answered, tries a
+ * longer interval, up to MQTT_KEEPALIVE_MAX_S. If the connection is lost while
+ * such a PINGREQ is outstanding, the access point or NAT dropped the idle
+ * connection, and the interval falls back to the longest one known to work.
+ *
+ * The learned intervals are kept per Wi-Fi network, identified by a hash of
+ * its SSID, and saved to the KVStore.
+ */
+#ifndef MQTT_KEEPALIVE_H
+#define MQTT_KEEPALIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core_mqtt.h"
+
+/**
+ * @brief Keep alive interval used on a network with no learned interval, and
+ * the shortest interval ever used.
+ */
+#ifndef MQTT_KEEPALIVE_MIN_S
+    #define MQTT_KEEPALIVE_MIN_S    60U
+#endif /* MQTT_KEEPALIVE_MIN_S */
+
+/**
+ * @brief Longest keep alive interval probed. Also sent to the broker in the
+ * CONNECT packet, so must not exceed the broker's maximum keep alive.
+ */
+#ifndef MQTT_KEEPALIVE_MAX_S
+    #define MQTT_KEEPALIVE_MAX_S    1200U
+#endif /* MQTT_KEEPALIVE_MAX_S */
+
+/**
+ * @brief Amount by which the keep alive interval grows after each confirmed
+ * idle interval, and shrinks if the longest known interval stops working.
+ */
+#ifndef MQTT_KEEPALIVE_STEP_S
+    #define MQTT_KEEPALIVE_STEP_S    60U
+#endif /* MQTT_KEEPALIVE_STEP_S */
+
+/**
+ * @brief Time after which a PINGREQ is sent if packets are being sent but none
+ * have been received. Bounds the time taken to notice a dead connection while
+ * the PINGREQs of the keep alive interval are pushed back by outgoing traffic.
+ */
+#ifndef MQTT_KEEPALIVE_RX_TIMEOUT_S
+    #define MQTT_KEEPALIVE_RX_TIMEOUT_S    120U
+#endif /* MQTT_KEEPALIVE_RX_TIMEOUT_S */
+
+/**
+ * @brief Number of networks for which a learned interval is kept.
+ */
+#ifndef MQTT_KEEPALIVE_NETWORKS
+    #define MQTT_KEEPALIVE_NETWORKS    4U
+#endif /* MQTT_KEEPALIVE_NETWORKS */
+
+/**
+ * @brief Set to 1 to save the learned intervals to the KVStore.
+ */
+#ifndef MQTT_KEEPALIVE_PERSIST
+    #define MQTT_KEEPALIVE_PERSIST    1
+#endif /* MQTT_KEEPALIVE_PERSIST */
+
+typedef struct MqttKeepAliveStats
+{
+    uint32_t ulIntervalS;       /* Keep alive interval in use. */
+    uint32_t ulSafeS;           /* Longest idle interval confirmed on this network. */
+    uint32_t ulLimitS;          /* Shortest idle interval that failed, zero if none. */
+    uint32_t ulPingsSent;       /* PINGREQs sent on this connection. */
+    uint32_t ulProbesConfirmed; /* Longer intervals confirmed since boot. */
+    uint32_t ulProbesFailed;    /* Intervals which lost the connection since boot. */
+} MqttKeepAliveStats_t;
+
+/**
+ * @brief Keep alive state of an MQTT agent. Only accessed by the agent task,
+ * except through MqttKeepAlive_GetStats.
+ */
+typedef struct MqttKeepAlive
+{
+    uint32_t ulNetworkHash;
+    uint32_t ulLastActivityMs;
+    uint32_t ulPingIdleMs;
+    bool xWaitingForPingResp;
+    MqttKeepAliveStats_t xStats;
+} MqttKeepAlive_t;
+
+/**
+ * @brief Select the keep alive interval for a new connection.
+ *
+ * Call once the CONNACK has been received. The CONNECT packet should carry
+ * MQTT_KEEPALIVE_MAX_S, so that the broker accepts any interval chosen later.
+ *
+ * @param[in] pxKeepAlive Keep alive state.
+ * @param[in] pxMqttContext Connected MQTT context.
+ */
+void MqttKeepAlive_Start( MqttKeepAlive_t * pxKeepAlive,
+                          MQTTContext_t * pxMqttContext );
+
+/**
+ * @brief Track PINGREQs sent by coreMQTT and adjust the keep alive interval.
+ * Sends a PINGREQ if nothing has been received for MQTT_KEEPALIVE_RX_TIMEOUT_S
+ * since the last packet was sent.
+ *
+ * Call from the agent task on every iteration of the command loop.
+ *
+ * @param[in] pxKeepAlive Keep alive state.
+ * @param[in] pxMqttContext Connected MQTT context.
+ */
+void MqttKeepAlive_Process( MqttKeepAlive_t * pxKeepAlive,
+                            MQTTContext_t * pxMqttContext );
+
+/**
+ * @brief Time until coreMQTT or MqttKeepAlive_Process next has to run to send
+ * a PINGREQ or to notice a missing PINGRESP.
+ *
+ * @param[in] pxKeepAlive Keep alive state.
+ * @param[in] pxMqttContext Connected MQTT context.
+ *
+ * @return Time in milliseconds, zero if a deadline has already passed.
+ */
+uint32_t MqttKeepAlive_GetWaitMs( const MqttKeepAlive_t * pxKeepAlive,
+                                  const MQTTContext_t * pxMqttContext );
+
+/**
+ * @brief Record the end of a connection.
+ *
+ * @param[in] pxKeepAlive Keep alive state.
+ * @param[in] xStatus Status returned by the command loop.
+ */
+void MqttKeepAlive_Stop( MqttKeepAlive_t * pxKeepAlive,
+                         MQTTStatus_t xStatus );
+
+/**
+ * @brief Get a copy of the keep alive statistics.
+ *
+ * @param[in] pxKeepAlive Keep alive state.
+ * @param[out] pxStats Statistics.
+ */
+void MqttKeepAlive_GetStats( const MqttKeepAlive_t * pxKeepAlive,
+                             MqttKeepAliveStats_t * pxStats );
+
+#endif /* MQTT_KEEPALIVE_H */
@@ -0,0 +1,168 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+#include "mqtt_rate_limit.h"
+
+/*-----------------------------------------------------------*/
+
+/* Tokens are counted in thousandths, so that a bucket refills by ulRatePerSec
+ * thousandths every millisecond. */
+#define MILLI_TOKENS_PER_TOKEN    ( 1000U )
+
+/*-----------------------------------------------------------*/
+
+static inline uint32_t prvCapacity( const MqttRateClass_t * pxClass )
+{
+    uint32_t ulBurst = ( pxClass->ulBurst > 0U ) ? pxClass->ulBurst : 1U;
+
+    return ulBurst * MILLI_TOKENS_PER_TOKEN;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvTokensAt( const MqttRateBucket_t * pxBucket,
+                             uint32_t ulNowMs )
+{
+    uint32_t ulCapacity = prvCapacity( pxBucket->pxClass );
+    uint64_t ullMilliTokens = ( uint64_t ) pxBucket->ulMilliTokens +
+                              ( ( uint64_t ) ( ulNowMs - pxBucket->ulLastRefillMs ) * pxBucket->pxClass->ulRatePerSec );
+
+    return( ( ullMilliTokens > ulCapacity ) ? ulCapacity : ( uint32_t ) ullMilliTokens );
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttRateLimit_Init( MqttRateLimit_t * pxRateLimit,
+                         const MqttRateClass_t * pxClasses,
+                         size_t uxClassCount,
+                         uint32_t ulNowMs )
+{
+    memset( pxRateLimit, 0, sizeof( MqttRateLimit_t ) );
+
+    for( size_t uxIdx = 0; ( pxClasses != NULL ) && ( uxIdx < uxClassCount ); uxIdx++ )
+    {
+        if( ( pxClasses[ uxIdx ].ulRatePerSec > 0U ) &&
+            ( pxRateLimit->uxBucketCount < MQTT_RATE_LIMIT_MAX_CLASSES ) )
+        {
+            MqttRateBucket_t * pxBucket = &( pxRateLimit->pxBuckets[ pxRateLimit->uxBucketCount ] );
+
+            pxBucket->pxClass = &( pxClasses[ uxIdx ] );
+            pxBucket->ulMilliTokens = prvCapacity( pxBucket->pxClass );
+            pxBucket->ulLastRefillMs = ulNowMs;
+            pxRateLimit->uxBucketCount++;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+size_t MqttRateLimit_Classify( const MqttRateLimit_t * pxRateLimit,
+                               const MQTTPublishInfo_t * pxPublishInfo,
+                               uint32_t ulLane )
+{
+    size_t uxMatch = MQTT_RATE_LIMIT_MAX_CLASSES;
+
+    for( size_t uxIdx = 0; ( uxIdx < pxRateLimit->uxBucketCount ) && ( uxMatch == MQTT_RATE_LIMIT_MAX_CLASSES ); uxIdx++ )
+    {
+        const MqttRateClass_t * pxClass = pxRateLimit->pxBuckets[ uxIdx ].pxClass;
+        bool xMatch = ( pxClass->ulLaneMask == 0U ) || ( ( pxClass->ulLaneMask & ( 1UL << ulLane ) ) != 0U );
+
+        if( xMatch && ( pxClass->pcTopicPrefix != NULL ) )
+        {
+            size_t uxPrefixLength = strlen( pxClass->pcTopicPrefix );
+
+            xMatch = ( uxPrefixLength <= pxPublishInfo->topicNameLength ) &&
+                     ( strncmp( pxPublishInfo->pTopicName, pxClass->pcTopicPrefix, uxPrefixLength ) == 0 );
+        }
+
+        if( xMatch )
+        {
+            uxMatch = uxIdx;
+        }
+    }
+
+    return uxMatch;
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttRateLimit_Take( MqttRateBucket_t * pxBucket,
+                         uint32_t ulNowMs )
+{
+    bool xTaken = false;
+
+    pxBucket->ulMilliTokens = prvTokensAt( pxBucket, ulNowMs );
+    pxBucket->ulLastRefillMs = ulNowMs;
+
+    if( pxBucket->ulMilliTokens >= MILLI_TOKENS_PER_TOKEN )
+    {
+        pxBucket->ulMilliTokens -= MILLI_TOKENS_PER_TOKEN;
+        xTaken = true;
+    }
+
+    return xTaken;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t MqttRateLimit_GetWaitMs( const MqttRateBucket_t * pxBucket,
+                                  uint32_t ulNowMs )
+{
+    uint32_t ulWaitMs = 0;
+    uint32_t ulMilliTokens = prvTokensAt( pxBucket, ulNowMs );
+
+    if( ulMilliTokens < MILLI_TOKENS_PER_TOKEN )
+    {
+        uint32_t ulMissing = MILLI_TOKENS_PER_TOKEN - ulMilliTokens;
+
+        /* Round up, so that the token is there once the time has passed. */
+        ulWaitMs = ( ulMissing + pxBucket->pxClass->ulRatePerSec - 1U ) / pxBucket->pxClass->ulRatePerSec;
+    }
+
+    return ulWaitMs;
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttRateLimit_GetStats( const MqttRateLimit_t * pxRateLimit,
+                             size_t uxClass,
+                             MqttRateStats_t * pxStats )
+{
+    bool xResult = false;
+
+    if( ( pxRateLimit != NULL ) &&
+        ( uxClass < pxRateLimit->uxBucketCount ) &&
+        ( pxStats != NULL ) )
+    {
+        *pxStats = pxRateLimit->pxBuckets[ uxClass ].xStats;
+        xResult = true;
+    }
+
+    return xResult;
+}
@@ -0,0 +1,159 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_rate_limit.h
+ * @brief Token bucket limits on the publishes sent by the MQTT agent.
+ *
+ * Brokers throttle the publish rate of each connection, and disconnect clients
+ * which exceed it. Each publish belongs to the first rate class whose topic
+ * prefix and lanes match it. A class allows ulRatePerSec publishes per second
+ * on average, in bursts of up to ulBurst. The agent holds back publishes beyond
+ * that before they are written to the connection, as set by the class policy.
+ * Publishes which match no class are not limited, so a last class without a
+ * topic prefix limits everything else.
+ */
+#ifndef MQTT_RATE_LIMIT_H
+#define MQTT_RATE_LIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core_mqtt.h"
+
+/**
+ * @brief Maximum number of rate classes of an agent instance.
+ */
+#ifndef MQTT_RATE_LIMIT_MAX_CLASSES
+    #define MQTT_RATE_LIMIT_MAX_CLASSES    4U
+#endif /* MQTT_RATE_LIMIT_MAX_CLASSES */
+
+/**
+ * @brief Publishes of a class held by the agent while the class has no tokens.
+ * Once the backlog is full, further publishes of the class are left in their
+ * lane, which then fills and pushes back on the publishing tasks.
+ */
+#ifndef MQTT_RATE_LIMIT_BACKLOG_LENGTH
+    #define MQTT_RATE_LIMIT_BACKLOG_LENGTH    8U
+#endif /* MQTT_RATE_LIMIT_BACKLOG_LENGTH */
+
+typedef enum MqttRatePolicy
+{
+    MQTT_RATE_DELAY = 0, /* Hold the publish until a token is available. */
+    MQTT_RATE_MERGE,     /* As MQTT_RATE_DELAY, but a QoS0 publish replaces a held one to the same topic. */
+    MQTT_RATE_DROP       /* Fail the publish with MQTTNoMemory. */
+} MqttRatePolicy_t;
+
+/* Referenced, not copied, so it must stay valid for as long as the agent runs. */
+typedef struct MqttRateClass
+{
+    const char * pcTopicPrefix; /* NULL matches every topic. */
+    uint32_t ulLaneMask;        /* ( 1 << lane ) for each lane matched, 0 for every lane. */
+    uint32_t ulRatePerSec;      /* Classes with a zero rate are ignored. */
+    uint32_t ulBurst;           /* Publishes that may be sent back to back, at least 1. */
+    MqttRatePolicy_t xPolicy;
+} MqttRateClass_t;
+
+typedef struct MqttRateStats
+{
+    uint32_t ulPassed;     /* Publishes sent without waiting. */
+    uint32_t ulDelayed;    /* Publishes held until a token was available. */
+    uint32_t ulMerged;     /* Held publishes replaced by a newer one to the same topic. */
+    uint32_t ulDropped;    /* Publishes failed by the MQTT_RATE_DROP policy. */
+    uint32_t ulMaxDelayMs; /* Longest time a publish was held. */
+} MqttRateStats_t;
+
+/**
+ * @brief Token bucket of a rate class. Only accessed by the agent task,
+ * except through MqttRateLimit_GetStats.
+ */
+typedef struct MqttRateBucket
+{
+    const MqttRateClass_t * pxClass;
+    uint32_t ulMilliTokens;
+    uint32_t ulLastRefillMs;
+    MqttRateStats_t xStats;
+} MqttRateBucket_t;
+
+typedef struct MqttRateLimit
+{
+    MqttRateBucket_t pxBuckets[ MQTT_RATE_LIMIT_MAX_CLASSES ];
+    size_t uxBucketCount;
+} MqttRateLimit_t;
+
+/**
+ * @brief Set up a full bucket for each rate class.
+ *
+ * @param[in] pxRateLimit Rate limit state.
+ * @param[in] pxClasses Rate classes, in the order they are matched. May be NULL.
+ * @param[in] uxClassCount Number of classes, at most MQTT_RATE_LIMIT_MAX_CLASSES are used.
+ * @param[in] ulNowMs Current time in milliseconds.
+ */
+void MqttRateLimit_Init( MqttRateLimit_t * pxRateLimit,
+                         const MqttRateClass_t * pxClasses,
+                         size_t uxClassCount,
+                         uint32_t ulNowMs );
+
+/**
+ * @brief Find the bucket of a publish.
+ *
+ * @param[in] pxRateLimit Rate limit state.
+ * @param[in] pxPublishInfo Publish to classify.
+ * @param[in] ulLane Lane the publish was queued on.
+ *
+ * @return Index of the bucket, or MQTT_RATE_LIMIT_MAX_CLASSES if the publish is not limited.
+ */
+size_t MqttRateLimit_Classify( const MqttRateLimit_t * pxRateLimit,
+                               const MQTTPublishInfo_t * pxPublishInfo,
+                               uint32_t ulLane );
+
+/**
+ * @brief Take a token from a bucket.
+ *
+ * @return true if a token was available.
+ */
+bool MqttRateLimit_Take( MqttRateBucket_t * pxBucket,
+                         uint32_t ulNowMs );
+
+/**
+ * @brief Time until a bucket next holds a token.
+ *
+ * @return Time in milliseconds, zero if a token is available.
+ */
+uint32_t MqttRateLimit_GetWaitMs( const MqttRateBucket_t * pxBucket,
+                                  uint32_t ulNowMs );
+
+/**
+ * @brief Get a copy of the statistics of a rate class.
+ *
+ * @return false if there is no class uxClass.
+ */
+bool MqttRateLimit_GetStats( const MqttRateLimit_t * pxRateLimit,
+                             size_t uxClass,
+                             MqttRateStats_t * pxStats );
+
+#endif /* MQTT_RATE_LIMIT_H */
@@ -0,0 +1,429 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+#include "mqtt_session_store.h"
+
+#if MQTT_AGENT_SESSION_STORE_ENABLED
+
+/* Standard includes. */
+    #include <string.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+
+/* Kernel includes. */
+    #include "FreeRTOS.h"
+
+    #include "lfs.h"
+    #include "fs/lfs_port.h"
+
+/*-----------------------------------------------------------*/
+
+    #define SESSION_RECORD_MAGIC    ( 0x4D535353UL )
+    #define SESSION_PATH_MAX        ( sizeof( MQTT_SESSION_STORE_DIR ) + 10 )
+
+    typedef struct SessionRecordHeader
+    {
+        uint32_t ulMagic;
+        uint16_t usPacketId;
+        uint16_t usTopicLength;
+        uint8_t ucQoS;
+        uint8_t ucRetain;
+        uint16_t usReserved;
+        uint32_t ulPayloadLength;
+    } SessionRecordHeader_t;
+
+/* Only used by the agent task of the default instance. */
+    typedef struct SessionStoreCtx
+    {
+        lfs_t * pxLfs;
+        uint32_t ulNextSeq;
+        MqttSessionStoreStats_t xStats;
+    } SessionStoreCtx_t;
+
+    static SessionStoreCtx_t xStore = { 0 };
+
+/*-----------------------------------------------------------*/
+
+    static inline void prvRecordPath( char * pcPath,
+                                      uint32_t ulSeq )
+    {
+        ( void ) snprintf( pcPath, SESSION_PATH_MAX, MQTT_SESSION_STORE_DIR "/%08lx", ( unsigned long ) ulSeq );
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool prvParseSeq( const struct lfs_info * pxInfo,
+                             uint32_t * pulSeq )
+    {
+        char * pcEnd = NULL;
+        unsigned long ulSeq = strtoul( pxInfo->name, &pcEnd, 16 );
+
+        *pulSeq = ( uint32_t ) ulSeq;
+
+        return( ( pxInfo->type == LFS_TYPE_REG ) && ( pcEnd != pxInfo->name ) && ( *pcEnd == '\0' ) );
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool prvHeaderIsValid( const SessionRecordHeader_t * pxHeader,
+                                  size_t uxFileSize )
+    {
+        return( ( pxHeader->ulMagic == SESSION_RECORD_MAGIC ) &&
+                ( pxHeader->usPacketId != 0U ) &&
+                ( pxHeader->ucQoS == ( uint8_t ) MQTTQoS1 ) &&
+                ( pxHeader->usTopicLength > 0U ) &&
+                ( pxHeader->ulPayloadLength <= MQTT_SESSION_STORE_MAX_RECORD_SIZE ) &&
+                ( ( pxHeader->usTopicLength + pxHeader->ulPayloadLength ) <= MQTT_SESSION_STORE_MAX_RECORD_SIZE ) &&
+                ( uxFileSize == ( sizeof( SessionRecordHeader_t ) + pxHeader->usTopicLength + pxHeader->ulPayloadLength ) ) );
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Collect the sequence numbers of the records on flash, in ascending order. */
+    static size_t prvListRecords( uint32_t * pulSeqs,
+                                  size_t uxMaxSeqs )
+    {
+        struct lfs_info xInfo = { 0 };
+        lfs_dir_t xDir = { 0 };
+        size_t uxCount = 0;
+
+        if( lfs_dir_open( xStore.pxLfs, &xDir, MQTT_SESSION_STORE_DIR ) == LFS_ERR_OK )
+        {
+            while( ( lfs_dir_read( xStore.pxLfs, &xDir, &xInfo ) > 0 ) && ( uxCount < uxMaxSeqs ) )
+            {
+                uint32_t ulSeq = 0;
+
+                if( prvParseSeq( &xInfo, &ulSeq ) )
+                {
+                    size_t uxIdx = uxCount;
+
+                    while( ( uxIdx > 0 ) && ( pulSeqs[ uxIdx - 1 ] > ulSeq ) )
+                    {
+                        pulSeqs[ uxIdx ] = pulSeqs[ uxIdx - 1 ];
+                        uxIdx--;
+                    }
+
+                    pulSeqs[ uxIdx ] = ulSeq;
+                    uxCount++;
+                }
+            }
+
+            ( void ) lfs_dir_close( xStore.pxLfs, &xDir );
+        }
+
+        return uxCount;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static MqttSessionRecord_t * prvReadRecord( uint32_t ulSeq )
+    {
+        char pcPath[ SESSION_PATH_MAX ];
+        lfs_file_t xFile = { 0 };
+        SessionRecordHeader_t xHeader = { 0 };
+        MqttSessionRecord_t * pxRecord = NULL;
+
+        prvRecordPath( pcPath, ulSeq );
+
+        if( lfs_file_open( xStore.pxLfs, &xFile, pcPath, LFS_O_RDONLY ) == LFS_ERR_OK )
+        {
+            if( ( lfs_file_read( xStore.pxLfs, &xFile, &xHeader, sizeof( xHeader ) ) == sizeof( xHeader ) ) &&
+                prvHeaderIsValid( &xHeader, ( size_t ) lfs_file_size( xStore.pxLfs, &xFile ) ) )
+            {
+                size_t uxDataLength = xHeader.usTopicLength + xHeader.ulPayloadLength;
+
+                pxRecord = ( MqttSessionRecord_t * ) pvPortMalloc( sizeof( MqttSessionRecord_t ) + uxDataLength );
+
+                if( pxRecord == NULL )
+                {
+                    LogError( "Failed to allocate %lu bytes for a stored publish.",
+                              ( unsigned long ) ( sizeof( MqttSessionRecord_t ) + uxDataLength ) );
+                }
+                else if( lfs_file_read( xStore.pxLfs, &xFile, &( pxRecord[ 1 ] ), uxDataLength ) != ( lfs_ssize_t ) uxDataLength )
+                {
+                    vPortFree( pxRecord );
+                    pxRecord = NULL;
+                }
+                else
+                {
+                    char * pcTopic = ( char * ) &( pxRecord[ 1 ] );
+
+                    memset( pxRecord, 0, sizeof( MqttSessionRecord_t ) );
+                    pxRecord->xPublishInfo.qos = MQTTQoS1;
+                    pxRecord->xPublishInfo.retain = ( xHeader.ucRetain != 0U );
+                    pxRecord->xPublishInfo.pTopicName = pcTopic;
+                    pxRecord->xPublishInfo.topicNameLength = xHeader.usTopicLength;
+                    pxRecord->xPublishInfo.pPayload = &( pcTopic[ xHeader.usTopicLength ] );
+                    pxRecord->xPublishInfo.payloadLength = xHeader.ulPayloadLength;
+                    pxRecord->usPacketId = xHeader.usPacketId;
+                    pxRecord->ulSeq = ulSeq;
+                }
+            }
+
+            ( void ) lfs_file_close( xStore.pxLfs, &xFile );
+        }
+
+        return pxRecord;
+    }
+
+/*-----------------------------------------------------------*/
+
+    MQTTStatus_t MqttSessionStore_Init( void )
+    {
+        MQTTStatus_t xStatus = MQTTSuccess;
+        struct lfs_info xInfo = { 0 };
+        lfs_dir_t xDir = { 0 };
+        int lError = LFS_ERR_OK;
+
+        if( xStore.pxLfs == NULL )
+        {
+            xStore.pxLfs = pxGetDefaultFsCtx();
+
+            if( xStore.pxLfs == NULL )
+            {
+                xStatus = MQTTIllegalState;
+            }
+            else
+            {
+                lError = lfs_stat( xStore.pxLfs, MQTT_SESSION_STORE_DIR, &xInfo );
+
+                if( lError == LFS_ERR_NOENT )
+                {
+                    lError = lfs_mkdir( xStore.pxLfs, MQTT_SESSION_STORE_DIR );
+                }
+
+                if( lError == LFS_ERR_OK )
+                {
+                    lError = lfs_dir_open( xStore.pxLfs, &xDir, MQTT_SESSION_STORE_DIR );
+                }
+            }
+
+            if( ( xStatus == MQTTSuccess ) && ( lError == LFS_ERR_OK ) )
+            {
+                while( lfs_dir_read( xStore.pxLfs, &xDir, &xInfo ) > 0 )
+                {
+                    uint32_t ulSeq = 0;
+
+                    if( prvParseSeq( &xInfo, &ulSeq ) )
+                    {
+                        xStore.ulNextSeq = ( ulSeq >= xStore.ulNextSeq ) ? ( ulSeq + 1 ) : xStore.ulNextSeq;
+                        xStore.xStats.ulRecordsStored++;
+                    }
+                }
+
+                ( void ) lfs_dir_close( xStore.pxLfs, &xDir );
+
+                LogInfo( "Session store holds %lu publishes.", ( unsigned long ) xStore.xStats.ulRecordsStored );
+            }
+            else if( xStatus == MQTTSuccess )
+            {
+                LogError( "Failed to open session store directory %s: %d.", MQTT_SESSION_STORE_DIR, lError );
+                xStatus = MQTTIllegalState;
+            }
+
+            if( xStatus != MQTTSuccess )
+            {
+                xStore.pxLfs = NULL;
+            }
+        }
+
+        return xStatus;
+    }
+
+/*-----------------------------------------------------------*/
+
+    MqttSessionRecord_t * MqttSessionStore_Load( void )
+    {
+        MqttSessionRecord_t * pxHead = NULL;
+        MqttSessionRecord_t ** ppxTail = &pxHead;
+        uint32_t * pulSeqs = NULL;
+        size_t uxCount = 0;
+
+        if( ( xStore.pxLfs != NULL ) && ( xStore.xStats.ulRecordsStored > 0 ) )
+        {
+            pulSeqs = ( uint32_t * ) pvPortMalloc( xStore.xStats.ulRecordsStored * sizeof( uint32_t ) );
+
+            if( pulSeqs == NULL )
+            {
+                LogError( "Failed to allocate the list of %lu stored publishes.",
+                          ( unsigned long ) xStore.xStats.ulRecordsStored );
+            }
+            else
+            {
+                uxCount = prvListRecords( pulSeqs, xStore.xStats.ulRecordsStored );
+            }
+        }
+
+        /* The directory is closed, so unreadable records can be removed. */
+        for( size_t uxIdx = 0; uxIdx < uxCount; uxIdx++ )
+        {
+            MqttSessionRecord_t * pxRecord = prvReadRecord( pulSeqs[ uxIdx ] );
+
+            if( pxRecord != NULL )
+            {
+                *ppxTail = pxRecord;
+                ppxTail = &( pxRecord->pxNext );
+                xStore.xStats.ulRestored++;
+            }
+            else
+            {
+                LogWarn( "Discarding unreadable stored publish %08lx.", ( unsigned long ) pulSeqs[ uxIdx ] );
+                MqttSessionStore_Remove( pulSeqs[ uxIdx ] );
+            }
+        }
+
+        vPortFree( pulSeqs );
+
+        return pxHead;
+    }
+
+/*-----------------------------------------------------------*/
+
+    MQTTStatus_t MqttSessionStore_Save( uint16_t usPacketId,
+                                        const MQTTPublishInfo_t * pxPublishInfo,
+                                        uint32_t * pulSeq )
+    {
+        MQTTStatus_t xStatus = MQTTSuccess;
+        SessionRecordHeader_t xHeader = { 0 };
+
+        if( ( pxPublishInfo == NULL ) ||
+            ( pulSeq == NULL ) ||
+            ( usPacketId == 0U ) ||
+            ( pxPublishInfo->qos != MQTTQoS1 ) ||
+            ( pxPublishInfo->pTopicName == NULL ) ||
+            ( pxPublishInfo->topicNameLength == 0 ) ||
+            ( ( pxPublishInfo->pPayload == NULL ) && ( pxPublishInfo->payloadLength > 0 ) ) ||
+            ( ( pxPublishInfo->topicNameLength + pxPublishInfo->payloadLength ) > MQTT_SESSION_STORE_MAX_RECORD_SIZE ) )
+        {
+            xStatus = MQTTBadParameter;
+        }
+        else if( xStore.pxLfs == NULL )
+        {
+            xStatus = MQTTIllegalState;
+        }
+        else
+        {
+            char pcPath[ SESSION_PATH_MAX ];
+            lfs_file_t xFile = { 0 };
+            lfs_ssize_t lReturn = 0;
+
+            xHeader.ulMagic = SESSION_RECORD_MAGIC;
+            xHeader.usPacketId = usPacketId;
+            xHeader.usTopicLength = pxPublishInfo->topicNameLength;
+            xHeader.ucQoS = ( uint8_t ) pxPublishInfo->qos;
+            xHeader.ucRetain = ( uint8_t ) pxPublishInfo->retain;
+            xHeader.ulPayloadLength = ( uint32_t ) pxPublishInfo->payloadLength;
+
+            prvRecordPath( pcPath, xStore.ulNextSeq );
+
+            lReturn = lfs_file_open( xStore.pxLfs, &xFile, pcPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC );
+
+            if( lReturn == LFS_ERR_OK )
+            {
+                lReturn = lfs_file_write( xStore.pxLfs, &xFile, &xHeader, sizeof( xHeader ) );
+
+                if( lReturn >= 0 )
+                {
+                    lReturn = lfs_file_write( xStore.pxLfs, &xFile, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+                }
+
+                if( ( lReturn >= 0 ) && ( pxPublishInfo->payloadLength > 0 ) )
+                {
+                    lReturn = lfs_file_write( xStore.pxLfs, &xFile, pxPublishInfo->pPayload, pxPublishInfo->payloadLength );
+                }
+
+                /* Closing commits the file, an incomplete one fails validation when loaded. */
+                if( lReturn >= 0 )
+                {
+                    lReturn = lfs_file_close( xStore.pxLfs, &xFile );
+                }
+                else
+                {
+                    ( void ) lfs_file_close( xStore.pxLfs, &xFile );
+                }
+            }
+
+            if( lReturn < 0 )
+            {
+                LogError( "Failed to store publish with packet id %u: %ld.",
+                          ( unsigned int ) usPacketId, ( long ) lReturn );
+                ( void ) lfs_remove( xStore.pxLfs, pcPath );
+                xStatus = MQTTSendFailed;
+            }
+            else
+            {
+                *pulSeq = xStore.ulNextSeq;
+                xStore.ulNextSeq++;
+                xStore.xStats.ulSaved++;
+                xStore.xStats.ulRecordsStored++;
+            }
+        }
+
+        if( xStatus != MQTTSuccess )
+        {
+            xStore.xStats.ulSkipped++;
+        }
+
+        return xStatus;
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttSessionStore_Remove( uint32_t ulSeq )
+    {
+        char pcPath[ SESSION_PATH_MAX ];
+
+        if( xStore.pxLfs != NULL )
+        {
+            prvRecordPath( pcPath, ulSeq );
+
+            if( lfs_remove( xStore.pxLfs, pcPath ) == LFS_ERR_OK )
+            {
+                xStore.xStats.ulRemoved++;
+
+                if( xStore.xStats.ulRecordsStored > 0 )
+                {
+                    xStore.xStats.ulRecordsStored--;
+                }
+            }
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    void MqttSessionStore_GetStats( MqttSessionStoreStats_t * pxStats )
+    {
+        if( pxStats != NULL )
+        {
+            *pxStats = xStore.xStats;
+        }
+    }
+
+#endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
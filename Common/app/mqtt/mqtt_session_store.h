@@ -0,0 +1,138 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_session_store.h
+ * @brief Copies of the QoS1 publishes awaiting a PUBACK, kept on the littlefs
+ * partition so that they can be resent with their packet ids after a reset.
+ *
+ * Each record is a small file holding the packet id, topic and payload of one
+ * publish. The agent writes it once the publish has been awaiting its PUBACK
+ * for MQTT_SESSION_STORE_SYNC_INTERVAL_MS, and removes it at the next sync
+ * after the PUBACK arrives or the command fails. Most publishes are
+ * acknowledged sooner and never reach flash. A reset before the write loses
+ * the publish as before.
+ */
+#ifndef MQTT_SESSION_STORE_H
+#define MQTT_SESSION_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core_mqtt.h"
+#include "kvstore_config_plat.h"
+
+/**
+ * @brief Set to 1 to keep in-flight QoS1 publishes across resets. Requires littlefs.
+ */
+#ifndef MQTT_AGENT_SESSION_STORE_ENABLED
+    #if defined( KV_STORE_NVIMPL_LITTLEFS ) && ( KV_STORE_NVIMPL_LITTLEFS == 1 )
+        #define MQTT_AGENT_SESSION_STORE_ENABLED    1
+    #else
+        #define MQTT_AGENT_SESSION_STORE_ENABLED    0
+    #endif
+#endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+/**
+ * @brief Directory holding one file per stored publish.
+ */
+#ifndef MQTT_SESSION_STORE_DIR
+    #define MQTT_SESSION_STORE_DIR    "/mqtt_session"
+#endif /* MQTT_SESSION_STORE_DIR */
+
+/**
+ * @brief Largest topic plus payload stored. Larger publishes are not kept
+ * across resets, since every restored publish is held in RAM until acknowledged.
+ */
+#ifndef MQTT_SESSION_STORE_MAX_RECORD_SIZE
+    #define MQTT_SESSION_STORE_MAX_RECORD_SIZE    2048U
+#endif /* MQTT_SESSION_STORE_MAX_RECORD_SIZE */
+
+/**
+ * @brief Interval at which the agent writes and removes records. A publish
+ * must be awaiting its PUBACK at two successive syncs to be written.
+ */
+#ifndef MQTT_SESSION_STORE_SYNC_INTERVAL_MS
+    #define MQTT_SESSION_STORE_SYNC_INTERVAL_MS    ( 2000U )
+#endif /* MQTT_SESSION_STORE_SYNC_INTERVAL_MS */
+
+typedef struct MqttSessionStoreStats
+{
+    uint32_t ulSaved;         /* Publishes written to flash. */
+    uint32_t ulRemoved;       /* Records removed after the PUBACK or a failure. */
+    uint32_t ulSkipped;       /* Publishes too large to store, or lost to a write error. */
+    uint32_t ulRestored;      /* Records read back after a reset. */
+    uint32_t ulRecordsStored; /* Records currently on flash. */
+} MqttSessionStoreStats_t;
+
+/* A publish read back from the store. The topic and payload follow the struct
+ * in the same allocation, free it with vPortFree. */
+typedef struct MqttSessionRecord
+{
+    MQTTPublishInfo_t xPublishInfo;
+    uint16_t usPacketId;
+    uint32_t ulSeq;
+    struct MqttSessionRecord * pxNext;
+} MqttSessionRecord_t;
+
+#if MQTT_AGENT_SESSION_STORE_ENABLED
+
+/**
+ * @brief Open the store, creating MQTT_SESSION_STORE_DIR if needed. The
+ * filesystem must be mounted.
+ *
+ * @return `MQTTSuccess` if the store can be used.
+ */
+    MQTTStatus_t MqttSessionStore_Init( void );
+
+/**
+ * @brief Read back the records left by a previous boot.
+ *
+ * @return List of records, oldest first, or NULL if there are none. Records
+ * that could not be read or allocated are removed.
+ */
+    MqttSessionRecord_t * MqttSessionStore_Load( void );
+
+/**
+ * @brief Store a publish sent with packet id usPacketId.
+ *
+ * @param[out] pulSeq Identifies the record for MqttSessionStore_Remove.
+ *
+ * @return `MQTTSuccess` if the record was written, `MQTTIllegalState` if the
+ * store is not open, `MQTTBadParameter` if the publish is too large,
+ * `MQTTSendFailed` on a write error.
+ */
+    MQTTStatus_t MqttSessionStore_Save( uint16_t usPacketId,
+                                        const MQTTPublishInfo_t * pxPublishInfo,
+                                        uint32_t * pulSeq );
+
+    void MqttSessionStore_Remove( uint32_t ulSeq );
+
+    void MqttSessionStore_GetStats( MqttSessionStoreStats_t * pxStats );
+
+#endif /* MQTT_AGENT_SESSION_STORE_ENABLED */
+
+#endif /* MQTT_SESSION_STORE_H */
@@ -0,0 +1,183 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+#include "slab_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/* Elements are aligned for any member type, including 64 bit integers. */
+#define SLAB_ALIGNMENT    ( sizeof( uint64_t ) )
+
+typedef union SlabHeader
+{
+    union SlabHeader * pxNext;
+    uint64_t ullAlign;
+} SlabHeader_t;
+
+/*-----------------------------------------------------------*/
+
+static inline size_t prvSlabSize( const SlabPool_t * pxPool )
+{
+    return sizeof( SlabHeader_t ) + ( pxPool->uxElementSize * pxPool->uxElementsPerSlab );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvAddSlab( SlabPool_t * pxPool )
+{
+    SlabHeader_t * pxSlab = NULL;
+    size_t uxSlabSize = prvSlabSize( pxPool );
+
+    if( ( pxPool->uxBytesAllocated + uxSlabSize ) <= pxPool->uxMemoryBudget )
+    {
+        pxSlab = pvPortMalloc( uxSlabSize );
+    }
+
+    if( pxSlab != NULL )
+    {
+        uint8_t * pucElements = ( uint8_t * ) &( pxSlab[ 1 ] );
+
+        pxSlab->pxNext = ( SlabHeader_t * ) pxPool->pvSlabs;
+        pxPool->pvSlabs = pxSlab;
+        pxPool->uxBytesAllocated += uxSlabSize;
+
+        /* Thread the new elements onto the free list. */
+        for( size_t uxIdx = 0; uxIdx < pxPool->uxElementsPerSlab; uxIdx++ )
+        {
+            void ** ppvElement = ( void ** ) &( pucElements[ uxIdx * pxPool->uxElementSize ] );
+
+            *ppvElement = pxPool->pvFreeList;
+            pxPool->pvFreeList = ppvElement;
+        }
+    }
+
+    return( pxSlab != NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+void SlabPool_Init( SlabPool_t * pxPool,
+                    size_t uxElementSize,
+                    size_t uxElementsPerSlab,
+                    size_t uxMemoryBudget )
+{
+    configASSERT( pxPool );
+    configASSERT( uxElementsPerSlab > 0 );
+
+    memset( pxPool, 0, sizeof( SlabPool_t ) );
+
+    if( uxElementSize < sizeof( void * ) )
+    {
+        uxElementSize = sizeof( void * );
+    }
+
+    pxPool->uxElementSize = ( uxElementSize + SLAB_ALIGNMENT - 1 ) & ~( SLAB_ALIGNMENT - 1 );
+    pxPool->uxElementsPerSlab = uxElementsPerSlab;
+    pxPool->uxMemoryBudget = uxMemoryBudget;
+}
+
+/*-----------------------------------------------------------*/
+
+void SlabPool_Destroy( SlabPool_t * pxPool )
+{
+    SlabHeader_t * pxSlab = NULL;
+
+    configASSERT( pxPool );
+
+    pxSlab = ( SlabHeader_t * ) pxPool->pvSlabs;
+
+    while( pxSlab != NULL )
+    {
+        SlabHeader_t * pxNext = pxSlab->pxNext;
+
+        vPortFree( pxSlab );
+        pxSlab = pxNext;
+    }
+
+    SlabPool_Init( pxPool, pxPool->uxElementSize,
+                   pxPool->uxElementsPerSlab, pxPool->uxMemoryBudget );
+}
+
+/*-----------------------------------------------------------*/
+
+void * SlabPool_Alloc( SlabPool_t * pxPool )
+{
+    void * pvElement = NULL;
+
+    configASSERT( pxPool );
+
+    if( ( pxPool->pvFreeList != NULL ) || prvAddSlab( pxPool ) )
+    {
+        pvElement = pxPool->pvFreeList;
+        pxPool->pvFreeList = *( ( void ** ) pvElement );
+
+        memset( pvElement, 0, pxPool->uxElementSize );
+
+        pxPool->uxElementsInUse++;
+
+        if( pxPool->uxElementsInUse > pxPool->uxElementsHighWater )
+        {
+            pxPool->uxElementsHighWater = pxPool->uxElementsInUse;
+        }
+    }
+    else
+    {
+        pxPool->ulAllocFailures++;
+        LogWarn( "Slab pool exhausted, %lu of %lu bytes allocated.",
+                 ( unsigned long ) pxPool->uxBytesAllocated,
+                 ( unsigned long ) pxPool->uxMemoryBudget );
+    }
+
+    return pvElement;
+}
+
+/*-----------------------------------------------------------*/
+
+void SlabPool_Free( SlabPool_t * pxPool,
+                    void * pvElement )
+{
+    configASSERT( pxPool );
+
+    if( pvElement != NULL )
+    {
+        configASSERT( pxPool->uxElementsInUse > 0 );
+
+        *( ( void ** ) pvElement ) = pxPool->pvFreeList;
+        pxPool->pvFreeList = pvElement;
+        pxPool->uxElementsInUse--;
+    }
+}
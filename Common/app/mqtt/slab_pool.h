@@ -0,0 +1,95 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file slab_pool.h
+ * @brief Allocator for fixed size elements carved out of heap allocated slabs.
+ *
+ * Elements never move once allocated, so pointers to them can be kept as
+ * handles. Slabs are allocated on demand until the pool's memory budget is
+ * reached and are only returned to the heap by SlabPool_Destroy.
+ * The pool is not thread safe.
+ */
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct SlabPool
+{
+    size_t uxElementSize;
+    size_t uxElementsPerSlab;
+    size_t uxMemoryBudget;
+    size_t uxBytesAllocated;
+    void * pvSlabs;
+    void * pvFreeList;
+    size_t uxElementsInUse;
+    size_t uxElementsHighWater;
+    uint32_t ulAllocFailures;
+} SlabPool_t;
+
+/**
+ * @brief Initialize an empty pool. No memory is allocated until the first
+ * call to SlabPool_Alloc.
+ *
+ * @param[in] pxPool Pool to initialize.
+ * @param[in] uxElementSize Size of each element in bytes.
+ * @param[in] uxElementsPerSlab Number of elements allocated together.
+ * @param[in] uxMemoryBudget Maximum number of bytes the pool may take from the heap.
+ */
+void SlabPool_Init( SlabPool_t * pxPool,
+                    size_t uxElementSize,
+                    size_t uxElementsPerSlab,
+                    size_t uxMemoryBudget );
+
+/**
+ * @brief Return every slab to the heap. All elements become invalid.
+ *
+ * @param[in] pxPool Pool to clear. It may be used again afterwards.
+ */
+void SlabPool_Destroy( SlabPool_t * pxPool );
+
+/**
+ * @brief Allocate a zero filled element.
+ *
+ * @param[in] pxPool Pool to allocate from.
+ *
+ * @return The element, or NULL if the pool is empty and another slab would
+ * exceed the memory budget or could not be allocated.
+ */
+void * SlabPool_Alloc( SlabPool_t * pxPool );
+
+/**
+ * @brief Return an element to the pool.
+ *
+ * @param[in] pxPool Pool the element was allocated from.
+ * @param[in] pvElement Element to release.
+ */
+void SlabPool_Free( SlabPool_t * pxPool,
+                    void * pvElement );
+
+#endif /* SLAB_POOL_H */
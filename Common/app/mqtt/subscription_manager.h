@@ -36,18 +36,34 @@
 #include "mqtt_agent_task.h"
 
 /**
- * @brief Maximum number of concurrent subscriptions.
+ * @brief Maximum number of bytes of heap used to store subscriptions and
+ * callbacks. Topic filter strings are allocated separately.
  */
-#ifndef MQTT_AGENT_MAX_SUBSCRIPTIONS
-    #define MQTT_AGENT_MAX_SUBSCRIPTIONS    10U
-#endif /* MQTT_AGENT_MAX_SUBSCRIPTIONS */
+#ifndef MQTT_AGENT_SUBSCRIPTION_MEMORY_BUDGET
+    #define MQTT_AGENT_SUBSCRIPTION_MEMORY_BUDGET    4096U
+#endif /* MQTT_AGENT_SUBSCRIPTION_MEMORY_BUDGET */
 
 /**
- * @brief Maximum number of callbacks that may be registered.
+ * @brief Number of subscription or callback entries allocated at a time.
  */
-#ifndef MQTT_AGENT_MAX_CALLBACKS
-    #define MQTT_AGENT_MAX_CALLBACKS    10U
-#endif /* MQTT_AGENT_MAX_CALLBACKS */
+#ifndef MQTT_AGENT_SUBSCRIPTION_SLAB_ENTRIES
+    #define MQTT_AGENT_SUBSCRIPTION_SLAB_ENTRIES    8U
+#endif /* MQTT_AGENT_SUBSCRIPTION_SLAB_ENTRIES */
+
+/**
+ * @brief Maximum number of tasks which may use deferred publish delivery at once.
+ */
+#ifndef MQTT_AGENT_MAX_DELIVERY_QUEUES
+    #define MQTT_AGENT_MAX_DELIVERY_QUEUES    8U
+#endif /* MQTT_AGENT_MAX_DELIVERY_QUEUES */
+
+/**
+ * @brief Length of a task's delivery queue when MqttAgent_SubscribeSyncDeferred
+ * is called with a uxQueueLength of 0.
+ */
+#ifndef MQTT_AGENT_DELIVERY_QUEUE_LENGTH
+    #define MQTT_AGENT_DELIVERY_QUEUE_LENGTH    8U
+#endif /* MQTT_AGENT_DELIVERY_QUEUE_LENGTH */
 
 /**
  * @brief Callback function called when receiving a publish.
@@ -59,25 +75,61 @@ typedef void (* IncomingPubCallback_t )( void * pvIncomingPublishCallbackContext
                                          MQTTPublishInfo_t * pxPublishInfo );
 
 /**
- * @brief An element in the list of subscriptions.
+ * @brief Callback function called with each piece of the payload of a publish
+ * received on a stream subscription.
  *
- * This subscription manager implementation expects that the array of the
- * subscription elements used for storing subscriptions to be initialized to 0.
+ * @param[in] pvIncomingPublishCallbackContext The incoming publish callback context.
+ * @param[in] pxPublishInfo Deserialized publish information. payloadLength is the
+ * length of the whole payload and pPayload is NULL.
+ * @param[in] uxOffset Offset of pucChunk in the payload.
+ * @param[in] pucChunk Next piece of the payload, only valid during the call.
+ * @param[in] uxChunkLength Length of pucChunk. The last piece of a publish
+ * ends at pxPublishInfo->payloadLength.
+ */
+typedef void (* IncomingPubChunkCallback_t )( void * pvIncomingPublishCallbackContext,
+                                              const MQTTPublishInfo_t * pxPublishInfo,
+                                              size_t uxOffset,
+                                              const uint8_t * pucChunk,
+                                              size_t uxChunkLength );
+
+/**
+ * @brief Handle to an incoming publish retained with MqttAgent_RetainPayload.
+ */
+typedef struct MQTTAgentRxBuffer * MQTTAgentPayloadHandle_t;
+
+/**
+ * @brief A callback registered for a subscription.
  *
  * @note This implementation allows multiple tasks to subscribe to the same topic.
- * In this case, another element is added to the subscription list, differing
- * in the intended publish callback. Also note that the topic filters are not
- * copied in the subscription manager and hence the topic filter strings need to
- * stay in scope until unsubscribed.
+ * In this case, another element is added to the callback list of the
+ * subscription, differing in the intended publish callback. Elements are
+ * allocated from a slab pool and never move, so they are unlinked from the list
+ * without touching any other element.
  */
-typedef struct
+typedef struct SubCallbackElement
 {
     IncomingPubCallback_t pxIncomingPublishCallback;
+    IncomingPubChunkCallback_t pxChunkCallback;      /* Set instead of pxIncomingPublishCallback for stream subscriptions. */
     void * pvIncomingPublishCallbackContext;
     TaskHandle_t xTaskHandle;
     MQTTSubscribeInfo_t * pxSubInfo;
+    struct MQTTAgentDeliveryQueue * pxDeliveryQueue; /* NULL when the callback runs in the agent task. */
+    struct SubCallbackElement * pxNext;
+    struct SubCallbackElement * pxPrev;
 } SubCallbackElement_t;
 
+/**
+ * @brief Counters for the deferred delivery queue of a single subscriber task.
+ */
+typedef struct MQTTAgentDeliveryStats
+{
+    uint32_t ulQueued;         /**< Publishes placed on the queue by the agent. */
+    uint32_t ulDelivered;      /**< Publishes handed to a callback by MqttAgent_ProcessDeliveries. */
+    uint32_t ulDropped;        /**< Publishes discarded because the queue was full or out of memory. */
+    uint32_t ulOverflows;      /**< Number of times the queue went from accepting to dropping publishes. */
+    UBaseType_t uxMaxDepth;    /**< Highest number of publishes waiting on the queue. */
+} MQTTAgentDeliveryStats_t;
+
 
 /* @brief Add a callback for a given topic filter. Subscribe if not already subscribed.
  *
@@ -108,4 +160,111 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
                                         IncomingPubCallback_t pxCallback,
                                         void * pvCallbackCtx );
 
+/* @brief Add a callback for a given topic filter which runs in the calling task
+ * rather than in the MQTT agent task. Subscribe if not already subscribed.
+ *
+ * Matching publishes are retained with MqttAgent_RetainPayload (or copied when
+ * no spare receive buffer is available) in a reference counted descriptor and
+ * placed on a bounded queue owned by the calling task, so that a slow callback does not
+ * stall the agent. The calling task must call MqttAgent_ProcessDeliveries to
+ * run the callbacks. When the queue is full, publishes are dropped and counted.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] pcTopicFilter Topic filter string to subscribe to.
+ * @param[in] xRequestedQoS Requested QoS for this subscription.
+ * @param[in] pxIncomingPublishCallback Callback function for the subscription.
+ * @param[in] pvIncomingPublishCallbackContext Context for the subscription callback.
+ * @param[in] uxQueueLength Length of the task's delivery queue, or 0 to use
+ * MQTT_AGENT_DELIVERY_QUEUE_LENGTH. Ignored if the task already has a queue.
+ * @return `MQTTSuccess` if the subscription was added successfully.
+ **/
+MQTTStatus_t MqttAgent_SubscribeSyncDeferred( MQTTAgentHandle_t xHandle,
+                                              const char * pcTopicFilter,
+                                              MQTTQoS_t xRequestedQoS,
+                                              IncomingPubCallback_t pxCallback,
+                                              void * pvCallbackCtx,
+                                              UBaseType_t uxQueueLength );
+
+/* @brief Add a callback for a given topic filter which receives payloads in
+ * pieces. Subscribe if not already subscribed.
+ *
+ * Publishes larger than the agent's network buffer are not held in RAM. The
+ * payload is passed to the callback as it is read from the connection, in
+ * pieces of up to the network buffer size. Smaller publishes are passed in a
+ * single piece. The callback runs in the MQTT agent task, so it must not block
+ * for long.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] pcTopicFilter Topic filter string to subscribe to.
+ * @param[in] xRequestedQoS Requested QoS for this subscription.
+ * @param[in] pxChunkCallback Callback function for the subscription.
+ * @param[in] pvCallbackCtx Context for the subscription callback.
+ * @return `MQTTSuccess` if the subscription was added successfully.
+ **/
+MQTTStatus_t MqttAgent_SubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                            const char * pcTopicFilter,
+                                            MQTTQoS_t xRequestedQoS,
+                                            IncomingPubChunkCallback_t pxChunkCallback,
+                                            void * pvCallbackCtx );
+
+/* @brief Remove a callback added with MqttAgent_SubscribeStreamSync.
+ * Unsubscribe from the specified topic is no other callback exist for the same filter.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] pcTopicFilter Topic filter string to unsubscribe from.
+ * @param[in] pxChunkCallback Callback function for the subscription.
+ * @param[in] pvCallbackCtx Context for the subscription callback.
+ * @return `MQTTSuccess` if the subscription was successfully removed.
+ **/
+MQTTStatus_t MqttAgent_UnSubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                              const char * pcTopicFilter,
+                                              IncomingPubChunkCallback_t pxChunkCallback,
+                                              void * pvCallbackCtx );
+
+/* @brief Run the deferred callbacks queued for the calling task.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] xTicksToWait Time to wait for the first publish to arrive. If the
+ * calling task has no delivery queue, the task is delayed for this time instead.
+ * Once the task's last deferred callback is removed, by itself or by a clean
+ * session reconnect, the queue is deleted here, and the call may return early.
+ * @return The number of callbacks which were run.
+ **/
+size_t MqttAgent_ProcessDeliveries( MQTTAgentHandle_t xHandle,
+                                    TickType_t xTicksToWait );
+
+/* @brief Read the deferred delivery counters of a subscriber task.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] xTaskHandle Subscriber task, or NULL for the calling task.
+ * @param[out] pxStats Location to copy the counters to.
+ * @return `MQTTSuccess` if the task has a delivery queue, else `MQTTNoDataAvailable`.
+ **/
+MQTTStatus_t MqttAgent_GetDeliveryStats( MQTTAgentHandle_t xHandle,
+                                         TaskHandle_t xTaskHandle,
+                                         MQTTAgentDeliveryStats_t * pxStats );
+
+/* @brief Keep the topic name and payload of an incoming publish valid after the
+ * subscription callback returns, without copying them.
+ *
+ * Must be called from an IncomingPubCallback_t running in the MQTT agent task.
+ * The agent hands the receive buffer holding the publish to the caller and
+ * continues receiving into a spare buffer. pxPublishInfo->pTopicName and
+ * pxPublishInfo->pPayload remain valid until MqttAgent_ReleasePayload is called.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] pxPublishInfo Publish passed to the subscription callback.
+ * @return A handle to pass to MqttAgent_ReleasePayload, or NULL if no spare
+ * receive buffer is available, in which case the caller must copy the data.
+ **/
+MQTTAgentPayloadHandle_t MqttAgent_RetainPayload( MQTTAgentHandle_t xHandle,
+                                                  const MQTTPublishInfo_t * pxPublishInfo );
+
+/* @brief Release a publish retained with MqttAgent_RetainPayload. May be called
+ * from any task.
+ *
+ * @param[in] xPayload Handle returned by MqttAgent_RetainPayload.
+ **/
+void MqttAgent_ReleasePayload( MQTTAgentPayloadHandle_t xPayload );
+
 #endif /* SUBSCRIPTION_MANAGER_H */
@@ -0,0 +1,558 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+#include "topic_trie.h"
+
+/*-----------------------------------------------------------*/
+
+#define TOPIC_LEVEL_SEPARATOR    '/'
+#define TOPIC_WILDCARD_PLUS      '+'
+#define TOPIC_WILDCARD_HASH      '#'
+
+typedef struct MatchState
+{
+    TopicTrieVisitor_t pxVisitor;
+    void * pvCtx;
+    size_t uxMatchCount;
+} MatchState_t;
+
+/*-----------------------------------------------------------*/
+
+static inline uint16_t prvLevelLength( const char * pcLevel,
+                                       uint16_t usRemaining )
+{
+    uint16_t usLength = 0;
+
+    while( ( usLength < usRemaining ) &&
+           ( pcLevel[ usLength ] != TOPIC_LEVEL_SEPARATOR ) )
+    {
+        usLength++;
+    }
+
+    return usLength;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvIsWildcardLevel( const char * pcLevel,
+                                       uint16_t usLevelLength,
+                                       char cWildcard )
+{
+    return( ( usLevelLength == 1U ) && ( pcLevel[ 0 ] == cWildcard ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static TopicTrieNode_t * prvFindLiteralChild( const TopicTrieNode_t * pxNode,
+                                              const char * pcLevel,
+                                              uint16_t usLevelLength )
+{
+    TopicTrieNode_t * pxChild = pxNode->pxFirstChild;
+
+    while( ( pxChild != NULL ) &&
+           ( ( pxChild->usLabelLength != usLevelLength ) ||
+             ( memcmp( pxChild->pcLabel, pcLevel, usLevelLength ) != 0 ) ) )
+    {
+        pxChild = pxChild->pxNextSibling;
+    }
+
+    return pxChild;
+}
+
+/*-----------------------------------------------------------*/
+
+static TopicTrieNode_t * prvAllocateNode( TopicTrie_t * pxTrie,
+                                          TopicTrieNode_t * pxParent,
+                                          const char * pcLevel,
+                                          uint16_t usLevelLength )
+{
+    /* The label is stored in the same allocation, directly after the node. */
+    TopicTrieNode_t * pxNode = pvPortMalloc( sizeof( TopicTrieNode_t ) + usLevelLength );
+
+    if( pxNode != NULL )
+    {
+        char * pcLabel = ( char * ) &( pxNode[ 1 ] );
+
+        memset( pxNode, 0, sizeof( TopicTrieNode_t ) );
+        ( void ) memcpy( pcLabel, pcLevel, usLevelLength );
+
+        pxNode->pxParent = pxParent;
+        pxNode->pcLabel = pcLabel;
+        pxNode->usLabelLength = usLevelLength;
+
+        pxTrie->uxNodeCount++;
+    }
+
+    return pxNode;
+}
+
+/*-----------------------------------------------------------*/
+
+static TopicTrieNode_t * prvGetOrAddChild( TopicTrie_t * pxTrie,
+                                           TopicTrieNode_t * pxNode,
+                                           const char * pcLevel,
+                                           uint16_t usLevelLength )
+{
+    TopicTrieNode_t * pxChild = NULL;
+
+    if( prvIsWildcardLevel( pcLevel, usLevelLength, TOPIC_WILDCARD_PLUS ) )
+    {
+        if( pxNode->pxPlusChild == NULL )
+        {
+            pxNode->pxPlusChild = prvAllocateNode( pxTrie, pxNode, pcLevel, usLevelLength );
+        }
+
+        pxChild = pxNode->pxPlusChild;
+    }
+    else if( prvIsWildcardLevel( pcLevel, usLevelLength, TOPIC_WILDCARD_HASH ) )
+    {
+        if( pxNode->pxHashChild == NULL )
+        {
+            pxNode->pxHashChild = prvAllocateNode( pxTrie, pxNode, pcLevel, usLevelLength );
+        }
+
+        pxChild = pxNode->pxHashChild;
+    }
+    else
+    {
+        pxChild = prvFindLiteralChild( pxNode, pcLevel, usLevelLength );
+
+        if( pxChild == NULL )
+        {
+            pxChild = prvAllocateNode( pxTrie, pxNode, pcLevel, usLevelLength );
+
+            if( pxChild != NULL )
+            {
+                pxChild->pxNextSibling = pxNode->pxFirstChild;
+                pxNode->pxFirstChild = pxChild;
+            }
+        }
+    }
+
+    return pxChild;
+}
+
+/*-----------------------------------------------------------*/
+
+static TopicTrieNode_t * prvFindNode( const TopicTrie_t * pxTrie,
+                                      const char * pcTopicFilter,
+                                      uint16_t usTopicFilterLength )
+{
+    const TopicTrieNode_t * pxNode = &( pxTrie->xRoot );
+    uint16_t usOffset = 0;
+    bool xDone = false;
+
+    while( ( pxNode != NULL ) && !xDone )
+    {
+        const char * pcLevel = &( pcTopicFilter[ usOffset ] );
+        uint16_t usLevelLength = prvLevelLength( pcLevel, usTopicFilterLength - usOffset );
+
+        if( prvIsWildcardLevel( pcLevel, usLevelLength, TOPIC_WILDCARD_PLUS ) )
+        {
+            pxNode = pxNode->pxPlusChild;
+        }
+        else if( prvIsWildcardLevel( pcLevel, usLevelLength, TOPIC_WILDCARD_HASH ) )
+        {
+            pxNode = pxNode->pxHashChild;
+        }
+        else
+        {
+            pxNode = prvFindLiteralChild( pxNode, pcLevel, usLevelLength );
+        }
+
+        usOffset += usLevelLength;
+
+        if( usOffset >= usTopicFilterLength )
+        {
+            xDone = true;
+        }
+        else
+        {
+            /* Skip the level separator. */
+            usOffset++;
+        }
+    }
+
+    return ( TopicTrieNode_t * ) pxNode;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvNodeIsUnused( const TopicTrieNode_t * pxNode )
+{
+    return( ( pxNode->pvValue == NULL ) &&
+            ( pxNode->pxFirstChild == NULL ) &&
+            ( pxNode->pxPlusChild == NULL ) &&
+            ( pxNode->pxHashChild == NULL ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvUnlinkNode( TopicTrieNode_t * pxNode )
+{
+    TopicTrieNode_t * pxParent = pxNode->pxParent;
+
+    if( pxParent->pxPlusChild == pxNode )
+    {
+        pxParent->pxPlusChild = NULL;
+    }
+    else if( pxParent->pxHashChild == pxNode )
+    {
+        pxParent->pxHashChild = NULL;
+    }
+    else
+    {
+        TopicTrieNode_t ** ppxLink = &( pxParent->pxFirstChild );
+
+        while( ( *ppxLink != NULL ) && ( *ppxLink != pxNode ) )
+        {
+            ppxLink = &( ( *ppxLink )->pxNextSibling );
+        }
+
+        configASSERT( *ppxLink == pxNode );
+
+        *ppxLink = pxNode->pxNextSibling;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Free pxNode and any of its ancestors which are no longer in use. */
+static void prvPrune( TopicTrie_t * pxTrie,
+                      TopicTrieNode_t * pxNode )
+{
+    while( ( pxNode != NULL ) &&
+           ( pxNode != &( pxTrie->xRoot ) ) &&
+           prvNodeIsUnused( pxNode ) )
+    {
+        TopicTrieNode_t * pxParent = pxNode->pxParent;
+
+        prvUnlinkNode( pxNode );
+        vPortFree( pxNode );
+
+        configASSERT( pxTrie->uxNodeCount > 0 );
+        pxTrie->uxNodeCount--;
+
+        pxNode = pxParent;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvFreeChildren( TopicTrieNode_t * pxNode )
+{
+    TopicTrieNode_t * pxChild = pxNode->pxFirstChild;
+
+    while( pxChild != NULL )
+    {
+        TopicTrieNode_t * pxNext = pxChild->pxNextSibling;
+
+        prvFreeChildren( pxChild );
+        vPortFree( pxChild );
+        pxChild = pxNext;
+    }
+
+    if( pxNode->pxPlusChild != NULL )
+    {
+        prvFreeChildren( pxNode->pxPlusChild );
+        vPortFree( pxNode->pxPlusChild );
+    }
+
+    if( pxNode->pxHashChild != NULL )
+    {
+        prvFreeChildren( pxNode->pxHashChild );
+        vPortFree( pxNode->pxHashChild );
+    }
+
+    pxNode->pxFirstChild = NULL;
+    pxNode->pxPlusChild = NULL;
+    pxNode->pxHashChild = NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline void prvVisit( const TopicTrieNode_t * pxNode,
+                             MatchState_t * pxState )
+{
+    if( ( pxNode != NULL ) && ( pxNode->pvValue != NULL ) )
+    {
+        pxState->uxMatchCount++;
+        pxState->pxVisitor( pxNode->pvValue, pxState->pvCtx );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvMatchLevel( const TopicTrieNode_t * pxNode,
+                           const char * pcLevel,
+                           uint16_t usRemaining,
+                           bool xIsFirstLevel,
+                           MatchState_t * pxState );
+
+/* Continue matching below pxChild, which matched a level of usLevelLength bytes. */
+static inline void prvMatchChild( const TopicTrieNode_t * pxChild,
+                                  const char * pcLevel,
+                                  uint16_t usLevelLength,
+                                  uint16_t usRemaining,
+                                  MatchState_t * pxState )
+{
+    if( usLevelLength == usRemaining )
+    {
+        /* Last level of the topic name. "a/#" also matches "a". */
+        prvVisit( pxChild, pxState );
+        prvVisit( pxChild->pxHashChild, pxState );
+    }
+    else
+    {
+        prvMatchLevel( pxChild,
+                       &( pcLevel[ usLevelLength + 1U ] ),
+                       usRemaining - usLevelLength - 1U,
+                       false,
+                       pxState );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvMatchLevel( const TopicTrieNode_t * pxNode,
+                           const char * pcLevel,
+                           uint16_t usRemaining,
+                           bool xIsFirstLevel,
+                           MatchState_t * pxState )
+{
+    uint16_t usLevelLength = prvLevelLength( pcLevel, usRemaining );
+    const TopicTrieNode_t * pxLiteral = NULL;
+
+    /* Topic names starting with '$' are not matched by a leading wildcard. */
+    bool xWildcardAllowed = !( xIsFirstLevel && ( usRemaining > 0U ) && ( pcLevel[ 0 ] == '$' ) );
+
+    if( xWildcardAllowed )
+    {
+        prvVisit( pxNode->pxHashChild, pxState );
+
+        if( pxNode->pxPlusChild != NULL )
+        {
+            prvMatchChild( pxNode->pxPlusChild, pcLevel, usLevelLength, usRemaining, pxState );
+        }
+    }
+
+    pxLiteral = prvFindLiteralChild( pxNode, pcLevel, usLevelLength );
+
+    if( pxLiteral != NULL )
+    {
+        prvMatchChild( pxLiteral, pcLevel, usLevelLength, usRemaining, pxState );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void TopicTrie_Init( TopicTrie_t * pxTrie )
+{
+    configASSERT( pxTrie );
+
+    memset( pxTrie, 0, sizeof( TopicTrie_t ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void TopicTrie_Free( TopicTrie_t * pxTrie )
+{
+    configASSERT( pxTrie );
+
+    prvFreeChildren( &( pxTrie->xRoot ) );
+
+    TopicTrie_Init( pxTrie );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t TopicTrie_Insert( TopicTrie_t * pxTrie,
+                               const char * pcTopicFilter,
+                               uint16_t usTopicFilterLength,
+                               void * pvValue )
+{
+    MQTTStatus_t xStatus = MQTTSuccess;
+    TopicTrieNode_t * pxNode = NULL;
+    uint16_t usOffset = 0;
+    uint32_t ulLevelCount = 0;
+    bool xDone = false;
+
+    if( ( pxTrie == NULL ) ||
+        ( pcTopicFilter == NULL ) ||
+        ( usTopicFilterLength == 0U ) ||
+        ( pvValue == NULL ) )
+    {
+        xStatus = MQTTBadParameter;
+    }
+    else
+    {
+        pxNode = &( pxTrie->xRoot );
+    }
+
+    while( ( xStatus == MQTTSuccess ) && !xDone )
+    {
+        const char * pcLevel = &( pcTopicFilter[ usOffset ] );
+        uint16_t usLevelLength = prvLevelLength( pcLevel, usTopicFilterLength - usOffset );
+        bool xIsLastLevel = ( ( usOffset + usLevelLength ) >= usTopicFilterLength );
+
+        ulLevelCount++;
+
+        /* Wildcards must occupy a whole level and '#' must be the last level. */
+        if( ( ulLevelCount > TOPIC_TRIE_MAX_LEVELS ) ||
+            ( ( usLevelLength > 1U ) &&
+              ( ( memchr( pcLevel, TOPIC_WILDCARD_PLUS, usLevelLength ) != NULL ) ||
+                ( memchr( pcLevel, TOPIC_WILDCARD_HASH, usLevelLength ) != NULL ) ) ) ||
+            ( prvIsWildcardLevel( pcLevel, usLevelLength, TOPIC_WILDCARD_HASH ) && !xIsLastLevel ) )
+        {
+            xStatus = MQTTBadParameter;
+        }
+        else
+        {
+            TopicTrieNode_t * pxChild = prvGetOrAddChild( pxTrie, pxNode, pcLevel, usLevelLength );
+
+            if( pxChild == NULL )
+            {
+                xStatus = MQTTNoMemory;
+            }
+            else
+            {
+                pxNode = pxChild;
+            }
+        }
+
+        usOffset += usLevelLength + 1U;
+        xDone = xIsLastLevel;
+    }
+
+    if( xStatus == MQTTSuccess )
+    {
+        pxNode->pvValue = pvValue;
+    }
+    else if( pxNode != NULL )
+    {
+        LogError( "Failed to add topic filter \"%.*s\" to the trie: %s.",
+                  usTopicFilterLength, pcTopicFilter,
+                  MQTT_Status_strerror( xStatus ) );
+
+        /* Release any nodes added for this filter before the failure. */
+        prvPrune( pxTrie, pxNode );
+    }
+    else
+    {
+        /* Empty */
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t TopicTrie_Remove( TopicTrie_t * pxTrie,
+                               const char * pcTopicFilter,
+                               uint16_t usTopicFilterLength )
+{
+    MQTTStatus_t xStatus = MQTTNoDataAvailable;
+    TopicTrieNode_t * pxNode = NULL;
+
+    if( ( pxTrie == NULL ) ||
+        ( pcTopicFilter == NULL ) ||
+        ( usTopicFilterLength == 0U ) )
+    {
+        xStatus = MQTTBadParameter;
+    }
+    else
+    {
+        pxNode = prvFindNode( pxTrie, pcTopicFilter, usTopicFilterLength );
+    }
+
+    if( ( pxNode != NULL ) && ( pxNode->pvValue != NULL ) )
+    {
+        pxNode->pvValue = NULL;
+        prvPrune( pxTrie, pxNode );
+        xStatus = MQTTSuccess;
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+void * TopicTrie_Find( const TopicTrie_t * pxTrie,
+                       const char * pcTopicFilter,
+                       uint16_t usTopicFilterLength )
+{
+    void * pvValue = NULL;
+
+    if( ( pxTrie != NULL ) &&
+        ( pcTopicFilter != NULL ) &&
+        ( usTopicFilterLength > 0U ) )
+    {
+        const TopicTrieNode_t * pxNode = prvFindNode( pxTrie, pcTopicFilter, usTopicFilterLength );
+
+        if( pxNode != NULL )
+        {
+            pvValue = pxNode->pvValue;
+        }
+    }
+
+    return pvValue;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t TopicTrie_Match( const TopicTrie_t * pxTrie,
+                        const char * pcTopicName,
+                        uint16_t usTopicNameLength,
+                        TopicTrieVisitor_t pxVisitor,
+                        void * pvCtx )
+{
+    MatchState_t xState =
+    {
+        .pxVisitor    = pxVisitor,
+        .pvCtx        = pvCtx,
+        .uxMatchCount = 0,
+    };
+
+    if( ( pxTrie != NULL ) &&
+        ( pcTopicName != NULL ) &&
+        ( usTopicNameLength > 0U ) &&
+        ( pxVisitor != NULL ) )
+    {
+        prvMatchLevel( &( pxTrie->xRoot ), pcTopicName, usTopicNameLength, true, &xState );
+    }
+
+    return xState.uxMatchCount;
+}
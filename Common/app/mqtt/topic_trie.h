@@ -0,0 +1,170 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file topic_trie.h
+ * @brief Index of MQTT topic filters, keyed by topic level, used to find the
+ * subscriptions matching an incoming topic name without testing every filter.
+ */
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core_mqtt.h"
+
+/**
+ * @brief Maximum number of topic levels accepted in a topic filter.
+ *
+ * Matching recurses once per level of the trie, so this bounds the stack used
+ * by TopicTrie_Match.
+ */
+#ifndef TOPIC_TRIE_MAX_LEVELS
+    #define TOPIC_TRIE_MAX_LEVELS    16U
+#endif /* TOPIC_TRIE_MAX_LEVELS */
+
+/**
+ * @brief A single topic level in the trie.
+ *
+ * Literal children are kept in a singly linked sibling list. The single level
+ * ('+') and multi level ('#') wildcard children are kept separately so that
+ * they can be visited without a search.
+ */
+typedef struct TopicTrieNode
+{
+    struct TopicTrieNode * pxParent;
+    struct TopicTrieNode * pxFirstChild;
+    struct TopicTrieNode * pxNextSibling;
+    struct TopicTrieNode * pxPlusChild;
+    struct TopicTrieNode * pxHashChild;
+    void * pvValue;
+    const char * pcLabel;
+    uint16_t usLabelLength;
+} TopicTrieNode_t;
+
+/**
+ * @brief Topic filter trie. Must be initialized with TopicTrie_Init.
+ */
+typedef struct TopicTrie
+{
+    TopicTrieNode_t xRoot;
+    size_t uxNodeCount;
+} TopicTrie_t;
+
+/**
+ * @brief Called once for every topic filter that matches a topic name.
+ *
+ * @param[in] pvValue Value stored with the matching topic filter.
+ * @param[in] pvCtx Context passed to TopicTrie_Match.
+ */
+typedef void (* TopicTrieVisitor_t )( void * pvValue,
+                                      void * pvCtx );
+
+/**
+ * @brief Initialize an empty trie.
+ *
+ * @param[in] pxTrie Trie to initialize.
+ */
+void TopicTrie_Init( TopicTrie_t * pxTrie );
+
+/**
+ * @brief Free every node in the trie, leaving it empty.
+ *
+ * @param[in] pxTrie Trie to clear.
+ */
+void TopicTrie_Free( TopicTrie_t * pxTrie );
+
+/**
+ * @brief Add a topic filter to the trie, or replace the value stored with it.
+ *
+ * @param[in] pxTrie Trie to update.
+ * @param[in] pcTopicFilter Topic filter. Does not need to be null terminated.
+ * @param[in] usTopicFilterLength Length of pcTopicFilter.
+ * @param[in] pvValue Value to store with the filter. Must not be NULL.
+ *
+ * @return `MQTTSuccess` on success, `MQTTBadParameter` if the topic filter is
+ * malformed or has more than TOPIC_TRIE_MAX_LEVELS levels, `MQTTNoMemory` if a
+ * node could not be allocated.
+ */
+MQTTStatus_t TopicTrie_Insert( TopicTrie_t * pxTrie,
+                               const char * pcTopicFilter,
+                               uint16_t usTopicFilterLength,
+                               void * pvValue );
+
+/**
+ * @brief Remove a topic filter from the trie and free any nodes left unused.
+ *
+ * @param[in] pxTrie Trie to update.
+ * @param[in] pcTopicFilter Topic filter. Does not need to be null terminated.
+ * @param[in] usTopicFilterLength Length of pcTopicFilter.
+ *
+ * @return `MQTTSuccess` if the filter was removed, `MQTTNoDataAvailable` if it
+ * was not present.
+ */
+MQTTStatus_t TopicTrie_Remove( TopicTrie_t * pxTrie,
+                               const char * pcTopicFilter,
+                               uint16_t usTopicFilterLength );
+
+/**
+ * @brief Look up the value stored with a topic filter.
+ *
+ * Wildcards in pcTopicFilter are compared literally, so only the identical
+ * filter is found.
+ *
+ * @param[in] pxTrie Trie to search.
+ * @param[in] pcTopicFilter Topic filter. Does not need to be null terminated.
+ * @param[in] usTopicFilterLength Length of pcTopicFilter.
+ *
+ * @return The value stored with the filter, or NULL if it is not present.
+ */
+void * TopicTrie_Find( const TopicTrie_t * pxTrie,
+                       const char * pcTopicFilter,
+                       uint16_t usTopicFilterLength );
+
+/**
+ * @brief Call pxVisitor for every topic filter in the trie matching a topic name.
+ *
+ * Follows the same rules as MQTT_MatchTopic: '+' matches exactly one level,
+ * '#' matches the parent level and any number of child levels, and topic names
+ * starting with '$' are not matched by a wildcard in the first level.
+ *
+ * @param[in] pxTrie Trie to search.
+ * @param[in] pcTopicName Topic name of an incoming publish.
+ * @param[in] usTopicNameLength Length of pcTopicName.
+ * @param[in] pxVisitor Function called for each matching filter.
+ * @param[in] pvCtx Context passed to pxVisitor.
+ *
+ * @return Number of matching topic filters.
+ */
+size_t TopicTrie_Match( const TopicTrie_t * pxTrie,
+                        const char * pcTopicName,
+                        uint16_t usTopicNameLength,
+                        TopicTrieVisitor_t pxVisitor,
+                        void * pvCtx );
+
+#endif /* TOPIC_TRIE_H */
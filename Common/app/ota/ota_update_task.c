@@ -1052,7 +1052,7 @@ static OtaMqttStatus_t prvMQTTSubscribe( const char * pTopicFilter,
 
     xPublishCallback = prvGetPublishCallbackFromTopic( pTopicFilter, topicFilterLength );
 
-    xMQTTAgentHandle = xGetMqttAgentHandle();
+    xMQTTAgentHandle = xGetMqttAgentHandleForInstance( otaconfigMQTT_AGENT_INSTANCE );
 
     if( ( xMQTTAgentHandle == NULL ) ||
         ( xPublishCallback == NULL ) )
@@ -1113,11 +1113,10 @@ static OtaMqttStatus_t prvMQTTPublish( const char * const pacTopic,
 
     xCommandContext.xTaskToNotify = xTaskGetCurrentTaskHandle();
 
-    xCommandParams.blockTimeMs = otaexampleMQTT_TIMEOUT_MS;
     xCommandParams.cmdCompleteCallback = prvCommandCallback;
     xCommandParams.pCmdCompleteCallbackContext = &xCommandContext;
 
-    xMQTTAgentHandle = xGetMqttAgentHandle();
+    xMQTTAgentHandle = xGetMqttAgentHandleForInstance( otaconfigMQTT_AGENT_INSTANCE );
 
     if( xMQTTAgentHandle == NULL )
     {
@@ -1125,9 +1124,12 @@ static OtaMqttStatus_t prvMQTTPublish( const char * const pacTopic,
     }
     else
     {
-        mqttStatus = MQTTAgent_Publish( xMQTTAgentHandle,
-                                        &publishInfo,
-                                        &xCommandParams );
+        /* A saturated agent fails the publish at once instead of after
+         * otaexampleMQTT_TIMEOUT_MS, the OTA agent handles both the same way.
+         * The completion is still awaited as pMsg belongs to the OTA agent. */
+        mqttStatus = MqttAgent_PublishTry( xMQTTAgentHandle,
+                                           &publishInfo,
+                                           &xCommandParams );
 
         /* Wait for command to complete so MQTTSubscribeInfo_t remains in scope for the
          * duration of the command. */
@@ -1177,7 +1179,7 @@ static OtaMqttStatus_t prvMQTTUnsubscribe( const char * pTopicFilter,
 
     xPublishCallback = prvGetPublishCallbackFromTopic( pTopicFilter, topicFilterLength );
 
-    xMQTTAgentHandle = xGetMqttAgentHandle();
+    xMQTTAgentHandle = xGetMqttAgentHandleForInstance( otaconfigMQTT_AGENT_INSTANCE );
 
     if( ( xMQTTAgentHandle == NULL ) ||
         ( xPublishCallback == NULL ) )
@@ -1367,15 +1369,15 @@ void vOTAUpdateTask( void * pvParam )
         LogInfo( "Waiting until MQTT Agent is connected." );
 
         uxEvents = xEventGroupWaitBits( xSystemEvents,
-                                        EVT_MASK_MQTT_CONNECTED,
+                                        EVT_MASK_MQTT_CONNECTED_INSTANCE( otaconfigMQTT_AGENT_INSTANCE ),
                                         pdFALSE,
                                         pdTRUE,
                                         pdMS_TO_TICKS( otaexampleOTA_UPDATE_TIMEOUT_MS ) );
 
-        if( uxEvents & EVT_MASK_MQTT_CONNECTED )
+        if( uxEvents & EVT_MASK_MQTT_CONNECTED_INSTANCE( otaconfigMQTT_AGENT_INSTANCE ) )
         {
             LogInfo( "MQTT Agent is connected. Resuming..." );
-            xMQTTAgentHandle = xGetMqttAgentHandle();
+            xMQTTAgentHandle = xGetMqttAgentHandleForInstance( otaconfigMQTT_AGENT_INSTANCE );
         }
         else
         {
@@ -204,6 +204,18 @@ extern MQTTAgentContext_t xGlobalMqttAgentContext;
  */
 static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx );
 
+/**
+ * @brief Run the shadow callbacks for publishes queued by the MQTT agent, for
+ * up to xTicksToWait.
+ *
+ * @param[in] xStopOnNotify Return as soon as a callback has notified the task.
+ *
+ * @return The task's notification value if xStopOnNotify is set, else 0.
+ */
+static uint32_t prvProcessDeliveries( ShadowDeviceCtx_t * pxCtx,
+                                      TickType_t xTicksToWait,
+                                      bool xStopOnNotify );
+
 /**
  * @brief The callback to execute when there is an incoming publish on the
  * topic for delta updates. It verifies the document and sets the
@@ -344,11 +356,13 @@ static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx )
 {
     MQTTStatus_t xStatus = MQTTSuccess;
 
-    xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
-                                       pxCtx->pcTopicUpdateDelta,
-                                       MQTTQoS1,
-                                       prvIncomingPublishUpdateDeltaCallback,
-                                       pxCtx );
+    /* The callbacks parse JSON, so they run in this task rather than the agent's. */
+    xStatus = MqttAgent_SubscribeSyncDeferred( pxCtx->xAgentHandle,
+                                               pxCtx->pcTopicUpdateDelta,
+                                               MQTTQoS1,
+                                               prvIncomingPublishUpdateDeltaCallback,
+                                               pxCtx,
+                                               0U );
 
     if( xStatus != MQTTSuccess )
     {
@@ -356,11 +370,12 @@ static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx )
     }
     else
     {
-        xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
-                                           pxCtx->pcTopicUpdateAccepted,
-                                           MQTTQoS1,
-                                           prvIncomingPublishUpdateAcceptedCallback,
-                                           pxCtx );
+        xStatus = MqttAgent_SubscribeSyncDeferred( pxCtx->xAgentHandle,
+                                                   pxCtx->pcTopicUpdateAccepted,
+                                                   MQTTQoS1,
+                                                   prvIncomingPublishUpdateAcceptedCallback,
+                                                   pxCtx,
+                                                   0U );
 
         if( xStatus != MQTTSuccess )
         {
@@ -370,11 +385,12 @@ static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx )
 
     if( xStatus == MQTTSuccess )
     {
-        xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
-                                           pxCtx->pcTopicUpdateRejected,
-                                           MQTTQoS1,
-                                           prvIncomingPublishUpdateRejectedCallback,
-                                           pxCtx );
+        xStatus = MqttAgent_SubscribeSyncDeferred( pxCtx->xAgentHandle,
+                                                   pxCtx->pcTopicUpdateRejected,
+                                                   MQTTQoS1,
+                                                   prvIncomingPublishUpdateRejectedCallback,
+                                                   pxCtx,
+                                                   0U );
 
         if( xStatus != MQTTSuccess )
         {
@@ -387,6 +403,31 @@ static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx )
 
 /*-----------------------------------------------------------*/
 
+static uint32_t prvProcessDeliveries( ShadowDeviceCtx_t * pxCtx,
+                                      TickType_t xTicksToWait,
+                                      bool xStopOnNotify )
+{
+    TimeOut_t xTimeOut;
+    uint32_t ulNotificationValue = 0UL;
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    while( ( ulNotificationValue == 0UL ) &&
+           ( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdFALSE ) )
+    {
+        ( void ) MqttAgent_ProcessDeliveries( pxCtx->xAgentHandle, xTicksToWait );
+
+        if( xStopOnNotify )
+        {
+            ulNotificationValue = ulTaskNotifyTake( pdFALSE, 0 );
+        }
+    }
+
+    return ulNotificationValue;
+}
+
+/*-----------------------------------------------------------*/
+
 static void prvIncomingPublishUpdateDeltaCallback( void * pvCtx,
                                                    MQTTPublishInfo_t * pxPublishInfo )
 {
@@ -608,7 +649,7 @@ static void prvIncomingPublishUpdateAcceptedCallback( void * pvCtx,
                 pxCtx->ulReportedPowerOnState = ( uint32_t ) strtoul( pcOutValue, NULL, 10 );
             }
 
-            /* Wake up the shadow task which is waiting for this response. */
+            /* Tell the shadow task, which runs this callback, that the response arrived. */
             xTaskNotifyGive( pxCtx->xShadowDeviceTaskHandle );
         }
     }
@@ -701,7 +742,7 @@ static void prvIncomingPublishUpdateRejectedCallback( void * pvCtx,
                          pcOutValue );
             }
 
-            /* Wake up the shadow task which is waiting for this response. */
+            /* Tell the shadow task, which runs this callback, that the response arrived. */
             xTaskNotifyGive( pxCtx->xShadowDeviceTaskHandle );
         }
     }
@@ -804,7 +845,7 @@ void vShadowDeviceTask( void * pvParameters )
                 {
                     /* Wait for the response to our report. When the Device shadow service receives the request it will
                      * publish a response to  the /update/accepted or update/rejected */
-                    ulNotificationValue = ulTaskNotifyTake( pdFALSE, pdMS_TO_TICKS( shadow_SIGNAL_TIMEOUT ) );
+                    ulNotificationValue = prvProcessDeliveries( &xShadowCtx, pdMS_TO_TICKS( shadow_SIGNAL_TIMEOUT ), true );
 
                     if( ulNotificationValue == 0 )
                     {
@@ -822,7 +863,7 @@ void vShadowDeviceTask( void * pvParameters )
             }
 
             LogDebug( "Sleeping until next update check." );
-            vTaskDelay( pdMS_TO_TICKS( shadowMS_BETWEEN_REPORTS ) );
+            ( void ) prvProcessDeliveries( &xShadowCtx, pdMS_TO_TICKS( shadowMS_BETWEEN_REPORTS ), false );
         }
     }
     else
@@ -347,6 +347,8 @@ void Task_CLI( void * pvParameters )
     FreeRTOS_CLIRegisterCommand( &xCommandDef_uptime );
     FreeRTOS_CLIRegisterCommand( &xCommandDef_rngtest );
     FreeRTOS_CLIRegisterCommand( &xCommandDef_assert );
+    FreeRTOS_CLIRegisterCommand( &xCommandDef_mqttstat );
+    FreeRTOS_CLIRegisterCommand( &xCommandDef_sockstat );
 
     char * pcCommandBuffer = NULL;
 
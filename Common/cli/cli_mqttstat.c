@@ -0,0 +1,245 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * http://www.FreeRTOS.org
+ * http://aws.amazon.com/freertos
+ *
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "cli.h"
+#include "cli_prv.h"
+
+#include "mqtt_agent_task.h"
+#include "mqtt_agent_metrics.h"
+#include "freertos_command_pool.h"
+
+static void prvMqttStatCommand( ConsoleIO_t * const pxCIO,
+                                uint32_t ulArgc,
+                                char * ppcArgv[] );
+
+const CLI_Command_Definition_t xCommandDef_mqttstat =
+{
+    "mqttstat",
+    "mqttstat\r\n"
+    "    mqttstat [ -v ]\r\n"
+    "        Display MQTT agent command latency, lane, rate limit, command pool and wake-up statistics.\r\n"
+    "        -v also lists the latency histogram buckets.\r\n\n"
+    "    mqttstat reset\r\n"
+    "        Clear the latency histograms and wake-up counters.\r\n\n",
+    prvMqttStatCommand
+};
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintHistograms( ConsoleIO_t * const pxCIO,
+                                bool xVerbose )
+{
+    pxCIO->print( "+---------+------------+------------+------------+------------+------------+\r\n" );
+    pxCIO->print( "|  Stage  |   Count    |  Mean (us) |  p50 (us)  |  p99 (us)  |  Max (us)  |\r\n" );
+    pxCIO->print( "+---------+------------+------------+------------+------------+------------+\r\n" );
+
+    for( uint32_t ulStage = 0; ulStage < MQTT_AGENT_NUM_STAGES; ulStage++ )
+    {
+        MQTTAgentHistogram_t xHistogram;
+        uint32_t ulMeanUs = 0;
+
+        MqttAgentMetrics_GetHistogram( ( MQTTAgentStage_t ) ulStage, &xHistogram );
+
+        if( xHistogram.ulCount > 0 )
+        {
+            ulMeanUs = MqttAgentMetrics_TicksToUs( xHistogram.ullTotalTicks / xHistogram.ulCount );
+        }
+
+        snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                  "| %-7s | %10lu | %10lu | %10lu | %10lu | %10lu |\r\n",
+                  MqttAgentMetrics_StageName( ( MQTTAgentStage_t ) ulStage ),
+                  ( unsigned long ) xHistogram.ulCount,
+                  ( unsigned long ) ulMeanUs,
+                  ( unsigned long ) MqttAgentMetrics_PercentileUs( &xHistogram, 50 ),
+                  ( unsigned long ) MqttAgentMetrics_PercentileUs( &xHistogram, 99 ),
+                  ( unsigned long ) MqttAgentMetrics_TicksToUs( xHistogram.ulMaxTicks ) );
+        pxCIO->print( pcCliScratchBuffer );
+
+        for( size_t uxBucket = 0; xVerbose && ( uxBucket < MQTT_AGENT_METRICS_BUCKETS ); uxBucket++ )
+        {
+            if( xHistogram.pulBuckets[ uxBucket ] > 0 )
+            {
+                if( uxBucket < ( MQTT_AGENT_METRICS_BUCKETS - 1U ) )
+                {
+                    snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                              "|         |   < %10lu us: %10lu\r\n",
+                              ( unsigned long ) MqttAgentMetrics_BucketLimitUs( uxBucket ),
+                              ( unsigned long ) xHistogram.pulBuckets[ uxBucket ] );
+                }
+                else
+                {
+                    snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                              "|         |  >= %10lu us: %10lu\r\n",
+                              ( unsigned long ) MqttAgentMetrics_BucketLimitUs( uxBucket - 1U ),
+                              ( unsigned long ) xHistogram.pulBuckets[ uxBucket ] );
+                }
+
+                pxCIO->print( pcCliScratchBuffer );
+            }
+        }
+    }
+
+    pxCIO->print( "+---------+------------+------------+------------+------------+------------+\r\n" );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintLanes( ConsoleIO_t * const pxCIO )
+{
+    static const char * const pcLaneNames[ MQTT_AGENT_NUM_LANES ] = { "high", "normal", "bulk" };
+    MQTTAgentHandle_t xHandle = xGetMqttAgentHandle();
+
+    pxCIO->print( "+---------+------------+------------+------------+-----------+--------------+------------+\r\n" );
+    pxCIO->print( "|  Lane   |  Enqueued  |  Dequeued  |  Rejected  | Max Depth | Max Wait(ms) | High Water |\r\n" );
+    pxCIO->print( "+---------+------------+------------+------------+-----------+--------------+------------+\r\n" );
+
+    for( uint32_t ulLane = 0; ulLane < MQTT_AGENT_NUM_LANES; ulLane++ )
+    {
+        MQTTAgentLaneStats_t xStats;
+
+        if( xMQTTAgentGetLaneStats( xHandle, ( MQTTAgentLane_t ) ulLane, &xStats ) )
+        {
+            snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                      "| %-7s | %10lu | %10lu | %10lu | %9lu | %12lu | %10lu |\r\n",
+                      pcLaneNames[ ulLane ],
+                      ( unsigned long ) xStats.ulEnqueued,
+                      ( unsigned long ) xStats.ulDequeued,
+                      ( unsigned long ) xStats.ulRejected,
+                      ( unsigned long ) xStats.ulMaxDepth,
+                      ( unsigned long ) xStats.ulMaxWaitMs,
+                      ( unsigned long ) xStats.ulHighWatermarks );
+            pxCIO->print( pcCliScratchBuffer );
+        }
+    }
+
+    pxCIO->print( "+---------+------------+------------+------------+-----------+--------------+------------+\r\n" );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintRateClasses( ConsoleIO_t * const pxCIO )
+{
+    MQTTAgentHandle_t xHandle = xGetMqttAgentHandle();
+    MqttRateStats_t xStats;
+
+    if( xMQTTAgentGetRateStats( xHandle, 0, &xStats ) )
+    {
+        pxCIO->print( "+---------+------------+------------+------------+------------+---------------+\r\n" );
+        pxCIO->print( "|  Rate   |   Passed   |  Delayed   |   Merged   |  Dropped   | Max Delay(ms) |\r\n" );
+        pxCIO->print( "+---------+------------+------------+------------+------------+---------------+\r\n" );
+
+        for( size_t uxClass = 0; xMQTTAgentGetRateStats( xHandle, uxClass, &xStats ); uxClass++ )
+        {
+            snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                      "| %7lu | %10lu | %10lu | %10lu | %10lu | %13lu |\r\n",
+                      ( unsigned long ) uxClass,
+                      ( unsigned long ) xStats.ulPassed,
+                      ( unsigned long ) xStats.ulDelayed,
+                      ( unsigned long ) xStats.ulMerged,
+                      ( unsigned long ) xStats.ulDropped,
+                      ( unsigned long ) xStats.ulMaxDelayMs );
+            pxCIO->print( pcCliScratchBuffer );
+        }
+
+        pxCIO->print( "+---------+------------+------------+------------+------------+---------------+\r\n" );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvMqttStatCommand( ConsoleIO_t * const pxCIO,
+                                uint32_t ulArgc,
+                                char * ppcArgv[] )
+{
+    bool xVerbose = false;
+    bool xPrintStats = true;
+
+    for( uint32_t i = 1; i < ulArgc; i++ )
+    {
+        if( strcmp( "-v", ppcArgv[ i ] ) == 0 )
+        {
+            xVerbose = true;
+        }
+        else if( strcmp( "reset", ppcArgv[ i ] ) == 0 )
+        {
+            MqttAgentMetrics_Reset();
+            pxCIO->print( "Cleared the MQTT agent latency histograms and wake-up counters.\r\n" );
+            xPrintStats = false;
+        }
+        else
+        {
+            pxCIO->print( "Error: Unrecognized argument: " );
+            pxCIO->print( ppcArgv[ i ] );
+            pxCIO->print( "\r\n" );
+            xPrintStats = false;
+        }
+    }
+
+    if( xPrintStats )
+    {
+        CommandPoolStats_t xPoolStats;
+        MQTTAgentWakeStats_t xWakeStats;
+        uint32_t ulElapsedS = 0;
+
+        prvPrintHistograms( pxCIO, xVerbose );
+
+        if( xGetMqttAgentHandle() != NULL )
+        {
+            prvPrintLanes( pxCIO );
+            prvPrintRateClasses( pxCIO );
+        }
+
+        Agent_GetPoolStats( &xPoolStats );
+
+        snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                  "Command pool: %lu of %lu in use, high water %lu, exhausted %lu times.\r\n",
+                  ( unsigned long ) xPoolStats.ulInUse,
+                  ( unsigned long ) xPoolStats.ulPoolSize,
+                  ( unsigned long ) xPoolStats.ulHighWater,
+                  ( unsigned long ) xPoolStats.ulExhausted );
+        pxCIO->print( pcCliScratchBuffer );
+
+        MqttAgentMetrics_GetWakeStats( &xWakeStats );
+        ulElapsedS = ( xWakeStats.ulElapsedMs / 1000U ) + 1U;
+
+        snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                  "Agent wake-ups: %lu in %lu s (%lu per minute), %lu without a notification.\r\n",
+                  ( unsigned long ) xWakeStats.ulWakeups,
+                  ( unsigned long ) ulElapsedS,
+                  ( unsigned long ) ( ( ( uint64_t ) xWakeStats.ulWakeups * 60U ) / ulElapsedS ),
+                  ( unsigned long ) xWakeStats.ulTimeouts );
+        pxCIO->print( pcCliScratchBuffer );
+    }
+}
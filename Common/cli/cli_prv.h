@@ -133,5 +133,7 @@ extern const CLI_Command_Definition_t xCommandDef_reset;
 extern const CLI_Command_Definition_t xCommandDef_uptime;
 extern const CLI_Command_Definition_t xCommandDef_rngtest;
 extern const CLI_Command_Definition_t xCommandDef_assert;
+extern const CLI_Command_Definition_t xCommandDef_mqttstat;
+extern const CLI_Command_Definition_t xCommandDef_sockstat;
 
 #endif /* _CLI_PRIV */
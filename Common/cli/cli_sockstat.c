@@ -0,0 +1,114 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * http://www.FreeRTOS.org
+ * http://aws.amazon.com/freertos
+ *
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "cli.h"
+#include "cli_prv.h"
+
+#include "sock_mux.h"
+
+static void prvSockStatCommand( ConsoleIO_t * const pxCIO,
+                                uint32_t ulArgc,
+                                char * ppcArgv[] );
+
+const CLI_Command_Definition_t xCommandDef_sockstat =
+{
+    "sockstat",
+    "sockstat\r\n"
+    "    sockstat\r\n"
+    "        Display socket multiplexer events, wake-ups and context switches.\r\n\n"
+    "    sockstat reset\r\n"
+    "        Clear the socket multiplexer and context switch counters.\r\n\n",
+    prvSockStatCommand
+};
+
+/*-----------------------------------------------------------*/
+
+static void prvSockStatCommand( ConsoleIO_t * const pxCIO,
+                                uint32_t ulArgc,
+                                char * ppcArgv[] )
+{
+    bool xPrintStats = true;
+
+    for( uint32_t i = 1; i < ulArgc; i++ )
+    {
+        if( strcmp( "reset", ppcArgv[ i ] ) == 0 )
+        {
+            SockMux_ResetStats();
+            pxCIO->print( "Cleared the socket multiplexer and context switch counters.\r\n" );
+            xPrintStats = false;
+        }
+        else
+        {
+            pxCIO->print( "Error: Unrecognized argument: " );
+            pxCIO->print( ppcArgv[ i ] );
+            pxCIO->print( "\r\n" );
+            xPrintStats = false;
+        }
+    }
+
+    if( xPrintStats )
+    {
+        SockMuxStats_t xStats;
+        uint32_t ulSwitchesPerRead = 0;
+
+        SockMux_GetStats( &xStats );
+
+        if( xStats.ulReadEvents > 0 )
+        {
+            ulSwitchesPerRead = ( uint32_t ) ( ( ( uint64_t ) xStats.ulContextSwitches * 100U ) / xStats.ulReadEvents );
+        }
+
+        snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                  "Sockets: %lu registered, %lu select wake-ups, %lu wake signals.\r\n",
+                  ( unsigned long ) xStats.ulSockets,
+                  ( unsigned long ) xStats.ulSelectReturns,
+                  ( unsigned long ) xStats.ulWakeSignals );
+        pxCIO->print( pcCliScratchBuffer );
+
+        snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                  "Events: %lu read, %lu write, %lu error.\r\n",
+                  ( unsigned long ) xStats.ulReadEvents,
+                  ( unsigned long ) xStats.ulWriteEvents,
+                  ( unsigned long ) xStats.ulErrorEvents );
+        pxCIO->print( pcCliScratchBuffer );
+
+        snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                  "Context switches: %lu, %lu.%02lu per read event.\r\n",
+                  ( unsigned long ) xStats.ulContextSwitches,
+                  ( unsigned long ) ( ulSwitchesPerRead / 100U ),
+                  ( unsigned long ) ( ulSwitchesPerRead % 100U ) );
+        pxCIO->print( pcCliScratchBuffer );
+    }
+}
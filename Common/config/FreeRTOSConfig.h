@@ -194,4 +194,16 @@
 #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
 #define portGET_RUN_TIME_COUNTER_VALUE()    ( timer_get_count( pxHndlTim5 ) )
 
+/* Set to 1 to count context switches in ulContextSwitchCount, which is
+ * defined and reported by the socket multiplexer. Only for images that link
+ * sock_mux.c. */
+#ifndef configCOUNT_CONTEXT_SWITCHES
+    #define configCOUNT_CONTEXT_SWITCHES    0
+#endif
+
+#if ( configCOUNT_CONTEXT_SWITCHES == 1 )
+    extern volatile uint32_t ulContextSwitchCount;
+    #define traceTASK_SWITCHED_IN()    ( ulContextSwitchCount++ )
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
@@ -50,10 +50,42 @@
 #define MQTT_STATE_ARRAY_MAX_COUNT                   ( 20U )
 #define MQTT_RECV_POLLING_TIMEOUT_MS                 ( 250 )
 
+/**
+ * @brief Longest time without sending a packet before coreMQTT sends a PINGREQ.
+ *
+ * @note The keep alive interval chosen by the agent is used when it is shorter,
+ * so this only needs to be at least MQTT_KEEPALIVE_MAX_S (in milliseconds).
+ */
+#define PACKET_TX_TIMEOUT_MS                         ( 1200U * 1000U )
+
+/**
+ * @brief Longest time without receiving a packet before coreMQTT sends a PINGREQ.
+ *
+ * @note A shorter value would send PINGREQs on an idle connection before the
+ * keep alive interval elapses. The agent pings sooner itself if packets are
+ * sent but none received for MQTT_KEEPALIVE_RX_TIMEOUT_S.
+ */
+#define PACKET_RX_TIMEOUT_MS                         ( 1200U * 1000U )
+
 /*_RB_ To document and add to the mqtt config defaults header file. */
 #define MQTT_AGENT_COMMAND_QUEUE_LENGTH              ( 32 )
 #define MQTT_COMMAND_CONTEXTS_POOL_SIZE              ( 32 )
 
+/**
+ * @brief Number of consecutive normal lane commands the agent processes
+ * before giving a waiting bulk lane command a turn.
+ *
+ * @note High lane commands are always processed first. Each lane queue holds up
+ * to MQTT_AGENT_COMMAND_QUEUE_LENGTH commands.
+ */
+#define MQTT_AGENT_LANE_NORMAL_WEIGHT                ( 4 )
+
+/**
+ * @brief Number of back-pressure watermarks that can be registered on each
+ * lane with xMQTTAgentAddLaneWatermark.
+ */
+#define MQTT_AGENT_LANE_MAX_WATERMARKS               ( 4 )
+
 /**
  * @brief The maximum number of subscriptions to track for a single connection.
  *
@@ -77,11 +109,90 @@
 /**
  * @brief Dimensions the buffer used to serialize and deserialize MQTT packets.
  * @note Specified in bytes.  Must be large enough to hold the maximum
- * anticipated MQTT payload.
+ * anticipated MQTT payload, except for publishes received by subscriptions made
+ * with MqttAgent_SubscribeStreamSync, which are passed on in pieces of up to
+ * this size.
  */
 #define MQTT_AGENT_NETWORK_BUFFER_SIZE               ( 6 * 1024 )
 
+/**
+ * @brief Number of MQTT_AGENT_NETWORK_BUFFER_SIZE receive buffers owned by the agent.
+ * @note One buffer is always in use by coreMQTT. Each additional buffer is
+ * allocated from the heap for every agent instance and allows one more
+ * incoming publish to be held by MqttAgent_RetainPayload at a time instead of
+ * being copied by the subscriber. Raise it in applications that retain
+ * payloads, with 1 MqttAgent_RetainPayload always returns NULL.
+ */
+#ifndef MQTT_AGENT_RX_BUFFER_COUNT
+    #define MQTT_AGENT_RX_BUFFER_COUNT               ( 1 )
+#endif
+
+/**
+ * @brief Size of the buffer used to combine QoS0 publishes into a single
+ * transport write.
+ * @note Specified in bytes. Publishes processed back to back by the agent are
+ * written to the TLS connection as one record once the command queue is empty,
+ * this buffer is full or MQTT_AGENT_TX_COALESCE_MAX_DELAY_MS has elapsed.
+ */
+#define MQTT_AGENT_TX_COALESCE_BUFFER_SIZE           ( 1024 )
+
+/**
+ * @brief Set to 0 to write every QoS0 publish to the transport on its own.
+ * @note The host benchmark builds the agent both ways to measure the gain.
+ */
+#ifndef MQTT_AGENT_TX_COALESCE_ENABLED
+    #define MQTT_AGENT_TX_COALESCE_ENABLED           ( 1 )
+#endif
+
+/**
+ * @brief Maximum time a QoS0 publish may wait in the coalescing buffer.
+ * @note Specified in milliseconds.
+ */
+#define MQTT_AGENT_TX_COALESCE_MAX_DELAY_MS          ( 20 )
+
+/**
+ * @brief Set to 1 to limit the publish rate of the default agent instance to
+ * MQTT_AGENT_PUBLISH_RATE_PER_SEC.
+ * @note Off by default, so publishes are sent as soon as the agent takes them.
+ * The limit targets the broker behind IoTConnect on AWS, which is AWS IoT
+ * Core: it allows 100 publishes per second on each connection and
+ * disconnects clients which exceed it.
+ */
+#ifndef MQTT_AGENT_PUBLISH_RATE_LIMIT_ENABLED
+    #define MQTT_AGENT_PUBLISH_RATE_LIMIT_ENABLED    ( 0 )
+#endif
 
+/**
+ * @brief Average number of publishes per second sent by the default agent
+ * instance when MQTT_AGENT_PUBLISH_RATE_LIMIT_ENABLED is 1.
+ * @note Publishes beyond the limit are held by the agent until they can be
+ * sent, see mqtt_rate_limit.h. Keep it below the broker's limit per connection.
+ */
+#ifndef MQTT_AGENT_PUBLISH_RATE_PER_SEC
+    #define MQTT_AGENT_PUBLISH_RATE_PER_SEC          ( 90 )
+#endif
+
+/**
+ * @brief Number of publishes the default agent instance may send back to back
+ * before MQTT_AGENT_PUBLISH_RATE_PER_SEC applies.
+ */
+#ifndef MQTT_AGENT_PUBLISH_BURST
+    #define MQTT_AGENT_PUBLISH_BURST                 ( 20 )
+#endif
+
+
+/**
+ * @brief Longest time the agent task sleeps while connected and idle.
+ * @note Specified in milliseconds. Incoming data and commands wake the agent
+ * immediately, and it wakes for keep alive deadlines by itself, so this only
+ * bounds the wait in case a notification is missed.
+ */
+#define MQTT_AGENT_MAX_IDLE_WAIT_MS                  ( 60 * 1000 )
+
+/**
+ * @brief Time the agent waits for a command between polls of the connection
+ * while it is not connected.
+ */
 #define MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME         ( 1 )
 
 #endif /* ifndef CORE_MQTT_CONFIG_H */
@@ -41,6 +41,8 @@ typedef enum KvStoreEnum
     CS_TIME_HWM_S_1970,
     CS_IOTC_CPID,
     CS_IOTC_ENV,
+    CS_DNS_CACHE,
+    CS_MQTT_KEEPALIVE,
     CS_NUM_KEYS
 } KVStoreKey_t;
 
@@ -118,7 +120,9 @@ typedef enum KvStoreEnum
         "wifi_credential", \
         "time_hwm",        \
         "cpid",            \
-        "env"              \
+        "env",             \
+        "dns_cache",       \
+        "mqtt_keepalive"   \
     }
 
 #define KV_STORE_DEFAULTS                                                          \
@@ -131,6 +135,8 @@ typedef enum KvStoreEnum
         KV_DFLT( KV_TYPE_UINT32, 0 ),                  /* CS_TIME_HWM_S_1970 */    \
         KV_DFLT( KV_TYPE_STRING, IOTC_CPID_DFLT ), 	   /* CS_IOTC_CPID */          \
         KV_DFLT( KV_TYPE_STRING, IOTC_ENV_DFLT ), 	   /* CS_IOTC_ENV */           \
+        KV_DFLT( KV_TYPE_STRING, "" ),                 /* CS_DNS_CACHE */          \
+        KV_DFLT( KV_TYPE_STRING, "" ),                 /* CS_MQTT_KEEPALIVE */     \
     }
 
 #endif /* _KVSTORE_CONFIG_H */
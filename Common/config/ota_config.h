@@ -222,4 +222,13 @@
 
 #define configOTA_PRIMARY_DATA_PROTOCOL    OTA_DATA_OVER_MQTT
 
+/**
+ * @brief MQTT agent instance used for the OTA jobs and file block transfers.
+ *
+ * Point this at an instance started with vMQTTAgentInstanceTask to keep large
+ * downloads from delaying the telemetry and command traffic of the default
+ * instance.
+ */
+#define otaconfigMQTT_AGENT_INSTANCE       ( 0U )
+
 #endif /* OTA_CONFIG_H_ */
@@ -33,6 +33,8 @@
 #define sock_setsockopt     lwip_setsockopt
 #define sock_fcntl          lwip_fcntl
 #define sock_select         lwip_select
+#define sock_bind           lwip_bind
+#define sock_getsockname    lwip_getsockname
 
 #define dns_getaddrinfo     lwip_getaddrinfo
 #define dns_freeaddrinfo    lwip_freeaddrinfo
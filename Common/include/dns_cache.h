@@ -0,0 +1,96 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file dns_cache.h
+ * @brief Cache of resolved IPv4 host addresses, used by the TLS transport to
+ * reconnect without waiting for a DNS lookup.
+ */
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/sockets.h"
+
+/**
+ * @brief Number of host names cached.
+ */
+#ifndef DNS_CACHE_ENTRIES
+    #define DNS_CACHE_ENTRIES    2U
+#endif /* DNS_CACHE_ENTRIES */
+
+/**
+ * @brief Age in seconds after which a cached address is refreshed. lwIP does
+ * not report the TTL of the DNS record, so a fixed value is used instead.
+ * Stale addresses are still tried first while the refresh runs in the background.
+ */
+#ifndef DNS_CACHE_TTL_S
+    #define DNS_CACHE_TTL_S    300U
+#endif /* DNS_CACHE_TTL_S */
+
+/**
+ * @brief Set to 1 to keep the most recently resolved address in the KVStore
+ * (CS_DNS_CACHE), so the first connection after a reset can skip DNS too.
+ */
+#ifndef DNS_CACHE_PERSIST
+    #define DNS_CACHE_PERSIST    1
+#endif /* DNS_CACHE_PERSIST */
+
+/**
+ * @brief Look up the cached address of a host.
+ *
+ * @param[in] pcHostName Null terminated host name.
+ * @param[out] pxAddr Cached address.
+ * @param[out] pxIsStale Set to true when the address is older than
+ * DNS_CACHE_TTL_S, or was loaded from the KVStore, and should be refreshed.
+ *
+ * @return true if an address is cached for the host.
+ */
+bool DnsCache_Lookup( const char * pcHostName,
+                      struct in_addr * pxAddr,
+                      bool * pxIsStale );
+
+/**
+ * @brief Add or update the cached address of a host.
+ */
+void DnsCache_Store( const char * pcHostName,
+                     const struct in_addr * pxAddr );
+
+/**
+ * @brief Forget the cached address of a host, for instance after a failed
+ * connection attempt.
+ */
+void DnsCache_Invalidate( const char * pcHostName );
+
+/**
+ * @brief Resolve a host name again from a background task and update the cache.
+ * Returns immediately.
+ */
+void DnsCache_RefreshAsync( const char * pcHostName );
+
+#endif /* DNS_CACHE_H */
@@ -65,6 +65,57 @@
     #define SOCK_OK    0
 #endif
 
+/**
+ * @brief Time allowed for the TLS handshake of mbedtls_transport_connect,
+ * after the socket is connected.
+ */
+#ifndef MBEDTLS_TRANSPORT_HANDSHAKE_TIMEOUT_MS
+    #define MBEDTLS_TRANSPORT_HANDSHAKE_TIMEOUT_MS    ( 30000U )
+#endif
+
+/**
+ * @brief Longest time a call of mbedtls_transport_send waits for space in
+ * the socket send buffer. When it expires with nothing sent, the call
+ * returns 0 and may be repeated with the same data.
+ */
+#ifndef MBEDTLS_TRANSPORT_SEND_TIMEOUT_MS
+    #define MBEDTLS_TRANSPORT_SEND_TIMEOUT_MS    ( 1000U )
+#endif
+
+/**
+ * @brief Longest single wait for space in the socket send buffer before the
+ * send is tried again. lwIP only reports a socket writable once more than
+ * TCP_SNDLOWAT bytes are free, a partial write can go through earlier.
+ */
+#ifndef MBEDTLS_TRANSPORT_SEND_POLL_MS
+    #define MBEDTLS_TRANSPORT_SEND_POLL_MS    ( 5U )
+#endif
+
+/**
+ * @brief Largest packet mbedtls_transport_sendv gathers into one TLS record.
+ * The buffer is part of each connection's context, larger packets are
+ * written one vector at a time.
+ */
+#ifndef MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE
+    #define MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Basic ECC operations done by one handshake step when
+ * MBEDTLS_ECP_RESTARTABLE is enabled. See mbedtls_ecp_set_max_ops.
+ */
+#ifndef MBEDTLS_TRANSPORT_ECP_MAX_OPS
+    #define MBEDTLS_TRANSPORT_ECP_MAX_OPS    ( 500U )
+#endif
+
+/**
+ * @brief Frequency of portGET_RUN_TIME_COUNTER_VALUE, used to report the CPU
+ * time of handshakes.
+ */
+#ifndef MBEDTLS_TRANSPORT_RUN_TIME_COUNTER_HZ
+    #define MBEDTLS_TRANSPORT_RUN_TIME_COUNTER_HZ    ( 160000000U / 4097U )
+#endif
+
 
 /* Public Types */
 typedef enum
@@ -73,11 +124,15 @@ typedef enum
     STATE_ALLOCATED = 1,
     STATE_CONFIGURED = 2,
     STATE_CONNECTED = 3,
+    STATE_HANDSHAKING = 4,
 } ConnectionState_t;
 
 typedef enum TlsTransportStatus
 {
     TLS_TRANSPORT_SUCCESS = PKI_SUCCESS,
+    TLS_TRANSPORT_WANT_READ = 1,   /* Handshake waits for data from the peer. */
+    TLS_TRANSPORT_WANT_WRITE = 2,  /* Handshake waits for space in the socket. */
+    TLS_TRANSPORT_IN_PROGRESS = 3, /* Handshake paused between ECC steps. */
     TLS_TRANSPORT_UNKNOWN_ERROR = PKI_ERR,
     TLS_TRANSPORT_INVALID_PARAMETER = PKI_ERR_ARG_INVALID,
     TLS_TRANSPORT_INSUFFICIENT_MEMORY = PKI_ERR_NOMEM,
@@ -97,6 +152,22 @@ typedef enum TlsTransportStatus
 
 typedef void ( * GenericCallback_t )( void * );
 
+/**
+ * @brief Handshakes completed by a network context, counted separately for
+ * full and resumed handshakes. Bytes are those on the socket, TLS record
+ * headers included.
+ */
+typedef struct TlsHandshakeStats
+{
+    uint32_t ulCount;
+    uint32_t ulTotalMs;
+    uint32_t ulMaxMs;
+    uint32_t ulTotalCpuUs; /* Time spent in mbedtls_ssl_handshake. */
+    uint32_t ulMaxCpuUs;
+    uint32_t ulTotalBytesSent;
+    uint32_t ulTotalBytesReceived;
+} TlsHandshakeStats_t;
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -120,7 +191,11 @@ TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkCo
                                                   const PkiObject_t * pxRootCaCerts,
                                                   const size_t uxNumRootCA );
 
-
+/**
+ * @brief Set a callback that runs in the socket multiplexer task when data
+ * arrives on the connection. After reporting once, it only runs again after
+ * a call of mbedtls_transport_recv which found nothing to read.
+ */
 int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
                                            GenericCallback_t pxCallback,
                                            void * pvCtx );
@@ -136,6 +211,10 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
  * @param[in] receiveTimeoutMs Receive socket timeout.
  * @param[in] sendTimeoutMs Send socket timeout.
  *
+ * The handshake is run with mbedtls_transport_connect_step. The calling task
+ * sleeps while it waits for the server and yields between ECC steps. The
+ * handshake fails after MBEDTLS_TRANSPORT_HANDSHAKE_TIMEOUT_MS.
+ *
  * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INSUFFICIENT_MEMORY, #TLS_TRANSPORT_INVALID_CREDENTIALS,
  * #TLS_TRANSPORT_HANDSHAKE_FAILED, #TLS_TRANSPORT_INTERNAL_ERROR, or #TLS_TRANSPORT_CONNECT_FAILURE.
  */
@@ -145,6 +224,48 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
                                                 uint32_t ulRecvTimeoutMs,
                                                 uint32_t ulSendTimeoutMs );
 
+/**
+ * @brief Start a TLS connection without waiting for the handshake.
+ *
+ * Resolves the host and connects the socket, then leaves the handshake to
+ * mbedtls_transport_connect_step. Parameters are those of
+ * mbedtls_transport_connect.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS when the handshake can start, else an error.
+ */
+TlsTransportStatus_t mbedtls_transport_connect_start( NetworkContext_t * pxNetworkContext,
+                                                      const char * pcHostName,
+                                                      uint16_t usPort,
+                                                      uint32_t ulRecvTimeoutMs,
+                                                      uint32_t ulSendTimeoutMs );
+
+/**
+ * @brief Advance the handshake of a connection started with
+ * mbedtls_transport_connect_start.
+ *
+ * Never blocks on a non-blocking socket. With MBEDTLS_ECP_RESTARTABLE, each
+ * call does at most MBEDTLS_TRANSPORT_ECP_MAX_OPS of ECC work. Operations of
+ * a PKCS#11 or PSA private key are not split.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS once connected;
+ * #TLS_TRANSPORT_WANT_READ or #TLS_TRANSPORT_WANT_WRITE to be called again
+ * when the socket is ready, see mbedtls_transport_connect_wait;
+ * #TLS_TRANSPORT_IN_PROGRESS to be called again as soon as convenient;
+ * else an error, after which the socket is closed.
+ */
+TlsTransportStatus_t mbedtls_transport_connect_step( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Wait until the socket is ready for the next handshake step.
+ *
+ * @param[in] pxNetworkContext Network context.
+ * @param[in] ulTimeoutMs Longest wait.
+ *
+ * @return Positive if ready, 0 on timeout, negative on error.
+ */
+int32_t mbedtls_transport_connect_wait( NetworkContext_t * pxNetworkContext,
+                                        uint32_t ulTimeoutMs );
+
 /**
  * @brief Sets the socket option for the underlying socket connection.
  *
@@ -168,6 +289,17 @@ int32_t mbedtls_transport_setsockopt( NetworkContext_t * pxNetworkContext,
  */
 void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext );
 
+/**
+ * @brief Read the handshake statistics of a network context.
+ *
+ * @param[in] pxNetworkContext Network context.
+ * @param[out] pxFullStats Statistics of full handshakes, may be NULL.
+ * @param[out] pxResumedStats Statistics of resumed handshakes, may be NULL.
+ */
+void mbedtls_transport_gethandshakestats( NetworkContext_t * pxNetworkContext,
+                                          TlsHandshakeStats_t * pxFullStats,
+                                          TlsHandshakeStats_t * pxResumedStats );
+
 /**
  * @brief Receives data from an established TLS connection.
  *
@@ -182,11 +314,26 @@ int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
                                 void * pBuffer,
                                 size_t bytesToRecv );
 
+/**
+ * @brief Wait until mbedtls_transport_recv has data to return.
+ *
+ * For a reader which must complete a packet after mbedtls_transport_recv
+ * returned 0.
+ *
+ * @param[in] pxNetworkContext Network context.
+ * @param[in] ulTimeoutMs Longest wait.
+ *
+ * @return Positive if data is ready, 0 on timeout, negative on error.
+ */
+int32_t mbedtls_transport_recv_wait( NetworkContext_t * pxNetworkContext,
+                                     uint32_t ulTimeoutMs );
+
 /**
  * @brief Sends data over an established TLS connection.
  *
  * This is the TLS version of the transport interface's
- * #TransportSend_t function.
+ * #TransportSend_t function. Once connected, a full socket send buffer is
+ * waited for with select(), for at most MBEDTLS_TRANSPORT_SEND_TIMEOUT_MS.
  *
  * @return Number of bytes (> 0) sent on success;
  * 0 if the socket times out without sending any bytes;
@@ -196,6 +343,27 @@ int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
                                 const void * pBuffer,
                                 size_t uxBytesToSend );
 
+/**
+ * @brief Sends the concatenation of several buffers over an established TLS
+ * connection.
+ *
+ * This is the TLS version of the transport interface's
+ * #TransportWritev_t function. A packet of up to
+ * MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE bytes, and no more than one record
+ * payload, is gathered and sent as a single TLS record. A larger one is
+ * written vector by vector.
+ *
+ * After a return of 0 or a partial count, the call must be repeated with
+ * the remaining data before any call of mbedtls_transport_send.
+ *
+ * @return Number of bytes (> 0) sent on success;
+ * 0 if the socket times out without sending any bytes;
+ * else a negative value to represent error.
+ */
+int32_t mbedtls_transport_sendv( NetworkContext_t * pxNetworkContext,
+                                 TransportOutVector_t * pxVectors,
+                                 size_t uxVectorCount );
+
 
 #ifdef MBEDTLS_TRANSPORT_PKCS11
     extern mbedtls_pk_info_t mbedtls_pkcs11_pk_ecdsa;
@@ -0,0 +1,117 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file sock_mux.h
+ * @brief A single task that waits for readiness of all registered sockets
+ * and reports it through callbacks, in place of a select() task per socket.
+ *
+ * Interest in an event is one-shot: once an event has been reported, the
+ * socket is no longer watched for it until SockMux_Arm is called again,
+ * typically after the owner has read or written as much as it could.
+ */
+#ifndef SOCK_MUX_H
+#define SOCK_MUX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tls_transport_config.h"
+
+/**
+ * @brief Number of sockets that can be registered at the same time.
+ */
+#ifndef SOCK_MUX_MAX_SOCKETS
+    #define SOCK_MUX_MAX_SOCKETS    4U
+#endif /* SOCK_MUX_MAX_SOCKETS */
+
+/**
+ * @brief Priority of the multiplexer task. Below the socket owners, so they
+ * usually re-arm before the task selects again and no wake-up is needed.
+ */
+#ifndef SOCK_MUX_TASK_PRIORITY
+    #define SOCK_MUX_TASK_PRIORITY    ( tskIDLE_PRIORITY + 1 )
+#endif /* SOCK_MUX_TASK_PRIORITY */
+
+#ifndef SOCK_MUX_TASK_STACK_WORDS
+    #define SOCK_MUX_TASK_STACK_WORDS    ( 512U )
+#endif /* SOCK_MUX_TASK_STACK_WORDS */
+
+#define SOCK_MUX_EVT_READ     ( 1UL << 0 ) /* Data or a connection close to read. */
+#define SOCK_MUX_EVT_WRITE    ( 1UL << 1 ) /* Space in the send buffer. */
+#define SOCK_MUX_EVT_ERROR    ( 1UL << 2 ) /* Socket error, always watched while armed. */
+
+/**
+ * @brief Called from the multiplexer task with the events that occurred.
+ * Must not block or call the SockMux functions.
+ */
+typedef void ( * SockMuxCallback_t )( void * pvCallbackCtx,
+                                      uint32_t ulEvents );
+
+typedef struct SockMuxEntry * SockMuxHandle_t;
+
+typedef struct SockMuxStats
+{
+    uint32_t ulSockets;         /* Currently registered. */
+    uint32_t ulSelectReturns;   /* Times the task woke from select(). */
+    uint32_t ulWakeSignals;     /* Wake-ups sent to make the task select again. */
+    uint32_t ulReadEvents;
+    uint32_t ulWriteEvents;
+    uint32_t ulErrorEvents;
+    uint32_t ulContextSwitches; /* Of all tasks since the last reset, 0 unless configCOUNT_CONTEXT_SWITCHES is 1. */
+} SockMuxStats_t;
+
+/**
+ * @brief Start watching a connected socket. The multiplexer task is created
+ * on first use.
+ *
+ * @param[in] xSockHandle Socket to watch.
+ * @param[in] pxCallback Readiness callback.
+ * @param[in] pvCallbackCtx Passed to the callback.
+ *
+ * @return Handle for the other functions, or NULL if all entries are in use.
+ */
+SockMuxHandle_t SockMux_Register( SockHandle_t xSockHandle,
+                                  SockMuxCallback_t pxCallback,
+                                  void * pvCallbackCtx );
+
+/**
+ * @brief Watch the socket for the given events until one of them is reported.
+ */
+void SockMux_Arm( SockMuxHandle_t xHandle,
+                  uint32_t ulEvents );
+
+/**
+ * @brief Stop watching a socket. On return the callback is no longer called
+ * and the socket may be closed.
+ */
+void SockMux_Unregister( SockMuxHandle_t xHandle );
+
+void SockMux_GetStats( SockMuxStats_t * pxStats );
+
+void SockMux_ResetStats( void );
+
+#endif /* SOCK_MUX_H */
@@ -36,6 +36,10 @@
 #define EVT_MASK_MQTT_INIT         0x08
 #define EVT_MASK_MQTT_CONNECTED    0x10
 
+/* Bits of each MQTT agent instance. Instance 0 uses the two masks above. */
+#define EVT_MASK_MQTT_INIT_INSTANCE( ulInstance )         ( ( EventBits_t ) EVT_MASK_MQTT_INIT << ( 2U * ( ulInstance ) ) )
+#define EVT_MASK_MQTT_CONNECTED_INSTANCE( ulInstance )    ( ( EventBits_t ) EVT_MASK_MQTT_CONNECTED << ( 2U * ( ulInstance ) ) )
+
 extern EventGroupHandle_t xSystemEvents;
 
 #endif /* _SYS_EVT_H */
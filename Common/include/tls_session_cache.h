@@ -0,0 +1,109 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file tls_session_cache.h
+ * @brief Storage of the TLS session negotiated with the broker, so that the
+ * first connection after a reset can resume it instead of running a full
+ * handshake.
+ *
+ * Only builds with TF-M keep the session, in PSA Protected Storage, which
+ * TF-M encrypts and authenticates. Other builds have no storage out of reach
+ * of code reading the flash, so they resume sessions only until a reset.
+ */
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbedtls/ssl.h"
+
+#include "tls_transport_config.h"
+
+/**
+ * @brief Set to 1 to offer the session of the previous handshake to the
+ * server on reconnect.
+ */
+#ifndef TLS_SESSION_CACHE_ENABLED
+    #define TLS_SESSION_CACHE_ENABLED    1
+#endif /* TLS_SESSION_CACHE_ENABLED */
+
+/**
+ * @brief Set to 1 to keep the most recent session across resets. Requires
+ * PSA Protected Storage, so only available with MBEDTLS_TRANSPORT_PSA.
+ */
+#ifndef TLS_SESSION_CACHE_PERSIST
+    #ifdef MBEDTLS_TRANSPORT_PSA
+        #define TLS_SESSION_CACHE_PERSIST    TLS_SESSION_CACHE_ENABLED
+    #else
+        #define TLS_SESSION_CACHE_PERSIST    0
+    #endif
+#endif /* TLS_SESSION_CACHE_PERSIST */
+
+#if ( TLS_SESSION_CACHE_PERSIST != 0 ) && !defined( MBEDTLS_TRANSPORT_PSA )
+    #error "TLS_SESSION_CACHE_PERSIST requires MBEDTLS_TRANSPORT_PSA."
+#endif
+
+/**
+ * @brief Largest serialized session stored. With
+ * MBEDTLS_SSL_KEEP_PEER_CERTIFICATE the session holds the server certificate.
+ */
+#ifndef TLS_SESSION_CACHE_MAX_LEN
+    #define TLS_SESSION_CACHE_MAX_LEN    2048U
+#endif /* TLS_SESSION_CACHE_MAX_LEN */
+
+#ifndef TLS_SESSION_CACHE_PSA_UID
+    #define TLS_SESSION_CACHE_PSA_UID    0x1000000000000301ULL
+#endif /* TLS_SESSION_CACHE_PSA_UID */
+
+/**
+ * @brief Read the stored session of a host.
+ *
+ * @param[in] pcHostName Null terminated host name.
+ * @param[in] usPort Server port.
+ * @param[out] pxSession Initialized session, filled in on success.
+ *
+ * @return true if a session was stored for this host and port.
+ */
+bool TlsSessionCache_Load( const char * pcHostName,
+                           uint16_t usPort,
+                           mbedtls_ssl_session * pxSession );
+
+/**
+ * @brief Store the session of a host, replacing the stored one.
+ */
+void TlsSessionCache_Store( const char * pcHostName,
+                            uint16_t usPort,
+                            const mbedtls_ssl_session * pxSession );
+
+/**
+ * @brief Remove the stored session, for instance after the server refused
+ * to resume it.
+ */
+void TlsSessionCache_Invalidate( void );
+
+#endif /* TLS_SESSION_CACHE_H */
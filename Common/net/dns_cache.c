@@ -0,0 +1,374 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "dns_cache.h"
+#include "tls_transport_config.h"
+#include "lwip/netdb.h"
+
+#if DNS_CACHE_PERSIST
+    #include "kvstore.h"
+#endif
+
+/*-----------------------------------------------------------*/
+
+#define DNS_CACHE_HOST_MAX_LEN           ( 255U )
+
+/* Hash and dotted address, e.g. "1a2b3c4d 192.0.2.1". */
+#define DNS_CACHE_RECORD_MAX_LEN         ( 8U + 1U + IP4ADDR_STRLEN_MAX )
+
+#define DNS_CACHE_REFRESH_STACK_WORDS    ( 512U )
+
+typedef struct DnsCacheEntry
+{
+    uint32_t ulHostHash; /* Zero when the entry is unused. */
+    struct in_addr xAddr;
+    TickType_t xResolvedAt;
+    bool xFromStorage;   /* Loaded from the KVStore, so its age is unknown. */
+} DnsCacheEntry_t;
+
+static DnsCacheEntry_t pxCacheEntries[ DNS_CACHE_ENTRIES ] = { 0 };
+
+static TaskHandle_t xRefreshTaskHandle = NULL;
+static char pcRefreshHostName[ DNS_CACHE_HOST_MAX_LEN + 1 ] = { 0 };
+
+#if DNS_CACHE_PERSIST
+    static bool xStorageLoaded = false;
+#endif
+
+/*-----------------------------------------------------------*/
+
+/* 32 bit FNV-1a. Zero is reserved for unused entries. */
+static uint32_t prvHashHostName( const char * pcHostName )
+{
+    uint32_t ulHash = 2166136261UL;
+
+    for( size_t uxIdx = 0; ( uxIdx < DNS_CACHE_HOST_MAX_LEN ) && ( pcHostName[ uxIdx ] != '\0' ); uxIdx++ )
+    {
+        ulHash ^= ( uint8_t ) pcHostName[ uxIdx ];
+        ulHash *= 16777619UL;
+    }
+
+    return( ( ulHash == 0 ) ? 1 : ulHash );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Must be called from a critical section. */
+static DnsCacheEntry_t * prvFindEntry( uint32_t ulHostHash )
+{
+    DnsCacheEntry_t * pxEntry = NULL;
+
+    for( size_t uxIdx = 0; ( uxIdx < DNS_CACHE_ENTRIES ) && ( pxEntry == NULL ); uxIdx++ )
+    {
+        if( pxCacheEntries[ uxIdx ].ulHostHash == ulHostHash )
+        {
+            pxEntry = &( pxCacheEntries[ uxIdx ] );
+        }
+    }
+
+    return pxEntry;
+}
+
+/*-----------------------------------------------------------*/
+
+#if DNS_CACHE_PERSIST
+
+    static void prvLoadFromStorage( void )
+    {
+        char pcRecord[ DNS_CACHE_RECORD_MAX_LEN + 1 ] = { 0 };
+        char * pcEnd = NULL;
+        uint32_t ulHostHash = 0;
+        struct in_addr xAddr = { 0 };
+
+        xStorageLoaded = true;
+
+        if( KVStore_getString( CS_DNS_CACHE, pcRecord, sizeof( pcRecord ) ) > 0 )
+        {
+            ulHostHash = ( uint32_t ) strtoul( pcRecord, &pcEnd, 16 );
+
+            if( ( ulHostHash != 0 ) &&
+                ( *pcEnd == ' ' ) &&
+                ( inet_aton( pcEnd + 1, &xAddr ) != 0 ) )
+            {
+                taskENTER_CRITICAL();
+                {
+                    pxCacheEntries[ 0 ].ulHostHash = ulHostHash;
+                    pxCacheEntries[ 0 ].xAddr = xAddr;
+                    pxCacheEntries[ 0 ].xResolvedAt = xTaskGetTickCount();
+                    pxCacheEntries[ 0 ].xFromStorage = true;
+                }
+                taskEXIT_CRITICAL();
+            }
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvSaveToStorage( uint32_t ulHostHash,
+                                  const struct in_addr * pxAddr )
+    {
+        char pcAddr[ IP4ADDR_STRLEN_MAX ] = { 0 };
+        char pcRecord[ DNS_CACHE_RECORD_MAX_LEN + 1 ] = { 0 };
+
+        ( void ) inet_ntoa_r( *pxAddr, pcAddr, sizeof( pcAddr ) );
+        ( void ) snprintf( pcRecord, sizeof( pcRecord ), "%08lx %s", ( unsigned long ) ulHostHash, pcAddr );
+
+        if( ( KVStore_setString( CS_DNS_CACHE, pcRecord ) != pdTRUE ) ||
+            ( KVStore_xCommitChanges() != pdTRUE ) )
+        {
+            LogWarn( "Failed to save the cached address %s.", pcAddr );
+        }
+    }
+
+#endif /* DNS_CACHE_PERSIST */
+
+/*-----------------------------------------------------------*/
+
+static bool prvResolve( const char * pcHostName,
+                        struct in_addr * pxAddr )
+{
+    const struct addrinfo xAddrInfoHint =
+    {
+        .ai_family   = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP,
+    };
+    struct addrinfo * pxAddrInfo = NULL;
+    bool xResolved = false;
+
+    if( ( dns_getaddrinfo( pcHostName, NULL, &xAddrInfoHint, &pxAddrInfo ) == 0 ) &&
+        ( pxAddrInfo != NULL ) &&
+        ( pxAddrInfo->ai_family == AF_INET ) )
+    {
+        *pxAddr = ( ( struct sockaddr_in * ) pxAddrInfo->ai_addr )->sin_addr;
+        xResolved = true;
+    }
+
+    if( pxAddrInfo != NULL )
+    {
+        dns_freeaddrinfo( pxAddrInfo );
+    }
+
+    return xResolved;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRefreshTask( void * pvParameters )
+{
+    char pcHostName[ DNS_CACHE_HOST_MAX_LEN + 1 ];
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        struct in_addr xAddr = { 0 };
+        TickType_t xStartTime = 0;
+
+        ( void ) ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+
+        taskENTER_CRITICAL();
+        {
+            ( void ) memcpy( pcHostName, pcRefreshHostName, sizeof( pcHostName ) );
+        }
+        taskEXIT_CRITICAL();
+
+        xStartTime = xTaskGetTickCount();
+
+        if( prvResolve( pcHostName, &xAddr ) )
+        {
+            LogDebug( "Refreshed address of %s in %lu ms.", pcHostName,
+                      ( unsigned long ) ( ( xTaskGetTickCount() - xStartTime ) * portTICK_PERIOD_MS ) );
+
+            DnsCache_Store( pcHostName, &xAddr );
+        }
+        else
+        {
+            /* Keep the stale address, it may still be reachable. */
+            LogWarn( "Failed to refresh the address of %s.", pcHostName );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool DnsCache_Lookup( const char * pcHostName,
+                      struct in_addr * pxAddr,
+                      bool * pxIsStale )
+{
+    uint32_t ulHostHash = 0;
+    bool xFound = false;
+
+    configASSERT( pcHostName != NULL );
+    configASSERT( pxAddr != NULL );
+    configASSERT( pxIsStale != NULL );
+
+    #if DNS_CACHE_PERSIST
+        if( !xStorageLoaded )
+        {
+            prvLoadFromStorage();
+        }
+    #endif
+
+    ulHostHash = prvHashHostName( pcHostName );
+
+    taskENTER_CRITICAL();
+    {
+        const DnsCacheEntry_t * pxEntry = prvFindEntry( ulHostHash );
+
+        if( pxEntry != NULL )
+        {
+            *pxAddr = pxEntry->xAddr;
+            *pxIsStale = pxEntry->xFromStorage ||
+                         ( ( xTaskGetTickCount() - pxEntry->xResolvedAt ) >= pdMS_TO_TICKS( DNS_CACHE_TTL_S * 1000U ) );
+            xFound = true;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return xFound;
+}
+
+/*-----------------------------------------------------------*/
+
+void DnsCache_Store( const char * pcHostName,
+                     const struct in_addr * pxAddr )
+{
+    uint32_t ulHostHash = 0;
+    bool xChanged = false;
+
+    configASSERT( pcHostName != NULL );
+    configASSERT( pxAddr != NULL );
+
+    ulHostHash = prvHashHostName( pcHostName );
+
+    taskENTER_CRITICAL();
+    {
+        DnsCacheEntry_t * pxEntry = prvFindEntry( ulHostHash );
+
+        if( pxEntry == NULL )
+        {
+            /* Reuse an unused entry, or the one resolved longest ago. */
+            pxEntry = &( pxCacheEntries[ 0 ] );
+
+            for( size_t uxIdx = 1; uxIdx < DNS_CACHE_ENTRIES; uxIdx++ )
+            {
+                if( ( pxEntry->ulHostHash != 0 ) &&
+                    ( ( pxCacheEntries[ uxIdx ].ulHostHash == 0 ) ||
+                      ( ( xTaskGetTickCount() - pxCacheEntries[ uxIdx ].xResolvedAt ) >
+                        ( xTaskGetTickCount() - pxEntry->xResolvedAt ) ) ) )
+                {
+                    pxEntry = &( pxCacheEntries[ uxIdx ] );
+                }
+            }
+
+            xChanged = true;
+        }
+        else
+        {
+            xChanged = ( pxEntry->xAddr.s_addr != pxAddr->s_addr );
+        }
+
+        pxEntry->ulHostHash = ulHostHash;
+        pxEntry->xAddr = *pxAddr;
+        pxEntry->xResolvedAt = xTaskGetTickCount();
+        pxEntry->xFromStorage = false;
+    }
+    taskEXIT_CRITICAL();
+
+    #if DNS_CACHE_PERSIST
+        /* Only write to flash when the address actually changes. */
+        if( xChanged )
+        {
+            prvSaveToStorage( ulHostHash, pxAddr );
+        }
+    #else
+        ( void ) xChanged;
+    #endif
+}
+
+/*-----------------------------------------------------------*/
+
+void DnsCache_Invalidate( const char * pcHostName )
+{
+    uint32_t ulHostHash = 0;
+
+    configASSERT( pcHostName != NULL );
+
+    ulHostHash = prvHashHostName( pcHostName );
+
+    taskENTER_CRITICAL();
+    {
+        DnsCacheEntry_t * pxEntry = prvFindEntry( ulHostHash );
+
+        if( pxEntry != NULL )
+        {
+            memset( pxEntry, 0, sizeof( DnsCacheEntry_t ) );
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+void DnsCache_RefreshAsync( const char * pcHostName )
+{
+    configASSERT( pcHostName != NULL );
+
+    if( xRefreshTaskHandle == NULL )
+    {
+        if( xTaskCreate( prvRefreshTask, "DnsRefresh", DNS_CACHE_REFRESH_STACK_WORDS,
+                         NULL, tskIDLE_PRIORITY + 1, &xRefreshTaskHandle ) != pdPASS )
+        {
+            LogError( "Failed to create the DNS refresh task." );
+            xRefreshTaskHandle = NULL;
+        }
+    }
+
+    if( xRefreshTaskHandle != NULL )
+    {
+        taskENTER_CRITICAL();
+        {
+            ( void ) strncpy( pcRefreshHostName, pcHostName, DNS_CACHE_HOST_MAX_LEN );
+        }
+        taskEXIT_CRITICAL();
+
+        ( void ) xTaskNotifyGive( xRefreshTaskHandle );
+    }
+}
@@ -123,8 +123,9 @@
 /**
  * MEMP_NUM_NETCONN: the number of struct netconns.
  * (only needed if you use the sequential API, like api_lib.c)
+ * One is held by the wake-up socket of the socket multiplexer.
  */
-#define MEMP_NUM_NETCONN           32
+#define MEMP_NUM_NETCONN           33
 
 /*
  * ----------------------------------
@@ -33,6 +33,9 @@
 #define MBEDTLS_ALLOW_PRIVATE_ACCESS
 
 #include "mbedtls_transport.h"
+#include "dns_cache.h"
+#include "tls_session_cache.h"
+#include "sock_mux.h"
 #include <string.h>
 
 /* FreeRTOS includes. */
@@ -48,6 +51,7 @@
 #include "mbedtls/pem.h"
 #include "mbedtls/platform.h"
 #include "mbedtls/ssl.h"
+#include "mbedtls/ecp.h"
 #include "mbedtls/asn1.h"
 #include "mbedtls/oid.h"
 #include "pk_wrap.h"
@@ -61,16 +65,6 @@
     #include "core_pkcs11.h"
 #endif
 
-typedef struct
-{
-    TaskHandle_t xTaskHandle;
-    void * pvRecvReadyCallbackCtx;
-    GenericCallback_t pxRecvReadyCallback;
-    StackType_t puxStackBuffer[ 128 ];
-    StaticTask_t xTaskBuffer;
-    SockHandle_t xSockHandle;
-} NotifyThreadCtx_t;
-
 /**
  * @brief Secured connection context.
  */
@@ -79,7 +73,10 @@ typedef struct TLSContext
     ConnectionState_t xConnectionState;
     SockHandle_t xSockHandle;
 
-    NotifyThreadCtx_t * pxNotifyThreadCtx;
+    /* Receive ready notification through the socket multiplexer. */
+    GenericCallback_t pxRecvReadyCallback;
+    void * pvRecvReadyCallbackCtx;
+    SockMuxHandle_t xSockMuxHandle;
 
     /* TLS connection */
     mbedtls_ssl_config xSslConfig;
@@ -102,6 +99,38 @@ typedef struct TLSContext
     #ifdef TRANSPORT_USE_CTR_DRBG
         mbedtls_ctr_drbg_context xCtrDrbgCtx;
     #endif /* TRANSPORT_USE_CTR_DRBG */
+
+    /* Session of the last handshake, offered on the next connect. */
+    mbedtls_ssl_session xSession;
+    bool xSessionValid;
+    uint16_t usSessionPort;
+
+    /* State of the connection attempt between connect_start and the end
+     * of the handshake. */
+    TickType_t xConnectStartTime;
+    TickType_t xHandshakeStartTime;
+    uint32_t ulHandshakeCpuTime; /* In portGET_RUN_TIME_COUNTER_VALUE counts. */
+    int lHandshakeState;         /* Last return value of mbedtls_ssl_handshake. */
+    uint16_t usPort;
+    bool xDnsCacheHit;
+    bool xSessionOffered;
+
+    /* mbedtls_transport_sendv gathers packets of up to
+     * MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE bytes in ucSendvBuffer, which
+     * mbedtls_ssl_write then encrypts into its own output record. Larger
+     * packets are written vector by vector. uxSendvPending is the length of a
+     * gathered packet that mbedtls is still flushing, xSendPending is set
+     * while a record written from the caller's buffers is. */
+    uint8_t ucSendvBuffer[ MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE ];
+    size_t uxSendvPending;
+    bool xSendPending;
+
+    /* Bytes passed through the bio callbacks, reset before each handshake. */
+    size_t uxBytesSent;
+    size_t uxBytesReceived;
+
+    TlsHandshakeStats_t xFullHandshakeStats;
+    TlsHandshakeStats_t xResumedHandshakeStats;
 } TLSContext_t;
 
 
@@ -115,14 +144,9 @@ static TlsTransportStatus_t xConfigureCAChain( TLSContext_t * pxTLSCtx,
                                                const PkiObject_t * pxRootCaCerts,
                                                const size_t uxNumRootCA );
 
-static inline void vStopSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx );
+static void vStartSocketEvents( TLSContext_t * pxTLSCtx );
 
-static void vCreateSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx,
-                                     SockHandle_t xSockHandle );
-static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx );
-
-
-static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx );
+static void vStopSocketEvents( TLSContext_t * pxTLSCtx );
 
 #ifdef MBEDTLS_DEBUG_C
 /* Used to print mbedTLS log output. */
@@ -135,60 +159,18 @@ static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx );
 
 /*-----------------------------------------------------------*/
 
-static void vSocketNotifyThread( void * pvParameters )
+static void vSockMuxCallback( void * pvCtx,
+                              uint32_t ulEvents )
 {
-    NotifyThreadCtx_t * pxCtx = ( NotifyThreadCtx_t * ) pvParameters;
-    SockHandle_t xSockHandle = pxCtx->xSockHandle;
-    BaseType_t xExitFlag = pdFALSE;
-    fd_set xReadSet;
-    fd_set xErrorSet;
-    int lRslt;
-    uint32_t ulNotifyValue = 0;
-
-    ( void ) xTaskNotifyStateClear( NULL );
-
-    if( pxCtx->pxRecvReadyCallback == NULL )
-    {
-        xExitFlag = pdTRUE;
-    }
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pvCtx;
 
-    while( !xExitFlag )
+    /* The reader does not poll, so wake it for errors too. The next read
+     * reports them. */
+    if( ( ulEvents & ( SOCK_MUX_EVT_READ | SOCK_MUX_EVT_ERROR ) ) &&
+        ( pxTLSCtx->pxRecvReadyCallback != NULL ) )
     {
-        FD_ZERO( &xReadSet );
-        FD_ZERO( &xErrorSet );
-        FD_SET( xSockHandle, &xReadSet );
-        FD_SET( xSockHandle, &xErrorSet );
-
-        lRslt = sock_select( xSockHandle + 1, &xReadSet, NULL, &xErrorSet, NULL );
-
-        xExitFlag |= ( lRslt == 0 );
-
-        if( ( lRslt == 0 ) ||
-            FD_ISSET( xSockHandle, &xErrorSet ) )
-        {
-            xExitFlag = pdTRUE;
-        }
-        else
-        {
-            if( FD_ISSET( xSockHandle, &xReadSet ) &&
-                pxCtx->pxRecvReadyCallback )
-            {
-                pxCtx->pxRecvReadyCallback( pxCtx->pvRecvReadyCallbackCtx );
-            }
-        }
-
-        if( xTaskNotifyWait( 0x0, 0xFFFFFFFF, &ulNotifyValue, portMAX_DELAY ) )
-        {
-            if( ulNotifyValue == 0xFFFFFFFF )
-            {
-                xExitFlag = pdTRUE;
-            }
-        }
+        pxTLSCtx->pxRecvReadyCallback( pxTLSCtx->pvRecvReadyCallbackCtx );
     }
-
-    /* Delete thread error */
-    pxCtx->xTaskHandle = NULL;
-    vTaskDelete( NULL );
 }
 
 /*-----------------------------------------------------------*/
@@ -341,18 +323,53 @@ static void vLogCertInfo( mbedtls_x509_crt * pxCert,
 }
 
 /*-----------------------------------------------------------*/
-/*TODO add proper timeout */
+
+/* Wait until the socket is readable, or writable if xWrite is set, or has
+ * an error. Returns the result of select(), 0 on timeout. */
+static int32_t lSocketWait( TLSContext_t * pxTLSCtx,
+                            bool xWrite,
+                            uint32_t ulTimeoutMs )
+{
+    fd_set xSet;
+    fd_set xErrorSet;
+    struct timeval xTimeout =
+    {
+        .tv_sec  = ulTimeoutMs / 1000,
+        .tv_usec = ( ulTimeoutMs % 1000 ) * 1000
+    };
+    int32_t lRslt = -1;
+
+    FD_ZERO( &xSet );
+    FD_ZERO( &xErrorSet );
+    FD_SET( pxTLSCtx->xSockHandle, &xSet );
+    FD_SET( pxTLSCtx->xSockHandle, &xErrorSet );
+
+    if( xWrite )
+    {
+        lRslt = sock_select( pxTLSCtx->xSockHandle + 1, NULL, &xSet, &xErrorSet, &xTimeout );
+    }
+    else
+    {
+        lRslt = sock_select( pxTLSCtx->xSockHandle + 1, &xSet, NULL, &xErrorSet, &xTimeout );
+    }
+
+    return lRslt;
+}
+
+/*-----------------------------------------------------------*/
+
 static int mbedtls_ssl_send( void * pvCtx,
                              const unsigned char * pcBuf,
                              size_t uxLen )
 {
-    SockHandle_t * pxSockHandle = ( SockHandle_t * ) pvCtx;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pvCtx;
     int lError = 0;
     size_t uxBytesSent = 0;
-    uint32_t ulBackofftimeMs = 1;
+    const TickType_t xTimeout = pdMS_TO_TICKS( MBEDTLS_TRANSPORT_SEND_TIMEOUT_MS );
+    TickType_t xStartTime = xTaskGetTickCount();
 
-    if( ( pxSockHandle == NULL ) ||
-        ( *pxSockHandle < 0 ) )
+    if( ( pxTLSCtx == NULL ) ||
+        ( pxTLSCtx->xSockHandle < 0 ) )
     {
         lError = MBEDTLS_ERR_NET_SOCKET_FAILED;
     }
@@ -360,14 +377,15 @@ static int mbedtls_ssl_send( void * pvCtx,
     {
         while( uxBytesSent < uxLen && lError == 0 )
         {
-            ssize_t xRslt = sock_send( *pxSockHandle,
-                                       ( void * const ) pcBuf,
-                                       uxLen,
+            ssize_t xRslt = sock_send( pxTLSCtx->xSockHandle,
+                                       ( void * const ) &( pcBuf[ uxBytesSent ] ),
+                                       uxLen - uxBytesSent,
                                        0 );
 
             if( xRslt > 0 )
             {
                 uxBytesSent += ( size_t ) xRslt;
+                pxTLSCtx->uxBytesSent += ( size_t ) xRslt;
             }
             else
             {
@@ -385,6 +403,7 @@ static int mbedtls_ssl_send( void * pvCtx,
                     #endif
                     case EINTR:
                     case EWOULDBLOCK:
+                        lError = MBEDTLS_ERR_SSL_WANT_WRITE;
                         break;
 
                     case EPIPE:
@@ -397,17 +416,35 @@ static int mbedtls_ssl_send( void * pvCtx,
                         break;
                 }
 
-                if( lError == EWOULDBLOCK )
+                /* Sleep until lwIP reports space in the send buffer, or for
+                 * MBEDTLS_TRANSPORT_SEND_POLL_MS. The handshake must not
+                 * block, see mbedtls_transport_connect_step. */
+                if( ( lError == MBEDTLS_ERR_SSL_WANT_WRITE ) &&
+                    ( pxTLSCtx->xConnectionState == STATE_CONNECTED ) )
                 {
-                    vTaskDelay( ulBackofftimeMs );
-                    ulBackofftimeMs = ulBackofftimeMs * 2;
-                    lError = 0;
+                    TickType_t xElapsed = xTaskGetTickCount() - xStartTime;
+
+                    if( xElapsed < xTimeout )
+                    {
+                        uint32_t ulWaitMs = ( uint32_t ) ( ( xTimeout - xElapsed ) * portTICK_PERIOD_MS );
+
+                        if( ulWaitMs > MBEDTLS_TRANSPORT_SEND_POLL_MS )
+                        {
+                            ulWaitMs = MBEDTLS_TRANSPORT_SEND_POLL_MS;
+                        }
+
+                        if( lSocketWait( pxTLSCtx, true, ulWaitMs ) >= 0 )
+                        {
+                            lError = 0;
+                        }
+                    }
                 }
             }
         }
     }
 
-    return ( int ) lError < 0 ? lError : uxBytesSent;
+    /* A partial write is reported first, the error again on the next call. */
+    return ( uxBytesSent > 0 ) ? ( int ) uxBytesSent : lError;
 }
 
 /*-----------------------------------------------------------*/
@@ -416,19 +453,23 @@ static int mbedtls_ssl_recv( void * pvCtx,
                              unsigned char * pcBuf,
                              size_t xLen )
 {
-    SockHandle_t * pxSockHandle = ( SockHandle_t * ) pvCtx;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pvCtx;
     int lError = -1;
 
-    if( ( pxSockHandle != NULL ) &&
-        ( *pxSockHandle >= 0 ) )
+    if( ( pxTLSCtx != NULL ) &&
+        ( pxTLSCtx->xSockHandle >= 0 ) )
     {
-        lError = sock_recv( *pxSockHandle,
+        lError = sock_recv( pxTLSCtx->xSockHandle,
                             ( void * ) pcBuf,
                             xLen,
                             0 );
     }
 
-    if( lError < 0 )
+    if( lError > 0 )
+    {
+        pxTLSCtx->uxBytesReceived += ( size_t ) lError;
+    }
+    else if( lError < 0 )
     {
         lError = *__errno();
 
@@ -480,6 +521,7 @@ NetworkContext_t * mbedtls_transport_allocate( void )
         mbedtls_x509_crt_init( &( pxTLSCtx->xClientCert ) );
         mbedtls_x509_crt_init( &( pxTLSCtx->xRootCaChain ) );
         mbedtls_pk_init( &( pxTLSCtx->xPkCtx ) );
+        mbedtls_ssl_session_init( &( pxTLSCtx->xSession ) );
 
         #ifdef MBEDTLS_TRANSPORT_PKCS11
             pxTLSCtx->xP11SessionHandle = CK_INVALID_HANDLE;
@@ -507,7 +549,7 @@ void mbedtls_transport_free( NetworkContext_t * pxNetworkContext )
 
     if( pxNetworkContext != NULL )
     {
-        vFreeNotifyThreadCtx( pxTLSCtx->pxNotifyThreadCtx );
+        vStopSocketEvents( pxTLSCtx );
 
         if( pxTLSCtx->xSockHandle >= 0 )
         {
@@ -519,6 +561,7 @@ void mbedtls_transport_free( NetworkContext_t * pxNetworkContext )
         mbedtls_x509_crt_free( &( pxTLSCtx->xRootCaChain ) );
         mbedtls_x509_crt_free( &( pxTLSCtx->xClientCert ) );
         mbedtls_pk_free( &( pxTLSCtx->xPkCtx ) );
+        mbedtls_ssl_session_free( &( pxTLSCtx->xSession ) );
 
         #ifdef MBEDTLS_TRANSPORT_PKCS11
             if( pxTLSCtx->xP11SessionHandle != CK_INVALID_HANDLE )
@@ -977,6 +1020,13 @@ TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkCo
         mbedtls_ssl_conf_cert_profile( pxSslConfig, &mbedtls_x509_crt_profile_default );
 
         mbedtls_ssl_conf_authmode( pxSslConfig, MBEDTLS_SSL_VERIFY_REQUIRED );
+
+        #if defined( MBEDTLS_ECP_RESTARTABLE )
+            /* Split ECC operations of the handshake into bounded steps. This
+             * limit is global, but only affects callers of the restartable
+             * functions. */
+            mbedtls_ecp_set_max_ops( MBEDTLS_TRANSPORT_ECP_MAX_OPS );
+        #endif /* MBEDTLS_ECP_RESTARTABLE */
     }
 
     /* Configure certificate auth if a cert and key were provided */
@@ -1056,7 +1106,7 @@ TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkCo
         else
         {
             /* Setup mbedtls IO callbacks */
-            mbedtls_ssl_set_bio( pxSslCtx, &( pxTLSCtx->xSockHandle ),
+            mbedtls_ssl_set_bio( pxSslCtx, pxTLSCtx,
                                  mbedtls_ssl_send, mbedtls_ssl_recv, NULL );
 
             pxTLSCtx->xConnectionState = STATE_CONFIGURED;
@@ -1066,9 +1116,73 @@ TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkCo
     return xStatus;
 }
 
+#if LWIP_IPV4 == 1
+
+/* Connect to the cached address of pcHostName, if there is one. */
+    static TlsTransportStatus_t xConnectCachedAddress( TLSContext_t * pxTLSCtx,
+                                                       const char * pcHostName,
+                                                       uint16_t usPort,
+                                                       bool * pxCacheHit )
+    {
+        TlsTransportStatus_t xStatus = TLS_TRANSPORT_SUCCESS;
+        struct sockaddr_in xSockAddr = { 0 };
+        bool xIsStale = false;
+
+        if( DnsCache_Lookup( pcHostName, &( xSockAddr.sin_addr ), &xIsStale ) )
+        {
+            char ipAddrBuff[ IP4ADDR_STRLEN_MAX ] = { 0 };
+
+            xSockAddr.sin_len = sizeof( xSockAddr );
+            xSockAddr.sin_family = AF_INET;
+            xSockAddr.sin_port = htons( usPort );
+
+            ( void ) inet_ntoa_r( xSockAddr.sin_addr, ipAddrBuff, IP4ADDR_STRLEN_MAX );
+
+            pxTLSCtx->xSockHandle = sock_socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+
+            if( pxTLSCtx->xSockHandle < 0 )
+            {
+                LogError( "Failed to allocate socket." );
+                xStatus = TLS_TRANSPORT_INSUFFICIENT_SOCKETS;
+            }
+            else if( sock_connect( pxTLSCtx->xSockHandle,
+                                   ( struct sockaddr * ) &xSockAddr,
+                                   sizeof( xSockAddr ) ) != 0 )
+            {
+                LogWarn( "Cached address: %.*s for host: %s is unreachable, resolving it again.",
+                         IP4ADDR_STRLEN_MAX, ipAddrBuff, pcHostName );
+
+                ( void ) sock_close( pxTLSCtx->xSockHandle );
+                pxTLSCtx->xSockHandle = -1;
+
+                DnsCache_Invalidate( pcHostName );
+            }
+            else
+            {
+                LogInfo( "Connected socket: %ld to host: %s, cached address: %.*s, port: %uh.",
+                         pxTLSCtx->xSockHandle, pcHostName,
+                         IP4ADDR_STRLEN_MAX, ipAddrBuff, usPort );
+
+                *pxCacheHit = true;
+
+                if( xIsStale )
+                {
+                    DnsCache_RefreshAsync( pcHostName );
+                }
+            }
+        }
+
+        return xStatus;
+    }
+
+#endif /* LWIP_IPV4 == 1 */
+
+/*-----------------------------------------------------------*/
+
 static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
                                             const char * pcHostName,
-                                            uint16_t usPort )
+                                            uint16_t usPort,
+                                            bool * pxCacheHit )
 {
     TlsTransportStatus_t xStatus = TLS_TRANSPORT_SUCCESS;
     int lError = 0;
@@ -1077,6 +1191,9 @@ static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
     configASSERT( pxTLSCtx != NULL );
     configASSERT( pcHostName != NULL );
     configASSERT( usPort > 0 );
+    configASSERT( pxCacheHit != NULL );
+
+    *pxCacheHit = false;
 
     /* Close socket if already allocated */
     if( pxTLSCtx->xSockHandle >= 0 )
@@ -1085,8 +1202,13 @@ static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
         pxTLSCtx->xSockHandle = -1;
     }
 
+    #if LWIP_IPV4 == 1
+        xStatus = xConnectCachedAddress( pxTLSCtx, pcHostName, usPort, pxCacheHit );
+    #endif
+
     /* Perform address (DNS) lookup */
-    if( xStatus == TLS_TRANSPORT_SUCCESS )
+    if( ( xStatus == TLS_TRANSPORT_SUCCESS ) &&
+        ( *pxCacheHit == false ) )
     {
         const struct addrinfo xAddrInfoHint =
         {
@@ -1111,7 +1233,8 @@ static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
         }
     }
 
-    if( xStatus == TLS_TRANSPORT_SUCCESS )
+    if( ( xStatus == TLS_TRANSPORT_SUCCESS ) &&
+        ( pxAddrInfo != NULL ) )
     {
         struct addrinfo * pxAddrIter = NULL;
 
@@ -1189,6 +1312,8 @@ static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
                             LogInfo( "Connected socket: %ld to host: %s, address: %.*s, port: %uh.",
                                      pxTLSCtx->xSockHandle, pcHostName,
                                      IP4ADDR_STRLEN_MAX, ipAddrBuff, usPort );
+
+                            DnsCache_Store( pcHostName, &( ( ( struct sockaddr_in * ) pxAddrIter->ai_addr )->sin_addr ) );
                         }
                     #endif /* if LWIP_IPV4 == 1 */
                     #if LWIP_IPV6 == 1
@@ -1230,16 +1355,217 @@ static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
 
 /*-----------------------------------------------------------*/
 
-TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
-                                                const char * pcHostName,
-                                                uint16_t usPort,
-                                                uint32_t ulRecvTimeoutMs,
-                                                uint32_t ulSendTimeoutMs )
+static void vDropSession( TLSContext_t * pxTLSCtx )
+{
+    if( pxTLSCtx->xSessionValid )
+    {
+        mbedtls_ssl_session_free( &( pxTLSCtx->xSession ) );
+        mbedtls_ssl_session_init( &( pxTLSCtx->xSession ) );
+        pxTLSCtx->xSessionValid = false;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Offer the session of the last handshake with this server, if any. */
+static bool xOfferSession( TLSContext_t * pxTLSCtx,
+                           const char * pcHostName,
+                           uint16_t usPort )
+{
+    bool xOffered = false;
+
+    #if TLS_SESSION_CACHE_ENABLED
+        int lError = 0;
+
+        if( pxTLSCtx->usSessionPort != usPort )
+        {
+            vDropSession( pxTLSCtx );
+        }
+
+        if( !pxTLSCtx->xSessionValid )
+        {
+            pxTLSCtx->xSessionValid = TlsSessionCache_Load( pcHostName, usPort, &( pxTLSCtx->xSession ) );
+            pxTLSCtx->usSessionPort = usPort;
+        }
+
+        if( pxTLSCtx->xSessionValid )
+        {
+            lError = mbedtls_ssl_set_session( &( pxTLSCtx->xSslCtx ), &( pxTLSCtx->xSession ) );
+
+            if( lError != 0 )
+            {
+                LogWarn( "Failed to offer the previous TLS session: Error: %s : %s.",
+                         mbedtlsHighLevelCodeOrDefault( lError ),
+                         mbedtlsLowLevelCodeOrDefault( lError ) );
+                vDropSession( pxTLSCtx );
+            }
+            else
+            {
+                xOffered = true;
+            }
+        }
+    #else /* if TLS_SESSION_CACHE_ENABLED */
+        ( void ) pxTLSCtx;
+        ( void ) pcHostName;
+        ( void ) usPort;
+    #endif /* if TLS_SESSION_CACHE_ENABLED */
+
+    return xOffered;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Keep the session negotiated by the handshake that just completed.
+ * Returns true if the server resumed the offered session: a resumed
+ * handshake reuses the master secret, a full one derives a new one.
+ */
+static bool xSaveSession( TLSContext_t * pxTLSCtx,
+                          const char * pcHostName,
+                          uint16_t usPort,
+                          bool xOffered )
+{
+    bool xResumed = false;
+
+    #if TLS_SESSION_CACHE_ENABLED
+        mbedtls_ssl_session xSession;
+        bool xChanged = true;
+        int lError = 0;
+
+        mbedtls_ssl_session_init( &xSession );
+
+        lError = mbedtls_ssl_get_session( &( pxTLSCtx->xSslCtx ), &xSession );
+
+        if( lError != 0 )
+        {
+            LogWarn( "Failed to read the negotiated TLS session: Error: %s : %s.",
+                     mbedtlsHighLevelCodeOrDefault( lError ),
+                     mbedtlsLowLevelCodeOrDefault( lError ) );
+            mbedtls_ssl_session_free( &xSession );
+        }
+        else
+        {
+            if( xOffered )
+            {
+                xResumed = ( memcmp( xSession.MBEDTLS_PRIVATE( master ),
+                                     pxTLSCtx->xSession.MBEDTLS_PRIVATE( master ),
+                                     sizeof( xSession.MBEDTLS_PRIVATE( master ) ) ) == 0 );
+            }
+
+            #if defined( MBEDTLS_SSL_SESSION_TICKETS )
+                /* The server may renew the ticket on resumption. */
+                xChanged = ( !xResumed ||
+                             ( xSession.MBEDTLS_PRIVATE( ticket_len ) != pxTLSCtx->xSession.MBEDTLS_PRIVATE( ticket_len ) ) ||
+                             ( ( xSession.MBEDTLS_PRIVATE( ticket_len ) > 0 ) &&
+                               ( memcmp( xSession.MBEDTLS_PRIVATE( ticket ),
+                                         pxTLSCtx->xSession.MBEDTLS_PRIVATE( ticket ),
+                                         xSession.MBEDTLS_PRIVATE( ticket_len ) ) != 0 ) ) );
+            #else
+                xChanged = !xResumed;
+            #endif
+
+            vDropSession( pxTLSCtx );
+            pxTLSCtx->xSession = xSession;
+            pxTLSCtx->xSessionValid = true;
+            pxTLSCtx->usSessionPort = usPort;
+
+            if( xChanged )
+            {
+                TlsSessionCache_Store( pcHostName, usPort, &( pxTLSCtx->xSession ) );
+            }
+        }
+    #else /* if TLS_SESSION_CACHE_ENABLED */
+        ( void ) pxTLSCtx;
+        ( void ) pcHostName;
+        ( void ) usPort;
+        ( void ) xOffered;
+    #endif /* if TLS_SESSION_CACHE_ENABLED */
+
+    return xResumed;
+}
+
+/*-----------------------------------------------------------*/
+
+static void vUpdateHandshakeStats( TlsHandshakeStats_t * pxStats,
+                                   uint32_t ulElapsedMs,
+                                   uint32_t ulCpuUs,
+                                   size_t uxBytesSent,
+                                   size_t uxBytesReceived )
+{
+    pxStats->ulCount++;
+    pxStats->ulTotalMs += ulElapsedMs;
+    pxStats->ulTotalCpuUs += ulCpuUs;
+    pxStats->ulTotalBytesSent += ( uint32_t ) uxBytesSent;
+    pxStats->ulTotalBytesReceived += ( uint32_t ) uxBytesReceived;
+
+    if( ulElapsedMs > pxStats->ulMaxMs )
+    {
+        pxStats->ulMaxMs = ulElapsedMs;
+    }
+
+    if( ulCpuUs > pxStats->ulMaxCpuUs )
+    {
+        pxStats->ulMaxCpuUs = ulCpuUs;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Release the socket of a connection attempt that did not complete. */
+static void vConnectFailed( TLSContext_t * pxTLSCtx,
+                            const char * pcHostName,
+                            uint16_t usPort,
+                            bool xDnsCacheHit,
+                            bool xHandshakeFailed )
+{
+    if( pxTLSCtx->xSockHandle >= 0 )
+    {
+        /* Deallocate the open socket. */
+        sock_close( pxTLSCtx->xSockHandle );
+        pxTLSCtx->xSockHandle = -1;
+    }
+
+    /* Reset SSL session context for reconnect attempt */
+    mbedtls_ssl_session_reset( &( pxTLSCtx->xSslCtx ) );
+
+    /* The cached address may now belong to a different host. */
+    if( xDnsCacheHit )
+    {
+        DnsCache_Invalidate( pcHostName );
+    }
+
+    /* Do not offer a session the server may have rejected again. */
+    if( xHandshakeFailed && pxTLSCtx->xSessionOffered )
+    {
+        vDropSession( pxTLSCtx );
+        TlsSessionCache_Invalidate();
+    }
+
+    pxTLSCtx->xSessionOffered = false;
+
+    if( pxTLSCtx->xConnectionState == STATE_HANDSHAKING )
+    {
+        pxTLSCtx->xConnectionState = STATE_CONFIGURED;
+    }
+
+    LogInfo( "Network connection %p: to %s:%u failed.",
+             pxTLSCtx, pcHostName, usPort );
+}
+
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t mbedtls_transport_connect_start( NetworkContext_t * pxNetworkContext,
+                                                      const char * pcHostName,
+                                                      uint16_t usPort,
+                                                      uint32_t ulRecvTimeoutMs,
+                                                      uint32_t ulSendTimeoutMs )
 {
     TlsTransportStatus_t xStatus = TLS_TRANSPORT_SUCCESS;
     TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
     mbedtls_ssl_context * pxSslCtx = NULL;
     int lError = 0;
+    bool xCacheHit = false;
+    TickType_t xStartTime = xTaskGetTickCount();
 
     configASSERT( pxTLSCtx != NULL );
 
@@ -1264,6 +1590,12 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
         LogError( "Provided usPort parameter must not be 0." );
         xStatus = TLS_TRANSPORT_INVALID_PARAMETER;
     }
+    else if( pxTLSCtx->xConnectionState != STATE_CONFIGURED )
+    {
+        LogError( "Network connection %p: Cannot connect in state %d.",
+                  pxTLSCtx, pxTLSCtx->xConnectionState );
+        xStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
     else
     {
         pxSslCtx = &( pxTLSCtx->xSslCtx );
@@ -1274,6 +1606,9 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
         ( ( pxTLSCtx->xSslCtx.MBEDTLS_PRIVATE( hostname ) == NULL ) ||
           ( strncmp( pxTLSCtx->xSslCtx.MBEDTLS_PRIVATE( hostname ), pcHostName, MBEDTLS_SSL_MAX_HOST_NAME_LEN ) != 0 ) ) )
     {
+        /* A session is only valid with the server that issued it. */
+        vDropSession( pxTLSCtx );
+
         lError = mbedtls_ssl_set_hostname( pxSslCtx, pcHostName );
 
         if( lError != 0 )
@@ -1287,7 +1622,7 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
 
     if( xStatus == TLS_TRANSPORT_SUCCESS )
     {
-        xStatus = xConnectSocket( pxTLSCtx, pcHostName, usPort );
+        xStatus = xConnectSocket( pxTLSCtx, pcHostName, usPort, &xCacheHit );
     }
 
     /* Set send and receive timeout parameters */
@@ -1343,62 +1678,121 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
         }
     }
 
-    /* Perform TLS handshake. */
     if( xStatus == TLS_TRANSPORT_SUCCESS )
     {
-        /* Perform the TLS handshake. */
-        do
-        {
-            lError = mbedtls_ssl_handshake( pxSslCtx );
-        }
-        while( ( lError == MBEDTLS_ERR_SSL_WANT_READ ) ||
-               ( lError == MBEDTLS_ERR_SSL_WANT_WRITE ) );
+        pxTLSCtx->uxSendvPending = 0;
+        pxTLSCtx->xSendPending = false;
+        pxTLSCtx->xConnectStartTime = xStartTime;
+        pxTLSCtx->xHandshakeStartTime = xTaskGetTickCount();
+        pxTLSCtx->ulHandshakeCpuTime = 0;
+        pxTLSCtx->lHandshakeState = 0;
+        pxTLSCtx->usPort = usPort;
+        pxTLSCtx->xDnsCacheHit = xCacheHit;
+        pxTLSCtx->uxBytesSent = 0;
+        pxTLSCtx->uxBytesReceived = 0;
 
-        if( lError != 0 )
-        {
-            LogError( "Failed to perform TLS handshake: Error: %s : %s.",
-                      mbedtlsHighLevelCodeOrDefault( lError ),
-                      mbedtlsLowLevelCodeOrDefault( lError ) );
+        pxTLSCtx->xSessionOffered = xOfferSession( pxTLSCtx, pcHostName, usPort );
 
-            xStatus = TLS_TRANSPORT_HANDSHAKE_FAILED;
-        }
-        else
+        pxTLSCtx->xConnectionState = STATE_HANDSHAKING;
+    }
+    else if( pxSslCtx != NULL )
+    {
+        vConnectFailed( pxTLSCtx, pcHostName, usPort, xCacheHit, false );
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t mbedtls_transport_connect_step( NetworkContext_t * pxNetworkContext )
+{
+    TlsTransportStatus_t xStatus = TLS_TRANSPORT_SUCCESS;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    const char * pcHostName = NULL;
+    uint32_t ulStepStart = 0;
+    int lError = 0;
+
+    configASSERT( pxTLSCtx != NULL );
+
+    if( ( pxTLSCtx == NULL ) ||
+        ( pxTLSCtx->xConnectionState != STATE_HANDSHAKING ) )
+    {
+        xStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        pcHostName = pxTLSCtx->xSslCtx.MBEDTLS_PRIVATE( hostname );
+
+        /* Time spent in the handshake code, not waiting for the peer. */
+        ulStepStart = ( uint32_t ) portGET_RUN_TIME_COUNTER_VALUE();
+
+        lError = mbedtls_ssl_handshake( &( pxTLSCtx->xSslCtx ) );
+
+        pxTLSCtx->ulHandshakeCpuTime += ( uint32_t ) portGET_RUN_TIME_COUNTER_VALUE() - ulStepStart;
+        pxTLSCtx->lHandshakeState = lError;
+
+        switch( lError )
         {
-            LogInfo( "Network connection %p: TLS handshake successful.",
-                     pxTLSCtx );
+            case 0:
+                xStatus = TLS_TRANSPORT_SUCCESS;
+                break;
+
+            case MBEDTLS_ERR_SSL_WANT_READ:
+                xStatus = TLS_TRANSPORT_WANT_READ;
+                break;
+
+            case MBEDTLS_ERR_SSL_WANT_WRITE:
+                xStatus = TLS_TRANSPORT_WANT_WRITE;
+                break;
+
+            case MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS:
+            case MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS:
+                xStatus = TLS_TRANSPORT_IN_PROGRESS;
+                break;
+
+            default:
+                LogError( "Failed to perform TLS handshake: Error: %s : %s.",
+                          mbedtlsHighLevelCodeOrDefault( lError ),
+                          mbedtlsLowLevelCodeOrDefault( lError ) );
+                xStatus = TLS_TRANSPORT_HANDSHAKE_FAILED;
+                break;
         }
     }
 
     if( xStatus == TLS_TRANSPORT_SUCCESS )
     {
-        LogInfo( "Network connection %p: Connection to %s:%u established.",
-                 pxNetworkContext, pcHostName, usPort );
+        uint32_t ulElapsedMs = ( uint32_t ) ( ( xTaskGetTickCount() - pxTLSCtx->xHandshakeStartTime ) * portTICK_PERIOD_MS );
+        uint32_t ulCpuUs = ( uint32_t ) ( ( ( uint64_t ) pxTLSCtx->ulHandshakeCpuTime * 1000000ULL ) / MBEDTLS_TRANSPORT_RUN_TIME_COUNTER_HZ );
+        bool xResumed = xSaveSession( pxTLSCtx, pcHostName, pxTLSCtx->usPort, pxTLSCtx->xSessionOffered );
 
-        if( ( xStatus == TLS_TRANSPORT_SUCCESS ) &&
-            pxTLSCtx->pxNotifyThreadCtx )
-        {
-            vCreateSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx, pxTLSCtx->xSockHandle );
-        }
+        vUpdateHandshakeStats( xResumed ? &( pxTLSCtx->xResumedHandshakeStats ) : &( pxTLSCtx->xFullHandshakeStats ),
+                               ulElapsedMs, ulCpuUs, pxTLSCtx->uxBytesSent, pxTLSCtx->uxBytesReceived );
+
+        LogInfo( "Network connection %p: TLS handshake successful (%s) in %lu ms, %lu us CPU, %lu bytes sent, %lu bytes received.",
+                 pxTLSCtx, xResumed ? "resumed" : "full",
+                 ( unsigned long ) ulElapsedMs,
+                 ( unsigned long ) ulCpuUs,
+                 ( unsigned long ) pxTLSCtx->uxBytesSent,
+                 ( unsigned long ) pxTLSCtx->uxBytesReceived );
+
+        LogInfo( "Network connection %p: Connection to %s:%u established in %lu ms (%s address).",
+                 pxNetworkContext, pcHostName, pxTLSCtx->usPort,
+                 ( unsigned long ) ( ( xTaskGetTickCount() - pxTLSCtx->xConnectStartTime ) * portTICK_PERIOD_MS ),
+                 pxTLSCtx->xDnsCacheHit ? "cached" : "resolved" );
 
+        pxTLSCtx->xSessionOffered = false;
         pxTLSCtx->xConnectionState = STATE_CONNECTED;
+
+        vStartSocketEvents( pxTLSCtx );
+    }
+    else if( xStatus == TLS_TRANSPORT_HANDSHAKE_FAILED )
+    {
+        vConnectFailed( pxTLSCtx, pcHostName, pxTLSCtx->usPort, pxTLSCtx->xDnsCacheHit, true );
     }
     else
     {
-        /* Clean up on failure. */
-        if( ( pxNetworkContext != NULL ) &&
-            ( pxTLSCtx->xSockHandle >= 0 ) )
-        {
-            /* Deallocate the open socket. */
-            sock_close( pxTLSCtx->xSockHandle );
-            pxTLSCtx->xSockHandle = -1;
-        }
-
-        /* Reset SSL session context for reconnect attempt */
-        mbedtls_ssl_session_reset( pxSslCtx );
-
-        LogInfo( "Network connection %p: to %s:%u failed.",
-                 pxNetworkContext,
-                 pcHostName, usPort );
+        /* Empty */
     }
 
     return xStatus;
@@ -1406,54 +1800,106 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
 
 /*-----------------------------------------------------------*/
 
-static inline void vStopSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx )
+int32_t mbedtls_transport_connect_wait( NetworkContext_t * pxNetworkContext,
+                                        uint32_t ulTimeoutMs )
 {
-    configASSERT( pxNotifyThreadCtx );
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    int32_t lRslt = -1;
 
-    while( ( pxNotifyThreadCtx->xTaskHandle != NULL ) &&
-           ( eTaskGetState( pxNotifyThreadCtx->xTaskHandle ) != eDeleted ) )
+    configASSERT( pxTLSCtx != NULL );
+
+    if( ( pxTLSCtx != NULL ) &&
+        ( pxTLSCtx->xConnectionState == STATE_HANDSHAKING ) &&
+        ( pxTLSCtx->xSockHandle >= 0 ) )
     {
-        ( void ) xTaskNotify( pxNotifyThreadCtx->xTaskHandle, 0xFFFFFFFF, eSetValueWithOverwrite );
-        vTaskDelay( 1 );
+        lRslt = lSocketWait( pxTLSCtx,
+                             ( pxTLSCtx->lHandshakeState == MBEDTLS_ERR_SSL_WANT_WRITE ),
+                             ulTimeoutMs );
     }
+
+    return lRslt;
 }
 
 /*-----------------------------------------------------------*/
 
-static void vCreateSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx,
-                                     SockHandle_t xSockHandle )
+TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
+                                                const char * pcHostName,
+                                                uint16_t usPort,
+                                                uint32_t ulRecvTimeoutMs,
+                                                uint32_t ulSendTimeoutMs )
 {
-    TaskHandle_t xTaskHandle = NULL;
-
-    configASSERT_CONTINUE( pxNotifyThreadCtx );
+    TlsTransportStatus_t xStatus = TLS_TRANSPORT_SUCCESS;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    const TickType_t xTimeout = pdMS_TO_TICKS( MBEDTLS_TRANSPORT_HANDSHAKE_TIMEOUT_MS );
+    TickType_t xStartTime = xTaskGetTickCount();
 
-    vStopSocketNotifyTask( pxNotifyThreadCtx );
+    xStatus = mbedtls_transport_connect_start( pxNetworkContext, pcHostName, usPort,
+                                               ulRecvTimeoutMs, ulSendTimeoutMs );
 
-    if( pxNotifyThreadCtx &&
-        pxNotifyThreadCtx->pxRecvReadyCallback )
+    if( xStatus == TLS_TRANSPORT_SUCCESS )
     {
-        pxNotifyThreadCtx->xSockHandle = xSockHandle;
+        do
+        {
+            TickType_t xElapsed = 0;
+
+            xStatus = mbedtls_transport_connect_step( pxNetworkContext );
 
-        xTaskHandle = xTaskCreateStatic( vSocketNotifyThread,
-                                         "SockNotify",
-                                         128,
-                                         ( void * ) pxNotifyThreadCtx,
-                                         tskIDLE_PRIORITY,
-                                         pxNotifyThreadCtx->puxStackBuffer,
-                                         &( pxNotifyThreadCtx->xTaskBuffer ) );
+            xElapsed = xTaskGetTickCount() - xStartTime;
 
-        pxNotifyThreadCtx->xTaskHandle = xTaskHandle;
+            if( xStatus <= TLS_TRANSPORT_SUCCESS )
+            {
+                /* Connected or failed. */
+            }
+            else if( xElapsed >= xTimeout )
+            {
+                LogError( "Network connection %p: TLS handshake timed out after %lu ms.",
+                          pxNetworkContext, ( unsigned long ) ( xElapsed * portTICK_PERIOD_MS ) );
+                vConnectFailed( pxTLSCtx, pcHostName, usPort, pxTLSCtx->xDnsCacheHit, false );
+                xStatus = TLS_TRANSPORT_HANDSHAKE_FAILED;
+            }
+            else if( xStatus == TLS_TRANSPORT_IN_PROGRESS )
+            {
+                /* Let other tasks of the same priority run between ECC steps. */
+                taskYIELD();
+            }
+            else
+            {
+                /* Sleep until the peer answers rather than spinning. */
+                ( void ) mbedtls_transport_connect_wait( pxNetworkContext,
+                                                         ( uint32_t ) ( ( xTimeout - xElapsed ) * portTICK_PERIOD_MS ) );
+            }
+        }
+        while( xStatus > TLS_TRANSPORT_SUCCESS );
     }
+
+    return xStatus;
 }
+
 /*-----------------------------------------------------------*/
 
-static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx )
+static void vStartSocketEvents( TLSContext_t * pxTLSCtx )
 {
-    if( pxNotifyThreadCtx )
+    if( ( pxTLSCtx->pxRecvReadyCallback != NULL ) &&
+        ( pxTLSCtx->xSockMuxHandle == NULL ) &&
+        ( pxTLSCtx->xSockHandle >= 0 ) )
     {
-        vStopSocketNotifyTask( pxNotifyThreadCtx );
+        pxTLSCtx->xSockMuxHandle = SockMux_Register( pxTLSCtx->xSockHandle, vSockMuxCallback, pxTLSCtx );
 
-        vPortFree( pxNotifyThreadCtx );
+        if( pxTLSCtx->xSockMuxHandle != NULL )
+        {
+            SockMux_Arm( pxTLSCtx->xSockMuxHandle, SOCK_MUX_EVT_READ );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void vStopSocketEvents( TLSContext_t * pxTLSCtx )
+{
+    if( pxTLSCtx->xSockMuxHandle != NULL )
+    {
+        SockMux_Unregister( pxTLSCtx->xSockMuxHandle );
+        pxTLSCtx->xSockMuxHandle = NULL;
     }
 }
 
@@ -1464,7 +1910,6 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
                                            void * pvCtx )
 {
     TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
-    NotifyThreadCtx_t * pxNotifyThreadCtx = NULL;
     int32_t lError = 0;
 
     if( ( pxTLSCtx == NULL ) ||
@@ -1474,44 +1919,15 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
     }
     else
     {
-        pxNotifyThreadCtx = pxTLSCtx->pxNotifyThreadCtx;
-    }
+        /* The callback must not change while the multiplexer may call it. */
+        vStopSocketEvents( pxTLSCtx );
 
-    if( pxNotifyThreadCtx == NULL )
-    {
-        pxNotifyThreadCtx = pvPortMalloc( sizeof( NotifyThreadCtx_t ) );
-
-        if( pxNotifyThreadCtx == NULL )
-        {
-            LogError( "Failed to allocate memory for a NotifyThreadCtx_t." );
-            lError = -1;
-        }
-        else
-        {
-            pxTLSCtx->pxNotifyThreadCtx = pxNotifyThreadCtx;
-            pxNotifyThreadCtx->xSockHandle = -1;
-            pxNotifyThreadCtx->xTaskHandle = 0;
-        }
-    }
-    /* Connected and pxNotifyThreadCtx already exists */
-    else if( ( pxTLSCtx->xConnectionState == STATE_CONNECTED ) &&
-             pxNotifyThreadCtx->xTaskHandle )
-    {
-        vStopSocketNotifyTask( pxNotifyThreadCtx );
-    }
-    else
-    {
-        /* Empty */
-    }
-
-    if( lError == 0 )
-    {
-        pxNotifyThreadCtx->pxRecvReadyCallback = pxCallback;
-        pxNotifyThreadCtx->pvRecvReadyCallbackCtx = pvCtx;
+        pxTLSCtx->pxRecvReadyCallback = pxCallback;
+        pxTLSCtx->pvRecvReadyCallbackCtx = pvCtx;
 
         if( pxTLSCtx->xConnectionState == STATE_CONNECTED )
         {
-            vCreateSocketNotifyTask( pxNotifyThreadCtx, pxTLSCtx->xSockHandle );
+            vStartSocketEvents( pxTLSCtx );
         }
     }
 
@@ -1579,12 +1995,19 @@ void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext )
 
             pxTLSCtx->xConnectionState = STATE_CONFIGURED;
         }
-
-        if( pxTLSCtx->pxNotifyThreadCtx )
+        else if( pxTLSCtx->xConnectionState == STATE_HANDSHAKING )
+        {
+            /* Abandon the connection attempt. */
+            pxTLSCtx->xSessionOffered = false;
+            pxTLSCtx->xConnectionState = STATE_CONFIGURED;
+        }
+        else
         {
-            vStopSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx );
+            /* Empty */
         }
 
+        vStopSocketEvents( pxTLSCtx );
+
         if( pxTLSCtx->xSockHandle >= 0 )
         {
             /* Call socket close function to deallocate the socket. */
@@ -1602,6 +2025,30 @@ void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext )
 
 /*-----------------------------------------------------------*/
 
+void mbedtls_transport_gethandshakestats( NetworkContext_t * pxNetworkContext,
+                                          TlsHandshakeStats_t * pxFullStats,
+                                          TlsHandshakeStats_t * pxResumedStats )
+{
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+
+    configASSERT( pxNetworkContext != NULL );
+
+    if( pxNetworkContext != NULL )
+    {
+        if( pxFullStats != NULL )
+        {
+            *pxFullStats = pxTLSCtx->xFullHandshakeStats;
+        }
+
+        if( pxResumedStats != NULL )
+        {
+            *pxResumedStats = pxTLSCtx->xResumedHandshakeStats;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
 int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
                                 void * pBuffer,
                                 size_t uxBytesToRecv )
@@ -1644,6 +2091,12 @@ int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
             /* Mark these set of errors as a timeout. The libraries may retry read
              * on these errors. */
             tlsStatus = 0;
+
+            /* Nothing left to read, so report the next data. */
+            if( pxTLSCtx->xSockMuxHandle != NULL )
+            {
+                SockMux_Arm( pxTLSCtx->xSockMuxHandle, SOCK_MUX_EVT_READ );
+            }
         }
         /* Close the Socket if needed. */
         else if( ( tlsStatus == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ) ||
@@ -1654,10 +2107,7 @@ int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
 
             if( pxTLSCtx->xSockHandle >= 0 )
             {
-                if( pxTLSCtx->pxNotifyThreadCtx )
-                {
-                    vStopSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx );
-                }
+                vStopSocketEvents( pxTLSCtx );
 
                 sock_close( pxTLSCtx->xSockHandle );
                 pxTLSCtx->xSockHandle = -1;
@@ -1671,16 +2121,81 @@ int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
         }
         else
         {
-            if( pxTLSCtx->pxNotifyThreadCtx &&
-                pxTLSCtx->pxNotifyThreadCtx->xTaskHandle )
-            {
-                ( void ) xTaskNotify( pxTLSCtx->pxNotifyThreadCtx->xTaskHandle, 0x0, eSetValueWithOverwrite );
-            }
+            /* Empty else marker. */
         }
     }
 
     return tlsStatus;
 }
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_recv_wait( NetworkContext_t * pxNetworkContext,
+                                     uint32_t ulTimeoutMs )
+{
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    int32_t lRslt = -1;
+
+    if( ( pxTLSCtx != NULL ) &&
+        ( pxTLSCtx->xConnectionState == STATE_CONNECTED ) &&
+        ( pxTLSCtx->xSockHandle >= 0 ) )
+    {
+        if( mbedtls_ssl_check_pending( &( pxTLSCtx->xSslCtx ) ) != 0 )
+        {
+            lRslt = 1;
+        }
+        else
+        {
+            lRslt = lSocketWait( pxTLSCtx, false, ulTimeoutMs );
+        }
+    }
+
+    return lRslt;
+}
+/*-----------------------------------------------------------*/
+
+/* Convert the result of mbedtls_ssl_write to that of mbedtls_transport_send,
+ * closing the socket if the connection is gone. */
+static int32_t lWriteResult( TLSContext_t * pxTLSCtx,
+                             int32_t tlsStatus )
+{
+    if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        /* Mark these set of errors as a timeout. The libraries may retry send
+         * on these errors. */
+        tlsStatus = 0;
+    }
+    /* Close the Socket if needed. */
+    else if( ( tlsStatus == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ) ||
+             ( tlsStatus == MBEDTLS_ERR_NET_CONN_RESET ) )
+    {
+        tlsStatus = -1;
+        pxTLSCtx->xConnectionState = STATE_CONFIGURED;
+
+        if( pxTLSCtx->xSockHandle >= 0 )
+        {
+            vStopSocketEvents( pxTLSCtx );
+
+            sock_close( pxTLSCtx->xSockHandle );
+            pxTLSCtx->xSockHandle = -1;
+        }
+    }
+    else if( tlsStatus < 0 )
+    {
+        LogError( "Failed to send data:  Error: %s : %s.",
+                  mbedtlsHighLevelCodeOrDefault( tlsStatus ),
+                  mbedtlsLowLevelCodeOrDefault( tlsStatus ) );
+    }
+    else
+    {
+        /* Empty else marker. */
+    }
+
+    return tlsStatus;
+}
+
 /*-----------------------------------------------------------*/
 
 int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
@@ -1712,49 +2227,207 @@ int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
             tlsStatus = ( int32_t ) mbedtls_ssl_write( &( pxTLSCtx->xSslCtx ),
                                                        pBuffer,
                                                        uxBytesToSend );
+
+            /* Any record left pending is now this call's. */
+            pxTLSCtx->uxSendvPending = 0;
+            pxTLSCtx->xSendPending = ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) ||
+                                     ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+                                     ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT );
         }
         else
         {
             tlsStatus = 0;
         }
 
-        if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
-            ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
-            ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+        tlsStatus = lWriteResult( pxTLSCtx, tlsStatus );
+    }
+
+    return tlsStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Copy up to uxMaxLength bytes from the vectors, starting at *puxVector and
+ * *puxOffset, to pucDest and move past them. Only moves if pucDest is NULL. */
+static size_t uxGatherVectors( const TransportOutVector_t * pxVectors,
+                               size_t uxVectorCount,
+                               size_t * puxVector,
+                               size_t * puxOffset,
+                               uint8_t * pucDest,
+                               size_t uxMaxLength )
+{
+    size_t uxLength = 0;
+
+    while( ( *puxVector < uxVectorCount ) &&
+           ( uxLength < uxMaxLength ) )
+    {
+        const TransportOutVector_t * pxVector = &( pxVectors[ *puxVector ] );
+        size_t uxChunk = pxVector->iov_len - *puxOffset;
+
+        if( uxChunk > ( uxMaxLength - uxLength ) )
         {
-            /* Mark these set of errors as a timeout. The libraries may retry send
-             * on these errors. */
-            tlsStatus = 0;
+            uxChunk = uxMaxLength - uxLength;
         }
-        /* Close the Socket if needed. */
-        else if( ( tlsStatus == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ) ||
-                 ( tlsStatus == MBEDTLS_ERR_NET_CONN_RESET ) )
+
+        if( ( pucDest != NULL ) && ( uxChunk > 0 ) )
         {
-            tlsStatus = -1;
-            pxTLSCtx->xConnectionState = STATE_CONFIGURED;
+            ( void ) memcpy( &( pucDest[ uxLength ] ),
+                             &( ( ( const uint8_t * ) pxVector->iov_base )[ *puxOffset ] ),
+                             uxChunk );
+        }
 
-            if( pxTLSCtx->xSockHandle >= 0 )
+        uxLength += uxChunk;
+        *puxOffset += uxChunk;
+
+        if( *puxOffset >= pxVector->iov_len )
+        {
+            ( *puxVector )++;
+            *puxOffset = 0;
+        }
+    }
+
+    return uxLength;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_sendv( NetworkContext_t * pxNetworkContext,
+                                 TransportOutVector_t * pxVectors,
+                                 size_t uxVectorCount )
+{
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    int32_t tlsStatus = 0;
+    size_t uxBytesSent = 0;
+
+    if( ( pxTLSCtx == NULL ) ||
+        ( pxVectors == NULL ) ||
+        ( uxVectorCount == 0 ) )
+    {
+        LogWarn( ( "mbedtls_transport_sendv: Invalid parameter" ) );
+        tlsStatus = -1;
+    }
+    else if( pxTLSCtx->xConnectionState == STATE_CONNECTED )
+    {
+        mbedtls_ssl_context * pxSslCtx = &( pxTLSCtx->xSslCtx );
+        int lMaxPayload = mbedtls_ssl_get_max_out_record_payload( pxSslCtx );
+        size_t uxGatherLimit = sizeof( pxTLSCtx->ucSendvBuffer );
+        size_t uxTotalLength = 0;
+        size_t uxVector = 0;
+        size_t uxOffset = 0;
+
+        for( uxVector = 0; uxVector < uxVectorCount; uxVector++ )
+        {
+            uxTotalLength += pxVectors[ uxVector ].iov_len;
+        }
+
+        if( ( lMaxPayload > 0 ) && ( ( size_t ) lMaxPayload < uxGatherLimit ) )
+        {
+            uxGatherLimit = ( size_t ) lMaxPayload;
+        }
+
+        uxVector = 0;
+
+        if( lMaxPayload <= 0 )
+        {
+            tlsStatus = ( lMaxPayload < 0 ) ? lMaxPayload : MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+        }
+        else if( uxTotalLength <= uxGatherLimit )
+        {
+            /* A small packet fits one record, gather it so the header, topic
+             * and payload of a publish do not take a record each. */
+            if( pxTLSCtx->xSendPending )
             {
-                if( pxTLSCtx->pxNotifyThreadCtx )
+                /* mbedtls still holds a record of other data. */
+                LogError( "mbedtls_transport_sendv: A send is pending." );
+                tlsStatus = MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+            }
+            else if( uxTotalLength > 0 )
+            {
+                /* After a return of 0 the caller repeats the same data, which
+                 * mbedtls has already encrypted, so the write only flushes it. */
+                ( void ) uxGatherVectors( pxVectors, uxVectorCount, &uxVector, &uxOffset,
+                                          pxTLSCtx->ucSendvBuffer, uxTotalLength );
+
+                tlsStatus = ( int32_t ) mbedtls_ssl_write( pxSslCtx, pxTLSCtx->ucSendvBuffer, uxTotalLength );
+
+                if( tlsStatus > 0 )
                 {
-                    vStopSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx );
+                    uxBytesSent = ( size_t ) tlsStatus;
                 }
 
-                sock_close( pxTLSCtx->xSockHandle );
-                pxTLSCtx->xSockHandle = -1;
+                pxTLSCtx->uxSendvPending = ( ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) ||
+                                             ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+                                             ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ) ? uxTotalLength : 0U;
+            }
+            else
+            {
+                /* Empty else marker. */
             }
         }
-        else if( tlsStatus < 0 )
+        else if( pxTLSCtx->uxSendvPending > 0 )
         {
-            LogError( "Failed to send data:  Error: %s : %s.",
-                      mbedtlsHighLevelCodeOrDefault( tlsStatus ),
-                      mbedtlsLowLevelCodeOrDefault( tlsStatus ) );
+            /* mbedtls still holds a gathered record of other data. */
+            LogError( "mbedtls_transport_sendv: A send is pending." );
+            tlsStatus = MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
         }
         else
         {
-            /* Empty else marker. */
+            /* A large packet is written straight from its vectors, one
+             * mbedtls_ssl_write per vector and record. A retry after a return
+             * of 0 starts at the same byte and so repeats the pending write. */
+            bool xDone = false;
+
+            while( !xDone && ( uxVector < uxVectorCount ) )
+            {
+                const TransportOutVector_t * pxVector = &( pxVectors[ uxVector ] );
+
+                if( uxOffset >= pxVector->iov_len )
+                {
+                    uxVector++;
+                    uxOffset = 0;
+                }
+                else
+                {
+                    tlsStatus = ( int32_t ) mbedtls_ssl_write( pxSslCtx,
+                                                               &( ( ( const uint8_t * ) pxVector->iov_base )[ uxOffset ] ),
+                                                               pxVector->iov_len - uxOffset );
+
+                    pxTLSCtx->xSendPending = ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) ||
+                                             ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+                                             ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT );
+
+                    if( tlsStatus > 0 )
+                    {
+                        uxBytesSent += ( size_t ) tlsStatus;
+                        uxOffset += ( size_t ) tlsStatus;
+                    }
+                    else
+                    {
+                        xDone = true;
+                    }
+                }
+            }
         }
     }
+    else
+    {
+        tlsStatus = 0;
+    }
+
+    /* As in mbedtls_ssl_send, an error after a partial write is reported by
+     * the next call. */
+    if( uxBytesSent > 0 )
+    {
+        tlsStatus = ( int32_t ) uxBytesSent;
+    }
+    else if( tlsStatus < 0 )
+    {
+        tlsStatus = ( pxTLSCtx != NULL ) ? lWriteResult( pxTLSCtx, tlsStatus ) : tlsStatus;
+    }
+    else
+    {
+        tlsStatus = 0;
+    }
 
     return tlsStatus;
 }
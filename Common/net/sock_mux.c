@@ -0,0 +1,441 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+#include "errno.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "sock_mux.h"
+#include "lwip/sockets.h"
+
+/*
+ * The task waits in select() on the armed sockets and on a UDP socket
+ * connected to itself over the loopback interface. Sending a byte to that
+ * socket makes the task leave select() and rebuild its sets when a socket is
+ * armed or unregistered while it waits.
+ */
+
+typedef struct SockMuxEntry
+{
+    SockHandle_t xSockHandle;  /* -1 when the entry is free. */
+    SockMuxCallback_t pxCallback;
+    void * pvCallbackCtx;
+    uint32_t ulArmed;          /* Events to watch for. */
+    uint32_t ulSelected;       /* Events watched by the select() in progress. */
+} SockMuxEntry_t;
+
+#if ( configCOUNT_CONTEXT_SWITCHES == 1 )
+    /* Incremented by traceTASK_SWITCHED_IN, see FreeRTOSConfig.h. */
+    volatile uint32_t ulContextSwitchCount = 0;
+#else
+    static const uint32_t ulContextSwitchCount = 0;
+#endif
+
+static SockMuxEntry_t pxEntries[ SOCK_MUX_MAX_SOCKETS ];
+static SemaphoreHandle_t xMuxMutex = NULL;
+static StaticSemaphore_t xMuxMutexBuffer;
+static TaskHandle_t xMuxTaskHandle = NULL;
+static SockHandle_t xWakeSock = -1;
+
+/* Both only change with xMuxMutex held. */
+static volatile bool xInSelect = false;
+static volatile uint32_t ulSelectCount = 0;
+
+static SockMuxStats_t xStats = { 0 };
+static uint32_t ulContextSwitchBase = 0;
+
+/*-----------------------------------------------------------*/
+
+static void prvWake( void )
+{
+    uint8_t ucByte = 0;
+
+    xStats.ulWakeSignals++;
+    ( void ) sock_send( xWakeSock, &ucByte, sizeof( ucByte ), 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDrainWakeSock( void )
+{
+    uint8_t pucBuffer[ 8 ];
+
+    while( sock_recv( xWakeSock, pucBuffer, sizeof( pucBuffer ), MSG_DONTWAIT ) > 0 )
+    {
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvCreateWakeSock( void )
+{
+    struct sockaddr_in xAddr;
+    socklen_t xAddrLen = sizeof( xAddr );
+    SockHandle_t xSock = -1;
+    bool xSuccess = false;
+
+    memset( &xAddr, 0, sizeof( xAddr ) );
+    xAddr.sin_family = AF_INET;
+    xAddr.sin_port = 0;
+    xAddr.sin_addr.s_addr = PP_HTONL( INADDR_LOOPBACK );
+
+    xSock = sock_socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+    if( ( xSock >= 0 ) &&
+        ( sock_bind( xSock, ( struct sockaddr * ) &xAddr, sizeof( xAddr ) ) == 0 ) &&
+        ( sock_getsockname( xSock, ( struct sockaddr * ) &xAddr, &xAddrLen ) == 0 ) &&
+        ( sock_connect( xSock, ( struct sockaddr * ) &xAddr, xAddrLen ) == 0 ) )
+    {
+        xWakeSock = xSock;
+        xSuccess = true;
+    }
+    else
+    {
+        LogError( "Failed to create the socket multiplexer wake-up socket." );
+
+        if( xSock >= 0 )
+        {
+            ( void ) sock_close( xSock );
+        }
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSockMuxTask( void * pvParameters )
+{
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        fd_set xReadSet;
+        fd_set xWriteSet;
+        fd_set xErrorSet;
+        SockHandle_t xMaxSock = xWakeSock;
+        int lRslt = 0;
+
+        FD_ZERO( &xReadSet );
+        FD_ZERO( &xWriteSet );
+        FD_ZERO( &xErrorSet );
+        FD_SET( xWakeSock, &xReadSet );
+
+        ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+
+        for( size_t uxIdx = 0; uxIdx < SOCK_MUX_MAX_SOCKETS; uxIdx++ )
+        {
+            SockMuxEntry_t * pxEntry = &( pxEntries[ uxIdx ] );
+
+            pxEntry->ulSelected = 0;
+
+            if( ( pxEntry->xSockHandle >= 0 ) &&
+                ( pxEntry->ulArmed != 0 ) )
+            {
+                if( pxEntry->ulArmed & SOCK_MUX_EVT_READ )
+                {
+                    FD_SET( pxEntry->xSockHandle, &xReadSet );
+                }
+
+                if( pxEntry->ulArmed & SOCK_MUX_EVT_WRITE )
+                {
+                    FD_SET( pxEntry->xSockHandle, &xWriteSet );
+                }
+
+                FD_SET( pxEntry->xSockHandle, &xErrorSet );
+
+                pxEntry->ulSelected = pxEntry->ulArmed | SOCK_MUX_EVT_ERROR;
+
+                if( pxEntry->xSockHandle > xMaxSock )
+                {
+                    xMaxSock = pxEntry->xSockHandle;
+                }
+            }
+        }
+
+        xInSelect = true;
+
+        ( void ) xSemaphoreGive( xMuxMutex );
+
+        lRslt = sock_select( xMaxSock + 1, &xReadSet, &xWriteSet, &xErrorSet, NULL );
+
+        ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+
+        xInSelect = false;
+        ulSelectCount++;
+        xStats.ulSelectReturns++;
+
+        if( lRslt < 0 )
+        {
+            /* A socket was closed without being unregistered first. */
+            LogError( "select() failed: %d.", *__errno() );
+        }
+        else
+        {
+            if( FD_ISSET( xWakeSock, &xReadSet ) )
+            {
+                prvDrainWakeSock();
+            }
+
+            /* Entries unregistered during the select() have ulSelected 0. */
+            for( size_t uxIdx = 0; ( lRslt > 0 ) && ( uxIdx < SOCK_MUX_MAX_SOCKETS ); uxIdx++ )
+            {
+                SockMuxEntry_t * pxEntry = &( pxEntries[ uxIdx ] );
+                uint32_t ulEvents = 0;
+
+                if( pxEntry->ulSelected != 0 )
+                {
+                    if( FD_ISSET( pxEntry->xSockHandle, &xReadSet ) )
+                    {
+                        ulEvents |= SOCK_MUX_EVT_READ;
+                        xStats.ulReadEvents++;
+                    }
+
+                    if( FD_ISSET( pxEntry->xSockHandle, &xWriteSet ) )
+                    {
+                        ulEvents |= SOCK_MUX_EVT_WRITE;
+                        xStats.ulWriteEvents++;
+                    }
+
+                    if( FD_ISSET( pxEntry->xSockHandle, &xErrorSet ) )
+                    {
+                        ulEvents |= SOCK_MUX_EVT_ERROR;
+                        xStats.ulErrorEvents++;
+                    }
+                }
+
+                if( ulEvents & SOCK_MUX_EVT_ERROR )
+                {
+                    /* Not watched again until re-armed. */
+                    pxEntry->ulArmed = 0;
+                }
+                else
+                {
+                    pxEntry->ulArmed &= ~ulEvents;
+                }
+
+                if( ulEvents != 0 )
+                {
+                    pxEntry->pxCallback( pxEntry->pvCallbackCtx, ulEvents );
+                }
+            }
+        }
+
+        ( void ) xSemaphoreGive( xMuxMutex );
+
+        if( lRslt < 0 )
+        {
+            vTaskDelay( 1 );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvInit( void )
+{
+    bool xSuccess = true;
+
+    vTaskSuspendAll();
+
+    if( xMuxMutex == NULL )
+    {
+        for( size_t uxIdx = 0; uxIdx < SOCK_MUX_MAX_SOCKETS; uxIdx++ )
+        {
+            pxEntries[ uxIdx ].xSockHandle = -1;
+        }
+
+        xMuxMutex = xSemaphoreCreateMutexStatic( &xMuxMutexBuffer );
+    }
+
+    ( void ) xTaskResumeAll();
+
+    ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+
+    if( xMuxTaskHandle == NULL )
+    {
+        xSuccess = ( xWakeSock >= 0 ) || prvCreateWakeSock();
+
+        if( xSuccess &&
+            ( xTaskCreate( prvSockMuxTask, "SockMux", SOCK_MUX_TASK_STACK_WORDS,
+                           NULL, SOCK_MUX_TASK_PRIORITY, &xMuxTaskHandle ) != pdPASS ) )
+        {
+            LogError( "Failed to create the socket multiplexer task." );
+            xSuccess = false;
+        }
+    }
+
+    ( void ) xSemaphoreGive( xMuxMutex );
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+SockMuxHandle_t SockMux_Register( SockHandle_t xSockHandle,
+                                  SockMuxCallback_t pxCallback,
+                                  void * pvCallbackCtx )
+{
+    SockMuxEntry_t * pxEntry = NULL;
+
+    if( ( xSockHandle >= 0 ) &&
+        ( pxCallback != NULL ) &&
+        prvInit() )
+    {
+        ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+
+        for( size_t uxIdx = 0; ( pxEntry == NULL ) && ( uxIdx < SOCK_MUX_MAX_SOCKETS ); uxIdx++ )
+        {
+            if( pxEntries[ uxIdx ].xSockHandle < 0 )
+            {
+                pxEntry = &( pxEntries[ uxIdx ] );
+                pxEntry->xSockHandle = xSockHandle;
+                pxEntry->pxCallback = pxCallback;
+                pxEntry->pvCallbackCtx = pvCallbackCtx;
+                pxEntry->ulArmed = 0;
+                pxEntry->ulSelected = 0;
+                xStats.ulSockets++;
+            }
+        }
+
+        ( void ) xSemaphoreGive( xMuxMutex );
+
+        if( pxEntry == NULL )
+        {
+            LogError( "No free socket multiplexer entry, increase SOCK_MUX_MAX_SOCKETS." );
+        }
+    }
+
+    return pxEntry;
+}
+
+/*-----------------------------------------------------------*/
+
+void SockMux_Arm( SockMuxHandle_t xHandle,
+                  uint32_t ulEvents )
+{
+    SockMuxEntry_t * pxEntry = ( SockMuxEntry_t * ) xHandle;
+
+    configASSERT( pxEntry != NULL );
+
+    if( pxEntry != NULL )
+    {
+        ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+
+        pxEntry->ulArmed |= ulEvents;
+
+        /* Otherwise the task picks up the change before its next select(). */
+        if( xInSelect &&
+            ( ( pxEntry->ulSelected & ulEvents ) != ulEvents ) )
+        {
+            prvWake();
+        }
+
+        ( void ) xSemaphoreGive( xMuxMutex );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void SockMux_Unregister( SockMuxHandle_t xHandle )
+{
+    SockMuxEntry_t * pxEntry = ( SockMuxEntry_t * ) xHandle;
+    bool xWasSelected = false;
+    uint32_t ulSelectCountAtStart = 0;
+
+    if( pxEntry != NULL )
+    {
+        ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+
+        xWasSelected = xInSelect && ( pxEntry->ulSelected != 0 );
+        ulSelectCountAtStart = ulSelectCount;
+
+        pxEntry->xSockHandle = -1;
+        pxEntry->pxCallback = NULL;
+        pxEntry->pvCallbackCtx = NULL;
+        pxEntry->ulArmed = 0;
+        pxEntry->ulSelected = 0;
+        xStats.ulSockets--;
+
+        if( xWasSelected )
+        {
+            prvWake();
+        }
+
+        ( void ) xSemaphoreGive( xMuxMutex );
+
+        /* lwIP select() fails if a socket in its sets is closed, so wait for
+         * the task to leave it. */
+        while( xWasSelected &&
+               xInSelect &&
+               ( ulSelectCount == ulSelectCountAtStart ) )
+        {
+            vTaskDelay( 1 );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void SockMux_GetStats( SockMuxStats_t * pxStats )
+{
+    if( pxStats != NULL )
+    {
+        *pxStats = xStats;
+        pxStats->ulContextSwitches = ulContextSwitchCount - ulContextSwitchBase;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void SockMux_ResetStats( void )
+{
+    uint32_t ulSockets = 0;
+
+    if( xMuxMutex != NULL )
+    {
+        ( void ) xSemaphoreTake( xMuxMutex, portMAX_DELAY );
+    }
+
+    ulSockets = xStats.ulSockets;
+    memset( &xStats, 0, sizeof( xStats ) );
+    xStats.ulSockets = ulSockets;
+    ulContextSwitchBase = ulContextSwitchCount;
+
+    if( xMuxMutex != NULL )
+    {
+        ( void ) xSemaphoreGive( xMuxMutex );
+    }
+}
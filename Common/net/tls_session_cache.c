@@ -0,0 +1,240 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_INFO
+#include "logging.h"
+
+#include "tls_session_cache.h"
+
+#if TLS_SESSION_CACHE_PERSIST
+
+/* Standard includes. */
+    #include <string.h>
+
+/* mbedTLS includes. */
+    #include "mbedtls/platform.h"
+    #include "mbedtls/platform_util.h"
+
+    #include "psa/protected_storage.h"
+
+/*-----------------------------------------------------------*/
+
+    #define TLS_SESSION_RECORD_MAGIC    ( 0x544C5331UL ) /* "TLS1" */
+
+    typedef struct TlsSessionRecordHeader
+    {
+        uint32_t ulMagic;
+        uint32_t ulHostHash; /* Hash of the host name and port. */
+        uint32_t ulLength;   /* Bytes of serialized session following the header. */
+    } TlsSessionRecordHeader_t;
+
+/*-----------------------------------------------------------*/
+
+/* 32 bit FNV-1a of the host name followed by the port. */
+    static uint32_t prvHashHost( const char * pcHostName,
+                                 uint16_t usPort )
+    {
+        uint32_t ulHash = 2166136261UL;
+
+        for( size_t uxIdx = 0; ( uxIdx < MBEDTLS_SSL_MAX_HOST_NAME_LEN ) && ( pcHostName[ uxIdx ] != '\0' ); uxIdx++ )
+        {
+            ulHash ^= ( uint8_t ) pcHostName[ uxIdx ];
+            ulHash *= 16777619UL;
+        }
+
+        ulHash ^= ( uint8_t ) ( usPort >> 8 );
+        ulHash *= 16777619UL;
+        ulHash ^= ( uint8_t ) usPort;
+        ulHash *= 16777619UL;
+
+        return ulHash;
+    }
+
+/*-----------------------------------------------------------*/
+
+/* Read the stored record into a heap buffer holding the header and the session. */
+    static uint8_t * prvReadRecord( size_t * puxLength )
+    {
+        uint8_t * pucRecord = NULL;
+        size_t uxLength = 0;
+        struct psa_storage_info_t xInfo = { 0 };
+
+        if( ( psa_ps_get_info( TLS_SESSION_CACHE_PSA_UID, &xInfo ) == PSA_SUCCESS ) &&
+            ( xInfo.size > sizeof( TlsSessionRecordHeader_t ) ) &&
+            ( xInfo.size <= sizeof( TlsSessionRecordHeader_t ) + TLS_SESSION_CACHE_MAX_LEN ) )
+        {
+            pucRecord = mbedtls_calloc( 1, xInfo.size );
+
+            if( ( pucRecord != NULL ) &&
+                ( psa_ps_get( TLS_SESSION_CACHE_PSA_UID, 0, xInfo.size, pucRecord, &uxLength ) != PSA_SUCCESS ) )
+            {
+                mbedtls_free( pucRecord );
+                pucRecord = NULL;
+            }
+        }
+
+        *puxLength = uxLength;
+
+        return pucRecord;
+    }
+
+#endif /* TLS_SESSION_CACHE_PERSIST */
+
+/*-----------------------------------------------------------*/
+
+bool TlsSessionCache_Load( const char * pcHostName,
+                           uint16_t usPort,
+                           mbedtls_ssl_session * pxSession )
+{
+    bool xLoaded = false;
+
+    #if TLS_SESSION_CACHE_PERSIST
+        uint8_t * pucRecord = NULL;
+        size_t uxLength = 0;
+
+        if( ( pcHostName != NULL ) &&
+            ( pxSession != NULL ) )
+        {
+            pucRecord = prvReadRecord( &uxLength );
+        }
+
+        if( pucRecord != NULL )
+        {
+            TlsSessionRecordHeader_t * pxHeader = ( TlsSessionRecordHeader_t * ) pucRecord;
+            uint8_t * pucSession = &( pucRecord[ sizeof( TlsSessionRecordHeader_t ) ] );
+            int lError = 0;
+
+            if( ( pxHeader->ulMagic != TLS_SESSION_RECORD_MAGIC ) ||
+                ( pxHeader->ulLength != uxLength - sizeof( TlsSessionRecordHeader_t ) ) )
+            {
+                LogWarn( "Discarding a malformed stored TLS session." );
+                lError = -1;
+            }
+            else if( pxHeader->ulHostHash != prvHashHost( pcHostName, usPort ) )
+            {
+                /* Stored for another server. */
+                lError = -1;
+            }
+            else
+            {
+                /* Empty else marker. */
+            }
+
+            if( lError == 0 )
+            {
+                lError = mbedtls_ssl_session_load( pxSession, pucSession, pxHeader->ulLength );
+
+                if( lError != 0 )
+                {
+                    /* For instance saved by a build with another mbedTLS configuration. */
+                    LogWarn( "Failed to load the stored TLS session: %d.", lError );
+                }
+            }
+
+            xLoaded = ( lError == 0 );
+
+            mbedtls_platform_zeroize( pucRecord, uxLength );
+            mbedtls_free( pucRecord );
+        }
+    #else /* if TLS_SESSION_CACHE_PERSIST */
+        ( void ) pcHostName;
+        ( void ) usPort;
+        ( void ) pxSession;
+    #endif /* if TLS_SESSION_CACHE_PERSIST */
+
+    return xLoaded;
+}
+
+/*-----------------------------------------------------------*/
+
+void TlsSessionCache_Store( const char * pcHostName,
+                            uint16_t usPort,
+                            const mbedtls_ssl_session * pxSession )
+{
+    #if TLS_SESSION_CACHE_PERSIST
+        uint8_t * pucRecord = NULL;
+        size_t uxSessionLength = 0;
+        int lError = 0;
+
+        if( ( pcHostName == NULL ) ||
+            ( pxSession == NULL ) )
+        {
+            lError = -1;
+        }
+        else
+        {
+            /* Get the serialized length. */
+            lError = mbedtls_ssl_session_save( pxSession, NULL, 0, &uxSessionLength );
+
+            if( ( lError == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL ) &&
+                ( uxSessionLength > 0 ) &&
+                ( uxSessionLength <= TLS_SESSION_CACHE_MAX_LEN ) )
+            {
+                pucRecord = mbedtls_calloc( 1, sizeof( TlsSessionRecordHeader_t ) + uxSessionLength );
+            }
+            else
+            {
+                LogWarn( "Not storing a TLS session of %lu bytes.", ( unsigned long ) uxSessionLength );
+            }
+        }
+
+        if( pucRecord != NULL )
+        {
+            TlsSessionRecordHeader_t * pxHeader = ( TlsSessionRecordHeader_t * ) pucRecord;
+            uint8_t * pucSession = &( pucRecord[ sizeof( TlsSessionRecordHeader_t ) ] );
+
+            pxHeader->ulMagic = TLS_SESSION_RECORD_MAGIC;
+            pxHeader->ulHostHash = prvHashHost( pcHostName, usPort );
+            pxHeader->ulLength = ( uint32_t ) uxSessionLength;
+
+            lError = mbedtls_ssl_session_save( pxSession, pucSession, uxSessionLength, &uxSessionLength );
+
+            if( ( lError != 0 ) ||
+                ( psa_ps_set( TLS_SESSION_CACHE_PSA_UID, sizeof( TlsSessionRecordHeader_t ) + uxSessionLength,
+                              pucRecord, PSA_STORAGE_FLAG_NONE ) != PSA_SUCCESS ) )
+            {
+                LogWarn( "Failed to store the TLS session." );
+            }
+
+            mbedtls_platform_zeroize( pucRecord, sizeof( TlsSessionRecordHeader_t ) + uxSessionLength );
+            mbedtls_free( pucRecord );
+        }
+    #else /* if TLS_SESSION_CACHE_PERSIST */
+        ( void ) pcHostName;
+        ( void ) usPort;
+        ( void ) pxSession;
+    #endif /* if TLS_SESSION_CACHE_PERSIST */
+}
+
+/*-----------------------------------------------------------*/
+
+void TlsSessionCache_Invalidate( void )
+{
+    #if TLS_SESSION_CACHE_PERSIST
+        ( void ) psa_ps_remove( TLS_SESSION_CACHE_PSA_UID );
+    #endif /* TLS_SESSION_CACHE_PERSIST */
+}
@@ -49,6 +49,8 @@
 #include "ota_pal.h"
 
 #include "iotconnect_app.h"
+#include "mqtt_journal.h"
+#include "mqtt_agent_metrics.h"
 
 /* Definition for Qualification Test */
 #if ( DEVICE_ADVISOR_TEST_ENABLED == 1 ) || ( MQTT_TEST_ENABLED == 1 ) || ( TRANSPORT_INTERFACE_TEST_ENABLED == 1 ) || \
@@ -191,6 +193,7 @@ extern void net_main( void * pvParameters );
 extern void vMQTTAgentTask( void * );
 extern void vMotionSensorsPublish( void * );
 extern void vEnvironmentSensorPublishTask( void * );
+extern void vAgentMetricsPublishTask( void * );
 extern void vShadowDeviceTask( void * );
 extern void vOTAUpdateTask( void * pvParam );
 extern void vDefenderAgentTask( void * );
@@ -279,6 +282,16 @@ void vInitTask( void * pvArgs )
         xResult = xTaskCreate( vMotionSensorsPublish, "MotionS", 2048, NULL, 5, NULL );
         configASSERT( xResult == pdTRUE );
 
+        #if MQTT_AGENT_JOURNAL_ENABLED
+            xResult = xTaskCreate( vMQTTJournalTask, "MQTTJournal", 1024, NULL, 5, NULL );
+            configASSERT( xResult == pdTRUE );
+        #endif
+
+        #if MQTT_AGENT_METRICS_ENABLED
+            xResult = xTaskCreate( vAgentMetricsPublishTask, "MQTTMetrics", 1024, NULL, 5, NULL );
+            configASSERT( xResult == pdTRUE );
+        #endif
+
 //        xResult = xTaskCreate( vShadowDeviceTask, "ShadowDevice", 1024, NULL, 5, NULL );
 //        configASSERT( xResult == pdTRUE );
 //
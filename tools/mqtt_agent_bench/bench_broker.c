@@ -0,0 +1,494 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_WARN
+
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "atomic.h"
+
+#include "bench_broker.h"
+#include "bench_loopback.h"
+#include "bench_port.h"
+
+/*-----------------------------------------------------------*/
+
+#define BROKER_POLL_TICKS        pdMS_TO_TICKS( 10 )
+
+/* Fixed header byte and up to four remaining length bytes. */
+#define BROKER_FIXED_HEADER_MAX  ( 5U )
+
+/* Control packet types, MQTT 3.1.1 section 2.2.1. */
+#define PACKET_CONNECT           ( 0x10U )
+#define PACKET_CONNACK           ( 0x20U )
+#define PACKET_PUBLISH           ( 0x30U )
+#define PACKET_PUBACK            ( 0x40U )
+#define PACKET_PUBREC            ( 0x50U )
+#define PACKET_PUBREL            ( 0x60U )
+#define PACKET_PUBCOMP           ( 0x70U )
+#define PACKET_SUBSCRIBE         ( 0x80U )
+#define PACKET_SUBACK            ( 0x90U )
+#define PACKET_UNSUBSCRIBE       ( 0xA0U )
+#define PACKET_UNSUBACK          ( 0xB0U )
+#define PACKET_PINGREQ           ( 0xC0U )
+#define PACKET_PINGRESP          ( 0xD0U )
+#define PACKET_DISCONNECT        ( 0xE0U )
+
+/*-----------------------------------------------------------*/
+
+typedef struct InjectState
+{
+    BenchBrokerInject_t xParams;
+    uint8_t * pucPacket;      /* Serialized publish, stamp and packet id rewritten per send. */
+    size_t uxPacketLength;
+    size_t uxPacketIdOffset;  /* Zero for QoS0. */
+    size_t uxStampOffset;
+    uint32_t ulSent;
+    uint16_t usPacketId;
+} InjectState_t;
+
+/*-----------------------------------------------------------*/
+
+static NetworkContext_t * volatile pxBrokerLink = NULL;
+static TaskHandle_t xBrokerTask = NULL;
+static QueueHandle_t xInjectQueue = NULL;
+static uint32_t ulDelivered = 0;
+static BenchBrokerStats_t xBrokerStats = { 0 };
+
+/* Only used by the broker task. */
+static InjectState_t xInject = { 0 };
+static uint8_t pucRxPacket[ BENCH_BROKER_MAX_PACKET ];
+
+/*-----------------------------------------------------------*/
+
+static size_t prvEncodeRemainingLength( uint8_t * pucOut,
+                                        size_t uxLength )
+{
+    size_t uxIdx = 0;
+
+    do
+    {
+        uint8_t ucByte = ( uint8_t ) ( uxLength % 128U );
+
+        uxLength /= 128U;
+
+        if( uxLength > 0U )
+        {
+            ucByte |= 0x80U;
+        }
+
+        pucOut[ uxIdx++ ] = ucByte;
+    } while( uxLength > 0U );
+
+    return uxIdx;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read exactly uxLength bytes, unless the agent disconnects. */
+static bool prvRecvExact( NetworkContext_t * pxLink,
+                          uint8_t * pucBuffer,
+                          size_t uxLength )
+{
+    while( ( uxLength > 0U ) && ( pxBrokerLink == pxLink ) )
+    {
+        size_t uxRead = uxLoopbackBrokerRecv( pxLink, pucBuffer, uxLength, BROKER_POLL_TICKS );
+
+        pucBuffer += uxRead;
+        uxLength -= uxRead;
+    }
+
+    return( uxLength == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvSendAck( NetworkContext_t * pxLink,
+                        uint8_t ucType,
+                        const uint8_t * pucPacketId )
+{
+    uint8_t pucAck[ 4 ] = { ucType, 2U, pucPacketId[ 0 ], pucPacketId[ 1 ] };
+
+    return xLoopbackBrokerSend( pxLink, pucAck, sizeof( pucAck ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvHandlePublish( NetworkContext_t * pxLink,
+                              uint8_t ucFlags,
+                              const uint8_t * pucBody,
+                              size_t uxLength )
+{
+    uint8_t ucQoS = ( ucFlags >> 1 ) & 0x03U;
+    size_t uxTopicLength = 0;
+
+    ( void ) Atomic_Increment_u32( &( xBrokerStats.ulPublishesReceived ) );
+
+    if( uxLength >= 2U )
+    {
+        uxTopicLength = ( ( size_t ) pucBody[ 0 ] << 8 ) | pucBody[ 1 ];
+    }
+
+    if( ( ucQoS > 0U ) && ( uxLength >= ( 2U + uxTopicLength + 2U ) ) )
+    {
+        ( void ) prvSendAck( pxLink,
+                             ( ucQoS == 1U ) ? PACKET_PUBACK : PACKET_PUBREC,
+                             &( pucBody[ 2U + uxTopicLength ] ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvHandleSubscribe( NetworkContext_t * pxLink,
+                                const uint8_t * pucBody,
+                                size_t uxLength )
+{
+    uint8_t pucSubAck[ BROKER_FIXED_HEADER_MAX + 2U + 32U ];
+    uint8_t pucCodes[ 32 ];
+    size_t uxCodes = 0;
+    size_t uxOffset = 2;
+
+    /* Grant every filter at the requested QoS, capped at 1. */
+    while( ( uxOffset + 2U < uxLength ) && ( uxCodes < sizeof( pucCodes ) ) )
+    {
+        size_t uxFilterLength = ( ( size_t ) pucBody[ uxOffset ] << 8 ) | pucBody[ uxOffset + 1U ];
+        size_t uxQoSOffset = uxOffset + 2U + uxFilterLength;
+
+        if( uxQoSOffset >= uxLength )
+        {
+            break;
+        }
+
+        pucCodes[ uxCodes++ ] = ( pucBody[ uxQoSOffset ] > 1U ) ? 1U : pucBody[ uxQoSOffset ];
+        uxOffset = uxQoSOffset + 1U;
+    }
+
+    if( uxLength >= 2U )
+    {
+        size_t uxHeaderLength;
+
+        pucSubAck[ 0 ] = PACKET_SUBACK;
+        uxHeaderLength = 1U + prvEncodeRemainingLength( &( pucSubAck[ 1 ] ), 2U + uxCodes );
+        pucSubAck[ uxHeaderLength ] = pucBody[ 0 ];
+        pucSubAck[ uxHeaderLength + 1U ] = pucBody[ 1 ];
+        ( void ) memcpy( &( pucSubAck[ uxHeaderLength + 2U ] ), pucCodes, uxCodes );
+
+        ( void ) xLoopbackBrokerSend( pxLink, pucSubAck, uxHeaderLength + 2U + uxCodes );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvHandlePacket( NetworkContext_t * pxLink,
+                             uint8_t ucHeader,
+                             const uint8_t * pucBody,
+                             size_t uxLength )
+{
+    static const uint8_t pucConnAck[] = { PACKET_CONNACK, 2U, 0U, 0U };
+    static const uint8_t pucPingResp[] = { PACKET_PINGRESP, 0U };
+
+    switch( ucHeader & 0xF0U )
+    {
+        case PACKET_CONNECT:
+            ( void ) xLoopbackBrokerSend( pxLink, pucConnAck, sizeof( pucConnAck ) );
+            break;
+
+        case PACKET_PUBLISH:
+            prvHandlePublish( pxLink, ucHeader & 0x0FU, pucBody, uxLength );
+            break;
+
+        case PACKET_PUBACK:
+        case PACKET_PUBCOMP:
+            ( void ) Atomic_Increment_u32( &( xBrokerStats.ulPubAcksReceived ) );
+            break;
+
+        case PACKET_PUBREC:
+            ( void ) prvSendAck( pxLink, PACKET_PUBREL | 0x02U, pucBody );
+            break;
+
+        case PACKET_PUBREL:
+            ( void ) prvSendAck( pxLink, PACKET_PUBCOMP, pucBody );
+            break;
+
+        case PACKET_SUBSCRIBE:
+            prvHandleSubscribe( pxLink, pucBody, uxLength );
+            break;
+
+        case PACKET_UNSUBSCRIBE:
+            ( void ) prvSendAck( pxLink, PACKET_UNSUBACK, pucBody );
+            break;
+
+        case PACKET_PINGREQ:
+            ( void ) xLoopbackBrokerSend( pxLink, pucPingResp, sizeof( pucPingResp ) );
+            break;
+
+        case PACKET_DISCONNECT:
+        default:
+            break;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read one packet from the agent and answer it. */
+static void prvServiceAgent( NetworkContext_t * pxLink,
+                             TickType_t xTicksToWait )
+{
+    uint8_t ucHeader = 0;
+    size_t uxRemaining = 0;
+    uint32_t ulMultiplier = 1;
+    uint8_t ucByte = 0x80U;
+
+    if( uxLoopbackBrokerRecv( pxLink, &ucHeader, 1U, xTicksToWait ) == 1U )
+    {
+        for( size_t uxIdx = 1U; ( uxIdx < BROKER_FIXED_HEADER_MAX ) && ( ( ucByte & 0x80U ) != 0U ); uxIdx++ )
+        {
+            if( !prvRecvExact( pxLink, &ucByte, 1U ) )
+            {
+                return;
+            }
+
+            uxRemaining += ( size_t ) ( ucByte & 0x7FU ) * ulMultiplier;
+            ulMultiplier *= 128U;
+        }
+
+        if( uxRemaining <= sizeof( pucRxPacket ) )
+        {
+            if( prvRecvExact( pxLink, pucRxPacket, uxRemaining ) )
+            {
+                prvHandlePacket( pxLink, ucHeader, pucRxPacket, uxRemaining );
+            }
+        }
+        else
+        {
+            ( void ) Atomic_Increment_u32( &( xBrokerStats.ulPacketsDropped ) );
+
+            while( ( uxRemaining > 0U ) && ( pxBrokerLink == pxLink ) )
+            {
+                size_t uxChunk = ( uxRemaining < sizeof( pucRxPacket ) ) ? uxRemaining : sizeof( pucRxPacket );
+
+                if( !prvRecvExact( pxLink, pucRxPacket, uxChunk ) )
+                {
+                    break;
+                }
+
+                uxRemaining -= uxChunk;
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvStartInject( const BenchBrokerInject_t * pxParams )
+{
+    size_t uxTopicLength = strlen( pxParams->pcTopic );
+    size_t uxRemaining = 2U + uxTopicLength + pxParams->uxPayloadLength;
+    size_t uxOffset = 0;
+
+    vPortFree( xInject.pucPacket );
+    ( void ) memset( &xInject, 0, sizeof( xInject ) );
+
+    if( pxParams->xQoS > MQTTQoS0 )
+    {
+        uxRemaining += 2U;
+    }
+
+    if( pxParams->uxPayloadLength < BENCH_BROKER_STAMP_LEN )
+    {
+        LogError( "Injected payloads must hold a %u byte stamp.", ( unsigned ) BENCH_BROKER_STAMP_LEN );
+        return;
+    }
+
+    xInject.pucPacket = pvPortMalloc( BROKER_FIXED_HEADER_MAX + uxRemaining );
+
+    if( xInject.pucPacket == NULL )
+    {
+        LogError( "Failed to allocate a %lu byte publish.", ( unsigned long ) uxRemaining );
+        return;
+    }
+
+    xInject.xParams = *pxParams;
+    xInject.pucPacket[ uxOffset++ ] = PACKET_PUBLISH | ( ( uint8_t ) pxParams->xQoS << 1 );
+    uxOffset += prvEncodeRemainingLength( &( xInject.pucPacket[ uxOffset ] ), uxRemaining );
+    xInject.pucPacket[ uxOffset++ ] = ( uint8_t ) ( uxTopicLength >> 8 );
+    xInject.pucPacket[ uxOffset++ ] = ( uint8_t ) uxTopicLength;
+    ( void ) memcpy( &( xInject.pucPacket[ uxOffset ] ), pxParams->pcTopic, uxTopicLength );
+    uxOffset += uxTopicLength;
+
+    if( pxParams->xQoS > MQTTQoS0 )
+    {
+        xInject.uxPacketIdOffset = uxOffset;
+        uxOffset += 2U;
+    }
+
+    xInject.uxStampOffset = uxOffset;
+    ( void ) memset( &( xInject.pucPacket[ uxOffset ] ), 0xA5, pxParams->uxPayloadLength );
+    xInject.uxPacketLength = uxOffset + pxParams->uxPayloadLength;
+
+    /* Deliveries counted from now on belong to this request. */
+    ulDelivered = 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Send injected publishes while the window and the link have room.
+ * Returns true if the window is full. */
+static bool prvServiceInject( NetworkContext_t * pxLink )
+{
+    bool xWindowFull = false;
+
+    while( ( xInject.pucPacket != NULL ) &&
+           ( xInject.ulSent < xInject.xParams.ulCount ) )
+    {
+        uint64_t ullStamp;
+
+        if( ( xInject.ulSent - Atomic_OR_u32( &ulDelivered, 0U ) ) >= xInject.xParams.ulWindow )
+        {
+            xWindowFull = true;
+            break;
+        }
+
+        if( uxLoopbackBrokerSpace( pxLink ) < xInject.uxPacketLength )
+        {
+            break;
+        }
+
+        if( xInject.uxPacketIdOffset != 0U )
+        {
+            xInject.usPacketId = ( xInject.usPacketId == UINT16_MAX ) ? 1U : ( uint16_t ) ( xInject.usPacketId + 1U );
+            xInject.pucPacket[ xInject.uxPacketIdOffset ] = ( uint8_t ) ( xInject.usPacketId >> 8 );
+            xInject.pucPacket[ xInject.uxPacketIdOffset + 1U ] = ( uint8_t ) xInject.usPacketId;
+        }
+
+        ullStamp = ullBenchNowNs();
+        ( void ) memcpy( &( xInject.pucPacket[ xInject.uxStampOffset ] ), &ullStamp, sizeof( ullStamp ) );
+
+        if( !xLoopbackBrokerSend( pxLink, xInject.pucPacket, xInject.uxPacketLength ) )
+        {
+            break;
+        }
+
+        xInject.ulSent++;
+        ( void ) Atomic_Increment_u32( &( xBrokerStats.ulPublishesSent ) );
+    }
+
+    return xWindowFull;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvBrokerTask( void * pvParameters )
+{
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        NetworkContext_t * pxLink = pxBrokerLink;
+        BenchBrokerInject_t xParams;
+
+        if( xQueueReceive( xInjectQueue, &xParams, 0 ) == pdTRUE )
+        {
+            prvStartInject( &xParams );
+        }
+
+        if( pxLink == NULL )
+        {
+            vTaskDelay( 1 );
+        }
+        else
+        {
+            /* A full window is reopened by vBenchBrokerDelivered, which ends
+             * the wait early, so poll quickly while it is closed. */
+            TickType_t xWait = prvServiceInject( pxLink ) ? 1U : BROKER_POLL_TICKS;
+
+            prvServiceAgent( pxLink, xWait );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool xBenchBrokerStart( UBaseType_t uxPriority )
+{
+    xInjectQueue = xQueueCreate( 1, sizeof( BenchBrokerInject_t ) );
+
+    return( ( xInjectQueue != NULL ) &&
+            ( xTaskCreate( prvBrokerTask, "Broker", configMINIMAL_STACK_SIZE * 2,
+                           NULL, uxPriority, &xBrokerTask ) == pdPASS ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void vBenchBrokerAttach( NetworkContext_t * pxNetworkContext )
+{
+    pxBrokerLink = pxNetworkContext;
+}
+
+/*-----------------------------------------------------------*/
+
+void vBenchBrokerDetach( NetworkContext_t * pxNetworkContext )
+{
+    if( pxBrokerLink == pxNetworkContext )
+    {
+        pxBrokerLink = NULL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vBenchBrokerInject( const BenchBrokerInject_t * pxInject )
+{
+    ( void ) xQueueOverwrite( xInjectQueue, pxInject );
+    ( void ) xTaskAbortDelay( xBrokerTask );
+}
+
+/*-----------------------------------------------------------*/
+
+void vBenchBrokerDelivered( void )
+{
+    ( void ) Atomic_Increment_u32( &ulDelivered );
+    ( void ) xTaskAbortDelay( xBrokerTask );
+}
+
+/*-----------------------------------------------------------*/
+
+void vBenchBrokerGetStats( BenchBrokerStats_t * pxStats )
+{
+    taskENTER_CRITICAL();
+    *pxStats = xBrokerStats;
+    taskEXIT_CRITICAL();
+}
@@ -0,0 +1,86 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Broker stand-in for the MQTT agent benchmark. Accepts any CONNECT,
+ * acknowledges every PUBLISH, SUBSCRIBE, UNSUBSCRIBE and PINGREQ, and can
+ * send a stream of timestamped publishes to the agent.
+ */
+
+#ifndef BENCH_BROKER_H
+#define BENCH_BROKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "core_mqtt.h"
+
+/* Largest packet accepted from the agent. Larger ones are read and dropped. */
+#define BENCH_BROKER_MAX_PACKET    ( 16U * 1024U )
+
+/* Bytes of a timestamp written at the start of every injected payload. */
+#define BENCH_BROKER_STAMP_LEN     sizeof( uint64_t )
+
+typedef struct BenchBrokerInject
+{
+    const char * pcTopic;
+    size_t uxPayloadLength; /* At least BENCH_BROKER_STAMP_LEN. */
+    MQTTQoS_t xQoS;         /* MQTTQoS0 or MQTTQoS1. */
+    uint32_t ulCount;       /* Publishes to send. */
+    uint32_t ulWindow;      /* Most publishes sent but not yet delivered. */
+} BenchBrokerInject_t;
+
+typedef struct BenchBrokerStats
+{
+    uint32_t ulPublishesReceived;
+    uint32_t ulPubAcksReceived;
+    uint32_t ulPacketsDropped;
+    uint32_t ulPublishesSent;
+} BenchBrokerStats_t;
+
+/**
+ * @brief Create the broker task.
+ */
+bool xBenchBrokerStart( UBaseType_t uxPriority );
+
+/**
+ * @brief Start sending the publishes described by pxInject. Replaces any
+ * earlier request. pxInject is copied, the topic string it points to is not.
+ */
+void vBenchBrokerInject( const BenchBrokerInject_t * pxInject );
+
+/**
+ * @brief Count an injected publish as delivered, opening the window for the
+ * next one. Called by the subscriber, usually from the agent task.
+ */
+void vBenchBrokerDelivered( void );
+
+void vBenchBrokerGetStats( BenchBrokerStats_t * pxStats );
+
+#endif /* BENCH_BROKER_H */
@@ -0,0 +1,97 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * In-process link between the MQTT agent and the broker stand-in. The agent
+ * side is the mbedtls_transport API, the broker side is declared here.
+ */
+
+#ifndef BENCH_LOOPBACK_H
+#define BENCH_LOOPBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "mbedtls_transport.h"
+
+/* Bytes buffered in each direction of the link. */
+#define LOOPBACK_BUFFER_SIZE    ( 64U * 1024U )
+
+/* The link has no TLS. Bytes on the wire are estimated as if each transport
+ * write were sent in TLS 1.2 AES-GCM records: a 5 byte header, an 8 byte
+ * explicit nonce and a 16 byte tag per record of up to 16 KB. */
+#define LOOPBACK_TLS_RECORD_OVERHEAD    ( 29U )
+#define LOOPBACK_TLS_RECORD_PAYLOAD     ( 16U * 1024U )
+
+typedef struct LoopbackWireStats
+{
+    uint32_t ulWrites;        /* Calls of mbedtls_transport_send or _sendv which sent data. */
+    uint64_t ullPayloadBytes; /* Bytes sent by the agent. */
+    uint64_t ullWireBytes;    /* ullPayloadBytes plus the estimated record overhead. */
+} LoopbackWireStats_t;
+
+/**
+ * @brief Read up to uxLength bytes sent by the agent, waiting at most
+ * xTicksToWait for the first byte.
+ *
+ * @return Number of bytes read, 0 on timeout.
+ */
+size_t uxLoopbackBrokerRecv( NetworkContext_t * pxNetworkContext,
+                             void * pvBuffer,
+                             size_t uxLength,
+                             TickType_t xTicksToWait );
+
+/**
+ * @brief Write uxLength bytes for the agent, blocking while the link is full,
+ * then raise the receive ready callback if the agent is waiting for data.
+ *
+ * @return False if the agent disconnected first.
+ */
+bool xLoopbackBrokerSend( NetworkContext_t * pxNetworkContext,
+                          const void * pvBuffer,
+                          size_t uxLength );
+
+/**
+ * @brief Read and clear the counts of data sent by the agent.
+ */
+void vLoopbackTakeWireStats( LoopbackWireStats_t * pxStats );
+
+/**
+ * @brief Space left for broker writes, in bytes.
+ */
+size_t uxLoopbackBrokerSpace( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Called by mbedtls_transport_connect and mbedtls_transport_disconnect,
+ * implemented by bench_broker.c.
+ */
+void vBenchBrokerAttach( NetworkContext_t * pxNetworkContext );
+void vBenchBrokerDetach( NetworkContext_t * pxNetworkContext );
+
+#endif /* BENCH_LOOPBACK_H */
@@ -0,0 +1,1012 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Host benchmark of the MQTT agent. Runs mqtt_agent_task.c, the command pool
+ * and the subscription manager on the FreeRTOS POSIX port against the broker
+ * stand-in of bench_broker.c, over the loopback transport.
+ *
+ * For every combination of payload size, QoS and concurrency it measures:
+ * - publish: producer tasks each publish and wait for the command to
+ *   complete, which for QoS1 means the PUBACK was received.
+ * - dispatch: the broker sends timestamped publishes and the subscription
+ *   callback records the time until the agent delivered them. The
+ *   concurrency is the number of publishes in flight.
+ * - publish_burst: a producer above the agent's priority queues QoS0
+ *   publishes without waiting, so the agent finds several at once. Its
+ *   transport writes and bytes on the wire show the effect of coalescing,
+ *   which is compared by building the bench with and without it.
+ *
+ * The dispatch runs are then repeated with 10, 100 and 1000 topic filters
+ * subscribed, to measure the topic lookup as the subscription count grows.
+ *
+ * Last, several tasks take and return command pool entries directly, more
+ * than the pool holds, checking that no entry is handed out twice.
+ *
+ * Results are written as JSON, see README.md.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_INFO
+
+#include "logging.h"
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "event_groups.h"
+#include "atomic.h"
+
+/* MQTT library includes. */
+#include "core_mqtt.h"
+#include "core_mqtt_agent.h"
+
+#include "mqtt_agent_task.h"
+#include "PkiObject.h"
+#include "mqtt_agent_metrics.h"
+#include "freertos_command_pool.h"
+#include "subscription_manager.h"
+#include "sys_evt.h"
+
+#include "bench_broker.h"
+#include "bench_loopback.h"
+#include "bench_port.h"
+
+/*-----------------------------------------------------------*/
+
+#define BENCH_TOPIC_OUT               "bench/out"
+#define BENCH_TOPIC_IN                "bench/in"
+
+#define BENCH_DEFAULT_MESSAGES        ( 2000U )
+#define BENCH_DEFAULT_OUTPUT          "mqtt_agent_bench.json"
+
+/* Longest wait for one publish to complete, or for a whole dispatch run. */
+#define BENCH_ACK_TIMEOUT_MS          ( 5000U )
+#define BENCH_DISPATCH_TIMEOUT_MS     ( 60U * 1000U )
+
+#define BENCH_COMMAND_BLOCK_TIME_MS   ( 1000U )
+
+/* Upper bound of the entries of pulConcurrency. */
+#define BENCH_MAX_CONCURRENCY         ( 16U )
+
+/* Tasks of the command pool stress, and the most entries each holds at once.
+ * Together they ask for more than MQTT_COMMAND_CONTEXTS_POOL_SIZE. */
+#define BENCH_POOL_TASKS              ( 8U )
+#define BENCH_POOL_MAX_HELD           ( 6U )
+
+/* Longest topic filter added by prvAddFilters. */
+#define BENCH_FILTER_MAX_LENGTH       ( 32U )
+
+#define BENCH_AGENT_PRIORITY          ( 10U )
+#define BENCH_BROKER_PRIORITY         ( 10U )
+#define BENCH_TASK_PRIORITY           ( 5U )
+#define BENCH_BURST_PRIORITY          ( BENCH_AGENT_PRIORITY + 1U )
+
+/*-----------------------------------------------------------*/
+
+struct MQTTAgentCommandContext
+{
+    TaskHandle_t xTaskToNotify;
+    uint64_t ullStartNs;
+    MQTTStatus_t xReturnStatus;
+};
+
+typedef struct ProducerParams
+{
+    MQTTAgentHandle_t xHandle;
+    MQTTPublishInfo_t xPublishInfo;
+    uint32_t ulCount;
+    MQTTAgentCommandContext_t xCmdCtx; /* Outlives the task in case a late ack arrives. */
+} ProducerParams_t;
+
+typedef struct BurstParams
+{
+    MQTTAgentHandle_t xHandle;
+    MQTTPublishInfo_t xPublishInfo;
+    uint32_t ulCount;
+    MQTTAgentCommandContext_t * pxCmdCtxs; /* One per publish, all may be in flight. */
+} BurstParams_t;
+
+typedef struct BenchRun
+{
+    const char * pcDirection;
+    size_t uxPayloadLength;
+    MQTTQoS_t xQoS;
+    uint32_t ulConcurrency;
+    uint32_t ulFilters; /* Topic filters subscribed during the run. */
+    uint32_t ulMessages;
+    uint32_t ulFailed;
+    uint64_t ullElapsedNs;
+    LoopbackWireStats_t xWire; /* Sent by the agent during the run. */
+} BenchRun_t;
+
+/*-----------------------------------------------------------*/
+
+static const size_t puxPayloadLengths[] = { 64U, 1024U, 4096U };
+static const MQTTQoS_t pxQoSLevels[] = { MQTTQoS0, MQTTQoS1 };
+static const uint32_t pulConcurrency[] = { 1U, 4U };
+static const uint32_t pulFilterCounts[] = { 10U, 100U, 1000U };
+
+static uint32_t ulMessagesPerRun = BENCH_DEFAULT_MESSAGES;
+static const char * pcOutputPath = BENCH_DEFAULT_OUTPUT;
+
+/* Latencies of the current run in nanoseconds. */
+static uint64_t * pullSamples = NULL;
+static uint32_t ulSampleCount = 0;
+static uint64_t ullLastSampleNs = 0;
+static uint32_t ulFailedCount = 0;
+
+static SemaphoreHandle_t xProducersDone = NULL;
+static TaskHandle_t xRunnerTask = NULL;
+static uint32_t ulDispatchTarget = 0;
+static uint32_t ulFilterCount = 0;
+static uint32_t ulBurstCompleted = 0;
+
+/* Command pool stress: entries held by a stress task, and the counts of the run. */
+static uint32_t pulPoolOwned[ MQTT_COMMAND_CONTEXTS_POOL_SIZE ];
+static uint32_t ulPoolGets = 0;
+static uint32_t ulPoolErrors = 0;
+static uint32_t ulStrayDeliveries = 0;
+
+static PkiObject_t xNoCredential = { 0 };
+
+static MQTTAgentInstanceConfig_t xAgentConfig =
+{
+    .ulInstance          = MQTT_AGENT_DEFAULT_INSTANCE,
+    .pcEndpoint          = "loopback",
+    .usPort              = 1883U,
+    .pcClientId          = "mqtt_agent_bench",
+    .pxRootCaCert        = &xNoCredential,
+    .pxClientCert        = &xNoCredential,
+    .pxPrivateKey        = &xNoCredential,
+    .uxNetworkBufferSize = 0U,
+};
+
+EventGroupHandle_t xSystemEvents = NULL;
+
+/*-----------------------------------------------------------*/
+
+static void prvRecordSample( uint64_t ullStartNs )
+{
+    uint64_t ullNow = ullBenchNowNs();
+    uint32_t ulIdx = Atomic_Increment_u32( &ulSampleCount );
+
+    if( ulIdx < ulMessagesPerRun )
+    {
+        pullSamples[ ulIdx ] = ullNow - ullStartNs;
+    }
+
+    taskENTER_CRITICAL();
+    {
+        if( ullNow > ullLastSampleNs )
+        {
+            ullLastSampleNs = ullNow;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPublishCompleteCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                        MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    if( pxReturnInfo->returnCode == MQTTSuccess )
+    {
+        prvRecordSample( pxCommandContext->ullStartNs );
+    }
+
+    pxCommandContext->xReturnStatus = pxReturnInfo->returnCode;
+    ( void ) xTaskNotifyGive( pxCommandContext->xTaskToNotify );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvProducerTask( void * pvParameters )
+{
+    ProducerParams_t * pxParams = ( ProducerParams_t * ) pvParameters;
+    MQTTAgentCommandInfo_t xCommandInfo =
+    {
+        .cmdCompleteCallback          = prvPublishCompleteCallback,
+        .pCmdCompleteCallbackContext  = &( pxParams->xCmdCtx ),
+        .blockTimeMs                  = BENCH_COMMAND_BLOCK_TIME_MS,
+    };
+    uint32_t ulFailed = 0;
+
+    pxParams->xCmdCtx.xTaskToNotify = xTaskGetCurrentTaskHandle();
+
+    for( uint32_t ulIdx = 0; ulIdx < pxParams->ulCount; ulIdx++ )
+    {
+        MQTTStatus_t xStatus;
+
+        pxParams->xCmdCtx.xReturnStatus = MQTTIllegalState;
+        pxParams->xCmdCtx.ullStartNs = ullBenchNowNs();
+
+        xStatus = MQTTAgent_Publish( pxParams->xHandle,
+                                     &( pxParams->xPublishInfo ),
+                                     &xCommandInfo );
+
+        if( xStatus != MQTTSuccess )
+        {
+            ulFailed++;
+        }
+        else if( ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS( BENCH_ACK_TIMEOUT_MS ) ) == 0U )
+        {
+            /* The context may still be completed later, so stop using it. */
+            LogError( "Publish %lu was not completed in time.", ( unsigned long ) ulIdx );
+            ulFailed += pxParams->ulCount - ulIdx;
+            break;
+        }
+        else if( pxParams->xCmdCtx.xReturnStatus != MQTTSuccess )
+        {
+            ulFailed++;
+        }
+    }
+
+    taskENTER_CRITICAL();
+    ulFailedCount += ulFailed;
+    taskEXIT_CRITICAL();
+
+    ( void ) xSemaphoreGive( xProducersDone );
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvBurstCompleteCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                      MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    if( pxReturnInfo->returnCode == MQTTSuccess )
+    {
+        prvRecordSample( pxCommandContext->ullStartNs );
+    }
+    else
+    {
+        ( void ) Atomic_Increment_u32( &ulFailedCount );
+    }
+
+    if( ( Atomic_Increment_u32( &ulBurstCompleted ) + 1U ) == ulMessagesPerRun )
+    {
+        ( void ) xTaskNotifyGive( xRunnerTask );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Queue every publish without waiting. The agent runs whenever this task
+ * blocks on a full command pool or queue. */
+static void prvBurstTask( void * pvParameters )
+{
+    BurstParams_t * pxParams = ( BurstParams_t * ) pvParameters;
+
+    for( uint32_t ulIdx = 0; ulIdx < pxParams->ulCount; ulIdx++ )
+    {
+        MQTTAgentCommandInfo_t xCommandInfo =
+        {
+            .cmdCompleteCallback          = prvBurstCompleteCallback,
+            .pCmdCompleteCallbackContext  = &( pxParams->pxCmdCtxs[ ulIdx ] ),
+            .blockTimeMs                  = BENCH_COMMAND_BLOCK_TIME_MS,
+        };
+        MQTTAgentReturnInfo_t xFailed = { .returnCode = MQTTSendFailed };
+
+        pxParams->pxCmdCtxs[ ulIdx ].ullStartNs = ullBenchNowNs();
+
+        if( MQTTAgent_Publish( pxParams->xHandle,
+                               &( pxParams->xPublishInfo ),
+                               &xCommandInfo ) != MQTTSuccess )
+        {
+            prvBurstCompleteCallback( &( pxParams->pxCmdCtxs[ ulIdx ] ), &xFailed );
+        }
+    }
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Take 1 to BENCH_POOL_MAX_HELD entries, yield, then return them, for
+ * ulMessagesPerRun rounds. Only the first entry of a round waits for the pool,
+ * the others give up at once so that the tasks cannot block each other.
+ */
+static void prvPoolStressTask( void * pvParameters )
+{
+    MQTTAgentCommand_t * pxHeld[ BENCH_POOL_MAX_HELD ];
+    uint32_t ulSeed = ( uint32_t ) ( uintptr_t ) pvParameters;
+    uint32_t ulGets = 0;
+    uint32_t ulErrors = 0;
+
+    for( uint32_t ulRound = 0; ulRound < ulMessagesPerRun; ulRound++ )
+    {
+        size_t uxWanted = 1U + ( ( ulRound + ulSeed ) % BENCH_POOL_MAX_HELD );
+        size_t uxHeld = 0;
+
+        while( uxHeld < uxWanted )
+        {
+            MQTTAgentCommand_t * pxCommand = Agent_GetCommand( ( uxHeld == 0U ) ? BENCH_COMMAND_BLOCK_TIME_MS : 0U );
+            size_t uxIdx;
+
+            if( pxCommand == NULL )
+            {
+                ulErrors += ( uxHeld == 0U ) ? 1U : 0U;
+                break;
+            }
+
+            ulGets++;
+            uxIdx = Agent_GetCommandIndex( pxCommand );
+
+            if( ( uxIdx >= MQTT_COMMAND_CONTEXTS_POOL_SIZE ) ||
+                ( Atomic_CompareAndSwap_u32( &( pulPoolOwned[ uxIdx ] ), 1U, 0U ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+            {
+                LogError( "Command pool entry %lu was handed out twice.", ( unsigned long ) uxIdx );
+                ulErrors++;
+            }
+
+            pxHeld[ uxHeld++ ] = pxCommand;
+        }
+
+        taskYIELD();
+
+        while( uxHeld > 0U )
+        {
+            MQTTAgentCommand_t * pxCommand = pxHeld[ --uxHeld ];
+            size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+            if( uxIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE )
+            {
+                ( void ) Atomic_CompareAndSwap_u32( &( pulPoolOwned[ uxIdx ] ), 0U, 1U );
+            }
+
+            if( !Agent_ReleaseCommand( pxCommand ) )
+            {
+                ulErrors++;
+            }
+        }
+    }
+
+    ( void ) Atomic_Add_u32( &ulPoolGets, ulGets );
+    ( void ) Atomic_Add_u32( &ulPoolErrors, ulErrors );
+    ( void ) xSemaphoreGive( xProducersDone );
+
+    vTaskDelete( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvIncomingPublishCallback( void * pvCtx,
+                                        MQTTPublishInfo_t * pxPublishInfo )
+{
+    uint64_t ullStamp;
+
+    ( void ) pvCtx;
+
+    if( pxPublishInfo->payloadLength >= BENCH_BROKER_STAMP_LEN )
+    {
+        ( void ) memcpy( &ullStamp, pxPublishInfo->pPayload, sizeof( ullStamp ) );
+        prvRecordSample( ullStamp );
+        vBenchBrokerDelivered();
+
+        if( Atomic_OR_u32( &ulSampleCount, 0U ) == ulDispatchTarget )
+        {
+            ( void ) xTaskNotifyGive( xRunnerTask );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Callback of the filters added by prvAddFilters, none of which match BENCH_TOPIC_IN. */
+static void prvStrayPublishCallback( void * pvCtx,
+                                     MQTTPublishInfo_t * pxPublishInfo )
+{
+    ( void ) pvCtx;
+    ( void ) pxPublishInfo;
+
+    ( void ) Atomic_Increment_u32( &ulStrayDeliveries );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Subscribe to more topic filters until ulFilters are subscribed, counting
+ * BENCH_TOPIC_IN. Most are exact topics. Every fourth ends in a single level
+ * wildcard and every sixteenth starts with one, so some filters are checked
+ * at the first level of every incoming topic.
+ */
+static bool prvAddFilters( MQTTAgentHandle_t xHandle,
+                           uint32_t ulFilters )
+{
+    bool xSuccess = true;
+
+    while( xSuccess && ( ulFilterCount < ulFilters ) )
+    {
+        char pcFilter[ BENCH_FILTER_MAX_LENGTH ];
+
+        if( ( ulFilterCount % 16U ) == 0U )
+        {
+            ( void ) snprintf( pcFilter, sizeof( pcFilter ), "+/x/%lu/#", ( unsigned long ) ulFilterCount );
+        }
+        else if( ( ulFilterCount % 4U ) == 0U )
+        {
+            ( void ) snprintf( pcFilter, sizeof( pcFilter ), "bench/w/%lu/+", ( unsigned long ) ulFilterCount );
+        }
+        else
+        {
+            ( void ) snprintf( pcFilter, sizeof( pcFilter ), "bench/f/%lu", ( unsigned long ) ulFilterCount );
+        }
+
+        if( MqttAgent_SubscribeSync( xHandle, pcFilter, MQTTQoS0,
+                                     prvStrayPublishCallback, NULL ) == MQTTSuccess )
+        {
+            ulFilterCount++;
+        }
+        else
+        {
+            LogError( "Failed to subscribe to %s.", pcFilter );
+            xSuccess = false;
+        }
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvResetSamples( void )
+{
+    taskENTER_CRITICAL();
+    {
+        ulSampleCount = 0U;
+        ullLastSampleNs = 0U;
+        ulFailedCount = 0U;
+    }
+    taskEXIT_CRITICAL();
+
+    MqttAgentMetrics_Reset();
+
+    {
+        LoopbackWireStats_t xDiscard;
+
+        vLoopbackTakeWireStats( &xDiscard );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRunPublish( MQTTAgentHandle_t xHandle,
+                           BenchRun_t * pxRun,
+                           uint8_t * pucPayload )
+{
+    ProducerParams_t * pxProducers = pvPortMalloc( sizeof( ProducerParams_t ) * pxRun->ulConcurrency );
+    uint32_t ulStarted = 0;
+    uint64_t ullStartNs;
+
+    configASSERT( pxProducers != NULL );
+
+    prvResetSamples();
+    ullStartNs = ullBenchNowNs();
+
+    for( uint32_t ulIdx = 0; ulIdx < pxRun->ulConcurrency; ulIdx++ )
+    {
+        ProducerParams_t * pxParams = &( pxProducers[ ulIdx ] );
+
+        ( void ) memset( pxParams, 0, sizeof( ProducerParams_t ) );
+        pxParams->xHandle = xHandle;
+        pxParams->xPublishInfo.qos = pxRun->xQoS;
+        pxParams->xPublishInfo.pTopicName = BENCH_TOPIC_OUT;
+        pxParams->xPublishInfo.topicNameLength = ( uint16_t ) strlen( BENCH_TOPIC_OUT );
+        pxParams->xPublishInfo.pPayload = pucPayload;
+        pxParams->xPublishInfo.payloadLength = pxRun->uxPayloadLength;
+        pxParams->ulCount = pxRun->ulMessages / pxRun->ulConcurrency;
+
+        if( ulIdx == 0U )
+        {
+            pxParams->ulCount += pxRun->ulMessages % pxRun->ulConcurrency;
+        }
+
+        if( xTaskCreate( prvProducerTask, "Producer", configMINIMAL_STACK_SIZE,
+                         pxParams, BENCH_TASK_PRIORITY, NULL ) == pdPASS )
+        {
+            ulStarted++;
+        }
+        else
+        {
+            pxRun->ulFailed += pxParams->ulCount;
+        }
+    }
+
+    while( ulStarted > 0U )
+    {
+        ( void ) xSemaphoreTake( xProducersDone, portMAX_DELAY );
+        ulStarted--;
+    }
+
+    pxRun->ullElapsedNs = ullBenchNowNs() - ullStartNs;
+    pxRun->ulFailed += ulFailedCount;
+    vLoopbackTakeWireStats( &( pxRun->xWire ) );
+
+    /* A timed out publish may still complete, keep its context. */
+    if( ulFailedCount == 0U )
+    {
+        vPortFree( pxProducers );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRunDispatch( BenchRun_t * pxRun )
+{
+    BenchBrokerInject_t xInject =
+    {
+        .pcTopic         = BENCH_TOPIC_IN,
+        .uxPayloadLength = pxRun->uxPayloadLength,
+        .xQoS            = pxRun->xQoS,
+        .ulCount         = pxRun->ulMessages,
+        .ulWindow        = pxRun->ulConcurrency,
+    };
+    uint64_t ullStartNs;
+
+    prvResetSamples();
+    ulDispatchTarget = pxRun->ulMessages;
+    ( void ) ulTaskNotifyTake( pdTRUE, 0 );
+
+    ullStartNs = ullBenchNowNs();
+    vBenchBrokerInject( &xInject );
+
+    if( ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS( BENCH_DISPATCH_TIMEOUT_MS ) ) == 0U )
+    {
+        LogError( "Only %lu of %lu publishes were delivered.",
+                  ( unsigned long ) ulSampleCount, ( unsigned long ) pxRun->ulMessages );
+    }
+
+    taskENTER_CRITICAL();
+    {
+        pxRun->ulFailed = pxRun->ulMessages - ulSampleCount;
+        pxRun->ullElapsedNs = ( ullLastSampleNs > ullStartNs ) ? ( ullLastSampleNs - ullStartNs ) : 0U;
+    }
+    taskEXIT_CRITICAL();
+
+    vLoopbackTakeWireStats( &( pxRun->xWire ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRunBurst( MQTTAgentHandle_t xHandle,
+                         BenchRun_t * pxRun,
+                         uint8_t * pucPayload )
+{
+    BurstParams_t * pxParams = pvPortMalloc( sizeof( BurstParams_t ) );
+    uint64_t ullStartNs;
+
+    configASSERT( pxParams != NULL );
+
+    ( void ) memset( pxParams, 0, sizeof( BurstParams_t ) );
+    pxParams->xHandle = xHandle;
+    pxParams->xPublishInfo.qos = MQTTQoS0;
+    pxParams->xPublishInfo.pTopicName = BENCH_TOPIC_OUT;
+    pxParams->xPublishInfo.topicNameLength = ( uint16_t ) strlen( BENCH_TOPIC_OUT );
+    pxParams->xPublishInfo.pPayload = pucPayload;
+    pxParams->xPublishInfo.payloadLength = pxRun->uxPayloadLength;
+    pxParams->ulCount = pxRun->ulMessages;
+    pxParams->pxCmdCtxs = pvPortMalloc( sizeof( MQTTAgentCommandContext_t ) * pxRun->ulMessages );
+
+    configASSERT( pxParams->pxCmdCtxs != NULL );
+
+    prvResetSamples();
+    ulBurstCompleted = 0U;
+    ( void ) ulTaskNotifyTake( pdTRUE, 0 );
+
+    ullStartNs = ullBenchNowNs();
+
+    if( xTaskCreate( prvBurstTask, "Burst", configMINIMAL_STACK_SIZE,
+                     pxParams, BENCH_BURST_PRIORITY, NULL ) != pdPASS )
+    {
+        pxRun->ulFailed = pxRun->ulMessages;
+    }
+    else if( ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS( BENCH_DISPATCH_TIMEOUT_MS ) ) == 0U )
+    {
+        LogError( "Only %lu of %lu burst publishes were completed.",
+                  ( unsigned long ) ulBurstCompleted, ( unsigned long ) pxRun->ulMessages );
+        pxRun->ulFailed = pxRun->ulMessages - ulSampleCount;
+    }
+    else
+    {
+        pxRun->ulFailed = ulFailedCount;
+    }
+
+    taskENTER_CRITICAL();
+    {
+        pxRun->ullElapsedNs = ( ullLastSampleNs > ullStartNs ) ? ( ullLastSampleNs - ullStartNs ) : 0U;
+    }
+    taskEXIT_CRITICAL();
+
+    vLoopbackTakeWireStats( &( pxRun->xWire ) );
+
+    /* Late completions may still refer to the contexts. */
+    if( pxRun->ulFailed == 0U )
+    {
+        vPortFree( pxParams->pxCmdCtxs );
+        vPortFree( pxParams );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRunPoolStress( FILE * pxFile )
+{
+    CommandPoolStats_t xBefore;
+    CommandPoolStats_t xAfter;
+    uint32_t ulStarted = 0;
+    uint64_t ullStartNs;
+    uint64_t ullElapsedNs;
+
+    ( void ) memset( pulPoolOwned, 0, sizeof( pulPoolOwned ) );
+    ulPoolGets = 0U;
+    ulPoolErrors = 0U;
+
+    Agent_GetPoolStats( &xBefore );
+    ullStartNs = ullBenchNowNs();
+
+    for( uint32_t ulIdx = 0; ulIdx < BENCH_POOL_TASKS; ulIdx++ )
+    {
+        if( xTaskCreate( prvPoolStressTask, "PoolStress", configMINIMAL_STACK_SIZE,
+                         ( void * ) ( uintptr_t ) ulIdx, BENCH_TASK_PRIORITY, NULL ) == pdPASS )
+        {
+            ulStarted++;
+        }
+        else
+        {
+            ulPoolErrors++;
+        }
+    }
+
+    while( ulStarted > 0U )
+    {
+        ( void ) xSemaphoreTake( xProducersDone, portMAX_DELAY );
+        ulStarted--;
+    }
+
+    ullElapsedNs = ullBenchNowNs() - ullStartNs;
+    Agent_GetPoolStats( &xAfter );
+
+    /* Every entry taken by the stress tasks must be free again. */
+    if( xAfter.ulInUse != xBefore.ulInUse )
+    {
+        LogError( "%lu command pool entries in use after the stress, %lu before.",
+                  ( unsigned long ) xAfter.ulInUse, ( unsigned long ) xBefore.ulInUse );
+        ulPoolErrors++;
+    }
+
+    ( void ) fprintf( pxFile,
+                      "  \"command_pool\": {\"tasks\": %lu, \"pool_size\": %lu, \"gets\": %lu, "
+                      "\"elapsed_ms\": %.3f, \"gets_per_sec\": %.1f, \"exhausted\": %lu, "
+                      "\"high_water\": %lu, \"errors\": %lu}\n",
+                      ( unsigned long ) BENCH_POOL_TASKS,
+                      ( unsigned long ) xAfter.ulPoolSize,
+                      ( unsigned long ) ulPoolGets,
+                      ( double ) ullElapsedNs / 1e6,
+                      ( ullElapsedNs > 0U ) ? ( double ) ulPoolGets * 1e9 / ( double ) ullElapsedNs : 0.0,
+                      ( unsigned long ) ( xAfter.ulExhausted - xBefore.ulExhausted ),
+                      ( unsigned long ) xAfter.ulHighWater,
+                      ( unsigned long ) ulPoolErrors );
+
+    LogInfo( "command pool x%lu: %lu gets, %lu found it empty, %lu errors",
+             ( unsigned long ) BENCH_POOL_TASKS, ( unsigned long ) ulPoolGets,
+             ( unsigned long ) ( xAfter.ulExhausted - xBefore.ulExhausted ),
+             ( unsigned long ) ulPoolErrors );
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvCompareSamples( const void * pvA,
+                              const void * pvB )
+{
+    uint64_t ullA = *( const uint64_t * ) pvA;
+    uint64_t ullB = *( const uint64_t * ) pvB;
+
+    return( ( ullA > ullB ) - ( ullA < ullB ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static double prvPercentileUs( size_t uxCount,
+                               uint32_t ulPercent )
+{
+    double dResult = 0.0;
+
+    if( uxCount > 0U )
+    {
+        dResult = ( double ) pullSamples[ ( ( uxCount - 1U ) * ulPercent ) / 100U ] / 1000.0;
+    }
+
+    return dResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvWriteRun( FILE * pxFile,
+                         const BenchRun_t * pxRun,
+                         bool xFirst )
+{
+    size_t uxCount = ( ulSampleCount < ulMessagesPerRun ) ? ulSampleCount : ulMessagesPerRun;
+    double dElapsedS = ( double ) pxRun->ullElapsedNs / 1e9;
+    bool xFirstStage = true;
+
+    qsort( pullSamples, uxCount, sizeof( uint64_t ), prvCompareSamples );
+
+    ( void ) fprintf( pxFile,
+                      "%s\n    {\"direction\": \"%s\", \"payload_bytes\": %lu, \"qos\": %d, "
+                      "\"concurrency\": %lu, \"filters\": %lu, \"messages\": %lu, \"failed\": %lu, "
+                      "\"elapsed_ms\": %.3f, \"msgs_per_sec\": %.1f,\n"
+                      "     \"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n"
+                      "     \"tx\": {\"writes\": %lu, \"payload_bytes\": %llu, \"wire_bytes\": %llu},\n"
+                      "     \"agent_stages_us\": {",
+                      xFirst ? "" : ",",
+                      pxRun->pcDirection,
+                      ( unsigned long ) pxRun->uxPayloadLength,
+                      ( int ) pxRun->xQoS,
+                      ( unsigned long ) pxRun->ulConcurrency,
+                      ( unsigned long ) pxRun->ulFilters,
+                      ( unsigned long ) pxRun->ulMessages,
+                      ( unsigned long ) pxRun->ulFailed,
+                      ( double ) pxRun->ullElapsedNs / 1e6,
+                      ( dElapsedS > 0.0 ) ? ( double ) uxCount / dElapsedS : 0.0,
+                      prvPercentileUs( uxCount, 50U ),
+                      prvPercentileUs( uxCount, 99U ),
+                      prvPercentileUs( uxCount, 100U ),
+                      ( unsigned long ) pxRun->xWire.ulWrites,
+                      ( unsigned long long ) pxRun->xWire.ullPayloadBytes,
+                      ( unsigned long long ) pxRun->xWire.ullWireBytes );
+
+    /* Percentiles of the agent's own histograms are bucket upper bounds. */
+    for( MQTTAgentStage_t xStage = 0; xStage < MQTT_AGENT_NUM_STAGES; xStage++ )
+    {
+        MQTTAgentHistogram_t xHistogram;
+
+        MqttAgentMetrics_GetHistogram( xStage, &xHistogram );
+
+        if( xHistogram.ulCount > 0U )
+        {
+            ( void ) fprintf( pxFile, "%s\"%s\": {\"count\": %lu, \"p50\": %lu, \"p99\": %lu}",
+                              xFirstStage ? "" : ", ",
+                              MqttAgentMetrics_StageName( xStage ),
+                              ( unsigned long ) xHistogram.ulCount,
+                              ( unsigned long ) MqttAgentMetrics_PercentileUs( &xHistogram, 50U ),
+                              ( unsigned long ) MqttAgentMetrics_PercentileUs( &xHistogram, 99U ) );
+            xFirstStage = false;
+        }
+    }
+
+    ( void ) fprintf( pxFile, "}}" );
+
+    LogInfo( "%-8s %5lu B QoS%d x%lu, %4lu filters: %.1f msg/s, p50 %.1f us, p99 %.1f us, %lu failed",
+             pxRun->pcDirection, ( unsigned long ) pxRun->uxPayloadLength,
+             ( int ) pxRun->xQoS, ( unsigned long ) pxRun->ulConcurrency,
+             ( unsigned long ) pxRun->ulFilters,
+             ( dElapsedS > 0.0 ) ? ( double ) uxCount / dElapsedS : 0.0,
+             prvPercentileUs( uxCount, 50U ), prvPercentileUs( uxCount, 99U ),
+             ( unsigned long ) pxRun->ulFailed );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRunnerTask( void * pvParameters )
+{
+    MQTTAgentHandle_t xHandle;
+    uint8_t * pucPayload = NULL;
+    FILE * pxFile = NULL;
+    uint32_t ulTotalFailed = 0;
+    bool xFirst = true;
+
+    ( void ) pvParameters;
+
+    vSleepUntilMQTTAgentConnected();
+    xHandle = xGetMqttAgentHandle();
+
+    pucPayload = pvPortMalloc( puxPayloadLengths[ ( sizeof( puxPayloadLengths ) / sizeof( puxPayloadLengths[ 0 ] ) ) - 1U ] );
+    pullSamples = pvPortMalloc( sizeof( uint64_t ) * ulMessagesPerRun );
+    pxFile = fopen( pcOutputPath, "w" );
+
+    if( ( pucPayload == NULL ) || ( pullSamples == NULL ) || ( pxFile == NULL ) )
+    {
+        LogError( "Failed to set up the benchmark, output: %s.", pcOutputPath );
+        exit( EXIT_FAILURE );
+    }
+
+    ( void ) memset( pucPayload, 0x5A, puxPayloadLengths[ ( sizeof( puxPayloadLengths ) / sizeof( puxPayloadLengths[ 0 ] ) ) - 1U ] );
+
+    if( MqttAgent_SubscribeSync( xHandle, BENCH_TOPIC_IN, MQTTQoS1,
+                                 prvIncomingPublishCallback, NULL ) != MQTTSuccess )
+    {
+        LogError( "Failed to subscribe to %s.", BENCH_TOPIC_IN );
+        exit( EXIT_FAILURE );
+    }
+
+    ulFilterCount = 1U;
+
+    ( void ) fprintf( pxFile,
+                      "{\n  \"benchmark\": \"mqtt_agent\",\n"
+                      "  \"messages_per_run\": %lu,\n"
+                      "  \"network_buffer_bytes\": %lu,\n"
+                      "  \"tx_coalescing\": %s,\n"
+                      "  \"runs\": [",
+                      ( unsigned long ) ulMessagesPerRun,
+                      ( unsigned long ) MQTT_AGENT_NETWORK_BUFFER_SIZE,
+                      ( MQTT_AGENT_TX_COALESCE_ENABLED != 0 ) ? "true" : "false" );
+
+    for( size_t uxPayload = 0; uxPayload < ( sizeof( puxPayloadLengths ) / sizeof( puxPayloadLengths[ 0 ] ) ); uxPayload++ )
+    {
+        for( size_t uxQoS = 0; uxQoS < ( sizeof( pxQoSLevels ) / sizeof( pxQoSLevels[ 0 ] ) ); uxQoS++ )
+        {
+            for( size_t uxConc = 0; uxConc < ( sizeof( pulConcurrency ) / sizeof( pulConcurrency[ 0 ] ) ); uxConc++ )
+            {
+                BenchRun_t xRun =
+                {
+                    .uxPayloadLength = puxPayloadLengths[ uxPayload ],
+                    .xQoS            = pxQoSLevels[ uxQoS ],
+                    .ulConcurrency   = pulConcurrency[ uxConc ],
+                    .ulFilters       = ulFilterCount,
+                    .ulMessages      = ulMessagesPerRun,
+                };
+
+                xRun.pcDirection = "publish";
+                xRun.ulFailed = 0U;
+                prvRunPublish( xHandle, &xRun, pucPayload );
+                prvWriteRun( pxFile, &xRun, xFirst );
+                ulTotalFailed += xRun.ulFailed;
+                xFirst = false;
+
+                xRun.pcDirection = "dispatch";
+                xRun.ulFailed = 0U;
+                prvRunDispatch( &xRun );
+                prvWriteRun( pxFile, &xRun, false );
+                ulTotalFailed += xRun.ulFailed;
+            }
+        }
+    }
+
+    for( size_t uxPayload = 0; uxPayload < ( sizeof( puxPayloadLengths ) / sizeof( puxPayloadLengths[ 0 ] ) ); uxPayload++ )
+    {
+        BenchRun_t xRun =
+        {
+            .pcDirection     = "publish_burst",
+            .uxPayloadLength = puxPayloadLengths[ uxPayload ],
+            .xQoS            = MQTTQoS0,
+            .ulConcurrency   = 1U,
+            .ulFilters       = ulFilterCount,
+            .ulMessages      = ulMessagesPerRun,
+        };
+
+        prvRunBurst( xHandle, &xRun, pucPayload );
+        prvWriteRun( pxFile, &xRun, false );
+        ulTotalFailed += xRun.ulFailed;
+    }
+
+    /* Dispatch with a growing subscription list, small payloads so that the
+     * topic lookup is a large part of the time per publish. */
+    for( size_t uxFilters = 0; uxFilters < ( sizeof( pulFilterCounts ) / sizeof( pulFilterCounts[ 0 ] ) ); uxFilters++ )
+    {
+        if( !prvAddFilters( xHandle, pulFilterCounts[ uxFilters ] ) )
+        {
+            exit( EXIT_FAILURE );
+        }
+
+        for( size_t uxQoS = 0; uxQoS < ( sizeof( pxQoSLevels ) / sizeof( pxQoSLevels[ 0 ] ) ); uxQoS++ )
+        {
+            BenchRun_t xRun =
+            {
+                .pcDirection     = "dispatch",
+                .uxPayloadLength = puxPayloadLengths[ 0 ],
+                .xQoS            = pxQoSLevels[ uxQoS ],
+                .ulConcurrency   = pulConcurrency[ ( sizeof( pulConcurrency ) / sizeof( pulConcurrency[ 0 ] ) ) - 1U ],
+                .ulFilters       = ulFilterCount,
+                .ulMessages      = ulMessagesPerRun,
+            };
+
+            prvRunDispatch( &xRun );
+            prvWriteRun( pxFile, &xRun, false );
+            ulTotalFailed += xRun.ulFailed;
+        }
+    }
+
+    if( ulStrayDeliveries > 0U )
+    {
+        LogError( "%lu publishes were passed to a filter which does not match them.",
+                  ( unsigned long ) ulStrayDeliveries );
+        ulTotalFailed += ulStrayDeliveries;
+    }
+
+    ( void ) fprintf( pxFile, "\n  ],\n" );
+
+    prvRunPoolStress( pxFile );
+    ulTotalFailed += ulPoolErrors;
+
+    ( void ) fprintf( pxFile, "}\n" );
+    ( void ) fclose( pxFile );
+
+    LogInfo( "Results written to %s.", pcOutputPath );
+
+    exit( ( ulTotalFailed == 0U ) ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    int lOpt;
+
+    while( ( lOpt = getopt( argc, argv, "n:o:h" ) ) != -1 )
+    {
+        switch( lOpt )
+        {
+            case 'n':
+                ulMessagesPerRun = ( uint32_t ) strtoul( optarg, NULL, 10 );
+                break;
+
+            case 'o':
+                pcOutputPath = optarg;
+                break;
+
+            default:
+                ( void ) fprintf( stderr, "Usage: %s [-n messages_per_run] [-o output.json]\n", argv[ 0 ] );
+                return( ( lOpt == 'h' ) ? EXIT_SUCCESS : EXIT_FAILURE );
+        }
+    }
+
+    if( ulMessagesPerRun == 0U )
+    {
+        ( void ) fprintf( stderr, "messages_per_run must be above zero.\n" );
+        return EXIT_FAILURE;
+    }
+
+    xSystemEvents = xEventGroupCreate();
+    xProducersDone = xSemaphoreCreateCounting( BENCH_MAX_CONCURRENCY, 0 );
+    configASSERT( ( xSystemEvents != NULL ) && ( xProducersDone != NULL ) );
+
+    /* The loopback link is always up. */
+    ( void ) xEventGroupSetBits( xSystemEvents, EVT_MASK_NET_CONNECTED );
+
+    configASSERT( xBenchBrokerStart( BENCH_BROKER_PRIORITY ) );
+    configASSERT( xTaskCreate( vMQTTAgentInstanceTask, "MQTTAgent", configMINIMAL_STACK_SIZE * 4,
+                               &xAgentConfig, BENCH_AGENT_PRIORITY, NULL ) == pdPASS );
+    configASSERT( xTaskCreate( prvRunnerTask, "BenchRunner", configMINIMAL_STACK_SIZE * 2,
+                               NULL, BENCH_TASK_PRIORITY, &xRunnerTask ) == pdPASS );
+
+    vTaskStartScheduler();
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,154 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_ERROR
+
+#include "logging.h"
+
+/* Standard includes. */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "kvstore.h"
+#include "bench_port.h"
+
+/*-----------------------------------------------------------*/
+
+static char pcKvValues[ CS_NUM_KEYS ][ KVSTORE_VAL_MAX_LEN ];
+
+/*-----------------------------------------------------------*/
+
+uint64_t ullBenchNowNs( void )
+{
+    struct timespec xNow;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return( ( ( uint64_t ) xNow.tv_sec * 1000000000ULL ) + ( uint64_t ) xNow.tv_nsec );
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulBenchRunTimeCounter( void )
+{
+    return ( uint32_t ) ( ullBenchNowNs() / 1000ULL );
+}
+
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxRand( void )
+{
+    return ( UBaseType_t ) rand();
+}
+
+/*-----------------------------------------------------------*/
+
+void vBenchAssertFailed( const char * pcFile,
+                         unsigned long ulLine )
+{
+    ( void ) fprintf( stderr, "Assertion failed at %s:%lu\n", pcFile, ulLine );
+    abort();
+}
+
+/*-----------------------------------------------------------*/
+
+void vLoggingPrintf( const char * const pcLogLevel,
+                     const char * const pcFunctionName,
+                     const unsigned long ulLineNumber,
+                     const char * const pcFormat,
+                     ... )
+{
+    va_list xArgs;
+
+    /* stderr keeps log lines out of any JSON written to stdout. */
+    ( void ) fprintf( stderr, "<%s> %s:%lu ", pcLogLevel, pcFunctionName, ulLineNumber );
+
+    va_start( xArgs, pcFormat );
+    ( void ) vfprintf( stderr, pcFormat, xArgs );
+    va_end( xArgs );
+
+    ( void ) fputc( '\n', stderr );
+}
+
+/*-----------------------------------------------------------*/
+
+void vDyingGasp( void )
+{
+    ( void ) fflush( stderr );
+}
+
+/*-----------------------------------------------------------*/
+
+size_t KVStore_getString( KVStoreKey_t key,
+                          char * pvBuffer,
+                          size_t xMaxLength )
+{
+    size_t uxLength = 0;
+
+    if( ( key < CS_NUM_KEYS ) && ( pvBuffer != NULL ) && ( xMaxLength > 0U ) )
+    {
+        uxLength = strnlen( pcKvValues[ key ], xMaxLength - 1U );
+        ( void ) memcpy( pvBuffer, pcKvValues[ key ], uxLength );
+        pvBuffer[ uxLength ] = '\0';
+    }
+
+    return uxLength;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t KVStore_setString( KVStoreKey_t key,
+                              const char * pcNewValue )
+{
+    BaseType_t xResult = pdFALSE;
+
+    if( ( key < CS_NUM_KEYS ) &&
+        ( pcNewValue != NULL ) &&
+        ( strlen( pcNewValue ) < KVSTORE_VAL_MAX_LEN ) )
+    {
+        ( void ) strcpy( pcKvValues[ key ], pcNewValue );
+        xResult = pdTRUE;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t KVStore_xCommitChanges( void )
+{
+    return pdTRUE;
+}
@@ -0,0 +1,108 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/*
+ * FreeRTOS configuration of the host benchmark, built on the POSIX port.
+ * Mirrors the options of Common/config/FreeRTOSConfig.h that the MQTT agent
+ * depends on.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#include <stdint.h>
+
+#include "logging.h"
+
+#define configUSE_PREEMPTION                       1
+#define configSUPPORT_STATIC_ALLOCATION            0
+#define configSUPPORT_DYNAMIC_ALLOCATION           1
+#define configUSE_IDLE_HOOK                        0
+#define configUSE_TICK_HOOK                        0
+#define configUSE_MALLOC_FAILED_HOOK               0
+#define configTICK_RATE_HZ                         ( ( TickType_t ) 1000 )
+#define configMAX_PRIORITIES                       ( 56 )
+
+/* The POSIX port runs each task on a pthread whose stack is allocated from
+ * the FreeRTOS heap, so this must stay above PTHREAD_STACK_MIN. */
+#define configMINIMAL_STACK_SIZE                   ( ( uint16_t ) 4096 )
+#define configTOTAL_HEAP_SIZE                      ( ( size_t ) 64 * 1024 * 1024 )
+#define configMAX_TASK_NAME_LEN                    ( 32 )
+#define configUSE_TRACE_FACILITY                   1
+#define configUSE_16_BIT_TICKS                     0
+#define configUSE_MUTEXES                          1
+#define configQUEUE_REGISTRY_SIZE                  0
+#define configUSE_RECURSIVE_MUTEXES                1
+#define configUSE_COUNTING_SEMAPHORES              1
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS    5
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION    0
+#define configCHECK_FOR_STACK_OVERFLOW             0
+#define configMESSAGE_BUFFER_LENGTH_TYPE           size_t
+#define configUSE_CO_ROUTINES                      0
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES      8
+
+#define configUSE_TIMERS                           1
+#define configTIMER_TASK_PRIORITY                  ( configMAX_PRIORITIES - 1 )
+#define configTIMER_QUEUE_LENGTH                   10
+#define configTIMER_TASK_STACK_DEPTH               configMINIMAL_STACK_SIZE
+
+#define INCLUDE_vTaskPrioritySet                   1
+#define INCLUDE_uxTaskPriorityGet                  1
+#define INCLUDE_vTaskDelete                        1
+#define INCLUDE_vTaskSuspend                       1
+#define INCLUDE_vTaskDelayUntil                    1
+#define INCLUDE_vTaskDelay                         1
+#define INCLUDE_xTaskAbortDelay                    1
+#define INCLUDE_xTaskGetSchedulerState             1
+#define INCLUDE_xTaskGetHandle                     1
+#define INCLUDE_xQueueGetMutexHolder               1
+#define INCLUDE_xSemaphoreGetMutexHolder           1
+#define INCLUDE_xTaskGetCurrentTaskHandle          1
+#define INCLUDE_eTaskGetState                      1
+
+/* Timestamps of the agent metrics, in microseconds of CLOCK_MONOTONIC. */
+uint32_t ulBenchRunTimeCounter( void );
+#define portGET_RUN_TIME_COUNTER_VALUE()    ulBenchRunTimeCounter()
+#define MQTT_AGENT_METRICS_COUNTER_HZ       ( 1000000U )
+
+void vBenchAssertFailed( const char * pcFile,
+                         unsigned long ulLine );
+
+#define configASSERT( x )                                   \
+    do {                                                    \
+        if( ( x ) == 0 ) {                                  \
+            vBenchAssertFailed( __FILE__, __LINE__ );       \
+        }                                                   \
+    } while( 0 )
+
+#define configASSERT_CONTINUE( x )                      \
+    do {                                                \
+        if( ( x ) == 0 ) {                              \
+            LogAssert( "Non-fatal assertion failed." ); \
+        }                                               \
+    } while( 0 )
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,52 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Host stand-in for Common/include/PkiObject.h. The loopback transport never
+ * parses credentials, so only the type is needed.
+ */
+
+#ifndef _PKI_OBJECT_H_
+#define _PKI_OBJECT_H_
+
+#include <stddef.h>
+
+typedef enum PkiObjectForm
+{
+    OBJ_FORM_NONE,
+    OBJ_FORM_PEM,
+    OBJ_FORM_DER,
+} PkiObjectForm_t;
+
+typedef struct PkiObject
+{
+    PkiObjectForm_t xForm;
+    size_t uxLen;
+    const unsigned char * pucBuffer;
+} PkiObject_t;
+
+#endif /* _PKI_OBJECT_H_ */
@@ -0,0 +1,60 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Host stand-in for the IoTConnect SDK header. Holds the fields read by
+ * vMQTTAgentTask, which the benchmark does not run.
+ */
+
+#ifndef IOTCONNECT_H
+#define IOTCONNECT_H
+
+#include "PkiObject.h"
+
+#define MQTTS_PORT    8883
+
+typedef struct IotConnectAuthInfo
+{
+    PkiObject_t mqtt_root_ca;
+    struct
+    {
+        struct
+        {
+            PkiObject_t device_cert;
+            PkiObject_t device_key;
+        } cert_info;
+    } data;
+} IotConnectAuthInfo;
+
+typedef struct IotConnectDeviceClientConfig
+{
+    const char * host;
+    const char * duid;
+    IotConnectAuthInfo * auth;
+} IotConnectDeviceClientConfig;
+
+#endif /* IOTCONNECT_H */
@@ -0,0 +1,56 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Host stand-in for Common/kvstore/kvstore.h with only the keys used by the
+ * MQTT agent. Values live in RAM, see bench_stubs.c.
+ */
+
+#ifndef _KVSTORE_H
+#define _KVSTORE_H
+
+#include "FreeRTOS.h"
+#include <stddef.h>
+
+#include "kvstore_config_plat.h"
+
+typedef enum KvStoreEnum
+{
+    CS_WIFI_SSID,
+    CS_MQTT_KEEPALIVE,
+    CS_NUM_KEYS
+} KVStoreKey_t;
+
+size_t KVStore_getString( KVStoreKey_t key,
+                          char * pvBuffer,
+                          size_t xMaxLength );
+BaseType_t KVStore_setString( KVStoreKey_t key,
+                              const char * pcNewValue );
+
+BaseType_t KVStore_xCommitChanges( void );
+
+#endif /* _KVSTORE_H */
@@ -0,0 +1,124 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Host stand-in for Common/include/mbedtls_transport.h. Declares the same
+ * transport API, implemented by loopback_transport.c without TLS or sockets,
+ * so that mqtt_agent_task.c builds unchanged.
+ */
+
+#ifndef _MBEDTLS_TRANSPORT_H
+#define _MBEDTLS_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "transport_interface.h"
+#include "PkiObject.h"
+
+/* Only referenced by a declaration in mqtt_agent_task.c. */
+typedef struct mbedtls_x509_crt mbedtls_x509_crt;
+
+typedef enum TlsTransportStatus
+{
+    TLS_TRANSPORT_SUCCESS = 0,
+    TLS_TRANSPORT_UNKNOWN_ERROR = -1,
+    TLS_TRANSPORT_INVALID_PARAMETER = -2,
+    TLS_TRANSPORT_INSUFFICIENT_MEMORY = -3,
+    TLS_TRANSPORT_INVALID_CREDENTIALS = -4,
+    TLS_TRANSPORT_HANDSHAKE_FAILED = -5,
+    TLS_TRANSPORT_INTERNAL_ERROR = -6,
+    TLS_TRANSPORT_CONNECT_FAILURE = -7,
+} TlsTransportStatus_t;
+
+typedef void ( * GenericCallback_t )( void * );
+
+/* Provided by lwip's arch/cc.h on the target. */
+UBaseType_t uxRand( void );
+
+/*-----------------------------------------------------------*/
+
+NetworkContext_t * mbedtls_transport_allocate( void );
+
+void mbedtls_transport_free( NetworkContext_t * pxNetworkContext );
+
+TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkContext,
+                                                  const char ** ppcAlpnProtos,
+                                                  const PkiObject_t * pxPrivateKey,
+                                                  const PkiObject_t * pxClientCert,
+                                                  const PkiObject_t * pxRootCaCerts,
+                                                  const size_t uxNumRootCA );
+
+int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
+                                           GenericCallback_t pxCallback,
+                                           void * pvCtx );
+
+/**
+ * @brief Attach the context to the broker stand-in. The host name and port
+ * are ignored.
+ */
+TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
+                                                const char * pcHostName,
+                                                uint16_t usPort,
+                                                uint32_t ulRecvTimeoutMs,
+                                                uint32_t ulSendTimeoutMs );
+
+void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Non-blocking receive. Returns 0 when no data is buffered, after
+ * which the receive ready callback fires on the next write by the broker.
+ */
+int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
+                                void * pBuffer,
+                                size_t bytesToRecv );
+
+/**
+ * @brief Wait until mbedtls_transport_recv has data to return.
+ *
+ * @return Positive if data is ready, 0 on timeout, negative on error.
+ */
+int32_t mbedtls_transport_recv_wait( NetworkContext_t * pxNetworkContext,
+                                     uint32_t ulTimeoutMs );
+
+/**
+ * @brief Non-blocking send. Returns 0 when the broker's receive buffer is full.
+ */
+int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
+                                const void * pBuffer,
+                                size_t uxBytesToSend );
+
+/**
+ * @brief Non-blocking vectored send, with the same result as
+ * mbedtls_transport_send for the concatenated buffers.
+ */
+int32_t mbedtls_transport_sendv( NetworkContext_t * pxNetworkContext,
+                                 TransportOutVector_t * pxVectors,
+                                 size_t uxVectorCount );
+
+#endif /* _MBEDTLS_TRANSPORT_H */
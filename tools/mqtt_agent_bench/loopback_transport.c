@@ -0,0 +1,418 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2022 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+
+/*
+ * Loopback implementation of the mbedtls_transport API. Each direction is a
+ * FreeRTOS stream buffer: the agent task is the only writer towards the
+ * broker and the broker task the only writer towards the agent, as stream
+ * buffers require.
+ *
+ * The receive ready callback follows the socket multiplexer registration in
+ * mbedtls_transport.c: it fires once when data arrives and is re-armed when
+ * mbedtls_transport_recv finds nothing to read.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_ERROR
+
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stream_buffer.h"
+#include "atomic.h"
+
+#include "bench_loopback.h"
+
+/*-----------------------------------------------------------*/
+
+struct NetworkContext
+{
+    StreamBufferHandle_t xToBroker;
+    StreamBufferHandle_t xToAgent;
+    GenericCallback_t pxRecvReadyCallback;
+    void * pvRecvReadyCallbackCtx;
+    uint32_t ulRecvArmed;
+    volatile BaseType_t xConnected;
+};
+
+/*-----------------------------------------------------------*/
+
+static LoopbackWireStats_t xWireStats = { 0 };
+
+/*-----------------------------------------------------------*/
+
+/* Count a write of the agent, split into records as mbedtls_transport.c would. */
+static void prvCountWrite( int32_t lSent )
+{
+    if( lSent > 0 )
+    {
+        uint32_t ulRecords = ( ( uint32_t ) lSent + LOOPBACK_TLS_RECORD_PAYLOAD - 1U ) / LOOPBACK_TLS_RECORD_PAYLOAD;
+
+        taskENTER_CRITICAL();
+        {
+            xWireStats.ulWrites++;
+            xWireStats.ullPayloadBytes += ( uint64_t ) lSent;
+            xWireStats.ullWireBytes += ( uint64_t ) lSent + ( ( uint64_t ) ulRecords * LOOPBACK_TLS_RECORD_OVERHEAD );
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvNotifyRecvReady( NetworkContext_t * pxNetworkContext )
+{
+    if( ( pxNetworkContext->pxRecvReadyCallback != NULL ) &&
+        ( Atomic_CompareAndSwap_u32( &( pxNetworkContext->ulRecvArmed ), 0U, 1U ) == ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+    {
+        pxNetworkContext->pxRecvReadyCallback( pxNetworkContext->pvRecvReadyCallbackCtx );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+NetworkContext_t * mbedtls_transport_allocate( void )
+{
+    NetworkContext_t * pxNetworkContext = pvPortMalloc( sizeof( NetworkContext_t ) );
+
+    if( pxNetworkContext != NULL )
+    {
+        ( void ) memset( pxNetworkContext, 0, sizeof( NetworkContext_t ) );
+
+        pxNetworkContext->xToBroker = xStreamBufferCreate( LOOPBACK_BUFFER_SIZE, 1 );
+        pxNetworkContext->xToAgent = xStreamBufferCreate( LOOPBACK_BUFFER_SIZE, 1 );
+
+        if( ( pxNetworkContext->xToBroker == NULL ) ||
+            ( pxNetworkContext->xToAgent == NULL ) )
+        {
+            LogError( "Failed to allocate the loopback buffers." );
+            mbedtls_transport_free( pxNetworkContext );
+            pxNetworkContext = NULL;
+        }
+    }
+
+    return pxNetworkContext;
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_transport_free( NetworkContext_t * pxNetworkContext )
+{
+    if( pxNetworkContext != NULL )
+    {
+        if( pxNetworkContext->xToBroker != NULL )
+        {
+            vStreamBufferDelete( pxNetworkContext->xToBroker );
+        }
+
+        if( pxNetworkContext->xToAgent != NULL )
+        {
+            vStreamBufferDelete( pxNetworkContext->xToAgent );
+        }
+
+        vPortFree( pxNetworkContext );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkContext,
+                                                  const char ** ppcAlpnProtos,
+                                                  const PkiObject_t * pxPrivateKey,
+                                                  const PkiObject_t * pxClientCert,
+                                                  const PkiObject_t * pxRootCaCerts,
+                                                  const size_t uxNumRootCA )
+{
+    ( void ) ppcAlpnProtos;
+    ( void ) pxPrivateKey;
+    ( void ) pxClientCert;
+    ( void ) pxRootCaCerts;
+    ( void ) uxNumRootCA;
+
+    return( ( pxNetworkContext != NULL ) ? TLS_TRANSPORT_SUCCESS : TLS_TRANSPORT_INVALID_PARAMETER );
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
+                                           GenericCallback_t pxCallback,
+                                           void * pvCtx )
+{
+    int32_t lResult = TLS_TRANSPORT_INVALID_PARAMETER;
+
+    if( pxNetworkContext != NULL )
+    {
+        pxNetworkContext->pxRecvReadyCallback = pxCallback;
+        pxNetworkContext->pvRecvReadyCallbackCtx = pvCtx;
+        lResult = TLS_TRANSPORT_SUCCESS;
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
+                                                const char * pcHostName,
+                                                uint16_t usPort,
+                                                uint32_t ulRecvTimeoutMs,
+                                                uint32_t ulSendTimeoutMs )
+{
+    ( void ) pcHostName;
+    ( void ) usPort;
+    ( void ) ulRecvTimeoutMs;
+    ( void ) ulSendTimeoutMs;
+
+    if( pxNetworkContext == NULL )
+    {
+        return TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+
+    /* Reset fails while the broker is still blocked on a buffer of the
+     * previous connection, which lasts at most one broker poll period. */
+    while( ( xStreamBufferReset( pxNetworkContext->xToBroker ) != pdPASS ) ||
+           ( xStreamBufferReset( pxNetworkContext->xToAgent ) != pdPASS ) )
+    {
+        vTaskDelay( 1 );
+    }
+
+    pxNetworkContext->ulRecvArmed = 1U;
+    pxNetworkContext->xConnected = pdTRUE;
+
+    vBenchBrokerAttach( pxNetworkContext );
+
+    return TLS_TRANSPORT_SUCCESS;
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext )
+{
+    if( ( pxNetworkContext != NULL ) &&
+        ( pxNetworkContext->xConnected == pdTRUE ) )
+    {
+        pxNetworkContext->xConnected = pdFALSE;
+        vBenchBrokerDetach( pxNetworkContext );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
+                                void * pBuffer,
+                                size_t bytesToRecv )
+{
+    int32_t lResult = -1;
+
+    if( ( pxNetworkContext != NULL ) &&
+        ( pxNetworkContext->xConnected == pdTRUE ) )
+    {
+        lResult = ( int32_t ) xStreamBufferReceive( pxNetworkContext->xToAgent,
+                                                    pBuffer, bytesToRecv, 0 );
+
+        if( lResult == 0 )
+        {
+            ( void ) Atomic_CompareAndSwap_u32( &( pxNetworkContext->ulRecvArmed ), 1U, 0U );
+
+            /* Data written between the read and re-arming would otherwise
+             * not raise the callback. */
+            if( xStreamBufferBytesAvailable( pxNetworkContext->xToAgent ) > 0U )
+            {
+                prvNotifyRecvReady( pxNetworkContext );
+            }
+        }
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_recv_wait( NetworkContext_t * pxNetworkContext,
+                                     uint32_t ulTimeoutMs )
+{
+    int32_t lResult = -1;
+    TickType_t xStartTime = xTaskGetTickCount();
+
+    if( pxNetworkContext != NULL )
+    {
+        lResult = 0;
+
+        /* A stream buffer has no wait that leaves the data in place, poll once a tick. */
+        while( ( pxNetworkContext->xConnected == pdTRUE ) &&
+               ( lResult == 0 ) )
+        {
+            if( xStreamBufferBytesAvailable( pxNetworkContext->xToAgent ) > 0U )
+            {
+                lResult = 1;
+            }
+            else if( ( xTaskGetTickCount() - xStartTime ) >= pdMS_TO_TICKS( ulTimeoutMs ) )
+            {
+                break;
+            }
+            else
+            {
+                vTaskDelay( 1 );
+            }
+        }
+
+        if( pxNetworkContext->xConnected != pdTRUE )
+        {
+            lResult = -1;
+        }
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
+                                const void * pBuffer,
+                                size_t uxBytesToSend )
+{
+    int32_t lResult = -1;
+
+    if( ( pxNetworkContext != NULL ) &&
+        ( pxNetworkContext->xConnected == pdTRUE ) )
+    {
+        lResult = ( int32_t ) xStreamBufferSend( pxNetworkContext->xToBroker,
+                                                 pBuffer, uxBytesToSend, 0 );
+        prvCountWrite( lResult );
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_sendv( NetworkContext_t * pxNetworkContext,
+                                 TransportOutVector_t * pxVectors,
+                                 size_t uxVectorCount )
+{
+    int32_t lResult = -1;
+
+    if( ( pxNetworkContext != NULL ) &&
+        ( pxNetworkContext->xConnected == pdTRUE ) )
+    {
+        bool xComplete = true;
+        size_t uxTotalLength = 0;
+
+        for( size_t uxIdx = 0; uxIdx < uxVectorCount; uxIdx++ )
+        {
+            uxTotalLength += pxVectors[ uxIdx ].iov_len;
+        }
+
+        lResult = 0;
+
+        /* As the TLS transport, a small packet is gathered into one record
+         * and a larger one takes a record per vector. */
+        for( size_t uxIdx = 0; xComplete && ( uxIdx < uxVectorCount ); uxIdx++ )
+        {
+            size_t uxSent = xStreamBufferSend( pxNetworkContext->xToBroker,
+                                               pxVectors[ uxIdx ].iov_base,
+                                               pxVectors[ uxIdx ].iov_len, 0 );
+
+            lResult += ( int32_t ) uxSent;
+            xComplete = ( uxSent == pxVectors[ uxIdx ].iov_len );
+
+            if( uxTotalLength > MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE )
+            {
+                prvCountWrite( ( int32_t ) uxSent );
+            }
+        }
+
+        if( uxTotalLength <= MBEDTLS_TRANSPORT_SENDV_BUFFER_SIZE )
+        {
+            prvCountWrite( lResult );
+        }
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vLoopbackTakeWireStats( LoopbackWireStats_t * pxStats )
+{
+    taskENTER_CRITICAL();
+    {
+        *pxStats = xWireStats;
+        ( void ) memset( &xWireStats, 0, sizeof( xWireStats ) );
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxLoopbackBrokerRecv( NetworkContext_t * pxNetworkContext,
+                             void * pvBuffer,
+                             size_t uxLength,
+                             TickType_t xTicksToWait )
+{
+    return xStreamBufferReceive( pxNetworkContext->xToBroker,
+                                 pvBuffer, uxLength, xTicksToWait );
+}
+
+/*-----------------------------------------------------------*/
+
+bool xLoopbackBrokerSend( NetworkContext_t * pxNetworkContext,
+                          const void * pvBuffer,
+                          size_t uxLength )
+{
+    const uint8_t * pucBuffer = pvBuffer;
+
+    while( ( uxLength > 0U ) &&
+           ( pxNetworkContext->xConnected == pdTRUE ) )
+    {
+        size_t uxSent = xStreamBufferSend( pxNetworkContext->xToAgent,
+                                           pucBuffer, uxLength, pdMS_TO_TICKS( 10 ) );
+
+        pucBuffer += uxSent;
+        uxLength -= uxSent;
+
+        if( uxSent > 0U )
+        {
+            prvNotifyRecvReady( pxNetworkContext );
+        }
+    }
+
+    return( uxLength == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxLoopbackBrokerSpace( NetworkContext_t * pxNetworkContext )
+{
+    return xStreamBufferSpacesAvailable( pxNetworkContext->xToAgent );
+}